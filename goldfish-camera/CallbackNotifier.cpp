@@ -78,6 +78,9 @@ static int GetMessageStrings(uint32_t msg, const char** strings, int max)
     return out;
 }
 
+/* Maximum number of callback memory blocks kept for reuse per pool. */
+static const size_t kMaxPooledMemory = 8;
+
 /* Logs messages, enabled by the mask. */
 static void PrintMessages(uint32_t msg)
 {
@@ -101,10 +104,14 @@ CallbackNotifier::CallbackNotifier()
       mVideoRecEnabled(false),
       mTakingPicture(false)
 {
+    mVideoMemoryPool.size = 0;
+    mPreviewMemoryPool.size = 0;
 }
 
 CallbackNotifier::~CallbackNotifier()
 {
+    clearMemoryPool(&mVideoMemoryPool);
+    clearMemoryPool(&mPreviewMemoryPool);
 }
 
 /****************************************************************************
@@ -120,6 +127,10 @@ void CallbackNotifier::setCallbacks(camera_notify_callback notify_cb,
     ALOGV("%s: %p, %p, %p, %p (%p)",
          __FUNCTION__, notify_cb, data_cb, data_cb_timestamp, get_memory, user);
 
+    /* Pooled memory came from the previous allocator. */
+    clearMemoryPool(&mVideoMemoryPool);
+    clearMemoryPool(&mPreviewMemoryPool);
+
     Mutex::Autolock locker(&mObjectLock);
     mNotifyCB = notify_cb;
     mDataCB = data_cb;
@@ -174,14 +185,21 @@ void CallbackNotifier::disableVideoRecording()
 
 void CallbackNotifier::releaseRecordingFrame(const void* opaque)
 {
-    List<camera_memory_t*>::iterator it = mCameraMemoryTs.begin();
-    for( ; it != mCameraMemoryTs.end(); ++it ) {
-        if ( (*it)->data == opaque ) {
-            (*it)->release( *it );
-            mCameraMemoryTs.erase(it);
-            break;
+    camera_memory_t* mem = NULL;
+    {
+        Mutex::Autolock locker(&mMemoryLock);
+        List<camera_memory_t*>::iterator it = mCameraMemoryTs.begin();
+        for( ; it != mCameraMemoryTs.end(); ++it ) {
+            if ( (*it)->data == opaque ) {
+                mem = *it;
+                mCameraMemoryTs.erase(it);
+                break;
+            }
         }
     }
+    if (mem != NULL) {
+        recycleMemory(&mVideoMemoryPool, mem);
+    }
 }
 
 void CallbackNotifier::autoFocusComplete() {
@@ -203,6 +221,9 @@ status_t CallbackNotifier::storeMetaDataInBuffers(bool enable)
 
 void CallbackNotifier::cleanupCBNotifier()
 {
+    clearMemoryPool(&mVideoMemoryPool);
+    clearMemoryPool(&mPreviewMemoryPool);
+
     Mutex::Autolock locker(&mObjectLock);
     mMessageEnabler = 0;
     mNotifyCB = NULL;
@@ -228,25 +249,27 @@ void CallbackNotifier::onNextFrameAvailable(nsecs_t timestamp,
         // encoders that expect a YUV420 format but the camera parameter
         // constants cannot represent this. The closest we have is YV12 which is
         // YVU420. So we produce YV12 frames so that we can serve those through
-        // the preview callback below and then we convert from YV12 to YUV420
-        // here. This is a pretty cheap conversion in most cases since we have
-        // to copy the frame here anyway. In the best (and most common) cases
-        // the conversion is just copying the U and V parts of the frame in
-        // different order. A slightly more expensive case is when the YV12
-        // frame has padding to ensure that rows are aligned to 16-byte
-        // boundaries. The YUV420 format expected by the encoders do not have
-        // this alignment so it has to be removed. This way the encoder gets the
-        // format it expects and the preview callback (or data callback) below
-        // gets the format that is configured in camera parameters.
+        // the preview callback below, and have the camera device produce a
+        // YUV420 view of each frame while video recording is enabled. Devices
+        // that can't render that view directly have the YV12 frame converted
+        // here instead, which means copying the U and V parts of the frame in
+        // different order and removing any padding that aligns YV12 rows to
+        // 16-byte boundaries. This way the encoder gets the format it expects
+        // and the preview callback (or data callback) below gets the format
+        // that is configured in camera parameters.
         const size_t frameSize = camera_dev->getVideoFrameBufferSize();
-        camera_memory_t* cam_buff = mGetMemoryCB(-1, frameSize, 1, mCBOpaque);
+        camera_memory_t* cam_buff = acquireMemory(&mVideoMemoryPool, frameSize);
         if (NULL != cam_buff && NULL != cam_buff->data) {
             int64_t frame_timestamp = 0L;
             camera_dev->getCurrentFrame(cam_buff->data, V4L2_PIX_FMT_YUV420,
                                         &frame_timestamp);
+            {
+                /* The frame may be released as soon as it is delivered. */
+                Mutex::Autolock locker(&mMemoryLock);
+                mCameraMemoryTs.push_back( cam_buff );
+            }
             mDataCBTimestamp(frame_timestamp != 0L ? frame_timestamp : timestamp,
                              CAMERA_MSG_VIDEO_FRAME, cam_buff, 0, mCBOpaque);
-            mCameraMemoryTs.push_back( cam_buff );
         } else {
             ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
         }
@@ -254,14 +277,16 @@ void CallbackNotifier::onNextFrameAvailable(nsecs_t timestamp,
 
     if (isMessageEnabled(CAMERA_MSG_PREVIEW_FRAME)) {
         camera_memory_t* cam_buff =
-            mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, mCBOpaque);
+            acquireMemory(&mPreviewMemoryPool, camera_dev->getFrameBufferSize());
         if (NULL != cam_buff && NULL != cam_buff->data) {
             int64_t frame_timestamp = 0L;
             camera_dev->getCurrentFrame(cam_buff->data,
                                         camera_dev->getOriginalPixelFormat(),
                                         &frame_timestamp);
             mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, 0, NULL, mCBOpaque);
-            cam_buff->release(cam_buff);
+            /* The framework is done with preview frames once the callback
+             * returns. */
+            recycleMemory(&mPreviewMemoryPool, cam_buff);
         } else {
             ALOGE("%s: Memory failure in CAMERA_MSG_PREVIEW_FRAME", __FUNCTION__);
         }
@@ -286,10 +311,10 @@ void CallbackNotifier::onNextFrameAvailable(nsecs_t timestamp,
             // like EXIF default fields, a timestamp and GPS information.
             ExifData* exifData = createExifData(mCameraParameters);
 
-            // Hold the frame lock while accessing the current frame to prevent
-            // concurrent modifications. Then create our JPEG from that frame.
+            // Hold the current frame while accessing it to prevent concurrent
+            // modifications. Then create our JPEG from that frame.
             EmulatedCameraDevice::FrameLock lock(*camera_dev);
-            const void* frame = camera_dev->getCurrentFrame();
+            const void* frame = camera_dev->getCurrentFrame(lock);
 
             // Create a thumbnail and place the pointer and size in the EXIF
             // data structure. This transfers ownership to the EXIF data and
@@ -345,6 +370,56 @@ void CallbackNotifier::onCameraDeviceError(int err)
  * Private API
  ***************************************************************************/
 
+camera_memory_t* CallbackNotifier::acquireMemory(MemoryPool* pool, size_t size)
+{
+    Vector<camera_memory_t*> stale;
+    camera_memory_t* mem = NULL;
+    {
+        Mutex::Autolock locker(&mMemoryLock);
+        if (pool->size != size) {
+            stale = pool->idle;
+            pool->idle.clear();
+            pool->size = size;
+        } else if (!pool->idle.isEmpty()) {
+            mem = pool->idle.top();
+            pool->idle.pop();
+        }
+    }
+    for (size_t n = 0; n < stale.size(); n++) {
+        stale[n]->release(stale[n]);
+    }
+    if (mem == NULL && mGetMemoryCB != NULL) {
+        mem = mGetMemoryCB(-1, size, 1, mCBOpaque);
+    }
+    return mem;
+}
+
+void CallbackNotifier::recycleMemory(MemoryPool* pool, camera_memory_t* mem)
+{
+    {
+        Mutex::Autolock locker(&mMemoryLock);
+        if (mem->size == pool->size && pool->idle.size() < kMaxPooledMemory) {
+            pool->idle.push(mem);
+            return;
+        }
+    }
+    mem->release(mem);
+}
+
+void CallbackNotifier::clearMemoryPool(MemoryPool* pool)
+{
+    Vector<camera_memory_t*> idle;
+    {
+        Mutex::Autolock locker(&mMemoryLock);
+        idle = pool->idle;
+        pool->idle.clear();
+        pool->size = 0;
+    }
+    for (size_t n = 0; n < idle.size(); n++) {
+        idle[n]->release(idle[n]);
+    }
+}
+
 bool CallbackNotifier::isNewVideoFrameTime(nsecs_t timestamp)
 {
     Mutex::Autolock locker(&mObjectLock);
@@ -23,6 +23,7 @@
  */
 
 #include <utils/List.h>
+#include <utils/Vector.h>
 #include <CameraParameters.h>
 
 using ::android::hardware::camera::common::V1_0::helper::CameraParameters;
@@ -207,6 +208,27 @@ protected:
      *  timestamp - Timestamp for the new frame. */
     bool isNewVideoFrameTime(nsecs_t timestamp);
 
+    /* Callback memory blocks of one size, kept for reuse once the framework
+     * is done with them. */
+    struct MemoryPool {
+        size_t                      size;
+        Vector<camera_memory_t*>    idle;
+    };
+
+    /* Gets a callback memory block of |size| bytes, from |pool| if it has one.
+     * Blocks pooled for another size are released first.
+     * Return:
+     *  The memory block, or NULL on failure.
+     */
+    camera_memory_t* acquireMemory(MemoryPool* pool, size_t size);
+
+    /* Returns a block obtained from acquireMemory to |pool|, or releases it
+     * if the pool is full or the block is not of the pool's size. */
+    void recycleMemory(MemoryPool* pool, camera_memory_t* mem);
+
+    /* Releases all blocks in |pool|. */
+    void clearMemoryPool(MemoryPool* pool);
+
     /****************************************************************************
      * Data members
      ***************************************************************************/
@@ -225,9 +247,17 @@ protected:
     camera_request_memory           mGetMemoryCB;
     void*                           mCBOpaque;
 
+    /* Locks the memory pools and the video frame queue, which are accessed
+     * from both the frame delivery and the framework threads. */
+    Mutex                           mMemoryLock;
+
     /* video frame queue for the CameraHeapMemory destruction */
     List<camera_memory_t*>          mCameraMemoryTs;
 
+    /* Memory blocks for video and preview frame callbacks. */
+    MemoryPool                      mVideoMemoryPool;
+    MemoryPool                      mPreviewMemoryPool;
+
     /* Timestamp when last frame has been delivered to the framework. */
     nsecs_t                         mLastFrameTimestamp;
 
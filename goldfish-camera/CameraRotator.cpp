@@ -30,15 +30,17 @@
 #endif
 
 #include "CameraRotator.h"
+#include "Alignment.h"
 #include "system/camera_metadata.h"
 #include <gralloc_cb_bp.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <libyuv.h>
 #include <linux/videodev2.h>
 #include <log/log.h>
 #include <cutils/properties.h>
-#include <ui/Rect.h>
 #include <utils/Trace.h>
 
 namespace android {
@@ -74,20 +76,22 @@ static bool getIsMinigbmFromProperty() {
     return res;
 }
 
-CameraRotator::CameraRotator(int width, int height):
+CameraRotator::CameraRotator(int width, int height,
+                             const sp<AuxBufferPool>& auxBufferPool):
         Thread(false),
         mWidth(width),
         mHeight(height),
         mActiveArray{0, 0, width, height},
-        mLastRequestWidth(-1),
-        mLastRequestHeight(-1),
+        mStreamWidth(-1),
+        mStreamHeight(-1),
         mDeviceName("rotatingcamera"),
-        mGBA(&GraphicBufferAllocator::get()),
-        mGBM(nullptr),
+        mAuxBufferPool(auxBufferPool),
         mGotVSync(false),
         mFrameDuration(kFrameDurationRange[0]),
         mNextBuffers(nullptr),
         mFrameNumber(0),
+        mMaxStreamWidth(0),
+        mMaxStreamHeight(0),
         mCapturedBuffers(nullptr),
         mListener(nullptr),
         mIsMinigbm(getIsMinigbmFromProperty()) {
@@ -130,6 +134,8 @@ status_t CameraRotator::shutDown() {
     }
 
     mRender.stopDevice();
+    mStreamWidth = -1;
+    mStreamHeight = -1;
 
     mRender.disconnectDevice();
 
@@ -160,6 +166,12 @@ void CameraRotator::setFrameNumber(uint32_t frameNumber) {
     mFrameNumber = frameNumber;
 }
 
+void CameraRotator::setMaxStreamSize(uint32_t width, uint32_t height) {
+    Mutex::Autolock lock(mControlMutex);
+    mMaxStreamWidth = width;
+    mMaxStreamHeight = height;
+}
+
 bool CameraRotator::waitForVSync(nsecs_t reltime) {
     int res;
     Mutex::Autolock lock(mControlMutex);
@@ -173,6 +185,10 @@ bool CameraRotator::waitForVSync(nsecs_t reltime) {
     return mGotVSync;
 }
 
+void CameraRotator::dump(int fd, int indent) const {
+    mPacer.dump(fd, indent);
+}
+
 bool CameraRotator::waitForNewFrame(nsecs_t reltime, nsecs_t *captureTime) {
     Mutex::Autolock lock(mReadoutMutex);
     if (mCapturedBuffers == nullptr) {
@@ -195,6 +211,11 @@ bool CameraRotator::waitForNewFrame(nsecs_t reltime, nsecs_t *captureTime) {
 CameraRotator::CameraRotatorListener::~CameraRotatorListener() {
 }
 
+AuxBufferPool::Type CameraRotator::getAuxBufferType() const {
+    return (mHostCameraVer == 1 && !mIsMinigbm) ?
+            AuxBufferPool::GRALLOC : AuxBufferPool::HEAP;
+}
+
 void CameraRotator::setCameraRotatorListener(CameraRotatorListener *listener) {
     Mutex::Autolock lock(mControlMutex);
     mListener = listener;
@@ -205,6 +226,7 @@ status_t CameraRotator::readyToRun() {
     mStartupTime = systemTime();
     mNextCaptureTime = 0;
     mNextCapturedBuffers = nullptr;
+    mPacer.reset();
     return OK;
 }
 
@@ -245,13 +267,12 @@ bool CameraRotator::threadLoop() {
     Buffers *capturedBuffers = nullptr;
     nsecs_t captureTime = 0;
 
-    nsecs_t startRealTime = systemTime();
+    nsecs_t startRealTime = mPacer.beginFrame(frameDuration);
     /*
      * Stagefright cares about system time for timestamps, so base simulated
      * time on that.
      */
     nsecs_t simulatedTime = startRealTime;
-    nsecs_t frameEndRealTime = startRealTime + frameDuration;
 
     if (mNextCapturedBuffers != nullptr) {
         DDD("CameraRotator starting readout");
@@ -328,39 +349,11 @@ bool CameraRotator::threadLoop() {
                         bAux.height = b.height;
                         bAux.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
                         bAux.stride = b.width;
-                        if (mHostCameraVer == 1 && !mIsMinigbm) {
-                            const uint64_t usage =
-                                GRALLOC_USAGE_HW_CAMERA_READ |
-                                GRALLOC_USAGE_HW_CAMERA_WRITE |
-                                GRALLOC_USAGE_HW_TEXTURE;
-                            const uint64_t graphicBufferId = 0; // not used
-                            const uint32_t layerCount = 1;
-                            buffer_handle_t handle;
-                            uint32_t stride;
-
-                    DDD("allocate buffer here fmt is HAL_PIXEL_FORMAT_YCbCr_420_888: 0x%x", HAL_PIXEL_FORMAT_YCbCr_420_888);
-                            status_t status = mGBA->allocate(
-                                bAux.width, bAux.height, bAux.format,
-                                layerCount, usage,
-                                &handle, &stride,
-                                graphicBufferId, "CameraRotator");
-                            if (status != OK) {
-                                LOG_ALWAYS_FATAL("allocate failed");
-                            }
-
-                            android_ycbcr ycbcr = {};
-                            mGBM->lockYCbCr(handle,
-                                            GRALLOC_USAGE_HW_CAMERA_WRITE,
-                                            Rect(0, 0, bAux.width, bAux.height),
-                                            &ycbcr);
-
-                            bAux.buffer = new buffer_handle_t;
-                            *bAux.buffer = handle;
-                            bAux.img = (uint8_t*)ycbcr.y;
-                        } else {
-                            bAux.buffer = nullptr;
-                            // TODO: Reuse these.
-                            bAux.img = new uint8_t[b.width * b.height * 3];
+                        if (mAuxBufferPool->acquire(&bAux,
+                                getAuxBufferType()) != OK) {
+                            ALOGE("%s: Unable to get JPEG input buffer",
+                                    __FUNCTION__);
+                            break;
                         }
                         mNextCapturedBuffers->push_back(bAux);
                     }
@@ -394,18 +387,7 @@ bool CameraRotator::threadLoop() {
     }
 
     DDD("CameraRotator vertical blanking interval");
-    nsecs_t workDoneRealTime = systemTime();
-    const nsecs_t timeAccuracy = 2e6;  // 2 ms of imprecision is ok.
-    if (workDoneRealTime < frameEndRealTime - timeAccuracy) {
-        timespec t;
-        t.tv_sec = (frameEndRealTime - workDoneRealTime) / 1000000000L;
-        t.tv_nsec = (frameEndRealTime - workDoneRealTime) % 1000000000L;
-
-        int ret;
-        do {
-            ret = nanosleep(&t, &t);
-        } while (ret != 0);
-    }
+    mPacer.endFrame();
     DDD("Frame cycle took %d ms, target %d ms",
             (int) ((systemTime() - startRealTime) / 1000000),
             (int) (frameDuration / 1000000));
@@ -415,51 +397,8 @@ bool CameraRotator::threadLoop() {
 void CameraRotator::captureRGBA(uint8_t *img, uint32_t width, uint32_t height,
         uint32_t stride, int64_t *timestamp) {
     ATRACE_CALL();
-    status_t res;
-    if (width != (uint32_t)mLastRequestWidth ||
-        height != (uint32_t)mLastRequestHeight) {
-        ALOGI("%s: Dimensions for the current request (%dx%d) differ "
-              "from the previous request (%dx%d). Restarting camera",
-                __FUNCTION__, width, height, mLastRequestWidth,
-                mLastRequestHeight);
-
-        if (mLastRequestWidth != -1 || mLastRequestHeight != -1) {
-            // We only need to stop the camera if this isn't the first request.
-
-            // Stop the camera device.
-            res = queryStop();
-            if (res == NO_ERROR) {
-                mState = ECDS_CONNECTED;
-                DDD("%s: Qemu camera device '%s' is stopped",
-                        __FUNCTION__, (const char*) mDeviceName);
-            } else {
-                ALOGE("%s: Unable to stop device '%s'",
-                        __FUNCTION__, (const char*) mDeviceName);
-            }
-        }
-
-        /*
-         * Host Camera always assumes V4L2_PIX_FMT_RGB32 as the preview format,
-         * and asks for the video format from the pixFmt parameter, which is
-         * V4L2_PIX_FMT_YUV420 in our implementation.
-         */
-        uint32_t pixFmt = V4L2_PIX_FMT_YUV420;
-        res = queryStart(pixFmt, width, height);
-        if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
-            DDD("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            mState = ECDS_STARTED;
-        } else {
-            ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            return;
-        }
+    if (!startStream(width, height)) {
+        return;
     }
     if (width != stride) {
         ALOGW("%s: expect stride (%d), actual stride (%d)", __FUNCTION__,
@@ -483,12 +422,12 @@ void CameraRotator::captureRGBA(uint32_t width, uint32_t height,
         uint32_t stride, int64_t *timestamp, buffer_handle_t* handle) {
     ATRACE_CALL();
     status_t res;
-    if (mLastRequestWidth == -1 || mLastRequestHeight == -1) {
+    if (mStreamWidth == -1 || mStreamHeight == -1) {
         uint32_t pixFmt = V4L2_PIX_FMT_YUV420;
         res = queryStart();
         if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
+            mStreamWidth = width;
+            mStreamHeight = height;
             DDD("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
                     __FUNCTION__, (const char*) mDeviceName,
                     reinterpret_cast<const char*>(&pixFmt),
@@ -526,66 +465,48 @@ void CameraRotator::captureRGB(uint8_t *img, uint32_t width, uint32_t height, ui
 void CameraRotator::captureYU12(uint8_t *img, uint32_t width, uint32_t height, uint32_t stride,
                              int64_t *timestamp) {
     ATRACE_CALL();
-    status_t res;
-    if (width != (uint32_t)mLastRequestWidth ||
-        height != (uint32_t)mLastRequestHeight) {
-        ALOGI("%s: Dimensions for the current request (%dx%d) differ "
-              "from the previous request (%dx%d). Restarting camera",
-                __FUNCTION__, width, height, mLastRequestWidth,
-                mLastRequestHeight);
-
-        if (mLastRequestWidth != -1 || mLastRequestHeight != -1) {
-            // We only need to stop the camera if this isn't the first request.
-            // Stop the camera device.
-            res = queryStop();
-            if (res == NO_ERROR) {
-                mState = ECDS_CONNECTED;
-                DDD("%s: Qemu camera device '%s' is stopped",
-                        __FUNCTION__, (const char*) mDeviceName);
-            } else {
-                ALOGE("%s: Unable to stop device '%s'",
-                        __FUNCTION__, (const char*) mDeviceName);
-            }
-        }
-
-        /*
-         * Host Camera always assumes V4L2_PIX_FMT_RGB32 as the preview format,
-         * and asks for the video format from the pixFmt parameter, which is
-         * V4L2_PIX_FMT_YUV420 in our implementation.
-         */
-        uint32_t pixFmt = mIsMinigbm ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_YUV420;
-        res = queryStart(pixFmt, width, height);
-        if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
-            DDD("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            mState = ECDS_STARTED;
-        } else {
-            ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            return;
-        }
+    if (!startStream(width, height)) {
+        return;
     }
     if (width != stride) {
         ALOGW("%s: expect stride (%d), actual stride (%d)", __FUNCTION__,
               width, stride);
     }
 
-    // Calculate the buffer size for YUV420.
-    size_t bufferSize = (width * height * 12) / 8;
+    // Smaller frames are scaled down from a frame of the stream size.
+    const uint32_t streamWidth = mStreamWidth;
+    const uint32_t streamHeight = mStreamHeight;
+    // The renderer produces NV21 with Y rows 16 byte aligned, and VU rows
+    // |streamWidth| bytes apart.
+    const uint32_t yStride = align(streamWidth, 16);
+    const bool scale = width != streamWidth || height != streamHeight ||
+            yStride != streamWidth;
+
+    size_t bufferSize = yStride * streamHeight +
+            streamWidth * (streamHeight / 2);
+    uint8_t *frame = img;
+    if (scale) {
+        mStreamFrame.resize(bufferSize);
+        frame = mStreamFrame.data();
+    }
     // Apply no white balance or exposure compensation.
     float whiteBalance[] = {1.0f, 1.0f, 1.0f};
     float exposureCompensation = 1.0f;
     // Read video frame from webcam.
-    mRender.startDevice(width, height, HAL_PIXEL_FORMAT_YCbCr_420_888);
-    queryFrame(img, nullptr, bufferSize, 0, whiteBalance[0],
+    queryFrame(frame, nullptr, bufferSize, 0, whiteBalance[0],
             whiteBalance[1], whiteBalance[2],
             exposureCompensation, timestamp);
+    if (scale) {
+        // NV21 scales like NV12.
+        const FrameCrop crop = getCenterCrop(streamWidth, streamHeight,
+                width, height);
+        libyuv::NV12Scale(frame + crop.y * yStride + crop.x, yStride,
+                frame + yStride * streamHeight +
+                        (crop.y / 2) * streamWidth + crop.x, streamWidth,
+                crop.width, crop.height,
+                img, width, img + width * height, width,
+                width, height, libyuv::kFilterBilinear);
+    }
 
     DDD("YUV420 sensor image captured");
 }
@@ -594,12 +515,12 @@ void CameraRotator::captureYU12(uint32_t width, uint32_t height, uint32_t stride
                              int64_t *timestamp, buffer_handle_t* handle) {
     ATRACE_CALL();
     status_t res;
-    if (mLastRequestWidth == -1 || mLastRequestHeight == -1) {
+    if (mStreamWidth == -1 || mStreamHeight == -1) {
         uint32_t pixFmt = V4L2_PIX_FMT_YUV420;
         res = queryStart();
         if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
+            mStreamWidth = width;
+            mStreamHeight = height;
             DDD("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
                     __FUNCTION__, (const char*) mDeviceName,
                     reinterpret_cast<const char*>(&pixFmt),
@@ -629,6 +550,66 @@ void CameraRotator::captureYU12(uint32_t width, uint32_t height, uint32_t stride
     DDD("YUV420 sensor image captured");
 }
 
+bool CameraRotator::startStream(uint32_t width, uint32_t height) {
+    const bool started = mStreamWidth != -1 && mStreamHeight != -1;
+    // Frames are only ever scaled down, so the stream has to be at least as
+    // wide and as tall as the request.
+    if (started && width <= (uint32_t)mStreamWidth &&
+            height <= (uint32_t)mStreamHeight) {
+        return true;
+    }
+
+    // Start at the largest configured stream size if it covers the request,
+    // so that other streams don't restart the camera. They are cropped to
+    // their aspect ratio and scaled from it.
+    uint32_t streamWidth = width, streamHeight = height;
+    {
+        Mutex::Autolock lock(mControlMutex);
+        if (mMaxStreamWidth >= width && mMaxStreamHeight >= height) {
+            streamWidth = mMaxStreamWidth;
+            streamHeight = mMaxStreamHeight;
+        }
+    }
+
+    status_t res;
+    if (started) {
+        ALOGI("%s: Request for %dx%d frames doesn't fit the stream (%dx%d). "
+              "Restarting camera",
+                __FUNCTION__, width, height, mStreamWidth, mStreamHeight);
+
+        // Stop the camera device.
+        res = queryStop();
+        if (res == NO_ERROR) {
+            mState = ECDS_CONNECTED;
+            DDD("%s: Qemu camera device '%s' is stopped",
+                    __FUNCTION__, (const char*) mDeviceName);
+        } else {
+            ALOGE("%s: Unable to stop device '%s'",
+                    __FUNCTION__, (const char*) mDeviceName);
+        }
+        mStreamWidth = -1;
+        mStreamHeight = -1;
+    }
+
+    uint32_t pixFmt = mIsMinigbm ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_YUV420;
+    res = queryStart(pixFmt, streamWidth, streamHeight);
+    if (res != NO_ERROR) {
+        ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
+                __FUNCTION__, (const char*) mDeviceName,
+                reinterpret_cast<const char*>(&pixFmt),
+                streamWidth, streamHeight);
+        return false;
+    }
+    mStreamWidth = streamWidth;
+    mStreamHeight = streamHeight;
+    DDD("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
+            __FUNCTION__, (const char*) mDeviceName,
+            reinterpret_cast<const char*>(&pixFmt),
+            streamWidth, streamHeight);
+    mState = ECDS_STARTED;
+    return true;
+}
+
 status_t CameraRotator::queryFrame(void* vframe,
                         void* pframe,
                         size_t vframe_size,
@@ -661,7 +642,7 @@ status_t CameraRotator::queryFrame(int wdith,
 }
 
 status_t CameraRotator::queryStop() {
-    return NO_ERROR;
+    return mRender.stopDevice();
 }
 
 status_t CameraRotator::queryStart() {
@@ -670,9 +651,7 @@ status_t CameraRotator::queryStart() {
 
 status_t CameraRotator::queryStart(uint32_t fmt, int w, int h) {
     (void)fmt;
-    (void)w;
-    (void)h;
-    return NO_ERROR;
+    return mRender.startDevice(w, h, HAL_PIXEL_FORMAT_YCbCr_420_888);
 }
 
 }; // end of namespace android
@@ -17,11 +17,13 @@
 
 #pragma once
 
+#include "fake-pipeline2/AuxBufferPool.h"
 #include "fake-pipeline2/Base.h"
+#include "fake-pipeline2/FramePacer.h"
 #include "EmulatedFakeRotatingCameraDevice.h"
 
-#include <ui/GraphicBufferAllocator.h>
-#include <ui/GraphicBufferMapper.h>
+#include <vector>
+
 #include <utils/Mutex.h>
 #include <utils/Thread.h>
 #include <utils/Timers.h>
@@ -30,7 +32,7 @@ namespace android {
 
 class CameraRotator : private Thread, public virtual RefBase {
 public:
-    CameraRotator(int w, int h);
+    CameraRotator(int w, int h, const sp<AuxBufferPool>& auxBufferPool);
     ~CameraRotator();
 
 
@@ -50,6 +52,14 @@ public:
      * To simplify tracking the sensor's current frame.
      */
     void setFrameNumber(uint32_t frameNumber);
+    /*
+     * Size of the largest configured output stream, by area. Frames are
+     * rendered at this size and other outputs are cropped to their aspect
+     * ratio and scaled from them, so switching between streams doesn't
+     * restart the renderer. An output this size doesn't cover in both width
+     * and height restarts it at the output's own size.
+     */
+    void setMaxStreamSize(uint32_t width, uint32_t height);
 
     /*
      * Synchronizing with sensor operation (vertical sync).
@@ -74,6 +84,11 @@ public:
      */
     bool waitForNewFrame(nsecs_t reltime, nsecs_t *captureTime);
 
+    /*
+     * Write the frame timing statistics to fd, indented by indent spaces.
+     */
+    void dump(int fd, int indent) const;
+
     /*
      * Interrupt event servicing from the sensor. Only triggers for sensor
      * cycles that have valid buffers to write to.
@@ -90,6 +105,12 @@ public:
 
     void setCameraRotatorListener(CameraRotatorListener *listener);
 
+    /*
+     * Kind of auxiliary buffer JPEG outputs are captured into, for
+     * reserving them ahead of time.
+     */
+    AuxBufferPool::Type getAuxBufferType() const;
+
     /*
      * Static Sensor Characteristics
      */
@@ -106,7 +127,8 @@ public:
     static const char kHostCameraVerString[];
 
   private:
-    int32_t mLastRequestWidth, mLastRequestHeight;
+    // Size the camera is started with, -1 if it is stopped.
+    int32_t mStreamWidth, mStreamHeight;
 
     /*
      * Defines possible states of the emulated camera device object.
@@ -125,8 +147,7 @@ public:
     EmulatedCameraDeviceState mState;
 
     const char *mDeviceName;
-    GraphicBufferAllocator* mGBA;
-    GraphicBufferMapper*    mGBM;
+    sp<AuxBufferPool> mAuxBufferPool;
 
     // Always lock before accessing control parameters.
     Mutex mControlMutex;
@@ -138,6 +159,7 @@ public:
     uint64_t mFrameDuration;
     Buffers *mNextBuffers;
     uint32_t mFrameNumber;
+    uint32_t mMaxStreamWidth, mMaxStreamHeight;
 
     // Always lock before accessing readout variables.
     Mutex mReadoutMutex;
@@ -170,6 +192,15 @@ public:
      */
     nsecs_t mNextCaptureTime;
     Buffers *mNextCapturedBuffers;
+    FramePacer mPacer;
+    // Full stream frame that smaller frames are scaled down from.
+    std::vector<uint8_t> mStreamFrame;
+
+    /*
+     * Make sure the camera is started for frames of at least width x height.
+     * Returns false if it couldn't be started.
+     */
+    bool startStream(uint32_t width, uint32_t height);
 
     void captureRGBA(uint32_t width, uint32_t height, uint32_t stride,
                      int64_t *timestamp, buffer_handle_t* handle);
@@ -25,8 +25,618 @@
 
 #include "Alignment.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace android {
 
+/* Row converters take one row of Y samples and the row of U and V samples that
+ * goes with it. dUV is the distance between two adjacent U (or V) samples: 1
+ * for planar, and 2 for interleaved chroma. Vectorized converters produce the
+ * same output as the scalar ones, bit for bit.
+ */
+typedef void (*YUV420SRowToRGB565Func)(const uint8_t* Y,
+                                       const uint8_t* U,
+                                       const uint8_t* V,
+                                       int dUV,
+                                       uint16_t* rgb,
+                                       int width);
+typedef void (*YUV420SRowToRGB32Func)(const uint8_t* Y,
+                                      const uint8_t* U,
+                                      const uint8_t* V,
+                                      int dUV,
+                                      uint32_t* rgb,
+                                      int width);
+
+static void _YUV420SRowToRGB565(const uint8_t* Y,
+                                const uint8_t* U,
+                                const uint8_t* V,
+                                int dUV,
+                                uint16_t* rgb,
+                                int width)
+{
+    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
+        const uint8_t nU = *U;
+        const uint8_t nV = *V;
+        *rgb = YUVToRGB565(*Y, nU, nV);
+        Y++; rgb++;
+        *rgb = YUVToRGB565(*Y, nU, nV);
+        Y++; rgb++;
+    }
+}
+
+static void _YUV420SRowToRGB32(const uint8_t* Y,
+                               const uint8_t* U,
+                               const uint8_t* V,
+                               int dUV,
+                               uint32_t* rgb,
+                               int width)
+{
+    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
+        const uint8_t nU = *U;
+        const uint8_t nV = *V;
+        *rgb = YUVToRGB32(*Y, nU, nV);
+        Y++; rgb++;
+        *rgb = YUVToRGB32(*Y, nU, nV);
+        Y++; rgb++;
+    }
+}
+
+/* Converts one row of RGBA8888 pixels to Y samples and, if |VU| is not NULL,
+ * to the interleaved V and U samples of the top left pixel of each pair.
+ */
+typedef void (*RGBA8888RowToNV21Func)(const uint8_t* rgba,
+                                      uint8_t* Y,
+                                      uint8_t* VU,
+                                      int width);
+
+static void _RGBA8888RowToNV21(const uint8_t* rgba,
+                               uint8_t* Y,
+                               uint8_t* VU,
+                               int width)
+{
+    for (int x = 0; x < width; x++, rgba += 4) {
+        const int R = rgba[0];
+        const int G = rgba[1];
+        const int B = rgba[2];
+        *Y++ = RGB2Y_FULL(R, G, B);
+        if (VU != NULL && (x & 1) == 0) {
+            *VU++ = RGB2V_FULL(R, G, B);
+            *VU++ = RGB2U_FULL(R, G, B);
+        }
+    }
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN && (defined(__x86_64__) || defined(__i386__))
+
+/*
+ * SSE2 and AVX2 converters.
+ *
+ * They evaluate the YUV2RO/GO/BO macros exactly: the 298/409/100/208/516
+ * products are summed in 32 bits with pmaddwd on (C, E), (C, D) and (E, 1)
+ * pairs, shifted, and clamped to 0-255 in 16 bits.
+ */
+
+/* Two 16 bit multipliers for pmaddwd: |a| for even and |b| for odd lanes. */
+#define YUV_COEFF_PAIR(a, b) \
+    static_cast<int>(static_cast<uint16_t>(a) | \
+                     (static_cast<uint32_t>(static_cast<uint16_t>(b)) << 16))
+
+/* Computes clamped R, G, and B of 8 pixels from C, D, and E. */
+static __inline__ void
+_YUVToRGB16_SSE2(__m128i C, __m128i D, __m128i E,
+                 __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i kR = _mm_set1_epi32(YUV_COEFF_PAIR(298, 409));
+    const __m128i kG0 = _mm_set1_epi32(YUV_COEFF_PAIR(298, -100));
+    const __m128i kG1 = _mm_set1_epi32(YUV_COEFF_PAIR(-208, 128));
+    const __m128i kB = _mm_set1_epi32(YUV_COEFF_PAIR(298, 516));
+    const __m128i kRound = _mm_set1_epi32(128);
+    const __m128i kOne = _mm_set1_epi16(1);
+    const __m128i kMin = _mm_setzero_si128();
+    const __m128i kMax = _mm_set1_epi16(255);
+
+    const __m128i ce_lo = _mm_unpacklo_epi16(C, E);
+    const __m128i ce_hi = _mm_unpackhi_epi16(C, E);
+    const __m128i cd_lo = _mm_unpacklo_epi16(C, D);
+    const __m128i cd_hi = _mm_unpackhi_epi16(C, D);
+    const __m128i e1_lo = _mm_unpacklo_epi16(E, kOne);
+    const __m128i e1_hi = _mm_unpackhi_epi16(E, kOne);
+
+    __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce_lo, kR), kRound), 8);
+    __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce_hi, kR), kRound), 8);
+    *r = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), kMin), kMax);
+
+    lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_lo, kG0),
+                                      _mm_madd_epi16(e1_lo, kG1)), 8);
+    hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_hi, kG0),
+                                      _mm_madd_epi16(e1_hi, kG1)), 8);
+    *g = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), kMin), kMax);
+
+    lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_lo, kB), kRound), 8);
+    hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_hi, kB), kRound), 8);
+    *b = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), kMin), kMax);
+}
+
+/* Loads 8 U and 8 V samples, for 16 pixels, as D and E. */
+static __inline__ void
+_LoadUV_SSE2(const uint8_t* U, const uint8_t* V, int dUV,
+             __m128i* D, __m128i* E)
+{
+    const __m128i k128 = _mm_set1_epi16(128);
+    __m128i u, v;
+    if (dUV == 1) {
+        const __m128i zero = _mm_setzero_si128();
+        u = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(U)), zero);
+        v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(V)), zero);
+    } else {
+        const __m128i uv = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(U < V ? U : V));
+        const __m128i even = _mm_and_si128(uv, _mm_set1_epi16(0xff));
+        const __m128i odd = _mm_srli_epi16(uv, 8);
+        u = U < V ? even : odd;
+        v = U < V ? odd : even;
+    }
+    *D = _mm_sub_epi16(u, k128);
+    *E = _mm_sub_epi16(v, k128);
+}
+
+/* Converts 16 pixels to clamped R, G, and B, 8 pixels per register. */
+static __inline__ void
+_YUV420SToRGB16x16_SSE2(const uint8_t* Y, const uint8_t* U, const uint8_t* V,
+                        int dUV, __m128i r[2], __m128i g[2], __m128i b[2])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Y));
+    __m128i D, E;
+    _LoadUV_SSE2(U, V, dUV, &D, &E);
+
+    _YUVToRGB16_SSE2(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), k16),
+                     _mm_unpacklo_epi16(D, D), _mm_unpacklo_epi16(E, E),
+                     &r[0], &g[0], &b[0]);
+    _YUVToRGB16_SSE2(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), k16),
+                     _mm_unpackhi_epi16(D, D), _mm_unpackhi_epi16(E, E),
+                     &r[1], &g[1], &b[1]);
+}
+
+static void _YUV420SRowToRGB565_SSE2(const uint8_t* Y,
+                                     const uint8_t* U,
+                                     const uint8_t* V,
+                                     int dUV,
+                                     uint16_t* rgb,
+                                     int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, Y += 16, U += 8 * dUV, V += 8 * dUV) {
+        __m128i r[2], g[2], b[2];
+        _YUV420SToRGB16x16_SSE2(Y, U, V, dUV, r, g, b);
+        for (int n = 0; n < 2; n++) {
+            const __m128i px = _mm_or_si128(
+                _mm_or_si128(_mm_srli_epi16(r[n], 3),
+                             _mm_slli_epi16(_mm_srli_epi16(g[n], 2), 5)),
+                _mm_slli_epi16(_mm_srli_epi16(b[n], 3), 11));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + x + 8 * n), px);
+        }
+    }
+    _YUV420SRowToRGB565(Y, U, V, dUV, rgb + x, width - x);
+}
+
+static void _YUV420SRowToRGB32_SSE2(const uint8_t* Y,
+                                    const uint8_t* U,
+                                    const uint8_t* V,
+                                    int dUV,
+                                    uint32_t* rgb,
+                                    int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, Y += 16, U += 8 * dUV, V += 8 * dUV) {
+        __m128i r[2], g[2], b[2];
+        _YUV420SToRGB16x16_SSE2(Y, U, V, dUV, r, g, b);
+        for (int n = 0; n < 2; n++) {
+            const __m128i rg = _mm_or_si128(r[n], _mm_slli_epi16(g[n], 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + x + 8 * n),
+                             _mm_unpacklo_epi16(rg, b[n]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + x + 8 * n + 4),
+                             _mm_unpackhi_epi16(rg, b[n]));
+        }
+    }
+    _YUV420SRowToRGB32(Y, U, V, dUV, rgb + x, width - x);
+}
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+/* Computes clamped R, G, and B of 16 pixels from C, D, and E. */
+static AVX2_TARGET __inline__ void
+_YUVToRGB16_AVX2(__m256i C, __m256i D, __m256i E,
+                 __m256i* r, __m256i* g, __m256i* b)
+{
+    const __m256i kR = _mm256_set1_epi32(YUV_COEFF_PAIR(298, 409));
+    const __m256i kG0 = _mm256_set1_epi32(YUV_COEFF_PAIR(298, -100));
+    const __m256i kG1 = _mm256_set1_epi32(YUV_COEFF_PAIR(-208, 128));
+    const __m256i kB = _mm256_set1_epi32(YUV_COEFF_PAIR(298, 516));
+    const __m256i kRound = _mm256_set1_epi32(128);
+    const __m256i kOne = _mm256_set1_epi16(1);
+    const __m256i kMin = _mm256_setzero_si256();
+    const __m256i kMax = _mm256_set1_epi16(255);
+
+    /* Unpacking and packing both work within 128 bit lanes, so the pixel
+     * order is the same on the way out as on the way in. */
+    const __m256i ce_lo = _mm256_unpacklo_epi16(C, E);
+    const __m256i ce_hi = _mm256_unpackhi_epi16(C, E);
+    const __m256i cd_lo = _mm256_unpacklo_epi16(C, D);
+    const __m256i cd_hi = _mm256_unpackhi_epi16(C, D);
+    const __m256i e1_lo = _mm256_unpacklo_epi16(E, kOne);
+    const __m256i e1_hi = _mm256_unpackhi_epi16(E, kOne);
+
+    __m256i lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ce_lo, kR), kRound), 8);
+    __m256i hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ce_hi, kR), kRound), 8);
+    *r = _mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(lo, hi), kMin), kMax);
+
+    lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd_lo, kG0),
+                                            _mm256_madd_epi16(e1_lo, kG1)), 8);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd_hi, kG0),
+                                            _mm256_madd_epi16(e1_hi, kG1)), 8);
+    *g = _mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(lo, hi), kMin), kMax);
+
+    lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd_lo, kB), kRound), 8);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd_hi, kB), kRound), 8);
+    *b = _mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(lo, hi), kMin), kMax);
+}
+
+/* Converts 32 pixels to clamped R, G, and B, 16 pixels per register. */
+static AVX2_TARGET __inline__ void
+_YUV420SToRGB16x32_AVX2(const uint8_t* Y, const uint8_t* U, const uint8_t* V,
+                        int dUV, __m256i r[2], __m256i g[2], __m256i b[2])
+{
+    const __m256i k16 = _mm256_set1_epi16(16);
+    const __m256i k128 = _mm256_set1_epi16(128);
+    __m256i u, v;
+    if (dUV == 1) {
+        u = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(U)));
+        v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(V)));
+    } else {
+        const __m256i uv = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(U < V ? U : V));
+        const __m256i even = _mm256_and_si256(uv, _mm256_set1_epi16(0xff));
+        const __m256i odd = _mm256_srli_epi16(uv, 8);
+        u = U < V ? even : odd;
+        v = U < V ? odd : even;
+    }
+    /* Reorder the 64 bit quarters as 0, 2, 1, 3 so that the in-lane unpacks
+     * below duplicate samples 0-7 and 8-15 in order. */
+    const __m256i D = _mm256_permute4x64_epi64(_mm256_sub_epi16(u, k128), 0xd8);
+    const __m256i E = _mm256_permute4x64_epi64(_mm256_sub_epi16(v, k128), 0xd8);
+
+    for (int n = 0; n < 2; n++) {
+        const __m256i C = _mm256_sub_epi16(_mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(Y + 16 * n))), k16);
+        _YUVToRGB16_AVX2(C,
+                         n == 0 ? _mm256_unpacklo_epi16(D, D) : _mm256_unpackhi_epi16(D, D),
+                         n == 0 ? _mm256_unpacklo_epi16(E, E) : _mm256_unpackhi_epi16(E, E),
+                         &r[n], &g[n], &b[n]);
+    }
+}
+
+static AVX2_TARGET void _YUV420SRowToRGB565_AVX2(const uint8_t* Y,
+                                                 const uint8_t* U,
+                                                 const uint8_t* V,
+                                                 int dUV,
+                                                 uint16_t* rgb,
+                                                 int width)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32, Y += 32, U += 16 * dUV, V += 16 * dUV) {
+        __m256i r[2], g[2], b[2];
+        _YUV420SToRGB16x32_AVX2(Y, U, V, dUV, r, g, b);
+        for (int n = 0; n < 2; n++) {
+            const __m256i px = _mm256_or_si256(
+                _mm256_or_si256(_mm256_srli_epi16(r[n], 3),
+                                _mm256_slli_epi16(_mm256_srli_epi16(g[n], 2), 5)),
+                _mm256_slli_epi16(_mm256_srli_epi16(b[n], 3), 11));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb + x + 16 * n), px);
+        }
+    }
+    _YUV420SRowToRGB565(Y, U, V, dUV, rgb + x, width - x);
+}
+
+static AVX2_TARGET void _YUV420SRowToRGB32_AVX2(const uint8_t* Y,
+                                                const uint8_t* U,
+                                                const uint8_t* V,
+                                                int dUV,
+                                                uint32_t* rgb,
+                                                int width)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32, Y += 32, U += 16 * dUV, V += 16 * dUV) {
+        __m256i r[2], g[2], b[2];
+        _YUV420SToRGB16x32_AVX2(Y, U, V, dUV, r, g, b);
+        for (int n = 0; n < 2; n++) {
+            const __m256i rg = _mm256_or_si256(r[n], _mm256_slli_epi16(g[n], 8));
+            /* Pixels 0-3 and 8-11 in lo, 4-7 and 12-15 in hi. */
+            const __m256i lo = _mm256_unpacklo_epi16(rg, b[n]);
+            const __m256i hi = _mm256_unpackhi_epi16(rg, b[n]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb + x + 16 * n),
+                                _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb + x + 16 * n + 8),
+                                _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+    }
+    _YUV420SRowToRGB32(Y, U, V, dUV, rgb + x, width - x);
+}
+
+/* Y needs up to 65280 and U/V stay within +-32640 before the shift, so both
+ * are computed in 16 bits: unsigned for Y, signed for U/V.
+ */
+static void _RGBA8888RowToNV21_SSE2(const uint8_t* rgba,
+                                    uint8_t* Y,
+                                    uint8_t* VU,
+                                    int width)
+{
+    const __m128i kByte = _mm_set1_epi32(0xff);
+    const __m128i k128 = _mm_set1_epi16(128);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i p0 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(rgba + 4 * x));
+        const __m128i p1 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(rgba + 4 * x + 16));
+        const __m128i r = _mm_packs_epi32(_mm_and_si128(p0, kByte),
+                                          _mm_and_si128(p1, kByte));
+        const __m128i g = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(p0, 8), kByte),
+            _mm_and_si128(_mm_srli_epi32(p1, 8), kByte));
+        const __m128i b = _mm_packs_epi32(
+            _mm_and_si128(_mm_srli_epi32(p0, 16), kByte),
+            _mm_and_si128(_mm_srli_epi32(p1, 16), kByte));
+
+        const __m128i y = _mm_srli_epi16(
+            _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)),
+                                        _mm_mullo_epi16(g, _mm_set1_epi16(150))),
+                          _mm_mullo_epi16(b, _mm_set1_epi16(29))), 8);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(Y + x),
+                         _mm_packus_epi16(y, y));
+        if (VU == NULL) {
+            continue;
+        }
+
+        const __m128i v = _mm_add_epi16(_mm_srai_epi16(
+            _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(r, 7),
+                                        _mm_mullo_epi16(g, _mm_set1_epi16(-107))),
+                          _mm_mullo_epi16(b, _mm_set1_epi16(-21))), 8), k128);
+        const __m128i u = _mm_add_epi16(_mm_srai_epi16(
+            _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(-43)),
+                                        _mm_mullo_epi16(g, _mm_set1_epi16(-85))),
+                          _mm_slli_epi16(b, 7)), 8), k128);
+        /* V and U of each pixel in a 16 bit lane; keep the even pixels. */
+        const __m128i vu = _mm_or_si128(v, _mm_slli_epi16(u, 8));
+        const __m128i even = _mm_srai_epi32(_mm_slli_epi32(vu, 16), 16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(VU + x),
+                         _mm_packs_epi32(even, even));
+    }
+    _RGBA8888RowToNV21(rgba + 4 * x, Y + x, VU != NULL ? VU + x : NULL,
+                       width - x);
+}
+
+#elif __BYTE_ORDER == __LITTLE_ENDIAN && defined(__ARM_NEON)
+
+/*
+ * NEON converters.
+ *
+ * They evaluate the YUV2RO/GO/BO macros exactly: the products are accumulated
+ * in 32 bits with vmull/vmlal, and the shifted result is clamped to 0-255 with
+ * a saturating narrow.
+ */
+
+/* Computes one clamped color of 8 pixels as (c0 * a + c1 * b + c2 * c + 128) >> 8.
+ * The c term is skipped when c2 is 0. */
+static __inline__ uint8x8_t
+_YUVToColor_NEON(int16x8_t a, int16_t c0, int16x8_t b, int16_t c1,
+                 int16x8_t c, int16_t c2)
+{
+    const int32x4_t kRound = vdupq_n_s32(128);
+    int32x4_t lo = vmlal_n_s16(kRound, vget_low_s16(a), c0);
+    int32x4_t hi = vmlal_n_s16(kRound, vget_high_s16(a), c0);
+    lo = vmlal_n_s16(lo, vget_low_s16(b), c1);
+    hi = vmlal_n_s16(hi, vget_high_s16(b), c1);
+    if (c2 != 0) {
+        lo = vmlal_n_s16(lo, vget_low_s16(c), c2);
+        hi = vmlal_n_s16(hi, vget_high_s16(c), c2);
+    }
+    return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, 8), vshrn_n_s32(hi, 8)));
+}
+
+/* Converts 16 pixels to clamped R, G, and B. */
+static __inline__ void
+_YUV420SToRGB8x16_NEON(const uint8_t* Y, const uint8_t* U, const uint8_t* V,
+                       int dUV, uint8x16_t* r, uint8x16_t* g, uint8x16_t* b)
+{
+    const int16x8_t k16 = vdupq_n_s16(16);
+    const int16x8_t k128 = vdupq_n_s16(128);
+    uint8x8_t u, v;
+    if (dUV == 1) {
+        u = vld1_u8(U);
+        v = vld1_u8(V);
+    } else {
+        const uint8x8x2_t uv = vld2_u8(U < V ? U : V);
+        u = uv.val[U < V ? 0 : 1];
+        v = uv.val[U < V ? 1 : 0];
+    }
+    const int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)), k128);
+    const int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), k128);
+    const int16x8x2_t D = vzipq_s16(d, d);
+    const int16x8x2_t E = vzipq_s16(e, e);
+    const uint8x16_t y = vld1q_u8(Y);
+
+    uint8x8_t rn[2], gn[2], bn[2];
+    for (int n = 0; n < 2; n++) {
+        const int16x8_t C = vsubq_s16(vreinterpretq_s16_u16(
+            vmovl_u8(n == 0 ? vget_low_u8(y) : vget_high_u8(y))), k16);
+        rn[n] = _YUVToColor_NEON(C, 298, E.val[n], 409, E.val[n], 0);
+        gn[n] = _YUVToColor_NEON(C, 298, D.val[n], -100, E.val[n], -208);
+        bn[n] = _YUVToColor_NEON(C, 298, D.val[n], 516, D.val[n], 0);
+    }
+    *r = vcombine_u8(rn[0], rn[1]);
+    *g = vcombine_u8(gn[0], gn[1]);
+    *b = vcombine_u8(bn[0], bn[1]);
+}
+
+static void _YUV420SRowToRGB565_NEON(const uint8_t* Y,
+                                     const uint8_t* U,
+                                     const uint8_t* V,
+                                     int dUV,
+                                     uint16_t* rgb,
+                                     int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, Y += 16, U += 8 * dUV, V += 8 * dUV) {
+        uint8x16_t r, g, b;
+        _YUV420SToRGB8x16_NEON(Y, U, V, dUV, &r, &g, &b);
+        r = vshrq_n_u8(r, 3);
+        g = vshrq_n_u8(g, 2);
+        b = vshrq_n_u8(b, 3);
+        for (int n = 0; n < 2; n++) {
+            const uint16x8_t px = vorrq_u16(
+                vorrq_u16(vmovl_u8(n == 0 ? vget_low_u8(r) : vget_high_u8(r)),
+                          vshll_n_u8(n == 0 ? vget_low_u8(g) : vget_high_u8(g), 5)),
+                vshlq_n_u16(vmovl_u8(n == 0 ? vget_low_u8(b) : vget_high_u8(b)), 11));
+            vst1q_u16(rgb + x + 8 * n, px);
+        }
+    }
+    _YUV420SRowToRGB565(Y, U, V, dUV, rgb + x, width - x);
+}
+
+static void _YUV420SRowToRGB32_NEON(const uint8_t* Y,
+                                    const uint8_t* U,
+                                    const uint8_t* V,
+                                    int dUV,
+                                    uint32_t* rgb,
+                                    int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, Y += 16, U += 8 * dUV, V += 8 * dUV) {
+        uint8x16x4_t px;
+        _YUV420SToRGB8x16_NEON(Y, U, V, dUV, &px.val[0], &px.val[1], &px.val[2]);
+        px.val[3] = vdupq_n_u8(0);
+        vst4q_u8(reinterpret_cast<uint8_t*>(rgb + x), px);
+    }
+    _YUV420SRowToRGB32(Y, U, V, dUV, rgb + x, width - x);
+}
+
+static void _RGBA8888RowToNV21_NEON(const uint8_t* rgba,
+                                    uint8_t* Y,
+                                    uint8_t* VU,
+                                    int width)
+{
+    const int16x8_t k128 = vdupq_n_s16(128);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const uint8x8x4_t px = vld4_u8(rgba + 4 * x);
+        uint16x8_t y = vmull_u8(px.val[0], vdup_n_u8(77));
+        y = vmlal_u8(y, px.val[1], vdup_n_u8(150));
+        y = vmlal_u8(y, px.val[2], vdup_n_u8(29));
+        vst1_u8(Y + x, vshrn_n_u16(y, 8));
+        if (VU == NULL) {
+            continue;
+        }
+
+        const int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(px.val[0]));
+        const int16x8_t g = vreinterpretq_s16_u16(vmovl_u8(px.val[1]));
+        const int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(px.val[2]));
+        int16x8_t v = vmulq_n_s16(r, 128);
+        v = vmlaq_n_s16(v, g, -107);
+        v = vmlaq_n_s16(v, b, -21);
+        v = vaddq_s16(vshrq_n_s16(v, 8), k128);
+        int16x8_t u = vmulq_n_s16(r, -43);
+        u = vmlaq_n_s16(u, g, -85);
+        u = vmlaq_n_s16(u, b, 128);
+        u = vaddq_s16(vshrq_n_s16(u, 8), k128);
+        /* V and U of each pixel in a 16 bit lane; keep the even pixels. */
+        const uint16x8_t vu = vorrq_u16(vreinterpretq_u16_s16(v),
+                                        vshlq_n_u16(vreinterpretq_u16_s16(u), 8));
+        vst1_u8(VU + x, vreinterpret_u8_u16(
+                    vget_low_u16(vuzpq_u16(vu, vu).val[0])));
+    }
+    _RGBA8888RowToNV21(rgba + 4 * x, Y + x, VU != NULL ? VU + x : NULL,
+                       width - x);
+}
+
+#endif
+
+/* Row converters of one instruction set. */
+struct RowConverters {
+    YUV420SRowToRGB565Func  toRGB565;
+    YUV420SRowToRGB32Func   toRGB32;
+    RGBA8888RowToNV21Func   toNV21;
+};
+
+/* Gets the row converters of an instruction set, or returns false if the
+ * CPU or the build doesn't support it. */
+static bool getRowConvertersFor(ConverterInstructionSet set,
+                                RowConverters* converters)
+{
+    switch (set) {
+        case CONVERTERS_PLAIN:
+            *converters = {_YUV420SRowToRGB565, _YUV420SRowToRGB32,
+                           _RGBA8888RowToNV21};
+            return true;
+#if __BYTE_ORDER == __LITTLE_ENDIAN && (defined(__x86_64__) || defined(__i386__))
+        case CONVERTERS_SSE2:
+            *converters = {_YUV420SRowToRGB565_SSE2, _YUV420SRowToRGB32_SSE2,
+                           _RGBA8888RowToNV21_SSE2};
+            return true;
+        case CONVERTERS_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2")) {
+                return false;
+            }
+            *converters = {_YUV420SRowToRGB565_AVX2, _YUV420SRowToRGB32_AVX2,
+                           _RGBA8888RowToNV21_SSE2};
+            return true;
+        case CONVERTERS_BEST:
+            return getRowConvertersFor(CONVERTERS_AVX2, converters) ||
+                   getRowConvertersFor(CONVERTERS_SSE2, converters);
+#elif __BYTE_ORDER == __LITTLE_ENDIAN && defined(__ARM_NEON)
+        case CONVERTERS_NEON:
+            *converters = {_YUV420SRowToRGB565_NEON, _YUV420SRowToRGB32_NEON,
+                           _RGBA8888RowToNV21_NEON};
+            return true;
+        case CONVERTERS_BEST:
+            return getRowConvertersFor(CONVERTERS_NEON, converters);
+#else
+        case CONVERTERS_BEST:
+            return getRowConvertersFor(CONVERTERS_PLAIN, converters);
+#endif
+        default:
+            return false;
+    }
+}
+
+/* The row converters in use, the fastest this CPU supports by default. */
+static RowConverters& getRowConverters()
+{
+    static RowConverters converters = [] {
+        RowConverters best;
+        getRowConvertersFor(CONVERTERS_BEST, &best);
+        return best;
+    }();
+    return converters;
+}
+
+bool setConverterInstructionSet(ConverterInstructionSet set)
+{
+    RowConverters converters;
+    if (!getRowConvertersFor(set, &converters)) {
+        return false;
+    }
+    getRowConverters() = converters;
+    ALOGV("%s: Using instruction set %d", __FUNCTION__, set);
+    return true;
+}
+
 static void _YUV420SToRGB565(const uint8_t* Y,
                              const uint8_t* U,
                              const uint8_t* V,
@@ -37,22 +647,12 @@ static void _YUV420SToRGB565(const uint8_t* Y,
                              int y_stride,
                              int uv_stride)
 {
-    const uint8_t* Y_pos = Y;
-    const uint8_t* U_pos = U;
-    const uint8_t* V_pos = V;
-
-    for (int y = 0; y < height; y++) {
-        Y = Y_pos + y_stride * y;
-        U = U_pos + uv_stride * (y / 2);
-        V = V_pos + uv_stride * (y / 2);
-        for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
-            const uint8_t nU = *U;
-            const uint8_t nV = *V;
-            *rgb = YUVToRGB565(*Y, nU, nV);
-            Y++; rgb++;
-            *rgb = YUVToRGB565(*Y, nU, nV);
-            Y++; rgb++;
-        }
+    const YUV420SRowToRGB565Func convertRow = getRowConverters().toRGB565;
+    for (int y = 0; y < height; y++, rgb += width) {
+        convertRow(Y + y_stride * y,
+                   U + uv_stride * (y / 2),
+                   V + uv_stride * (y / 2),
+                   dUV, rgb, width);
     }
 }
 
@@ -66,22 +666,12 @@ static void _YUV420SToRGB32(const uint8_t* Y,
                             int y_stride,
                             int uv_stride)
 {
-    const uint8_t* Y_pos = Y;
-    const uint8_t* U_pos = U;
-    const uint8_t* V_pos = V;
-
-    for (int y = 0; y < height; y++) {
-        Y = Y_pos + y_stride * y;
-        U = U_pos + uv_stride * (y / 2);
-        V = V_pos + uv_stride * (y / 2);
-        for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
-            const uint8_t nU = *U;
-            const uint8_t nV = *V;
-            *rgb = YUVToRGB32(*Y, nU, nV);
-            Y++; rgb++;
-            *rgb = YUVToRGB32(*Y, nU, nV);
-            Y++; rgb++;
-        }
+    const YUV420SRowToRGB32Func convertRow = getRowConverters().toRGB32;
+    for (int y = 0; y < height; y++, rgb += width) {
+        convertRow(Y + y_stride * y,
+                   U + uv_stride * (y / 2),
+                   V + uv_stride * (y / 2),
+                   dUV, rgb, width);
     }
 }
 
@@ -199,4 +789,17 @@ void NV21ToRGB32(const void* nv21, void* rgb, int width, int height)
                  reinterpret_cast<uint32_t*>(rgb), width, height);
 }
 
+void RGBA8888ToNV21(const void* rgba, void* nv21, int width, int height,
+                    int y_stride)
+{
+    const RGBA8888RowToNV21Func convertRow = getRowConverters().toNV21;
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(rgba);
+    uint8_t* Y = reinterpret_cast<uint8_t*>(nv21);
+    uint8_t* VU = Y + y_stride * height;
+    for (int y = 0; y < height; y++, src += width * 4) {
+        convertRow(src, Y + y_stride * y,
+                   (y & 1) == 0 ? VU + width * (y / 2) : NULL, width);
+    }
+}
+
 }; /* namespace android */
@@ -148,6 +148,13 @@ clamp(int x)
 #define RGB2U(r, g, b) (uint8_t)(((-38 * (r) - 74 * (g) + 112 * (b) + 128) >> 8) + 128)
 #define RGB2V(r, g, b) (uint8_t)(((112 * (r) - 94 * (g) -  18 * (b) + 128) >> 8) + 128)
 
+/*
+ * Full range RGB -> YUV conversion macros, used for frames rendered with GL.
+ */
+#define RGB2Y_FULL(r, g, b) (uint8_t)((77 * (r) + 150 * (g) + 29 * (b)) >> 8)
+#define RGB2U_FULL(r, g, b) (uint8_t)(((-43 * (r) - 85 * (g) + 128 * (b)) >> 8) + 128)
+#define RGB2V_FULL(r, g, b) (uint8_t)(((128 * (r) - 107 * (g) - 21 * (b)) >> 8) + 128)
+
 /* Converts R8 G8 B8 color to YUV. */
 static __inline__ void
 R8G8B8ToYUV(uint8_t r, uint8_t g, uint8_t b, uint8_t* y, uint8_t* u, uint8_t* v)
@@ -220,6 +227,7 @@ YUVToRGB32(int y, int u, int v)
     /* Calculate C, D, and E values for the optimized macro. */
     y -= 16; u -= 128; v -= 128;
     RGB32_t rgb;
+    rgb.a = 0;
     rgb.r = YUV2RO(y,u,v) & 0xff;
     rgb.g = YUV2GO(y,u,v) & 0xff;
     rgb.b = YUV2BO(y,u,v) & 0xff;
@@ -309,6 +317,38 @@ void NV21ToRGB565(const void* nv21, void* rgb, int width, int height);
  */
 void NV21ToRGB32(const void* nv21, void* rgb, int width, int height);
 
+/* Converts an RGBA8888 framebuffer, as read back from GL, to NV21 framebuffer
+ * with the full range RGB2x_FULL macros. U and V come from the top left pixel
+ * of each 2x2 block.
+ * Param:
+ *  rgba - RGBA8888 framebuffer, without any row padding.
+ *  nv21 - NV21 framebuffer. The VU pane follows |height| Y rows, and its rows
+ *      are |width| bytes apart.
+ *  width, height - Dimensions for both framebuffers.
+ *  y_stride - Distance between two Y rows in the NV21 framebuffer.
+ */
+void RGBA8888ToNV21(const void* rgba, void* nv21, int width, int height,
+                    int y_stride);
+
+/* Instruction sets the converters above can be run with. */
+enum ConverterInstructionSet {
+    /* Plain C, which all the others match bit for bit. */
+    CONVERTERS_PLAIN,
+    CONVERTERS_SSE2,
+    CONVERTERS_AVX2,
+    CONVERTERS_NEON,
+    /* The fastest set the CPU supports, used by default. */
+    CONVERTERS_BEST,
+};
+
+/* Makes the converters above run with the given instruction set, for testing
+ * the vectorized converters against the plain C ones. Must not be called while
+ * frames are being converted.
+ * Return:
+ *  false if the CPU or the build doesn't support the instruction set.
+ */
+bool setConverterInstructionSet(ConverterInstructionSet set);
+
 }; /* namespace android */
 
 #endif  /* HW_EMULATOR_CAMERA_CONVERTERS_H */
@@ -252,6 +252,18 @@ void EmulatedCamera::onCameraDeviceError(int err)
 void EmulatedCamera::setTakingPicture(bool takingPicture) {
     mCallbackNotifier.setTakingPicture(takingPicture);
 }
+
+uint32_t EmulatedCamera::getFrameViews() {
+    uint32_t views = 0;
+    if (mPreviewWindow.isPreviewEnabled()) {
+        views |= EmulatedCameraDevice::FRAME_VIEW_PREVIEW;
+    }
+    if (mCallbackNotifier.isMessageEnabled(CAMERA_MSG_VIDEO_FRAME) &&
+            mCallbackNotifier.isVideoRecordingEnabled()) {
+        views |= EmulatedCameraDevice::FRAME_VIEW_VIDEO;
+    }
+    return views;
+}
 /****************************************************************************
  * Camera API implementation.
  ***************************************************************************/
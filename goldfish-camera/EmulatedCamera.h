@@ -103,6 +103,11 @@ public:
     /* Signal to the callback notifier that a pictuer is being taken. */
     void setTakingPicture(bool takingPicture);
 
+    /* Gets the frame views the enabled frame consumers take, as a mask of
+     * EmulatedCameraDevice::FrameView values. This is called by the camera
+     * device for every frame it produces, so it can render those directly. */
+    uint32_t getFrameViews();
+
     /****************************************************************************
      * Camera API implementation
      ***************************************************************************/
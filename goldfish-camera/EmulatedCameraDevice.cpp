@@ -178,40 +178,7 @@ status_t EmulatedCameraDevice::getCurrentFrameImpl(const uint8_t* source,
         return NO_ERROR;
     } else if (pixelFormat == V4L2_PIX_FMT_YUV420 &&
                mPixelFormat == V4L2_PIX_FMT_YVU420) {
-        // Convert from YV12 to YUV420 without alignment
-        const int ySize = mYStride * mFrameHeight;
-        const int uvSize = mUVStride * (mFrameHeight / 2);
-        if (mYStride == mFrameWidth) {
-            // Copy Y straight up
-            memcpy(dest, source, ySize);
-        } else {
-            // Strip alignment
-            for (int y = 0; y < mFrameHeight; ++y) {
-                memcpy(dest + y * mFrameWidth,
-                       source + y * mYStride,
-                       mFrameWidth);
-            }
-        }
-
-        if (mUVStride == mFrameWidth / 2) {
-            // Swap U and V
-            memcpy(dest + ySize, source + ySize + uvSize, uvSize);
-            memcpy(dest + ySize + uvSize, source + ySize, uvSize);
-        } else {
-            // Strip alignment
-            uint8_t* uvDest = dest + mFrameWidth * mFrameHeight;
-            const uint8_t* uvSource = source + ySize + uvSize;
-
-            for (int i = 0; i < 2; ++i) {
-                for (int y = 0; y < mFrameHeight / 2; ++y) {
-                    memcpy(uvDest + y * (mFrameWidth / 2),
-                           uvSource + y * mUVStride,
-                           mFrameWidth / 2);
-                }
-                uvDest += (mFrameHeight / 2) * (mFrameWidth / 2);
-                uvSource -= uvSize;
-            }
-        }
+        convertToVideoFrame(source, dest);
         return NO_ERROR;
     }
     ALOGE("%s: Invalid pixel format conversion [%.4s to %.4s] requested",
@@ -234,17 +201,22 @@ status_t EmulatedCameraDevice::getCurrentFrame(void* buffer,
     }
 
     FrameLock lock(*this);
-    const void* source = mCameraThread->getPrimaryBuffer();
-    if (source == nullptr) {
+    const FrameViews* views = lock.getFrameViews();
+    if (views == nullptr) {
         ALOGE("%s: No framebuffer", __FUNCTION__);
         return EINVAL;
     }
 
     if (timestamp != nullptr) {
-      *timestamp = mCameraThread->getPrimaryTimestamp();
+      *timestamp = lock.getTimestamp();
     }
 
-    return getCurrentFrameImpl(reinterpret_cast<const uint8_t*>(source),
+    if (pixelFormat == V4L2_PIX_FMT_YUV420 &&
+            (views->valid & FRAME_VIEW_VIDEO)) {
+        memcpy(buffer, views->video.data(), views->video.size());
+        return NO_ERROR;
+    }
+    return getCurrentFrameImpl(views->frame.data(),
                                reinterpret_cast<uint8_t*>(buffer),
                                pixelFormat);
 }
@@ -262,52 +234,55 @@ status_t EmulatedCameraDevice::getCurrentPreviewFrame(void* buffer,
     }
 
     FrameLock lock(*this);
-    const void* currentFrame = mCameraThread->getPrimaryBuffer();
-    if (currentFrame == nullptr) {
+    const FrameViews* views = lock.getFrameViews();
+    if (views == nullptr) {
         ALOGE("%s: No framebuffer", __FUNCTION__);
         return EINVAL;
     }
 
     if (timestamp != nullptr) {
-      *timestamp = mCameraThread->getPrimaryTimestamp();
+      *timestamp = lock.getTimestamp();
     }
 
-    /* In emulation the framebuffer is never RGB. */
-    switch (mPixelFormat) {
-        case V4L2_PIX_FMT_YVU420:
-            YV12ToRGB32(currentFrame, buffer, mFrameWidth, mFrameHeight);
-            return NO_ERROR;
-        case V4L2_PIX_FMT_YUV420:
-            YU12ToRGB32(currentFrame, buffer, mFrameWidth, mFrameHeight);
-            return NO_ERROR;
-        case V4L2_PIX_FMT_NV21:
-            NV21ToRGB32(currentFrame, buffer, mFrameWidth, mFrameHeight);
-            return NO_ERROR;
-        case V4L2_PIX_FMT_NV12:
-            NV12ToRGB32(currentFrame, buffer, mFrameWidth, mFrameHeight);
-            return NO_ERROR;
-
-        default:
-            ALOGE("%s: Unknown pixel format %.4s",
-                 __FUNCTION__, reinterpret_cast<const char*>(&mPixelFormat));
-            return EINVAL;
+    if (views->valid & FRAME_VIEW_PREVIEW) {
+        memcpy(buffer, views->preview.data(),
+               views->preview.size() * sizeof(uint32_t));
+        return NO_ERROR;
     }
+    return convertToPreviewFrame(views->frame.data(), buffer);
 }
 
-const void* EmulatedCameraDevice::getCurrentFrame() {
-    if (mCameraThread.get()) {
-        return mCameraThread->getPrimaryBuffer();
+const void* EmulatedCameraDevice::getCurrentFrame(const FrameLock& lock) {
+    const FrameViews* views = lock.getFrameViews();
+    if (views == nullptr) {
+        return nullptr;
     }
-    return nullptr;
+    return views->frame.data();
 }
 
 EmulatedCameraDevice::FrameLock::FrameLock(EmulatedCameraDevice& cameraDevice)
     : mCameraDevice(cameraDevice) {
-        mCameraDevice.lockCurrentFrame();
+        mIndex = mCameraDevice.lockCurrentFrame();
 }
 
 EmulatedCameraDevice::FrameLock::~FrameLock() {
-    mCameraDevice.unlockCurrentFrame();
+    mCameraDevice.unlockCurrentFrame(mIndex);
+}
+
+const EmulatedCameraDevice::FrameViews*
+EmulatedCameraDevice::FrameLock::getFrameViews() const {
+    if (mIndex < 0) {
+        return nullptr;
+    }
+    return reinterpret_cast<const FrameViews*>(
+            mCameraDevice.mCameraThread->getFrameBuffer(mIndex));
+}
+
+int64_t EmulatedCameraDevice::FrameLock::getTimestamp() const {
+    if (mIndex < 0) {
+        return 0L;
+    }
+    return mCameraDevice.mCameraThread->getFrameTimestamp(mIndex);
 }
 
 status_t EmulatedCameraDevice::setAutoFocus() {
@@ -375,9 +350,14 @@ status_t EmulatedCameraDevice::commonStartDevice(int width,
     mPixelFormat = pix_fmt;
     mTotalPixels = width * height;
 
-    /* Allocate framebuffer. */
-    mFrameBuffers[0].resize(mFrameBufferSize);
-    mFrameBuffers[1].resize(mFrameBufferSize);
+    /* Allocate framebuffers. Views are allocated by the producer once the
+     * consumers ask for them. */
+    for (FrameViews& views : mFrameViews) {
+        views.frame.resize(mFrameBufferSize);
+        views.video.clear();
+        views.preview.clear();
+        views.valid = 0;
+    }
     ALOGV("%s: Allocated %zu bytes for %d pixels in %.4s[%dx%d] frame",
          __FUNCTION__, mFrameBufferSize, mTotalPixels,
          reinterpret_cast<const char*>(&mPixelFormat), mFrameWidth, mFrameHeight);
@@ -389,11 +369,92 @@ void EmulatedCameraDevice::commonStopDevice()
     mFrameWidth = mFrameHeight = mTotalPixels = 0;
     mPixelFormat = 0;
 
-    mFrameBuffers[0].clear();
-    mFrameBuffers[1].clear();
-    // No need to keep all that memory allocated if the camera isn't running
-    mFrameBuffers[0].shrink_to_fit();
-    mFrameBuffers[1].shrink_to_fit();
+    for (FrameViews& views : mFrameViews) {
+        // No need to keep all that memory allocated if the camera isn't
+        // running
+        std::vector<uint8_t>().swap(views.frame);
+        std::vector<uint8_t>().swap(views.video);
+        std::vector<uint32_t>().swap(views.preview);
+        views.valid = 0;
+    }
+}
+
+bool EmulatedCameraDevice::produceFrameViews(FrameViews* views,
+                                             int64_t* timestamp)
+{
+    views->wanted = mCameraHAL->getFrameViews();
+    views->valid = 0;
+    if (views->wanted & FRAME_VIEW_VIDEO) {
+        views->video.resize((mFrameWidth * mFrameHeight * 12) / 8);
+    }
+    if (views->wanted & FRAME_VIEW_PREVIEW) {
+        views->preview.resize(mTotalPixels);
+    }
+    return produceFrame(views, timestamp);
+}
+
+void EmulatedCameraDevice::convertToVideoFrame(const uint8_t* source,
+                                               uint8_t* dest) const
+{
+    // Convert from YV12 to YUV420 without alignment
+    const int ySize = mYStride * mFrameHeight;
+    const int uvSize = mUVStride * (mFrameHeight / 2);
+    if (mYStride == mFrameWidth) {
+        // Copy Y straight up
+        memcpy(dest, source, ySize);
+    } else {
+        // Strip alignment
+        for (int y = 0; y < mFrameHeight; ++y) {
+            memcpy(dest + y * mFrameWidth,
+                   source + y * mYStride,
+                   mFrameWidth);
+        }
+    }
+
+    if (mUVStride == mFrameWidth / 2) {
+        // Swap U and V
+        memcpy(dest + ySize, source + ySize + uvSize, uvSize);
+        memcpy(dest + ySize + uvSize, source + ySize, uvSize);
+    } else {
+        // Strip alignment
+        uint8_t* uvDest = dest + mFrameWidth * mFrameHeight;
+        const uint8_t* uvSource = source + ySize + uvSize;
+
+        for (int i = 0; i < 2; ++i) {
+            for (int y = 0; y < mFrameHeight / 2; ++y) {
+                memcpy(uvDest + y * (mFrameWidth / 2),
+                       uvSource + y * mUVStride,
+                       mFrameWidth / 2);
+            }
+            uvDest += (mFrameHeight / 2) * (mFrameWidth / 2);
+            uvSource -= uvSize;
+        }
+    }
+}
+
+status_t EmulatedCameraDevice::convertToPreviewFrame(const uint8_t* source,
+                                                     void* dest) const
+{
+    /* In emulation the framebuffer is never RGB. */
+    switch (mPixelFormat) {
+        case V4L2_PIX_FMT_YVU420:
+            YV12ToRGB32(source, dest, mFrameWidth, mFrameHeight);
+            return NO_ERROR;
+        case V4L2_PIX_FMT_YUV420:
+            YU12ToRGB32(source, dest, mFrameWidth, mFrameHeight);
+            return NO_ERROR;
+        case V4L2_PIX_FMT_NV21:
+            NV21ToRGB32(source, dest, mFrameWidth, mFrameHeight);
+            return NO_ERROR;
+        case V4L2_PIX_FMT_NV12:
+            NV12ToRGB32(source, dest, mFrameWidth, mFrameHeight);
+            return NO_ERROR;
+
+        default:
+            ALOGE("%s: Unknown pixel format %.4s",
+                 __FUNCTION__, reinterpret_cast<const char*>(&mPixelFormat));
+            return EINVAL;
+    }
 }
 
 /****************************************************************************
@@ -465,26 +526,25 @@ EmulatedCameraDevice::CameraThread::CameraThread(EmulatedCameraDevice* dev,
 
 }
 
-const void* EmulatedCameraDevice::CameraThread::getPrimaryBuffer() const {
+int EmulatedCameraDevice::CameraThread::holdFrame() {
     if (mFrameProducer.get()) {
-        return mFrameProducer->getPrimaryBuffer();
+        return mFrameProducer->holdFrame();
     }
-    return nullptr;
+    return -1;
 }
 
-int64_t EmulatedCameraDevice::CameraThread::getPrimaryTimestamp() const {
-    if (mFrameProducer.get()) {
-        return mFrameProducer->getPrimaryTimestamp();
+void EmulatedCameraDevice::CameraThread::releaseFrame(int index) {
+    if (index >= 0 && mFrameProducer.get()) {
+        mFrameProducer->releaseFrame(index);
     }
-    return 0L;
 }
 
-void EmulatedCameraDevice::CameraThread::lockPrimaryBuffer() {
-    mFrameProducer->lockPrimaryBuffer();
+const void* EmulatedCameraDevice::CameraThread::getFrameBuffer(int index) const {
+    return mFrameProducer->getFrameBuffer(index);
 }
 
-void EmulatedCameraDevice::CameraThread::unlockPrimaryBuffer() {
-    mFrameProducer->unlockPrimaryBuffer();
+int64_t EmulatedCameraDevice::CameraThread::getFrameTimestamp(int index) const {
+    return mFrameProducer->getFrameTimestamp(index);
 }
 
 bool
@@ -535,11 +595,13 @@ bool EmulatedCameraDevice::CameraThread::inWorkerThread() {
 }
 
 status_t EmulatedCameraDevice::CameraThread::onThreadStart() {
-    void* primaryBuffer = mCameraDevice->getPrimaryBuffer();
-    void* secondaryBuffer = mCameraDevice->getSecondaryBuffer();
+    void* buffers[kFrameBufferCount];
+    for (int i = 0; i < kFrameBufferCount; ++i) {
+        buffers[i] = mCameraDevice->getFrameBuffer(i);
+    }
     mFrameProducer = new FrameProducer(mCameraDevice,
                                        mProducerFunc, mProducerOpaque,
-                                       primaryBuffer, secondaryBuffer);
+                                       buffers);
     if (mFrameProducer.get() == nullptr) {
         ALOGE("%s: Could not instantiate FrameProducer object", __FUNCTION__);
         return ENOMEM;
@@ -560,35 +622,66 @@ EmulatedCameraDevice::CameraThread::FrameProducer::FrameProducer(
         EmulatedCameraDevice* dev,
         ProduceFrameFunc producer,
         void* opaque,
-        void* primaryBuffer,
-        void* secondaryBuffer)
+        void* const* buffers)
     : WorkerThread("Camera_FrameProducer", dev, dev->mCameraHAL),
       mProducer(producer),
       mOpaque(opaque),
-      mPrimaryBuffer(primaryBuffer),
-      mSecondaryBuffer(secondaryBuffer),
-      mPrimaryTimestamp(0L),
-      mSecondaryTimestamp(0L),
       mLastFrame(0),
-      mHasFrame(false) {
+      mPublished(-1) {
+    for (int i = 0; i < kFrameBufferCount; ++i) {
+        mBuffers[i] = buffers[i];
+        mTimestamps[i] = 0L;
+        mHolds[i] = 0;
+    }
+}
+
+int EmulatedCameraDevice::CameraThread::FrameProducer::holdFrame() {
+    int index = mPublished.load();
+    while (index >= 0) {
+        mHolds[index].fetch_add(1);
+        // The producer only draws into buffers that are not published after
+        // it has seen them free, so the buffer is safe if it is still the
+        // published one now that the hold is visible.
+        const int published = mPublished.load();
+        if (published == index) {
+            break;
+        }
+        mHolds[index].fetch_sub(1);
+        index = published;
+    }
+    return index;
+}
 
+void EmulatedCameraDevice::CameraThread::FrameProducer::releaseFrame(int index) {
+    mHolds[index].fetch_sub(1);
 }
 
 const void*
-EmulatedCameraDevice::CameraThread::FrameProducer::getPrimaryBuffer() const {
-    return mPrimaryBuffer;
+EmulatedCameraDevice::CameraThread::FrameProducer::getFrameBuffer(int index) const {
+    return mBuffers[index];
 }
 
 int64_t
-EmulatedCameraDevice::CameraThread::FrameProducer::getPrimaryTimestamp() const {
-    return mPrimaryTimestamp;
+EmulatedCameraDevice::CameraThread::FrameProducer::getFrameTimestamp(int index) const {
+    return mTimestamps[index];
 }
 
-void EmulatedCameraDevice::CameraThread::FrameProducer::lockPrimaryBuffer() {
-    mBufferMutex.lock();
-}
-void EmulatedCameraDevice::CameraThread::FrameProducer::unlockPrimaryBuffer() {
-    mBufferMutex.unlock();
+int EmulatedCameraDevice::CameraThread::FrameProducer::findFreeBuffer() {
+    for (;;) {
+        const int published = mPublished.load();
+        for (int i = 0; i < kFrameBufferCount; ++i) {
+            if (i != published && mHolds[i].load() == 0) {
+                return i;
+            }
+        }
+
+        // Only possible with several readers holding frames at once.
+        Mutex::Autolock lock(mRunningMutex);
+        mRunningCondition.waitRelative(mRunningMutex, milliseconds(1));
+        if (!mRunning) {
+            return -1;
+        }
+    }
 }
 
 void EmulatedCameraDevice::CameraThread::requestRestart(int width,
@@ -606,7 +699,7 @@ void EmulatedCameraDevice::CameraThread::requestRestart(int width,
 }
 
 bool EmulatedCameraDevice::CameraThread::FrameProducer::hasFrame() const {
-    return mHasFrame;
+    return mPublished.load() >= 0;
 }
 
 bool EmulatedCameraDevice::CameraThread::checkRestartRequest() {
@@ -673,30 +766,36 @@ bool EmulatedCameraDevice::CameraThread::FrameProducer::inWorkerThread() {
         }
     }
 
-    // Produce one frame and place it in the secondary buffer
+    const int index = findFreeBuffer();
+    if (index < 0) {
+        ALOGV("%s: FrameProducer has been terminated.", __FUNCTION__);
+        return false;
+    }
+
+    // Produce one frame and place it in the free buffer
     mLastFrame = systemTime(SYSTEM_TIME_MONOTONIC);
-    if (!mProducer(mOpaque, mSecondaryBuffer, &mSecondaryTimestamp)) {
+    if (!mProducer(mOpaque, mBuffers[index], &mTimestamps[index])) {
         ALOGE("FrameProducer could not produce frame, exiting thread");
         mCameraHAL->onCameraDeviceError(CAMERA_ERROR_SERVER_DIED);
         return false;
     }
 
-    {
-        // Switch buffers now that the secondary buffer is ready
-        Mutex::Autolock lock(mBufferMutex);
-        std::swap(mPrimaryBuffer, mSecondaryBuffer);
-        std::swap(mPrimaryTimestamp, mSecondaryTimestamp);
-    }
-    mHasFrame = true;
+    // Publish the buffer now that the frame is ready
+    mPublished.store(index);
     return true;
 }
 
-void EmulatedCameraDevice::lockCurrentFrame() {
-    mCameraThread->lockPrimaryBuffer();
+int EmulatedCameraDevice::lockCurrentFrame() {
+    if (mCameraThread.get() == nullptr) {
+        return -1;
+    }
+    return mCameraThread->holdFrame();
 }
 
-void EmulatedCameraDevice::unlockCurrentFrame() {
-    mCameraThread->unlockPrimaryBuffer();
+void EmulatedCameraDevice::unlockCurrentFrame(int index) {
+    if (mCameraThread.get() != nullptr) {
+        mCameraThread->releaseFrame(index);
+    }
 }
 
 };  /* namespace android */
@@ -222,24 +222,62 @@ public:
      */
     virtual status_t getCurrentPreviewFrame(void* buffer, int64_t* timestamp);
 
+    /* Formats a frame can be produced in besides its raw format, one for each
+     * kind of frame consumer. Producers that can render these directly save
+     * the conversion from the raw frame when the frame is delivered. */
+    enum FrameView {
+        /* Packed YUV420, as taken by video frame callbacks. */
+        FRAME_VIEW_VIDEO    = 1 << 0,
+        /* RGB32, as taken by the preview window. */
+        FRAME_VIEW_PREVIEW  = 1 << 1,
+    };
+
+    /* One frame buffer of the frame producer, holding the frame in its raw
+     * format and in the views the consumers took when it was produced. */
+    struct FrameViews {
+        /* The frame in mPixelFormat. Always produced. */
+        std::vector<uint8_t>    frame;
+        /* The frame in packed YUV420, if FRAME_VIEW_VIDEO is valid. */
+        std::vector<uint8_t>    video;
+        /* The frame in RGB32, if FRAME_VIEW_PREVIEW is valid. */
+        std::vector<uint32_t>   preview;
+        /* Views that produceFrame should render, sized for it beforehand. */
+        uint32_t                wanted;
+        /* Views that produceFrame has rendered. Views that are not valid are
+         * converted from the raw frame when they are asked for. */
+        uint32_t                valid;
+    };
+
+    class FrameLock;
+
     /* Gets a pointer to the current frame buffer in its raw format.
      * This method must be called on a connected instance of this class with a
      * started camera device. If it is called on a disconnected instance, or
      * camera device has not been started, this method must return NULL.
-     * This method should only be called when the frame lock is held through
-     * a FrameLock object. Otherwise the contents of the frame might change
-     * unexpectedly or its memory could be deallocated leading to a crash.
+     * The frame is the one held by |lock|, and stays valid for as long as the
+     * lock object lives.
      * Return:
      *  A pointer to the current frame buffer on success, NULL otherwise.
      */
-    virtual const void* getCurrentFrame();
+    const void* getCurrentFrame(const FrameLock& lock);
 
+    /* Holds the latest produced frame for as long as the object lives. The
+     * frame producer keeps writing new frames to other buffers meanwhile, so
+     * holding a frame never stalls it. */
     class FrameLock {
     public:
         FrameLock(EmulatedCameraDevice& cameraDevice);
         ~FrameLock();
+
+        /* The buffer holding the frame, as passed to produceFrame(), or NULL
+         * if no frame has been produced yet. */
+        const FrameViews* getFrameViews() const;
+        /* Timestamp of the frame. */
+        int64_t getTimestamp() const;
     private:
         EmulatedCameraDevice& mCameraDevice;
+        /* Index of the frame buffer held, -1 if there is none. */
+        int mIndex;
     };
 
     /* Gets width of the frame obtained from the physical device.
@@ -450,21 +488,20 @@ protected:
      */
     virtual status_t stopWorkerThread();
 
-    /* Produce a camera frame and place it in buffer. The buffer is one of
-     * the two buffers provided to mFrameProducer during construction along with
-     * a pointer to this method. The method is expected to know what size frames
-     * it provided to the producer thread. Returning false indicates an
-     * unrecoverable error that will stop the frame production thread. */
-    virtual bool produceFrame(void* buffer, int64_t* timestamp) = 0;
+    /* Produce a camera frame and place it in views->frame, and in those of
+     * views->wanted that the device can render directly, marking them in
+     * views->valid. The views are one of the buffers provided to
+     * mFrameProducer during construction along with a pointer to this method.
+     * Returning false indicates an unrecoverable error that will stop the
+     * frame production thread. */
+    virtual bool produceFrame(FrameViews* views, int64_t* timestamp) = 0;
 
-    /* Get the primary buffer to use when constructing the FrameProducer. */
-    virtual void* getPrimaryBuffer() {
-        return mFrameBuffers[0].data();
-    }
+    /* Number of frame buffers the FrameProducer cycles through. */
+    static const int kFrameBufferCount = 3;
 
-    /* Get the seconary buffer to use when constructing the FrameProducer. */
-    virtual void* getSecondaryBuffer() {
-        return mFrameBuffers[1].data();
+    /* Get one of the buffers to use when constructing the FrameProducer. */
+    FrameViews* getFrameBuffer(int index) {
+        return &mFrameViews[index];
     }
 
     /* A class that encaspulates the asynchronous behavior of a camera. This
@@ -480,17 +517,15 @@ protected:
                      ProduceFrameFunc producer,
                      void* producerOpaque);
 
-        /* Access the primary buffer of the frame producer, this is the frame
-         * that is currently not being written to. The buffer will only have
-         * valid contents if hasFrame() returns true. Note that accessing this
-         * without first having created a Lock can lead to contents changing
-         * without notice. */
-        const void* getPrimaryBuffer() const;
-        int64_t getPrimaryTimestamp() const;
+        /* Hold the latest frame of the frame producer so that it isn't
+         * written to until it is released. Returns the index of the frame
+         * buffer, or -1 if no frame has been produced yet. Never blocks. */
+        int holdFrame();
+        void releaseFrame(int index);
 
-        /* Lock and unlock the primary buffer */
-        void lockPrimaryBuffer();
-        void unlockPrimaryBuffer();
+        /* Access a held frame buffer and the timestamp of its frame. */
+        const void* getFrameBuffer(int index) const;
+        int64_t getFrameTimestamp(int index) const;
 
         void requestRestart(int width, int height, uint32_t pixelFormat,
                             bool takingPicture, bool oneBurst);
@@ -504,39 +539,47 @@ protected:
         void onThreadExit() override;
 
         /* A class with a thread that will call a function at a specified
-         * interval to produce frames. This is done in a double-buffered fashion
-         * to make sure that one of the frames can be delivered without risk of
-         * overwriting its contents. Access to the primary buffer, the one NOT
-         * being drawn to, should be protected with the lock methods provided or
-         * the guarantee of not overwriting the contents does not hold.
+         * interval to produce frames. This is done in a triple-buffered fashion:
+         * each complete frame is published by atomically setting the index of
+         * its buffer, and readers hold the published buffer by counting
+         * themselves in its hold count, so that the producer draws the next
+         * frame into a buffer that is neither published nor held. With one
+         * reader at a time there is always such a buffer, and neither side
+         * ever waits for the other.
          */
         class FrameProducer : public WorkerThread {
         public:
             FrameProducer(EmulatedCameraDevice* cameraDevice,
                           ProduceFrameFunc producer, void* opaque,
-                          void* primaryBuffer, void* secondaryBuffer);
+                          void* const* buffers);
 
             /* Indicates if the producer has produced at least one frame. */
             bool hasFrame() const;
 
-            const void* getPrimaryBuffer() const;
-            int64_t getPrimaryTimestamp() const;
+            int holdFrame();
+            void releaseFrame(int index);
 
-            void lockPrimaryBuffer();
-            void unlockPrimaryBuffer();
+            const void* getFrameBuffer(int index) const;
+            int64_t getFrameTimestamp(int index) const;
 
         protected:
             bool inWorkerThread() override;
 
+            /* Find a buffer that is neither published nor held. Waits for
+             * readers holding all of them to release one. Returns -1 if the
+             * thread is stopped while waiting. */
+            int findFreeBuffer();
+
             ProduceFrameFunc mProducer;
             void* mOpaque;
-            void* mPrimaryBuffer;
-            void* mSecondaryBuffer;
-            int64_t mPrimaryTimestamp;
-            int64_t mSecondaryTimestamp;
+            void* mBuffers[kFrameBufferCount];
+            int64_t mTimestamps[kFrameBufferCount];
             nsecs_t mLastFrame;
-            mutable Mutex mBufferMutex;
-            std::atomic<bool> mHasFrame;
+            /* Index of the buffer with the latest frame, -1 until a frame has
+             * been produced. */
+            std::atomic<int> mPublished;
+            /* Number of readers holding each buffer. */
+            std::atomic<uint32_t> mHolds[kFrameBufferCount];
         };
 
         nsecs_t mCurFrameTimestamp;
@@ -573,11 +616,11 @@ protected:
     /* Emulated camera object containing this instance. */
     EmulatedCamera*             mCameraHAL;
 
-    /* Framebuffers containing the frame being drawn to and the frame being
-     * delivered. This is used by the double buffering producer thread and
-     * the consumer thread will copy frames from one of these buffers to
-     * mCurrentFrame to avoid being stalled by frame production. */
-    std::vector<uint8_t>        mFrameBuffers[2];
+    /* Framebuffers containing the frame being drawn to, the latest complete
+     * frame and the frame being delivered. This is used by the triple
+     * buffering producer thread so that neither frame production nor frame
+     * delivery is stalled by the other. */
+    FrameViews                  mFrameViews[kFrameBufferCount];
 
     /*
      * Framebuffer properties.
@@ -636,22 +679,32 @@ protected:
     EmulatedCameraDeviceState   mState;
 
 private:
-    /* Lock the current frame so that it can safely be accessed using
+    /* Hold the current frame so that it can safely be accessed using
      * getCurrentFrame. Prefer using a FrameLock object on the stack instead
-     * to ensure that the lock is always unlocked properly.
+     * to ensure that the frame is always released properly. Returns the index
+     * of the held frame buffer, -1 if there is none.
      */
-    void lockCurrentFrame();
-    /* Unlock the current frame after locking it. Prefer using a FrameLock
+    int lockCurrentFrame();
+    /* Release a frame held with lockCurrentFrame. Prefer using a FrameLock
      * object instead.
      */
-    void unlockCurrentFrame();
+    void unlockCurrentFrame(int index);
 
     static bool staticProduceFrame(void* opaque, void* buffer,
                                    int64_t* timestamp) {
         auto cameraDevice = reinterpret_cast<EmulatedCameraDevice*>(opaque);
-        return cameraDevice->produceFrame(buffer, timestamp);
+        return cameraDevice->produceFrameViews(
+                reinterpret_cast<FrameViews*>(buffer), timestamp);
     }
 
+    /* Asks the consumers which views they take, makes room for them in
+     * |views|, and produces the frame. */
+    bool produceFrameViews(FrameViews* views, int64_t* timestamp);
+
+    /* Convert the raw frame |source| into a view. */
+    void convertToVideoFrame(const uint8_t* source, uint8_t* dest) const;
+    status_t convertToPreviewFrame(const uint8_t* source, void* dest) const;
+
     /* A flag indicating if an auto-focus completion event should be sent the
      * next time the worker thread runs. This implies that auto-focus completion
      * event can only be delivered while preview frames are being delivered.
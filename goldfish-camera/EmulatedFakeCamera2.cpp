@@ -175,8 +175,9 @@ status_t EmulatedFakeCamera2::connectCamera(hw_device_t** device) {
     mConfigureThread = new ConfigureThread(this);
     mReadoutThread = new ReadoutThread(this);
     mControlThread = new ControlThread(this);
-    mSensor = new Sensor(mSensorWidth, mSensorHeight);
-    mJpegCompressor = new JpegCompressor(mGBM);
+    mAuxBufferPool = new AuxBufferPool(mGBM);
+    mSensor = new Sensor(mSensorWidth, mSensorHeight, mAuxBufferPool);
+    mJpegCompressor = new JpegCompressor(mAuxBufferPool);
 
     mNextStreamId = 1;
     mNextReprocessStreamId = 1;
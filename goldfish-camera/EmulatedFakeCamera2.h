@@ -422,6 +422,7 @@ private:
     /** Simulated hardware interfaces */
     sp<Sensor> mSensor;
     sp<JpegCompressor> mJpegCompressor;
+    sp<AuxBufferPool> mAuxBufferPool;
 
     /** Pipeline control threads */
     sp<ConfigureThread> mConfigureThread;
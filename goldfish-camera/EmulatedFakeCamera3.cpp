@@ -29,13 +29,14 @@
 
 #include "EmulatedFakeCamera3.h"
 #include "EmulatedCameraFactory.h"
-#include <ui/Fence.h>
 #include <ui/Rect.h>
 
 #include "fake-pipeline2/Sensor.h"
 #include "fake-pipeline2/JpegCompressor.h"
 #include <cmath>
 
+#include <poll.h>
+#include <unistd.h>
 #include <vector>
 #include <algorithm>
 
@@ -96,6 +97,7 @@ const float   EmulatedFakeCamera3::kExposureWanderMax        = 1;
 EmulatedFakeCamera3::EmulatedFakeCamera3(int cameraId, bool facingBack,
         struct hw_module_t* module, GraphicBufferMapper* gbm) :
         EmulatedCamera3(cameraId, module),
+        mPipelineDepth(kDefaultPipelineDepth),
         mFacingBack(facingBack), mGBM(gbm) {
     ALOGI("Constructing emulated fake camera 3: ID %d, facing %s",
             mCameraID, facingBack ? "back" : "front");
@@ -129,6 +131,9 @@ status_t EmulatedFakeCamera3::Initialize() {
         return res;
     }
 
+    // The static info reports the pipeline depth
+    mPipelineDepth = getPipelineDepth();
+
     res = constructStaticInfo();
     if (res != OK) {
         ALOGE("%s: Unable to allocate static info: %s (%d)",
@@ -149,18 +154,28 @@ status_t EmulatedFakeCamera3::connectCamera(hw_device_t** device) {
         return INVALID_OPERATION;
     }
 
-    mSensor = new Sensor(mSensorWidth, mSensorHeight);
+    mAuxBufferPool = new AuxBufferPool(mGBM);
+    mSensor = new Sensor(mSensorWidth, mSensorHeight, mAuxBufferPool);
     mSensor->setSensorListener(this);
 
     res = mSensor->startUp();
     if (res != NO_ERROR) return res;
 
-    mReadoutThread = new ReadoutThread(this);
-    mJpegCompressor = new JpegCompressor(mGBM);
+    mSchedulerThread = new SchedulerThread(this, mPipelineDepth);
+    mReadoutThread = new ReadoutThread(this, mPipelineDepth);
+    mJpegCompressors.clear();
+    // One compressor per buffer a JPEG stream can have in flight
+    for (size_t i = 0; i < getMaxBufferCount(); i++) {
+        mJpegCompressors.push_back(new JpegCompressor(mAuxBufferPool));
+    }
+    mNextJpegCompressor = 0;
 
     res = mReadoutThread->run("EmuCam3::readoutThread");
     if (res != NO_ERROR) return res;
 
+    res = mSchedulerThread->run("EmuCam3::schedulerThread");
+    if (res != NO_ERROR) return res;
+
     // Initialize fake 3A
 
     mControlMode  = ANDROID_CONTROL_MODE_AUTO;
@@ -185,7 +200,25 @@ status_t EmulatedFakeCamera3::closeCamera() {
     {
         Mutex::Autolock l(mLock);
         if (mStatus == STATUS_CLOSED) return OK;
+    }
+
+    // Return the requests that haven't been scheduled, while the readout
+    // thread is still there to return them in order
+    mSchedulerThread->flush();
+
+    {
+        Mutex::Autolock l(mLock);
+        mSchedulerThread->requestExit();
+    }
+
+    // The scheduler uses the sensor, so it has to stop first
+    mSchedulerThread->join();
+
+    // Then the requests the sensor has been programmed with are captured
+    mReadoutThread->waitForIdle();
 
+    {
+        Mutex::Autolock l(mLock);
         res = mSensor->shutDown();
         if (res != NO_ERROR) {
             ALOGE("%s: Unable to shut down sensor: %d", __FUNCTION__, res);
@@ -208,7 +241,9 @@ status_t EmulatedFakeCamera3::closeCamera() {
             (*s)->priv = NULL;
         }
         mStreams.clear();
+        mSchedulerThread.clear();
         mReadoutThread.clear();
+        mAuxBufferPool->clear();
     }
 
     return EmulatedCamera3::closeCamera();
@@ -334,8 +369,9 @@ status_t EmulatedFakeCamera3::configureStreams(
             // New stream, construct info
             PrivateStreamInfo *privStream = new PrivateStreamInfo();
             privStream->alive = true;
+            privStream->bufferLocks = new GrallocLockTracker(mGBM);
 
-            newStream->max_buffers = kMaxBufferCount;
+            newStream->max_buffers = getMaxBufferCount();
             newStream->priv = privStream;
             mStreams.push_back(newStream);
         } else {
@@ -345,7 +381,7 @@ status_t EmulatedFakeCamera3::configureStreams(
             privStream->alive = true;
         }
         // Always update usage and max buffers
-        newStream->max_buffers = kMaxBufferCount;
+        newStream->max_buffers = getMaxBufferCount();
         switch (newStream->stream_type) {
             case CAMERA3_STREAM_OUTPUT:
                 newStream->usage |= GRALLOC_USAGE_HW_CAMERA_WRITE;
@@ -389,6 +425,21 @@ status_t EmulatedFakeCamera3::configureStreams(
         }
     }
 
+    /**
+     * Set aside JPEG input buffers for the new stream configuration
+     */
+    mAuxBufferPool->clear();
+    for (StreamIterator s = mStreams.begin(); s != mStreams.end(); ++s) {
+        if ((*s)->stream_type != CAMERA3_STREAM_INPUT &&
+                (*s)->format == HAL_PIXEL_FORMAT_BLOB &&
+                (*s)->data_space != HAL_DATASPACE_DEPTH) {
+            // A JPEG input buffer per compressor
+            mAuxBufferPool->reserve((*s)->width, (*s)->height,
+                    HAL_PIXEL_FORMAT_YCbCr_420_888, AuxBufferPool::HEAP,
+                    getMaxBufferCount());
+        }
+    }
+
     /**
      * Can't reuse settings across configure call
      */
@@ -785,7 +836,7 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
 
     uint32_t frameNumber = request->frame_number;
 
-    if (request->settings == NULL && mPrevSettings.isEmpty()) {
+    if (request->settings == NULL && mPrevSettings == NULL) {
         ALOGE("%s: Request %d: NULL settings for first request after"
                 "configureStreams()", __FUNCTION__, frameNumber);
         return BAD_VALUE;
@@ -862,15 +913,19 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
 
     mStatus = STATUS_ACTIVE;
 
-    CameraMetadata settings;
-
-    if (request->settings == NULL) {
-        settings.acquire(mPrevSettings);
-    } else {
-        settings = request->settings;
+    // Repeating requests usually come without settings, or with the same
+    // ones again; both just take another reference to the previous copy.
+    sp<SharedSettings> sharedSettings = mPrevSettings;
+    if (request->settings != NULL &&
+            (sharedSettings == NULL ||
+             !isSameSettings(sharedSettings->metadata, request->settings))) {
+        sharedSettings = new SharedSettings();
+        sharedSettings->metadata = request->settings;
     }
+    const CameraMetadata &settings = sharedSettings->metadata;
+    CameraMetadata overrides;
 
-    res = process3A(settings);
+    res = process3A(settings, overrides);
     if (res != OK) {
         return res;
     }
@@ -884,202 +939,214 @@ status_t EmulatedFakeCamera3::processCaptureRequest(
     nsecs_t  exposureTime;
     nsecs_t  frameDuration;
     uint32_t sensitivity;
-    bool     needJpeg = false;
-    camera_metadata_entry_t entry;
-    entry = settings.find(ANDROID_SENSOR_EXPOSURE_TIME);
+    camera_metadata_ro_entry_t entry;
+    entry = findSetting(settings, overrides, ANDROID_SENSOR_EXPOSURE_TIME);
     exposureTime = (entry.count > 0) ? entry.data.i64[0] : Sensor::kExposureTimeRange[0];
-    entry = settings.find(ANDROID_SENSOR_FRAME_DURATION);
+    entry = findSetting(settings, overrides, ANDROID_SENSOR_FRAME_DURATION);
     frameDuration = (entry.count > 0)? entry.data.i64[0] : Sensor::kFrameDurationRange[0];
-    entry = settings.find(ANDROID_SENSOR_SENSITIVITY);
+    entry = findSetting(settings, overrides, ANDROID_SENSOR_SENSITIVITY);
     sensitivity = (entry.count > 0) ? entry.data.i32[0] : Sensor::kSensitivityRange[0];
 
     if (exposureTime > frameDuration) {
         frameDuration = exposureTime + Sensor::kMinVerticalBlank;
-        settings.update(ANDROID_SENSOR_FRAME_DURATION, &frameDuration, 1);
+        overrides.update(ANDROID_SENSOR_FRAME_DURATION, &frameDuration, 1);
     }
 
-    Buffers *sensorBuffers = new Buffers();
-    HalBufferVector *buffers = new HalBufferVector();
-
-    sensorBuffers->setCapacity(request->num_output_buffers);
-    buffers->setCapacity(request->num_output_buffers);
-
-    // Process all the buffers we got for output, constructing internal buffer
-    // structures for them, and lock them for writing.
-    for (size_t i = 0; i < request->num_output_buffers; i++) {
-        const camera3_stream_buffer &srcBuf = request->output_buffers[i];
-        StreamBuffer destBuf;
-        destBuf.streamId = kGenericStreamId;
-        destBuf.width    = srcBuf.stream->width;
-        destBuf.height   = srcBuf.stream->height;
-        // inline with goldfish gralloc
-        if (srcBuf.stream->format == HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) {
-            if (srcBuf.stream->usage & GRALLOC_USAGE_HW_CAMERA_WRITE) {
-                if (srcBuf.stream->usage & GRALLOC_USAGE_HW_TEXTURE) {
-                    destBuf.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
-                }
-                else if (srcBuf.stream->usage & GRALLOC_USAGE_HW_VIDEO_ENCODER) {
-                    destBuf.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
-                }
-                else if ((srcBuf.stream->usage & GRALLOC_USAGE_HW_CAMERA_MASK)
-                         == GRALLOC_USAGE_HW_CAMERA_ZSL) {
-                    destBuf.format = HAL_PIXEL_FORMAT_RGB_888;
-                }
-            }
-        }
-        else {
-            destBuf.format = srcBuf.stream->format;
-        }
-        destBuf.stride   = srcBuf.stream->width;
-        destBuf.dataSpace = srcBuf.stream->data_space;
-        destBuf.buffer   = srcBuf.buffer;
+    /**
+     * Hand the request over to the scheduler thread, which waits for its
+     * buffers and the sensor. The buffer structures are copied, since the
+     * request is only valid for the duration of this call.
+     */
+    SchedulerThread::Request r;
+    r.frameNumber = frameNumber;
+    r.settings = sharedSettings;
+    r.overrides.acquire(overrides);
+    r.buffers = new HalBufferVector();
+    r.buffers->appendArray(request->output_buffers, request->num_output_buffers);
+    r.exposureTime = exposureTime;
+    r.frameDuration = frameDuration;
+    r.sensitivity = sensitivity;
+
+    res = mSchedulerThread->queueCaptureRequest(r);
+    if (res != OK) {
+        ALOGE("%s: Request %d: Timeout waiting for previous requests to be "
+                "scheduled!", __FUNCTION__, frameNumber);
+        delete r.buffers;
+        return NO_INIT;
+    }
+    ALOGVV("%s: Queued frame %d", __FUNCTION__, frameNumber);
 
-        if (destBuf.format == HAL_PIXEL_FORMAT_BLOB) {
-            needJpeg = true;
-        }
+    // Cache the settings for next time
+    mPrevSettings = sharedSettings;
 
-        // Wait on fence
-        sp<Fence> bufferAcquireFence = new Fence(srcBuf.acquire_fence);
-        res = bufferAcquireFence->wait(kFenceTimeoutMs);
-        if (res == TIMED_OUT) {
-            ALOGE("%s: Request %d: Buffer %zu: Fence timed out after %d ms",
-                    __FUNCTION__, frameNumber, i, kFenceTimeoutMs);
-        }
-        if (res == OK) {
-            // Lock buffer for writing
-            if (srcBuf.stream->format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                if (destBuf.format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                    android_ycbcr ycbcr = {};
-                    res = mGBM->lockYCbCr(
-                        *(destBuf.buffer),
-                        GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
-                        Rect(0, 0, destBuf.width, destBuf.height),
-                        &ycbcr);
-                    // This is only valid because we know that emulator's
-                    // YCbCr_420_888 is really contiguous NV21 under the hood
-                    destBuf.img = static_cast<uint8_t*>(ycbcr.y);
-                } else {
-                    ALOGE("Unexpected private format for flexible YUV: 0x%x",
-                            destBuf.format);
-                    res = INVALID_OPERATION;
-                }
-            } else {
-                res = mGBM->lock(
-                    *(destBuf.buffer),
-                    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
-                    Rect(0, 0, destBuf.width, destBuf.height),
-                    (void**)&(destBuf.img));
+    return OK;
+}
 
-            }
-            if (res != OK) {
-                ALOGE("%s: Request %d: Buffer %zu: Unable to lock buffer",
-                        __FUNCTION__, frameNumber, i);
-            } else {
-                ALOGV("%s, stream format 0x%x width %d height %d buffer 0x%p img 0x%p",
-                  __FUNCTION__, destBuf.format, destBuf.width, destBuf.height,
-                  destBuf.buffer, destBuf.img);
-            }
-        }
+status_t EmulatedFakeCamera3::flush() {
+    ALOGV("%s: E", __FUNCTION__);
+    // Not under mLock, which processCaptureRequest may hold while it waits
+    // for room in the intake queue. Requests the sensor hasn't been
+    // programmed with are returned with an error, the others are captured.
+    mSchedulerThread->flush();
+    return mReadoutThread->waitForIdle();
+}
 
-        if (res != OK) {
-            // Either waiting or locking failed. Unlock locked buffers and bail
-            // out.
-            for (size_t j = 0; j < i; j++) {
-                mGBM->unlock(*(request->output_buffers[i].buffer));
-            }
-            delete sensorBuffers;
-            delete buffers;
-            return NO_INIT;
-        }
+/** Debug methods */
 
-        sensorBuffers->push_back(destBuf);
-        buffers->push_back(srcBuf);
+void EmulatedFakeCamera3::dump(int fd) {
+    dprintf(fd, "    Fake camera %d:\n", mCameraID);
+    // processCaptureRequest() holds mLock while it waits for the pipeline,
+    // so don't wait for it here
+    if (mLock.tryLock() != NO_ERROR) {
+        dprintf(fd, "      Busy, state not dumped\n");
+        return;
+    }
+    if (mSensor == NULL) {
+        dprintf(fd, "      Closed\n");
+    } else {
+        mSensor->dump(fd, 6);
     }
+    mLock.unlock();
+}
 
-    /**
-     * Wait for JPEG compressor to not be busy, if needed
-     */
-    if (needJpeg) {
-        bool ready = mJpegCompressor->waitForDone(kJpegTimeoutNs);
-        if (!ready) {
-            ALOGE("%s: Timeout waiting for JPEG compression to complete!",
-                    __FUNCTION__);
-            return NO_INIT;
-        }
-        res = mJpegCompressor->reserve();
-        if (res != OK) {
-            ALOGE("%s: Error managing JPEG compressor resources, can't reserve it!", __FUNCTION__);
-            return NO_INIT;
+/**
+ * Private methods
+ */
+
+sp<JpegCompressor> EmulatedFakeCamera3::reserveJpegCompressor() {
+    // Compressors are handed out round-robin, so if all of them are busy the
+    // next one in line is the one that has been working the longest.
+    const size_t count = mJpegCompressors.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t index = (mNextJpegCompressor + i) % count;
+        if (!mJpegCompressors[index]->isBusy()) {
+            mNextJpegCompressor = index;
+            break;
         }
     }
 
-    /**
-     * Wait until the in-flight queue has room
-     */
-    res = mReadoutThread->waitForReadout();
-    if (res != OK) {
-        ALOGE("%s: Timeout waiting for previous requests to complete!",
+    sp<JpegCompressor> compressor = mJpegCompressors[mNextJpegCompressor];
+    if (!compressor->waitForDone(kJpegTimeoutNs)) {
+        ALOGE("%s: Timeout waiting for JPEG compression to complete!",
                 __FUNCTION__);
-        return NO_INIT;
+        return NULL;
     }
-
-    /**
-     * Wait until sensor's ready. This waits for lengthy amounts of time with
-     * mLock held, but the interface spec is that no other calls may by done to
-     * the HAL by the framework while process_capture_request is happening.
-     */
-    int syncTimeoutCount = 0;
-    while(!mSensor->waitForVSync(kSyncWaitTimeout)) {
-        if (mStatus == STATUS_ERROR) {
-            return NO_INIT;
-        }
-        if (syncTimeoutCount == kMaxSyncTimeoutCount) {
-            ALOGE("%s: Request %d: Sensor sync timed out after %" PRId64 " ms",
-                    __FUNCTION__, frameNumber,
-                    kSyncWaitTimeout * kMaxSyncTimeoutCount / 1000000);
-            return NO_INIT;
-        }
-        syncTimeoutCount++;
+    if (compressor->reserve() != OK) {
+        ALOGE("%s: Error managing JPEG compressor resources, can't reserve it!",
+                __FUNCTION__);
+        return NULL;
     }
+    mNextJpegCompressor = (mNextJpegCompressor + 1) % count;
+    return compressor;
+}
 
-    /**
-     * Configure sensor and queue up the request to the readout thread
-     */
-    mSensor->setExposureTime(exposureTime);
-    mSensor->setFrameDuration(frameDuration);
-    mSensor->setSensitivity(sensitivity);
-    mSensor->setDestinationBuffers(sensorBuffers);
-    mSensor->setFrameNumber(request->frame_number);
+GrallocLockTracker *EmulatedFakeCamera3::getBufferLocks(
+        const camera3_stream_t *stream) {
+    return static_cast<PrivateStreamInfo*>(stream->priv)->bufferLocks.get();
+}
 
-    ReadoutThread::Request r;
-    r.frameNumber = request->frame_number;
-    r.settings = settings;
-    r.sensorBuffers = sensorBuffers;
-    r.buffers = buffers;
+bool EmulatedFakeCamera3::isSameSettings(const CameraMetadata &settings,
+        const camera_metadata_t *other) {
+    // Compare entry by entry: the buffers can differ in unused capacity,
+    // which is also left uninitialized.
+    const camera_metadata_t *own = settings.getAndLock();
+    const size_t count = get_camera_metadata_entry_count(own);
+    bool same = count == get_camera_metadata_entry_count(other);
+    for (size_t i = 0; same && i < count; i++) {
+        camera_metadata_ro_entry_t a, b;
+        get_camera_metadata_ro_entry(own, i, &a);
+        same = find_camera_metadata_ro_entry(other, a.tag, &b) == OK &&
+                a.type == b.type && a.count == b.count &&
+                memcmp(a.data.u8, b.data.u8,
+                        camera_metadata_type_size[a.type] * a.count) == 0;
+    }
+    settings.unlock(own);
+    return same;
+}
 
-    mReadoutThread->queueCaptureRequest(r);
-    ALOGVV("%s: Queued frame %d", __FUNCTION__, request->frame_number);
+camera_metadata_ro_entry_t EmulatedFakeCamera3::findSetting(
+        const CameraMetadata &settings, const CameraMetadata &overrides,
+        uint32_t tag) {
+    camera_metadata_ro_entry_t entry = overrides.find(tag);
+    return (entry.count > 0) ? entry : settings.find(tag);
+}
 
-    // Cache the settings for next time
-    mPrevSettings.acquire(settings);
+void EmulatedFakeCamera3::applyOverrides(CameraMetadata *settings,
+        const CameraMetadata &overrides) {
+    if (overrides.isEmpty()) {
+        return;
+    }
+    const camera_metadata_t *o = overrides.getAndLock();
+    const size_t count = get_camera_metadata_entry_count(o);
+    for (size_t i = 0; i < count; i++) {
+        camera_metadata_ro_entry_t entry;
+        get_camera_metadata_ro_entry(o, i, &entry);
+        settings->update(entry);
+    }
+    overrides.unlock(o);
+}
 
-    return OK;
+bool EmulatedFakeCamera3::isJpegBuffer(const StreamBuffer &b) {
+    return b.format == HAL_PIXEL_FORMAT_BLOB &&
+            b.dataSpace != HAL_DATASPACE_DEPTH;
 }
 
-status_t EmulatedFakeCamera3::flush() {
-    ALOGW("%s: Not implemented; ignored", __FUNCTION__);
+status_t EmulatedFakeCamera3::waitForFences(const Vector<int> &fences,
+        int timeoutMs) {
+    std::vector<struct pollfd> fds(fences.size());
+    for (size_t i = 0; i < fences.size(); i++) {
+        fds[i].fd = fences[i];
+        fds[i].events = POLLIN;
+    }
+
+    // Signaled fences are swapped out of the first pending entries, so that
+    // each poll() only watches the ones still outstanding.
+    const nsecs_t deadline = systemTime() + milliseconds(timeoutMs);
+    size_t pending = fds.size();
+    while (pending > 0) {
+        const nsecs_t left = deadline - systemTime();
+        if (left <= 0) return TIMED_OUT;
+        int ret = poll(fds.data(), pending, (left + 999999) / 1000000);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -errno;
+        }
+        if (ret == 0) return TIMED_OUT;
+        for (size_t i = 0; i < pending;) {
+            if (fds[i].revents & (POLLERR | POLLNVAL)) {
+                return BAD_VALUE;
+            }
+            if (fds[i].revents & POLLIN) {
+                fds[i] = fds[--pending];
+            } else {
+                i++;
+            }
+        }
+    }
     return OK;
 }
 
-/** Debug methods */
-
-void EmulatedFakeCamera3::dump(int fd) {
+size_t EmulatedFakeCamera3::getPipelineDepth() {
+    int32_t depth = property_get_int32("ro.boot.qemu.camera.fake.pipeline_depth",
+            kDefaultPipelineDepth);
+    if (depth < 1 || depth > static_cast<int32_t>(kMaxPipelineDepth)) {
+        ALOGW("%s: Pipeline depth %d out of range, using %zu", __FUNCTION__,
+                depth, kDefaultPipelineDepth);
+        depth = kDefaultPipelineDepth;
+    }
+    return depth;
+}
 
+uint32_t EmulatedFakeCamera3::getMaxBufferCount() const {
+    // With fewer buffers, the framework couldn't keep a deeper pipeline full
+    return std::max<uint32_t>(kMaxBufferCount, mPipelineDepth);
 }
 
-/**
- * Private methods
- */
+uint8_t EmulatedFakeCamera3::getMaxPipelineDepth() const {
+    // A request waits behind at most mPipelineDepth - 1 queued requests and
+    // the one being read out
+    return kPipelineStages + mPipelineDepth + 1;
+}
 
 status_t EmulatedFakeCamera3::getCameraCapabilities() {
 
@@ -1807,7 +1874,7 @@ status_t EmulatedFakeCamera3::constructStaticInfo() {
     };
     ADD_STATIC_ENTRY(ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS, maxNumOutputStreams, 3);
 
-    static const uint8_t maxPipelineDepth = kMaxBufferCount;
+    const uint8_t maxPipelineDepth = getMaxPipelineDepth();
     ADD_STATIC_ENTRY(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &maxPipelineDepth, 1);
 
     static const int32_t partialResultCount = 1;
@@ -1908,13 +1975,14 @@ status_t EmulatedFakeCamera3::constructStaticInfo() {
     return OK;
 }
 
-status_t EmulatedFakeCamera3::process3A(CameraMetadata &settings) {
+status_t EmulatedFakeCamera3::process3A(const CameraMetadata &settings,
+        CameraMetadata &overrides) {
     /**
      * Extract top-level 3A controls
      */
     status_t res;
 
-    camera_metadata_entry e;
+    camera_metadata_ro_entry e;
 
     e = settings.find(ANDROID_CONTROL_MODE);
     if (e.count == 0) {
@@ -1930,7 +1998,7 @@ status_t EmulatedFakeCamera3::process3A(CameraMetadata &settings) {
         mAeState  = ANDROID_CONTROL_AE_STATE_INACTIVE;
         mAfState  = ANDROID_CONTROL_AF_STATE_INACTIVE;
         mAwbState = ANDROID_CONTROL_AWB_STATE_INACTIVE;
-        update3A(settings);
+        update3A(settings, overrides);
         return OK;
     } else if (controlMode == ANDROID_CONTROL_MODE_USE_SCENE_MODE) {
         if (!hasCapability(BACKWARD_COMPATIBLE)) {
@@ -1971,12 +2039,12 @@ status_t EmulatedFakeCamera3::process3A(CameraMetadata &settings) {
     res = doFakeAWB(settings);
     if (res != OK) return res;
 
-    update3A(settings);
+    update3A(settings, overrides);
     return OK;
 }
 
-status_t EmulatedFakeCamera3::doFakeAE(CameraMetadata &settings) {
-    camera_metadata_entry e;
+status_t EmulatedFakeCamera3::doFakeAE(const CameraMetadata &settings) {
+    camera_metadata_ro_entry e;
 
     e = settings.find(ANDROID_CONTROL_AE_MODE);
     if (e.count == 0 && hasCapability(BACKWARD_COMPATIBLE)) {
@@ -2094,8 +2162,8 @@ status_t EmulatedFakeCamera3::doFakeAE(CameraMetadata &settings) {
     return OK;
 }
 
-status_t EmulatedFakeCamera3::doFakeAF(CameraMetadata &settings) {
-    camera_metadata_entry e;
+status_t EmulatedFakeCamera3::doFakeAF(const CameraMetadata &settings) {
+    camera_metadata_ro_entry e;
 
     e = settings.find(ANDROID_CONTROL_AF_MODE);
     if (e.count == 0 && hasCapability(BACKWARD_COMPATIBLE)) {
@@ -2297,8 +2365,8 @@ status_t EmulatedFakeCamera3::doFakeAF(CameraMetadata &settings) {
     return OK;
 }
 
-status_t EmulatedFakeCamera3::doFakeAWB(CameraMetadata &settings) {
-    camera_metadata_entry e;
+status_t EmulatedFakeCamera3::doFakeAWB(const CameraMetadata &settings) {
+    camera_metadata_ro_entry e;
 
     e = settings.find(ANDROID_CONTROL_AWB_MODE);
     if (e.count == 0 && hasCapability(BACKWARD_COMPATIBLE)) {
@@ -2336,13 +2404,14 @@ status_t EmulatedFakeCamera3::doFakeAWB(CameraMetadata &settings) {
 
 // Update the 3A Region by calculating the intersection of AE/AF/AWB and CROP
 // regions
-static void update3ARegion(uint32_t tag, CameraMetadata &settings) {
+static void update3ARegion(uint32_t tag, const CameraMetadata &settings,
+        CameraMetadata &overrides) {
     if (tag != ANDROID_CONTROL_AE_REGIONS &&
         tag != ANDROID_CONTROL_AF_REGIONS &&
         tag != ANDROID_CONTROL_AWB_REGIONS) {
         return;
     }
-    camera_metadata_entry_t entry;
+    camera_metadata_ro_entry_t entry;
     entry = settings.find(ANDROID_SCALER_CROP_REGION);
     if (entry.count > 0) {
         int32_t cropRegion[4];
@@ -2352,7 +2421,7 @@ static void update3ARegion(uint32_t tag, CameraMetadata &settings) {
         cropRegion[3] =  entry.data.i32[3] + cropRegion[1];
         entry = settings.find(tag);
         if (entry.count > 0) {
-            int32_t* ARegion = entry.data.i32;
+            const int32_t* ARegion = entry.data.i32;
             // calculate the intersection of AE/AF/AWB and CROP regions
             if (ARegion[0] < cropRegion[2] && cropRegion[0] < ARegion[2] &&
                 ARegion[1] < cropRegion[3] && cropRegion[1] < ARegion[3]) {
@@ -2362,25 +2431,26 @@ static void update3ARegion(uint32_t tag, CameraMetadata &settings) {
                 interSect[2] = std::min(ARegion[2], cropRegion[2]);
                 interSect[3] = std::min(ARegion[3], cropRegion[3]);
                 interSect[4] = ARegion[4];
-                settings.update(tag, &interSect[0], 5);
+                overrides.update(tag, &interSect[0], 5);
             }
         }
     }
 }
 
-void EmulatedFakeCamera3::update3A(CameraMetadata &settings) {
+void EmulatedFakeCamera3::update3A(const CameraMetadata &settings,
+        CameraMetadata &overrides) {
     if (mAeMode != ANDROID_CONTROL_AE_MODE_OFF) {
-        settings.update(ANDROID_SENSOR_EXPOSURE_TIME,
+        overrides.update(ANDROID_SENSOR_EXPOSURE_TIME,
                 &mAeCurrentExposureTime, 1);
-        settings.update(ANDROID_SENSOR_SENSITIVITY,
+        overrides.update(ANDROID_SENSOR_SENSITIVITY,
                 &mAeCurrentSensitivity, 1);
     }
 
-    settings.update(ANDROID_CONTROL_AE_STATE,
+    overrides.update(ANDROID_CONTROL_AE_STATE,
             &mAeState, 1);
-    settings.update(ANDROID_CONTROL_AF_STATE,
+    overrides.update(ANDROID_CONTROL_AF_STATE,
             &mAfState, 1);
-    settings.update(ANDROID_CONTROL_AWB_STATE,
+    overrides.update(ANDROID_CONTROL_AWB_STATE,
             &mAwbState, 1);
 
     uint8_t lensState;
@@ -2398,17 +2468,18 @@ void EmulatedFakeCamera3::update3A(CameraMetadata &settings) {
             lensState = ANDROID_LENS_STATE_STATIONARY;
             break;
     }
-    settings.update(ANDROID_LENS_STATE, &lensState, 1);
-    update3ARegion(ANDROID_CONTROL_AE_REGIONS, settings);
-    update3ARegion(ANDROID_CONTROL_AF_REGIONS, settings);
-    update3ARegion(ANDROID_CONTROL_AWB_REGIONS, settings);
+    overrides.update(ANDROID_LENS_STATE, &lensState, 1);
+    update3ARegion(ANDROID_CONTROL_AE_REGIONS, settings, overrides);
+    update3ARegion(ANDROID_CONTROL_AF_REGIONS, settings, overrides);
+    update3ARegion(ANDROID_CONTROL_AWB_REGIONS, settings, overrides);
 }
 
 void EmulatedFakeCamera3::signalReadoutIdle() {
     Mutex::Autolock l(mLock);
     // Need to chek isIdle again because waiting on mLock may have allowed
     // something to be placed in the in-flight queue.
-    if (mStatus == STATUS_ACTIVE && mReadoutThread->isIdle()) {
+    if (mStatus == STATUS_ACTIVE && mSchedulerThread->isIdle() &&
+            mReadoutThread->isIdle()) {
         ALOGV("Now idle");
         mStatus = STATUS_READY;
     }
@@ -2435,8 +2506,345 @@ void EmulatedFakeCamera3::onSensorEvent(uint32_t frameNumber, Event e,
     }
 }
 
-EmulatedFakeCamera3::ReadoutThread::ReadoutThread(EmulatedFakeCamera3 *parent) :
-        mParent(parent), mJpegWaiting(false) {
+EmulatedFakeCamera3::SchedulerThread::SchedulerThread(
+        EmulatedFakeCamera3 *parent, size_t maxQueueSize) :
+        mParent(parent),
+        mMaxQueueSize(maxQueueSize),
+        mThreadActive(false),
+        mFlushing(false) {
+}
+
+EmulatedFakeCamera3::SchedulerThread::~SchedulerThread() {
+    // closeCamera() flushes the queue, so this is only a safety net
+    for (List<Request>::iterator i = mIntakeQueue.begin();
+         i != mIntakeQueue.end(); i++) {
+        returnUnscheduledRequest(*i);
+    }
+}
+
+status_t EmulatedFakeCamera3::SchedulerThread::queueCaptureRequest(
+        const Request &r) {
+    status_t res;
+    Mutex::Autolock l(mLock);
+    int loopCount = 0;
+    while (mIntakeQueue.size() >= mMaxQueueSize) {
+        res = mIntakeSignal.waitRelative(mLock, kWaitPerLoop);
+        if (res != OK && res != TIMED_OUT) {
+            ALOGE("%s: Error waiting for intake queue to shrink",
+                    __FUNCTION__);
+            return INVALID_OPERATION;
+        }
+        if (loopCount == kMaxWaitLoops) {
+            ALOGE("%s: Timed out waiting for intake queue to shrink",
+                    __FUNCTION__);
+            return TIMED_OUT;
+        }
+        loopCount++;
+    }
+
+    mIntakeQueue.push_back(r);
+    mIntakeSignal.broadcast();
+    return OK;
+}
+
+bool EmulatedFakeCamera3::SchedulerThread::isIdle() {
+    Mutex::Autolock l(mLock);
+    return mIntakeQueue.empty() && !mThreadActive;
+}
+
+void EmulatedFakeCamera3::SchedulerThread::flush() {
+    Mutex::Autolock l(mLock);
+    mFlushing = true;
+    mIntakeSignal.broadcast();
+    int loopCount = 0;
+    while (!mIntakeQueue.empty() || mThreadActive) {
+        status_t res = mIntakeSignal.waitRelative(mLock, kWaitPerLoop);
+        if (res != OK && res != TIMED_OUT) {
+            ALOGE("%s: Error waiting for intake queue to be flushed",
+                    __FUNCTION__);
+            break;
+        }
+        if (loopCount == kMaxWaitLoops) {
+            ALOGE("%s: Timed out waiting for intake queue to be flushed",
+                    __FUNCTION__);
+            break;
+        }
+        loopCount++;
+    }
+    mFlushing = false;
+}
+
+bool EmulatedFakeCamera3::SchedulerThread::isFlushing() {
+    Mutex::Autolock l(mLock);
+    return mFlushing;
+}
+
+void EmulatedFakeCamera3::SchedulerThread::returnUnscheduledRequest(
+        Request &r) {
+    ALOGE("%s: Returning frame %d with an error", __FUNCTION__,
+            r.frameNumber);
+
+    camera3_notify_msg_t msg;
+    msg.type = CAMERA3_MSG_ERROR;
+    msg.message.error.frame_number = r.frameNumber;
+    msg.message.error.error_stream = NULL;
+    msg.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+    mParent->sendNotify(&msg);
+
+    // The acquire fences were never waited on; the framework gets them back
+    for (size_t i = 0; i < r.buffers->size(); i++) {
+        camera3_stream_buffer &b = r.buffers->editItemAt(i);
+        b.status = CAMERA3_BUFFER_STATUS_ERROR;
+        b.release_fence = b.acquire_fence;
+        b.acquire_fence = -1;
+    }
+
+    camera3_capture_result result;
+    result.frame_number = r.frameNumber;
+    result.result = NULL;
+    result.num_output_buffers = r.buffers->size();
+    result.output_buffers = r.buffers->array();
+    result.input_buffer = nullptr;
+    result.partial_result = 0;
+    mParent->sendCaptureResult(&result);
+
+    delete r.buffers;
+    r.buffers = NULL;
+}
+
+bool EmulatedFakeCamera3::SchedulerThread::threadLoop() {
+    Request r;
+    {
+        Mutex::Autolock l(mLock);
+        if (mIntakeQueue.empty()) {
+            status_t res = mIntakeSignal.waitRelative(mLock, kWaitPerLoop);
+            if (res == TIMED_OUT) {
+                return true;
+            } else if (res != NO_ERROR) {
+                ALOGE("%s: Error waiting for capture requests: %d",
+                        __FUNCTION__, res);
+                return false;
+            }
+            if (mIntakeQueue.empty()) {
+                return true;
+            }
+        }
+        r.frameNumber = mIntakeQueue.begin()->frameNumber;
+        r.settings = mIntakeQueue.begin()->settings;
+        r.overrides.acquire(mIntakeQueue.begin()->overrides);
+        r.buffers = mIntakeQueue.begin()->buffers;
+        r.exposureTime = mIntakeQueue.begin()->exposureTime;
+        r.frameDuration = mIntakeQueue.begin()->frameDuration;
+        r.sensitivity = mIntakeQueue.begin()->sensitivity;
+        mIntakeQueue.erase(mIntakeQueue.begin());
+        mIntakeSignal.broadcast();
+        mThreadActive = true;
+    }
+
+    scheduleRequest(r);
+
+    // The readout thread has the request by now, so if it has already gone
+    // idle, it found this thread busy, and left going idle to it.
+    bool signalIdle;
+    {
+        Mutex::Autolock l(mLock);
+        mThreadActive = false;
+        signalIdle = mIntakeQueue.empty();
+        // flush() waits for this too
+        mIntakeSignal.broadcast();
+    }
+    if (signalIdle) mParent->signalReadoutIdle();
+    return true;
+}
+
+void EmulatedFakeCamera3::SchedulerThread::scheduleRequest(Request &r) {
+    // Flushed requests go to the readout thread as failed ones, so that they
+    // are returned in order
+    status_t res = isFlushing() ? NO_INIT : OK;
+    const uint32_t frameNumber = r.frameNumber;
+    HalBufferVector *buffers = r.buffers;
+    bool needJpeg = false;
+
+    Buffers *sensorBuffers = new Buffers();
+    sensorBuffers->setCapacity(buffers->size());
+
+    // Construct internal buffer structures for all the buffers we got for
+    // output, and gather the fences of the ones the sensor writes to.
+    Vector<int> fences;
+    for (size_t i = 0; i < buffers->size(); i++) {
+        const camera3_stream_buffer &srcBuf = buffers->itemAt(i);
+        StreamBuffer destBuf;
+        destBuf.streamId = kGenericStreamId;
+        destBuf.width    = srcBuf.stream->width;
+        destBuf.height   = srcBuf.stream->height;
+        // inline with goldfish gralloc
+        if (srcBuf.stream->format == HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) {
+            if (srcBuf.stream->usage & GRALLOC_USAGE_HW_CAMERA_WRITE) {
+                if (srcBuf.stream->usage & GRALLOC_USAGE_HW_TEXTURE) {
+                    destBuf.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
+                }
+                else if (srcBuf.stream->usage & GRALLOC_USAGE_HW_VIDEO_ENCODER) {
+                    destBuf.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
+                }
+                else if ((srcBuf.stream->usage & GRALLOC_USAGE_HW_CAMERA_MASK)
+                         == GRALLOC_USAGE_HW_CAMERA_ZSL) {
+                    destBuf.format = HAL_PIXEL_FORMAT_RGB_888;
+                }
+            }
+        }
+        else {
+            destBuf.format = srcBuf.stream->format;
+        }
+        destBuf.stride   = srcBuf.stream->width;
+        destBuf.dataSpace = srcBuf.stream->data_space;
+        destBuf.buffer   = srcBuf.buffer;
+        destBuf.img      = NULL;
+
+        if (isJpegBuffer(destBuf)) {
+            // Only the JPEG compressor writes here, so the readout thread
+            // waits for the buffer and locks it.
+            needJpeg = true;
+        } else if (srcBuf.acquire_fence != -1) {
+            fences.push_back(srcBuf.acquire_fence);
+        }
+        sensorBuffers->push_back(destBuf);
+    }
+
+    // Wait on all the fences at once, rather than one after the other
+    if (res == OK) {
+        res = waitForFences(fences, kFenceTimeoutMs);
+        if (res == TIMED_OUT) {
+            ALOGE("%s: Request %d: Fences timed out after %d ms",
+                    __FUNCTION__, frameNumber, kFenceTimeoutMs);
+        } else if (res != OK) {
+            ALOGE("%s: Request %d: Error waiting on fences: %d",
+                    __FUNCTION__, frameNumber, res);
+        }
+    }
+
+    // Lock buffers for writing
+    for (size_t i = 0; res == OK && i < buffers->size(); i++) {
+        camera3_stream_buffer &srcBuf = buffers->editItemAt(i);
+        StreamBuffer &destBuf = sensorBuffers->editItemAt(i);
+        if (isJpegBuffer(destBuf)) continue;
+
+        if (srcBuf.acquire_fence != -1) {
+            ::close(srcBuf.acquire_fence);
+            srcBuf.acquire_fence = -1;
+        }
+
+        const bool ycbcr =
+                srcBuf.stream->format == HAL_PIXEL_FORMAT_YCbCr_420_888;
+        if (ycbcr && destBuf.format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+            ALOGE("Unexpected private format for flexible YUV: 0x%x",
+                    destBuf.format);
+            res = INVALID_OPERATION;
+        } else {
+            res = getBufferLocks(srcBuf.stream)->lock(*(destBuf.buffer),
+                    ycbcr, destBuf.width, destBuf.height, &destBuf.img);
+        }
+        if (res != OK) {
+            ALOGE("%s: Request %d: Buffer %zu: Unable to lock buffer",
+                    __FUNCTION__, frameNumber, i);
+            destBuf.img = NULL;
+        } else {
+            ALOGV("%s, stream format 0x%x width %d height %d buffer 0x%p img 0x%p",
+              __FUNCTION__, destBuf.format, destBuf.width, destBuf.height,
+              destBuf.buffer, destBuf.img);
+        }
+    }
+
+    /**
+     * Get hold of a JPEG compressor, if needed
+     */
+    sp<JpegCompressor> jpegCompressor;
+    if (res == OK && needJpeg) {
+        jpegCompressor = mParent->reserveJpegCompressor();
+        if (jpegCompressor == NULL) {
+            res = NO_INIT;
+        }
+    }
+
+    /**
+     * Wait until the in-flight queue has room
+     */
+    if (res == OK) {
+        res = mParent->mReadoutThread->waitForReadout();
+        if (res != OK) {
+            ALOGE("%s: Timeout waiting for previous requests to complete!",
+                    __FUNCTION__);
+        }
+    }
+
+    /**
+     * Wait until sensor's ready. This no longer holds up the framework, which
+     * only waits for room in the intake queue.
+     */
+    if (res == OK) {
+        int syncTimeoutCount = 0;
+        while(!mParent->mSensor->waitForVSync(kSyncWaitTimeout)) {
+            if (exitPending() || isFlushing()) {
+                res = NO_INIT;
+                break;
+            }
+            if (syncTimeoutCount == kMaxSyncTimeoutCount) {
+                ALOGE("%s: Request %d: Sensor sync timed out after %" PRId64 " ms",
+                        __FUNCTION__, frameNumber,
+                        kSyncWaitTimeout * kMaxSyncTimeoutCount / 1000000);
+                res = NO_INIT;
+                break;
+            }
+            syncTimeoutCount++;
+        }
+    }
+
+    ReadoutThread::Request readout;
+    readout.frameNumber = frameNumber;
+    readout.sharedSettings = r.settings;
+    readout.overrides.acquire(r.overrides);
+    readout.buffers = buffers;
+    readout.failed = (res != OK);
+
+    if (readout.failed) {
+        // Unlock the buffers locked so far, and give the framework back the
+        // acquire fences that are still open.
+        for (size_t i = 0; i < buffers->size(); i++) {
+            camera3_stream_buffer &b = buffers->editItemAt(i);
+            if (sensorBuffers->itemAt(i).img != NULL) {
+                getBufferLocks(b.stream)->unlock(*(b.buffer));
+            }
+            b.release_fence = b.acquire_fence;
+            b.acquire_fence = -1;
+        }
+        delete sensorBuffers;
+        if (jpegCompressor != NULL) {
+            jpegCompressor->unreserve();
+        }
+        readout.sensorBuffers = NULL;
+        mParent->mReadoutThread->queueCaptureRequest(readout);
+        return;
+    }
+
+    /**
+     * Configure sensor and queue up the request to the readout thread
+     */
+    mParent->mSensor->setExposureTime(r.exposureTime);
+    mParent->mSensor->setFrameDuration(r.frameDuration);
+    mParent->mSensor->setSensitivity(r.sensitivity);
+    mParent->mSensor->setDestinationBuffers(sensorBuffers);
+    mParent->mSensor->setFrameNumber(frameNumber);
+
+    readout.sensorBuffers = sensorBuffers;
+    readout.jpegCompressor = jpegCompressor;
+    mParent->mReadoutThread->queueCaptureRequest(readout);
+    ALOGVV("%s: Scheduled frame %d", __FUNCTION__, frameNumber);
+}
+
+EmulatedFakeCamera3::ReadoutThread::ReadoutThread(EmulatedFakeCamera3 *parent,
+        size_t maxQueueSize) :
+        mParent(parent),
+        mMaxQueueSize(maxQueueSize),
+        mThreadActive(false) {
 }
 
 EmulatedFakeCamera3::ReadoutThread::~ReadoutThread() {
@@ -2450,7 +2858,9 @@ EmulatedFakeCamera3::ReadoutThread::~ReadoutThread() {
 void EmulatedFakeCamera3::ReadoutThread::queueCaptureRequest(const Request &r) {
     Mutex::Autolock l(mLock);
 
+    const size_t requestsAhead = mInFlightQueue.size() + (mThreadActive ? 1 : 0);
     mInFlightQueue.push_back(r);
+    (--mInFlightQueue.end())->requestsAhead = requestsAhead;
     mInFlightSignal.signal();
 }
 
@@ -2459,11 +2869,24 @@ bool EmulatedFakeCamera3::ReadoutThread::isIdle() {
     return mInFlightQueue.empty() && !mThreadActive;
 }
 
+status_t EmulatedFakeCamera3::ReadoutThread::waitForIdle() {
+    for (int loopCount = 0; loopCount < kMaxWaitLoops; loopCount++) {
+        // JPEG results are only added while the thread is active
+        if (isIdle()) {
+            Mutex::Autolock jl(mJpegLock);
+            if (mJpegResults.empty()) return OK;
+        }
+        usleep(kWaitPerLoop / 1000);
+    }
+    ALOGE("%s: Timed out waiting for requests to be returned", __FUNCTION__);
+    return TIMED_OUT;
+}
+
 status_t EmulatedFakeCamera3::ReadoutThread::waitForReadout() {
     status_t res;
     Mutex::Autolock l(mLock);
     int loopCount = 0;
-    while (mInFlightQueue.size() >= kMaxQueueSize) {
+    while (mInFlightQueue.size() >= mMaxQueueSize) {
         res = mInFlightSignal.waitRelative(mLock, kWaitPerLoop);
         if (res != OK && res != TIMED_OUT) {
             ALOGE("%s: Error waiting for in-flight queue to shrink",
@@ -2488,30 +2911,50 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
     // First wait for a request from the in-flight queue
 
     if (mCurrentRequest.settings.isEmpty()) {
-        Mutex::Autolock l(mLock);
-        if (mInFlightQueue.empty()) {
-            res = mInFlightSignal.waitRelative(mLock, kWaitPerLoop);
-            if (res == TIMED_OUT) {
-                ALOGVV("%s: ReadoutThread: Timed out waiting for request",
-                        __FUNCTION__);
-                return true;
-            } else if (res != NO_ERROR) {
-                ALOGE("%s: Error waiting for capture requests: %d",
-                        __FUNCTION__, res);
-                return false;
+        {
+            Mutex::Autolock l(mLock);
+            if (mInFlightQueue.empty()) {
+                res = mInFlightSignal.waitRelative(mLock, kWaitPerLoop);
+                if (res == TIMED_OUT) {
+                    ALOGVV("%s: ReadoutThread: Timed out waiting for request",
+                            __FUNCTION__);
+                    return true;
+                } else if (res != NO_ERROR) {
+                    ALOGE("%s: Error waiting for capture requests: %d",
+                            __FUNCTION__, res);
+                    return false;
+                }
             }
+            mCurrentRequest.frameNumber = mInFlightQueue.begin()->frameNumber;
+            mCurrentRequest.sharedSettings =
+                    mInFlightQueue.begin()->sharedSettings;
+            mCurrentRequest.overrides.acquire(
+                    mInFlightQueue.begin()->overrides);
+            mCurrentRequest.buffers = mInFlightQueue.begin()->buffers;
+            mCurrentRequest.sensorBuffers = mInFlightQueue.begin()->sensorBuffers;
+            mCurrentRequest.jpegCompressor = mInFlightQueue.begin()->jpegCompressor;
+            mCurrentRequest.failed = mInFlightQueue.begin()->failed;
+            mCurrentRequest.requestsAhead =
+                    mInFlightQueue.begin()->requestsAhead;
+            mInFlightQueue.erase(mInFlightQueue.begin());
+            mInFlightSignal.signal();
+            mThreadActive = true;
         }
-        mCurrentRequest.frameNumber = mInFlightQueue.begin()->frameNumber;
-        mCurrentRequest.settings.acquire(mInFlightQueue.begin()->settings);
-        mCurrentRequest.buffers = mInFlightQueue.begin()->buffers;
-        mCurrentRequest.sensorBuffers = mInFlightQueue.begin()->sensorBuffers;
-        mInFlightQueue.erase(mInFlightQueue.begin());
-        mInFlightSignal.signal();
-        mThreadActive = true;
+
+        // The result is the only full copy of the settings a request makes
+        mCurrentRequest.settings = mCurrentRequest.sharedSettings->metadata;
+        applyOverrides(&mCurrentRequest.settings, mCurrentRequest.overrides);
+        mCurrentRequest.sharedSettings.clear();
+        mCurrentRequest.overrides.clear();
         ALOGVV("%s: Beginning readout of frame %d", __FUNCTION__,
                 mCurrentRequest.frameNumber);
     }
 
+    if (mCurrentRequest.failed) {
+        returnFailedRequest();
+        return true;
+    }
+
     // Then wait for it to be delivered from the sensor
     ALOGVV("%s: ReadoutThread: Wait for frame to be delivered from sensor",
             __FUNCTION__);
@@ -2534,43 +2977,60 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
     HalBufferVector::iterator buf = mCurrentRequest.buffers->begin();
     while(buf != mCurrentRequest.buffers->end()) {
         bool goodBuffer = true;
+        bool locked = true;
         if ( buf->stream->format ==
                 HAL_PIXEL_FORMAT_BLOB && buf->stream->data_space != HAL_DATASPACE_DEPTH) {
+            res = lockJpegBuffer(&(*buf));
+            goodBuffer = locked = (res == OK);
+
             Mutex::Autolock jl(mJpegLock);
-            if (mJpegWaiting) {
-                // This shouldn't happen, because processCaptureRequest should
-                // be stalling until JPEG compressor is free.
-                ALOGE("%s: Already processing a JPEG!", __FUNCTION__);
+            if (goodBuffer && mCurrentRequest.jpegCompressor == NULL) {
+                // This shouldn't happen, because the scheduler thread
+                // reserves a compressor for every JPEG request.
+                ALOGE("%s: No JPEG compressor for frame %d!", __FUNCTION__,
+                        mCurrentRequest.frameNumber);
                 goodBuffer = false;
             }
             if (goodBuffer) {
                 // Compressor takes ownership of sensorBuffers here
-                res = mParent->mJpegCompressor->start(mCurrentRequest.sensorBuffers,
-                        this, &(mCurrentRequest.settings));
+                res = mCurrentRequest.jpegCompressor->start(
+                        mCurrentRequest.sensorBuffers, this,
+                        &(mCurrentRequest.settings));
                 goodBuffer = (res == OK);
             }
             if (goodBuffer) {
                 needJpeg = true;
 
-                mJpegHalBuffer = *buf;
-                mJpegFrameNumber = mCurrentRequest.frameNumber;
-                mJpegWaiting = true;
+                JpegResult jpegResult;
+                jpegResult.frameNumber = mCurrentRequest.frameNumber;
+                jpegResult.halBuffer = *buf;
+                jpegResult.done = false;
+                mJpegResults.push_back(jpegResult);
 
                 mCurrentRequest.sensorBuffers = NULL;
+                mCurrentRequest.jpegCompressor.clear();
                 buf = mCurrentRequest.buffers->erase(buf);
 
                 continue;
             }
             ALOGE("%s: Error compressing output buffer: %s (%d)",
                         __FUNCTION__, strerror(-res), res);
+            if (mCurrentRequest.jpegCompressor != NULL) {
+                mCurrentRequest.jpegCompressor->unreserve();
+                mCurrentRequest.jpegCompressor.clear();
+            }
             // fallthrough for cleanup
         }
-        mParent->mGBM->unlock(*(buf->buffer));
+        if (locked) {
+            getBufferLocks(buf->stream)->unlock(*(buf->buffer));
+        }
 
         buf->status = goodBuffer ? CAMERA3_BUFFER_STATUS_OK :
                 CAMERA3_BUFFER_STATUS_ERROR;
+        // Only a JPEG buffer that was never written can still have its
+        // acquire fence
+        buf->release_fence = buf->acquire_fence;
         buf->acquire_fence = -1;
-        buf->release_fence = -1;
 
         ++buf;
     } // end while
@@ -2621,8 +3081,10 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
             &captureTime, 1);
 
 
+    // Every request waits for the ones ahead of it to be read out, and
     // JPEGs take a stage longer
-    const uint8_t pipelineDepth = needJpeg ? kMaxBufferCount : kMaxBufferCount - 1;
+    const uint8_t pipelineDepth = kPipelineStages +
+            mCurrentRequest.requestsAhead + (needJpeg ? 1 : 0);
     mCurrentRequest.settings.update(ANDROID_REQUEST_PIPELINE_DEPTH,
             &pipelineDepth, 1);
 
@@ -2658,41 +3120,129 @@ bool EmulatedFakeCamera3::ReadoutThread::threadLoop() {
         delete mCurrentRequest.sensorBuffers;
         mCurrentRequest.sensorBuffers = NULL;
     }
+    mCurrentRequest.jpegCompressor.clear();
     mCurrentRequest.settings.clear();
 
     return true;
 }
 
-void EmulatedFakeCamera3::ReadoutThread::onJpegDone(
-        const StreamBuffer &jpegBuffer, bool success) {
-    Mutex::Autolock jl(mJpegLock);
+status_t EmulatedFakeCamera3::ReadoutThread::lockJpegBuffer(
+        camera3_stream_buffer *halBuffer) {
+    Vector<int> fences;
+    if (halBuffer->acquire_fence != -1) {
+        fences.push_back(halBuffer->acquire_fence);
+    }
+    status_t res = waitForFences(fences, kFenceTimeoutMs);
+    if (res != OK) {
+        ALOGE("%s: Frame %d: Error waiting on JPEG buffer fence: %d",
+                __FUNCTION__, mCurrentRequest.frameNumber, res);
+        return res;
+    }
+    if (halBuffer->acquire_fence != -1) {
+        ::close(halBuffer->acquire_fence);
+        halBuffer->acquire_fence = -1;
+    }
+
+    for (size_t i = 0; i < mCurrentRequest.sensorBuffers->size(); i++) {
+        StreamBuffer &b = mCurrentRequest.sensorBuffers->editItemAt(i);
+        if (b.buffer == halBuffer->buffer) {
+            return getBufferLocks(halBuffer->stream)->lock(*(b.buffer), false,
+                    b.width, b.height, &b.img);
+        }
+    }
+    ALOGE("%s: Frame %d: JPEG buffer not among the sensor buffers",
+            __FUNCTION__, mCurrentRequest.frameNumber);
+    return BAD_VALUE;
+}
 
-    mParent->mGBM->unlock(*(jpegBuffer.buffer));
+void EmulatedFakeCamera3::ReadoutThread::returnFailedRequest() {
+    ALOGE("%s: Returning frame %d with an error", __FUNCTION__,
+            mCurrentRequest.frameNumber);
 
-    mJpegHalBuffer.status = success ?
-            CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
-    mJpegHalBuffer.acquire_fence = -1;
-    mJpegHalBuffer.release_fence = -1;
-    mJpegWaiting = false;
+    camera3_notify_msg_t msg;
+    msg.type = CAMERA3_MSG_ERROR;
+    msg.message.error.frame_number = mCurrentRequest.frameNumber;
+    msg.message.error.error_stream = NULL;
+    msg.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+    mParent->sendNotify(&msg);
 
-    camera3_capture_result result;
+    for (size_t i = 0; i < mCurrentRequest.buffers->size(); i++) {
+        mCurrentRequest.buffers->editItemAt(i).status =
+                CAMERA3_BUFFER_STATUS_ERROR;
+    }
 
-    result.frame_number = mJpegFrameNumber;
+    camera3_capture_result result;
+    result.frame_number = mCurrentRequest.frameNumber;
     result.result = NULL;
-    result.num_output_buffers = 1;
-    result.output_buffers = &mJpegHalBuffer;
+    result.num_output_buffers = mCurrentRequest.buffers->size();
+    result.output_buffers = mCurrentRequest.buffers->array();
     result.input_buffer = nullptr;
     result.partial_result = 0;
 
+    bool signalIdle = false;
+    {
+        Mutex::Autolock l(mLock);
+        if (mInFlightQueue.empty()) {
+            mThreadActive = false;
+            signalIdle = true;
+        }
+    }
+    if (signalIdle) mParent->signalReadoutIdle();
+
+    mParent->sendCaptureResult(&result);
+
+    delete mCurrentRequest.buffers;
+    mCurrentRequest.buffers = NULL;
+    mCurrentRequest.jpegCompressor.clear();
+    mCurrentRequest.settings.clear();
+}
+
+void EmulatedFakeCamera3::ReadoutThread::onJpegDone(
+        const StreamBuffer &jpegBuffer, bool success) {
+    Mutex::Autolock jl(mJpegLock);
+
+    List<JpegResult>::iterator done = mJpegResults.begin();
+    while (done != mJpegResults.end() &&
+            done->halBuffer.buffer != jpegBuffer.buffer) {
+        ++done;
+    }
+    if (done == mJpegResults.end()) {
+        ALOGE("%s: Unknown JPEG buffer %p", __FUNCTION__, jpegBuffer.buffer);
+        return;
+    }
+    getBufferLocks(done->halBuffer.stream)->unlock(*(jpegBuffer.buffer));
+    done->halBuffer.status = success ?
+            CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
+    done->halBuffer.acquire_fence = -1;
+    done->halBuffer.release_fence = -1;
+    done->done = true;
+
     if (!success) {
-        ALOGE("%s: Compression failure, returning error state buffer to"
-                " framework", __FUNCTION__);
+        ALOGE("%s: Compression failure for frame %d, returning error state"
+                " buffer to framework", __FUNCTION__, done->frameNumber);
     } else {
-        ALOGV("%s: Compression complete, returning buffer to framework",
-                __FUNCTION__);
+        ALOGV("%s: Compression complete for frame %d", __FUNCTION__,
+                done->frameNumber);
     }
 
-    mParent->sendCaptureResult(&result);
+    // Buffers of a stream go back in frame order, so send every finished
+    // result that is not waiting on an earlier frame.
+    while (!mJpegResults.empty() && mJpegResults.begin()->done) {
+        JpegResult &jpegResult = *mJpegResults.begin();
+        camera3_capture_result result;
+
+        result.frame_number = jpegResult.frameNumber;
+        result.result = NULL;
+        result.num_output_buffers = 1;
+        result.output_buffers = &jpegResult.halBuffer;
+        result.input_buffer = nullptr;
+        result.partial_result = 0;
+
+        ALOGV("%s: Returning JPEG buffer for frame %d to framework",
+                __FUNCTION__, jpegResult.frameNumber);
+        mParent->sendCaptureResult(&result);
+        mJpegResults.erase(mJpegResults.begin());
+    }
 }
 
 void EmulatedFakeCamera3::ReadoutThread::onJpegInputDone(
@@ -26,6 +26,7 @@
 #include "EmulatedCamera3.h"
 #include "fake-pipeline2/Base.h"
 #include "fake-pipeline2/Sensor.h"
+#include "fake-pipeline2/GrallocLockTracker.h"
 #include "fake-pipeline2/JpegCompressor.h"
 #include <CameraMetadata.h>
 #include <utils/SortedVector.h>
@@ -111,19 +112,68 @@ private:
     status_t constructStaticInfo();
 
     /**
-     * Run the fake 3A algorithms as needed. May override/modify settings
-     * values.
+     * Run the fake 3A algorithms as needed. Settings values they override,
+     * and the 3A state, go to overrides rather than settings, which may be
+     * shared with other requests.
      */
-    status_t process3A(CameraMetadata &settings);
+    status_t process3A(const CameraMetadata &settings,
+            CameraMetadata &overrides);
 
-    status_t doFakeAE(CameraMetadata &settings);
-    status_t doFakeAF(CameraMetadata &settings);
-    status_t doFakeAWB(CameraMetadata &settings);
-    void     update3A(CameraMetadata &settings);
+    status_t doFakeAE(const CameraMetadata &settings);
+    status_t doFakeAF(const CameraMetadata &settings);
+    status_t doFakeAWB(const CameraMetadata &settings);
+    void     update3A(const CameraMetadata &settings,
+            CameraMetadata &overrides);
 
-    /** Signal from readout thread that it doesn't have anything to do */
+    /**
+     * Reserve a JPEG compressor for a new request, waiting for one to finish
+     * if all of them are busy. Returns NULL on timeout.
+     */
+    sp<JpegCompressor> reserveJpegCompressor();
+
+    /** Signal from the scheduler or readout thread that it doesn't have
+     * anything to do */
     void     signalReadoutIdle();
 
+    /** Whether settings hold exactly the contents of other */
+    static bool isSameSettings(const CameraMetadata &settings,
+            const camera_metadata_t *other);
+
+    /** Look a setting up in overrides first, then in settings */
+    static camera_metadata_ro_entry_t findSetting(
+            const CameraMetadata &settings, const CameraMetadata &overrides,
+            uint32_t tag);
+
+    /** Replace or add every entry of overrides in settings */
+    static void applyOverrides(CameraMetadata *settings,
+            const CameraMetadata &overrides);
+
+    /** Whether the JPEG compressor, not the sensor, fills this buffer */
+    static bool isJpegBuffer(const StreamBuffer &b);
+
+    /**
+     * Wait until all of the given sync fences have signaled, polling them
+     * together. timeoutMs bounds the wait as a whole. The fences stay open.
+     */
+    static status_t waitForFences(const Vector<int> &fences, int timeoutMs);
+
+    /**
+     * Number of requests the scheduler and readout threads each take ahead of
+     * the sensor, from the 'ro.boot.qemu.camera.fake.pipeline_depth' boot
+     * property.
+     */
+    static size_t getPipelineDepth();
+
+    /** Buffers each stream can have in flight at the pipeline depth */
+    uint32_t getMaxBufferCount() const;
+
+    /**
+     * Most pipeline stages a result can report: kPipelineStages, the
+     * requests a request can wait behind for readout, and the JPEG
+     * compressor.
+     */
+    uint8_t  getMaxPipelineDepth() const;
+
     /** Handle interrupt events from the sensor */
     void     onSensorEvent(uint32_t frameNumber, Event e, nsecs_t timestamp);
 
@@ -135,6 +185,7 @@ private:
     static const uint32_t kMaxProcessedStreamCount = 3;
     static const uint32_t kMaxJpegStreamCount = 1;
     static const uint32_t kMaxReprocessStreamCount = 2;
+    // Buffers per stream, unless the pipeline is deeper
     static const uint32_t kMaxBufferCount = 4;
     // We need a positive stream ID to distinguish external buffers from
     // sensor-generated buffers which use a nonpositive ID. Otherwise, HAL3 has
@@ -146,6 +197,15 @@ private:
     static const int32_t  kMaxSyncTimeoutCount = 1000; // 1000 kSyncWaitTimeouts
     static const uint32_t kFenceTimeoutMs      = 2000; // 2 s
     static const nsecs_t  kJpegTimeoutNs       = 5000000000L; // 5 s
+    static const size_t   kDefaultPipelineDepth = 4;
+    static const size_t   kMaxPipelineDepth = 8;
+    // The readout thread's queue and the request it is working on can all
+    // have frames waiting in the sensor
+    static_assert(kMaxPipelineDepth + 1 <= Sensor::kReadoutQueueSize,
+            "Sensor readout queue is shallower than the pipeline");
+    // Pipeline stages every request goes through: the scheduler, the sensor
+    // and the readout
+    static const uint8_t  kPipelineStages = 3;
 
     /****************************************************************************
      * Data members.
@@ -154,6 +214,9 @@ private:
     /* HAL interface serialization lock. */
     Mutex              mLock;
 
+    /* Depth of the scheduler and readout queues, set at initialization. */
+    size_t             mPipelineDepth;
+
     /* Facing back (true) or front (false) switch. */
     bool               mFacingBack;
     int32_t            mSensorWidth;
@@ -174,8 +237,13 @@ private:
      */
     struct PrivateStreamInfo {
         bool alive;
+        // Locks on the stream's buffers being written
+        sp<GrallocLockTracker> bufferLocks;
     };
 
+    /** Locks on the buffers of a configured stream */
+    static GrallocLockTracker *getBufferLocks(const camera3_stream_t *stream);
+
     // Shortcut to the input stream
     camera3_stream_t*  mInputStream;
 
@@ -186,26 +254,113 @@ private:
     // All streams, including input stream
     StreamList         mStreams;
 
+    /**
+     * Request settings as sent by the framework. They are never modified
+     * once a request holds them, so requests that repeat the same settings
+     * share a single copy.
+     */
+    struct SharedSettings : public LightRefBase<SharedSettings> {
+        CameraMetadata metadata;
+    };
+
     // Cached settings from latest submitted request
-    CameraMetadata     mPrevSettings;
+    sp<SharedSettings> mPrevSettings;
 
     /** Fake hardware interfaces */
     sp<Sensor>         mSensor;
-    sp<JpegCompressor> mJpegCompressor;
+    Vector<sp<JpegCompressor> > mJpegCompressors;
+    // Where reserveJpegCompressor starts looking for an idle compressor
+    size_t             mNextJpegCompressor;
+    sp<AuxBufferPool>  mAuxBufferPool;
     friend class       JpegCompressor;
 
+    /** Processing thread for programming the sensor with requests */
+
+    class SchedulerThread : public Thread {
+      public:
+        SchedulerThread(EmulatedFakeCamera3 *parent, size_t maxQueueSize);
+        ~SchedulerThread();
+
+        // A validated request, with what it needs from the framework's
+        // camera3_capture_request copied out
+        struct Request {
+            uint32_t         frameNumber;
+            sp<SharedSettings> settings;
+            // Values computed for this request, on top of settings
+            CameraMetadata   overrides;
+            HalBufferVector *buffers;
+            nsecs_t          exposureTime;
+            nsecs_t          frameDuration;
+            uint32_t         sensitivity;
+        };
+
+        /**
+         * Interface to parent class
+         */
+
+        // Place request in the intake queue, waiting only if the queue is full
+        status_t queueCaptureRequest(const Request &r);
+
+        // Test if the scheduler thread is idle (no queued requests, not
+        // currently scheduling anything)
+        bool     isIdle();
+
+        // Hand all queued requests to the readout thread to be returned with
+        // an error, and wait until that is done
+        void     flush();
+
+      private:
+        static const nsecs_t kWaitPerLoop  = 10000000L; // 10 ms
+        static const nsecs_t kMaxWaitLoops = 1000;
+
+        EmulatedFakeCamera3 *mParent;
+        const size_t  mMaxQueueSize;
+        Mutex         mLock;
+
+        List<Request> mIntakeQueue;
+        Condition     mIntakeSignal;
+        bool          mThreadActive;
+        bool          mFlushing;
+
+        virtual bool threadLoop();
+
+        bool     isFlushing();
+
+        // Returns a request that can't go through the readout thread any more
+        // with an error
+        void     returnUnscheduledRequest(Request &r);
+
+        // Waits on the request's acquire fences, locks its buffers, and
+        // waits for the sensor, then hands the request to the readout thread.
+        // Requests that fail are handed over too, to be returned in order.
+        void     scheduleRequest(Request &r);
+    };
+
+    sp<SchedulerThread> mSchedulerThread;
+
     /** Processing thread for sending out results */
 
     class ReadoutThread : public Thread, private JpegCompressor::JpegListener {
       public:
-        ReadoutThread(EmulatedFakeCamera3 *parent);
+        ReadoutThread(EmulatedFakeCamera3 *parent, size_t maxQueueSize);
         ~ReadoutThread();
 
         struct Request {
             uint32_t         frameNumber;
+            sp<SharedSettings> sharedSettings;
+            CameraMetadata   overrides;
+            // The two above merged, which becomes the result metadata. Only
+            // the readout thread builds this.
             CameraMetadata   settings;
             HalBufferVector *buffers;
             Buffers         *sensorBuffers;
+            // Reserved for the request's JPEG output, if it has one
+            sp<JpegCompressor> jpegCompressor;
+            // The request could not be scheduled; return its buffers with
+            // an error instead of waiting for the sensor
+            bool             failed;
+            // Requests queued or being read out ahead of this one
+            size_t           requestsAhead;
         };
 
         /**
@@ -219,15 +374,18 @@ private:
         // currently reading out anything
         bool     isIdle();
 
-        // Wait until isIdle is true
+        // Wait until the in-flight queue has room
         status_t waitForReadout();
 
+        // Wait until isIdle is true and all JPEG results have been sent
+        status_t waitForIdle();
+
       private:
         static const nsecs_t kWaitPerLoop  = 10000000L; // 10 ms
         static const nsecs_t kMaxWaitLoops = 1000;
-        static const size_t  kMaxQueueSize = 4;
 
         EmulatedFakeCamera3 *mParent;
+        const size_t mMaxQueueSize;
         Mutex mLock;
 
         List<Request> mInFlightQueue;
@@ -236,16 +394,30 @@ private:
 
         virtual bool threadLoop();
 
+        // Sends out an error for mCurrentRequest, and returns its buffers
+        void returnFailedRequest();
+
+        // Wait for the JPEG buffer of the current request and lock it. The
+        // scheduler thread leaves its fence to be waited on here, since only
+        // the compressor writes to it.
+        status_t lockJpegBuffer(camera3_stream_buffer *halBuffer);
+
         // Only accessed by threadLoop
 
         Request mCurrentRequest;
 
         // Jpeg completion callbacks
 
+        struct JpegResult {
+            uint32_t              frameNumber;
+            camera3_stream_buffer halBuffer;
+            bool                  done;
+        };
+
         Mutex                 mJpegLock;
-        bool                  mJpegWaiting;
-        camera3_stream_buffer mJpegHalBuffer;
-        uint32_t              mJpegFrameNumber;
+        // Compressions in flight in frame order. Results that finish early
+        // are held back until all earlier frames have been sent.
+        List<JpegResult>      mJpegResults;
         virtual void onJpegDone(const StreamBuffer &jpegBuffer, bool success);
         virtual void onJpegInputDone(const StreamBuffer &inputBuffer);
     };
@@ -203,23 +203,24 @@ status_t EmulatedFakeCameraDevice::stopDevice()
  * Worker thread management overrides.
  ***************************************************************************/
 
-bool EmulatedFakeCameraDevice::produceFrame(void* buffer, int64_t* timestamp)
+bool EmulatedFakeCameraDevice::produceFrame(FrameViews* views,
+                                            int64_t* timestamp)
 {
 #if EFCD_ROTATE_FRAME
     const int frame_type = rotateFrame();
     switch (frame_type) {
         case 0:
-            drawCheckerboard(buffer);
+            drawCheckerboard(views);
             break;
         case 1:
-            drawStripes(buffer);
+            drawStripes(getFrameCanvas(views->frame.data()));
             break;
         case 2:
-            drawSolid(buffer, mCurrentColor);
+            drawSolid(getFrameCanvas(views->frame.data()), mCurrentColor);
             break;
     }
 #else
-    drawCheckerboard(buffer);
+    drawCheckerboard(views);
 #endif  // EFCD_ROTATE_FRAME
     if (timestamp != nullptr) {
       *timestamp = 0L;
@@ -231,13 +232,47 @@ bool EmulatedFakeCameraDevice::produceFrame(void* buffer, int64_t* timestamp)
  * Fake camera device private API
  ***************************************************************************/
 
-void EmulatedFakeCameraDevice::drawCheckerboard(void* buffer)
+EmulatedFakeCameraDevice::Canvas
+EmulatedFakeCameraDevice::getFrameCanvas(uint8_t* buffer) const
+{
+    Canvas canvas;
+    canvas.Y = buffer;
+    canvas.U = buffer + mFrameUOffset;
+    canvas.V = buffer + mFrameVOffset;
+    canvas.yStride = mYStride;
+    canvas.uvStride = mUVStride;
+    canvas.uvStep = mUVStep;
+    canvas.rgb = nullptr;
+    return canvas;
+}
+
+EmulatedFakeCameraDevice::Canvas
+EmulatedFakeCameraDevice::getVideoCanvas(uint8_t* buffer) const
+{
+    /* Packed YUV420: planar, U first, without any row alignment. */
+    Canvas canvas;
+    canvas.Y = buffer;
+    canvas.U = buffer + mFrameWidth * mFrameHeight;
+    canvas.V = canvas.U + (mFrameWidth / 2) * (mFrameHeight / 2);
+    canvas.yStride = mFrameWidth;
+    canvas.uvStride = mFrameWidth / 2;
+    canvas.uvStep = 1;
+    canvas.rgb = nullptr;
+    return canvas;
+}
+
+EmulatedFakeCameraDevice::Canvas
+EmulatedFakeCameraDevice::getPreviewCanvas(uint32_t* buffer) const
+{
+    Canvas canvas = {};
+    canvas.rgb = buffer;
+    return canvas;
+}
+
+void EmulatedFakeCameraDevice::drawCheckerboard(FrameViews* views)
 {
     nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
     nsecs_t elapsed = now - mLastRedrawn;
-    uint8_t* currentFrame = reinterpret_cast<uint8_t*>(buffer);
-    uint8_t* frameU = currentFrame + mFrameUOffset;
-    uint8_t* frameV = currentFrame + mFrameVOffset;
 
     const int size = std::min(mFrameWidth, mFrameHeight) / 10;
     bool black = true;
@@ -277,32 +312,6 @@ void EmulatedFakeCameraDevice::drawCheckerboard(void* buffer)
     YUVPixel adjustedBlack = YUVPixel(mBlackYUV);
     adjustedBlack.Y = changeExposure(adjustedBlack.Y);
 
-    for(int y = 0; y < mFrameHeight; y++) {
-        int countx = checkxremainder;
-        bool current = black;
-        uint8_t* Y = currentFrame + mYStride * y;
-        uint8_t* U = frameU + mUVStride * (y / 2);
-        uint8_t* V = frameV + mUVStride * (y / 2);
-        for(int x = 0; x < mFrameWidth; x += 2) {
-            if (current) {
-                adjustedBlack.get(Y, U, V);
-            } else {
-                adjustedWhite.get(Y, U, V);
-            }
-            Y[1] = *Y;
-            Y += 2; U += mUVStep; V += mUVStep;
-            countx += 2;
-            if(countx >= size) {
-                countx = 0;
-                current = !current;
-            }
-        }
-        if(county++ >= size) {
-            county = 0;
-            black = !black;
-        }
-    }
-
     /* Run the square. */
     const int squareSize = std::min(mFrameWidth, mFrameHeight) / 4;
     mSquareX += mSquareXSpeed * elapsed;
@@ -335,75 +344,216 @@ void EmulatedFakeCameraDevice::drawCheckerboard(void* buffer)
         mSquareColor = mSquareColor == &mRedYUV ? &mGreenYUV : &mRedYUV;
     }
 
-    drawSquare(buffer, squareX, squareY, squareSize, mSquareColor);
+    YUVPixel adjustedColor = *mSquareColor;
+    changeWhiteBalance(adjustedColor.Y, adjustedColor.U, adjustedColor.V);
+    adjustedColor.Y = changeExposure(adjustedColor.Y);
+
+    /* Draw the same scene into the raw frame and each view the consumers
+     * take, rather than having them converted from the raw frame later. */
+    Canvas canvases[3];
+    int canvasCount = 0;
+    canvases[canvasCount++] = getFrameCanvas(views->frame.data());
+    if (views->wanted & FRAME_VIEW_VIDEO) {
+        canvases[canvasCount++] = getVideoCanvas(views->video.data());
+        views->valid |= FRAME_VIEW_VIDEO;
+    }
+    if (views->wanted & FRAME_VIEW_PREVIEW) {
+        canvases[canvasCount++] = getPreviewCanvas(views->preview.data());
+        views->valid |= FRAME_VIEW_PREVIEW;
+    }
+    for (int i = 0; i < canvasCount; ++i) {
+        drawChecks(canvases[i], size, black, county, checkxremainder,
+                   adjustedBlack, adjustedWhite);
+        drawSquare(canvases[i], squareX, squareY, squareSize, adjustedColor);
+    }
     mLastRedrawn = now;
 }
 
-void EmulatedFakeCameraDevice::drawSquare(void* buffer,
+void EmulatedFakeCameraDevice::drawChecks(const Canvas& canvas,
+                                          int size,
+                                          bool black,
+                                          int county,
+                                          int checkxremainder,
+                                          const YUVPixel& blackColor,
+                                          const YUVPixel& whiteColor)
+{
+    /* Each row is the same run of checks, only starting with one color or
+     * the other. Split the row into spans of a constant color once, fill the
+     * first row of each band of checks span by span, and copy it to the other
+     * rows of the band. A check changes its color once |countx|, growing by 2
+     * with each pair of pixels, reaches |size|. */
+    mCheckSpans.clear();
+    const int pairs = (mFrameWidth + 1) / 2;
+    for (int pair = 0, countx = checkxremainder; pair < pairs; countx = 0) {
+        pair = std::min(pairs, pair + std::max(1, (size - countx + 1) / 2));
+        mCheckSpans.push_back(std::min(mFrameWidth, pair * 2));
+    }
+
+    int lumaBlack = -1;
+    int chromaBlack = -1;
+    for(int y = 0; y < mFrameHeight; y++) {
+        if (lumaBlack == black) {
+            copyLumaRow(canvas, y - 1, y);
+        } else {
+            bool current = black;
+            int x = 0;
+            for (int end : mCheckSpans) {
+                fillLuma(canvas, y, x, end, current ? blackColor : whiteColor);
+                current = !current;
+                x = end;
+            }
+            lumaBlack = black;
+        }
+
+        /* Rows share U/V values in pairs, and the odd row has the last
+         * word on them. */
+        if (canvas.rgb == nullptr && (y & 1)) {
+            const int uvRow = y / 2;
+            if (chromaBlack == black) {
+                copyChromaRow(canvas, uvRow - 1, uvRow);
+            } else {
+                bool current = black;
+                int x = 0;
+                for (int end : mCheckSpans) {
+                    fillChroma(canvas, uvRow, x, end,
+                               current ? blackColor : whiteColor);
+                    current = !current;
+                    x = end;
+                }
+                chromaBlack = black;
+            }
+        }
+
+        if(county++ >= size) {
+            county = 0;
+            black = !black;
+        }
+    }
+}
+
+void EmulatedFakeCameraDevice::drawSquare(const Canvas& canvas,
                                           int x,
                                           int y,
                                           int size,
-                                          const YUVPixel* color)
+                                          const YUVPixel& color)
 {
-    uint8_t* currentFrame = reinterpret_cast<uint8_t*>(buffer);
-    uint8_t* frameU = currentFrame + mFrameUOffset;
-    uint8_t* frameV = currentFrame + mFrameVOffset;
-
     const int square_xstop = std::min(mFrameWidth, x + size);
     const int square_ystop = std::min(mFrameHeight, y + size);
-    uint8_t* Y_pos = currentFrame + y * mYStride + x;
-
-    YUVPixel adjustedColor = *color;
-    changeWhiteBalance(adjustedColor.Y, adjustedColor.U, adjustedColor.V);
+    if (x >= square_xstop || y >= square_ystop) {
+        return;
+    }
 
-    // Draw the square.
-    for (; y < square_ystop; y++) {
-        const int iUV = (y / 2) * mUVStride + (x / 2) * mUVStep;
-        uint8_t* sqU = frameU + iUV;
-        uint8_t* sqV = frameV + iUV;
-        uint8_t* sqY = Y_pos;
-        for (int i = x; i < square_xstop; i += 2) {
-            adjustedColor.get(sqY, sqU, sqV);
-            *sqY = changeExposure(*sqY);
-            sqY[1] = *sqY;
-            sqY += 2; sqU += mUVStep; sqV += mUVStep;
+    for (int row = y; row < square_ystop; row++) {
+        fillLuma(canvas, row, x, square_xstop, color);
+    }
+    if (canvas.rgb == nullptr) {
+        for (int uvRow = y / 2; uvRow <= (square_ystop - 1) / 2; uvRow++) {
+            fillChroma(canvas, uvRow, x, square_xstop, color);
         }
-        Y_pos += mYStride;
+    }
+}
+
+void EmulatedFakeCameraDevice::fillLuma(const Canvas& canvas,
+                                        int y,
+                                        int x,
+                                        int xstop,
+                                        const YUVPixel& color)
+{
+    if (canvas.rgb != nullptr) {
+        uint32_t* RGB = canvas.rgb + mFrameWidth * y;
+        std::fill(RGB + x, RGB + xstop,
+                  YUVToRGB32(color.Y, color.U, color.V));
+    } else {
+        memset(canvas.Y + canvas.yStride * y + x, color.Y, xstop - x);
+    }
+}
+
+void EmulatedFakeCameraDevice::fillChroma(const Canvas& canvas,
+                                          int uvRow,
+                                          int x,
+                                          int xstop,
+                                          const YUVPixel& color)
+{
+    /* A U/V pair covers two pixels: cover any pixel of the span, but stay
+     * within the row. */
+    const int first = x / 2;
+    const int count = std::min(mFrameWidth / 2, (xstop + 1) / 2) - first;
+    if (count <= 0) {
+        return;
+    }
+    const int offset = canvas.uvStride * uvRow + first * canvas.uvStep;
+    uint8_t* U = canvas.U + offset;
+    uint8_t* V = canvas.V + offset;
+    if (canvas.uvStep == 1) {
+        memset(U, color.U, count);
+        memset(V, color.V, count);
+    } else {
+        /* Interleaved U/V pane: fill it with U/V pairs instead. */
+        uint8_t* UV = std::min(U, V);
+        uint16_t pair;
+        uint8_t* pairBytes = reinterpret_cast<uint8_t*>(&pair);
+        pairBytes[U - UV] = color.U;
+        pairBytes[V - UV] = color.V;
+        std::fill_n(reinterpret_cast<uint16_t*>(UV), count, pair);
+    }
+}
+
+void EmulatedFakeCameraDevice::copyLumaRow(const Canvas& canvas,
+                                           int from,
+                                           int to)
+{
+    if (canvas.rgb != nullptr) {
+        memcpy(canvas.rgb + mFrameWidth * to, canvas.rgb + mFrameWidth * from,
+               mFrameWidth * sizeof(uint32_t));
+    } else {
+        memcpy(canvas.Y + canvas.yStride * to, canvas.Y + canvas.yStride * from,
+               mFrameWidth);
+    }
+}
+
+void EmulatedFakeCameraDevice::copyChromaRow(const Canvas& canvas,
+                                             int from,
+                                             int to)
+{
+    const int count = mFrameWidth / 2;
+    if (canvas.uvStep == 1) {
+        memcpy(canvas.U + canvas.uvStride * to,
+               canvas.U + canvas.uvStride * from, count);
+        memcpy(canvas.V + canvas.uvStride * to,
+               canvas.V + canvas.uvStride * from, count);
+    } else {
+        uint8_t* UV = std::min(canvas.U, canvas.V);
+        memcpy(UV + canvas.uvStride * to, UV + canvas.uvStride * from,
+               count * 2);
     }
 }
 
 #if EFCD_ROTATE_FRAME
 
-void EmulatedFakeCameraDevice::drawSolid(void* buffer, YUVPixel* color)
+void EmulatedFakeCameraDevice::drawSolid(const Canvas& canvas,
+                                         const YUVPixel* color)
 {
     YUVPixel adjustedColor = *color;
     changeWhiteBalance(adjustedColor.Y, adjustedColor.U, adjustedColor.V);
+    adjustedColor.Y = changeExposure(adjustedColor.Y);
 
-    /* All Ys are the same, will fill any alignment padding but that's OK */
-    memset(mCurrentFrame, changeExposure(adjustedColor.Y),
-           mFrameHeight * mYStride);
-
-    /* Fill U, and V panes. */
-    for (int y = 0; y < mFrameHeight / 2; ++y) {
-        uint8_t* U = mFrameU + y * mUVStride;
-        uint8_t* V = mFrameV + y * mUVStride;
-
-        for (int x = 0; x < mFrameWidth / 2; ++x, U += mUVStep, V += mUVStep) {
-            *U = color->U;
-            *V = color->V;
-        }
+    fillLuma(canvas, 0, 0, mFrameWidth, adjustedColor);
+    for (int y = 1; y < mFrameHeight; ++y) {
+        copyLumaRow(canvas, y - 1, y);
+    }
+    fillChroma(canvas, 0, 0, mFrameWidth, adjustedColor);
+    for (int y = 1; y < mFrameHeight / 2; ++y) {
+        copyChromaRow(canvas, y - 1, y);
     }
 }
 
-void EmulatedFakeCameraDevice::drawStripes(void* buffer)
+void EmulatedFakeCameraDevice::drawStripes(const Canvas& canvas)
 {
     /* Divide frame into 4 stripes. */
     const int change_color_at = mFrameHeight / 4;
-    const int each_in_row = mUVInRow / mUVStep;
-    uint8_t* pY = mCurrentFrame;
-    for (int y = 0; y < mFrameHeight; y++, pY += mYStride) {
+    for (int y = 0; y < mFrameHeight; y++) {
         /* Select the color. */
-        YUVPixel* color;
+        const YUVPixel* color;
         const int color_index = y / change_color_at;
         if (color_index == 0) {
             /* White stripe on top. */
@@ -418,19 +568,14 @@ void EmulatedFakeCameraDevice::drawStripes(void* buffer)
             /* And the blue stripe at the bottom. */
             color = &mBlueYUV;
         }
-        changeWhiteBalance(color->Y, color->U, color->V);
-
-        /* All Ys at the row are the same. */
-        memset(pY, changeExposure(color->Y), mFrameWidth);
-
-        /* Offset of the current row inside U/V panes. */
-        const int uv_off = (y / 2) * mUVStride;
-        /* Fill U, and V panes. */
-        uint8_t* U = mFrameU + uv_off;
-        uint8_t* V = mFrameV + uv_off;
-        for (int k = 0; k < each_in_row; k++, U += mUVStep, V += mUVStep) {
-            *U = color->U;
-            *V = color->V;
+        YUVPixel adjustedColor = *color;
+        changeWhiteBalance(adjustedColor.Y, adjustedColor.U, adjustedColor.V);
+        adjustedColor.Y = changeExposure(adjustedColor.Y);
+
+        /* All pixels in the row are the same. */
+        fillLuma(canvas, y, 0, mFrameWidth, adjustedColor);
+        if (y & 1) {
+            fillChroma(canvas, y / 2, 0, mFrameWidth, adjustedColor);
         }
     }
 }
@@ -84,8 +84,9 @@ public:
      **************************************************************************/
 
 protected:
-    /* Implementation of the frame production routine. */
-    bool produceFrame(void* buffer, int64_t* timestamp) override;
+    /* Implementation of the frame production routine. The frame is drawn
+     * into each of the wanted views directly. */
+    bool produceFrame(FrameViews* views, int64_t* timestamp) override;
 
     /****************************************************************************
      * Fake camera device private API
@@ -93,21 +94,66 @@ protected:
 
 private:
 
-    /* Draws a black and white checker board in |buffer| with the assumption
-     * that the size of buffer matches the current frame buffer size. */
-    void drawCheckerboard(void* buffer);
+    /* A buffer of the current frame size to draw into. Either a YUV 4:2:0
+     * buffer, with the same meaning of the fields as the frame layout members
+     * below, or an RGB32 buffer if |rgb| is not NULL. */
+    struct Canvas {
+        uint8_t*    Y;
+        uint8_t*    U;
+        uint8_t*    V;
+        int         yStride;
+        int         uvStride;
+        int         uvStep;
+        uint32_t*   rgb;
+    };
+
+    /* Canvases for the raw frame, and for the video and preview views. */
+    Canvas getFrameCanvas(uint8_t* buffer) const;
+    Canvas getVideoCanvas(uint8_t* buffer) const;
+    Canvas getPreviewCanvas(uint32_t* buffer) const;
+
+    /* Moves the checker board and the square along, and draws them into the
+     * raw frame and the wanted views of |views|. */
+    void drawCheckerboard(FrameViews* views);
+
+    /* Draws a black and white checker board in |canvas|.
+     * Param:
+     *  size - Size of a check's side.
+     *  black - Whether the top left check is black.
+     *  county, checkxremainder - Offset of the checks from the top left corner.
+     *  blackColor, whiteColor - Colors of the checks.
+     */
+    void drawChecks(const Canvas& canvas, int size, bool black, int county,
+                    int checkxremainder, const YUVPixel& blackColor,
+                    const YUVPixel& whiteColor);
 
-    /* Draws a square of the given color in the current frame buffer.
+    /* Draws a square of the given color in |canvas|.
      * Param:
      *  x, y - Coordinates of the top left corner of the square in the buffer.
      *  size - Size of the square's side.
-     *  color - Square's color.
+     *  color - Square's color, with white balance and exposure applied.
      */
-    void drawSquare(void* buffer, int x, int y, int size, const YUVPixel* color);
+    void drawSquare(const Canvas& canvas, int x, int y, int size,
+                    const YUVPixel& color);
+
+    /* Fills pixels [x, xstop) of the row |y| of |canvas| with the Y (or RGB)
+     * value of |color|. */
+    void fillLuma(const Canvas& canvas, int y, int x, int xstop,
+                  const YUVPixel& color);
+
+    /* Fills U/V values covering pixels [x, xstop) of the U/V row |uvRow| of
+     * |canvas| with the U/V values of |color|. */
+    void fillChroma(const Canvas& canvas, int uvRow, int x, int xstop,
+                    const YUVPixel& color);
+
+    /* Copies the row |from| of |canvas| into the row |to|: Y (or RGB) values
+     * for copyLumaRow, and U/V values for copyChromaRow. */
+    void copyLumaRow(const Canvas& canvas, int from, int to);
+    void copyChromaRow(const Canvas& canvas, int from, int to);
 
 #if EFCD_ROTATE_FRAME
-    void drawSolid(void* buffer, YUVPixel* color);
-    void drawStripes(void* buffer);
+    void drawSolid(const Canvas& canvas, const YUVPixel* color);
+    void drawStripes(const Canvas& canvas);
     int rotateFrame();
 #endif  // EFCD_ROTATE_FRAME
 
@@ -160,6 +206,10 @@ private:
     double      mSquareXSpeed;
     double      mSquareYSpeed;
 
+    /* Where the checks of a row end, in pixels, while drawing the checker
+     * board. */
+    std::vector<int> mCheckSpans;
+
 #if EFCD_ROTATE_FRAME
     /* Frame rotation frequency in nanosec (currently - 3 sec) */
     static const nsecs_t    mRotateFreq = 3000000000LL;
@@ -148,14 +148,15 @@ status_t EmulatedFakeRotatingCamera3::connectCamera(hw_device_t** device) {
         return INVALID_OPERATION;
     }
 
-    mSensor = new CameraRotator(mSensorWidth, mSensorHeight);
+    mAuxBufferPool = new AuxBufferPool(mGBM);
+    mSensor = new CameraRotator(mSensorWidth, mSensorHeight, mAuxBufferPool);
     mSensor->setCameraRotatorListener(this);
 
     res = mSensor->startUp();
     if (res != NO_ERROR) return res;
 
     mReadoutThread = new ReadoutThread(this);
-    mJpegCompressor = new JpegCompressor(mGBM);
+    mJpegCompressor = new JpegCompressor(mAuxBufferPool);
 
     res = mReadoutThread->run("EmuCam3::readoutThread");
     if (res != NO_ERROR) return res;
@@ -208,6 +209,7 @@ status_t EmulatedFakeRotatingCamera3::closeCamera() {
         }
         mStreams.clear();
         mReadoutThread.clear();
+        mAuxBufferPool->clear();
     }
 
     return EmulatedCamera3::closeCamera();
@@ -333,6 +335,7 @@ status_t EmulatedFakeRotatingCamera3::configureStreams(
             // New stream, construct info
             PrivateStreamInfo *privStream = new PrivateStreamInfo();
             privStream->alive = true;
+            privStream->bufferLocks = new GrallocLockTracker(mGBM);
 
             newStream->max_buffers = kMaxBufferCount;
             newStream->priv = privStream;
@@ -388,6 +391,35 @@ status_t EmulatedFakeRotatingCamera3::configureStreams(
         }
     }
 
+    /**
+     * Set aside JPEG input buffers for the new stream configuration
+     */
+    mAuxBufferPool->clear();
+    for (StreamIterator s = mStreams.begin(); s != mStreams.end(); ++s) {
+        if ((*s)->stream_type != CAMERA3_STREAM_INPUT &&
+                (*s)->format == HAL_PIXEL_FORMAT_BLOB &&
+                (*s)->data_space != HAL_DATASPACE_DEPTH) {
+            mAuxBufferPool->reserve((*s)->width, (*s)->height,
+                    HAL_PIXEL_FORMAT_YCbCr_420_888, mSensor->getAuxBufferType(),
+                    kAuxBufferCount);
+        }
+    }
+
+    /**
+     * Render at the largest output size, other outputs are cropped to their
+     * aspect ratio and scaled from it
+     */
+    uint32_t maxStreamWidth = 0, maxStreamHeight = 0;
+    for (StreamIterator s = mStreams.begin(); s != mStreams.end(); ++s) {
+        if ((*s)->stream_type != CAMERA3_STREAM_INPUT &&
+                (uint64_t)(*s)->width * (*s)->height >
+                (uint64_t)maxStreamWidth * maxStreamHeight) {
+            maxStreamWidth = (*s)->width;
+            maxStreamHeight = (*s)->height;
+        }
+    }
+    mSensor->setMaxStreamSize(maxStreamWidth, maxStreamHeight);
+
     /**
      * Can't reuse settings across configure call
      */
@@ -946,29 +978,15 @@ status_t EmulatedFakeRotatingCamera3::processCaptureRequest(
         }
         if (res == OK) {
             // Lock buffer for writing
-            if (srcBuf.stream->format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                if (destBuf.format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                    android_ycbcr ycbcr = {};
-                    res = mGBM->lockYCbCr(
-                        *(destBuf.buffer),
-                        GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
-                        Rect(0, 0, destBuf.width, destBuf.height),
-                        &ycbcr);
-                    // This is only valid because we know that emulator's
-                    // YCbCr_420_888 is really contiguous NV21 under the hood
-                    destBuf.img = static_cast<uint8_t*>(ycbcr.y);
-                } else {
-                    ALOGE("Unexpected private format for flexible YUV: 0x%x",
-                            destBuf.format);
-                    res = INVALID_OPERATION;
-                }
+            const bool ycbcr =
+                    srcBuf.stream->format == HAL_PIXEL_FORMAT_YCbCr_420_888;
+            if (ycbcr && destBuf.format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+                ALOGE("Unexpected private format for flexible YUV: 0x%x",
+                        destBuf.format);
+                res = INVALID_OPERATION;
             } else {
-                res = mGBM->lock(
-                    *(destBuf.buffer),
-                    GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
-                    Rect(0, 0, destBuf.width, destBuf.height),
-                    (void**)&(destBuf.img));
-
+                res = getBufferLocks(srcBuf.stream)->lock(*(destBuf.buffer),
+                        ycbcr, destBuf.width, destBuf.height, &destBuf.img);
             }
             if (res != OK) {
                 ALOGE("%s: Request %d: Buffer %zu: Unable to lock buffer",
@@ -984,7 +1002,8 @@ status_t EmulatedFakeRotatingCamera3::processCaptureRequest(
             // Either waiting or locking failed. Unlock locked buffers and bail
             // out.
             for (size_t j = 0; j < i; j++) {
-                mGBM->unlock(*(request->output_buffers[i].buffer));
+                const camera3_stream_buffer &b = request->output_buffers[j];
+                getBufferLocks(b.stream)->unlock(*(b.buffer));
             }
             delete sensorBuffers;
             delete buffers;
@@ -1073,13 +1092,24 @@ status_t EmulatedFakeRotatingCamera3::flush() {
 /** Debug methods */
 
 void EmulatedFakeRotatingCamera3::dump(int fd) {
-
+    Mutex::Autolock l(mLock);
+    dprintf(fd, "    Fake rotating camera %d:\n", mCameraID);
+    if (mSensor == NULL) {
+        dprintf(fd, "      Closed\n");
+        return;
+    }
+    mSensor->dump(fd, 6);
 }
 
 /**
  * Private methods
  */
 
+GrallocLockTracker *EmulatedFakeRotatingCamera3::getBufferLocks(
+        const camera3_stream_t *stream) {
+    return static_cast<PrivateStreamInfo*>(stream->priv)->bufferLocks.get();
+}
+
 status_t EmulatedFakeRotatingCamera3::getCameraCapabilities() {
 
     const char *key = mFacingBack ? "qemu.sf.back_camera_caps" : "qemu.sf.front_camera_caps";
@@ -2564,7 +2594,7 @@ bool EmulatedFakeRotatingCamera3::ReadoutThread::threadLoop() {
                         __FUNCTION__, strerror(-res), res);
             // fallthrough for cleanup
         }
-        mParent->mGBM->unlock(*(buf->buffer));
+        getBufferLocks(buf->stream)->unlock(*(buf->buffer));
 
         buf->status = goodBuffer ? CAMERA3_BUFFER_STATUS_OK :
                 CAMERA3_BUFFER_STATUS_ERROR;
@@ -2666,7 +2696,7 @@ void EmulatedFakeRotatingCamera3::ReadoutThread::onJpegDone(
         const StreamBuffer &jpegBuffer, bool success) {
     Mutex::Autolock jl(mJpegLock);
 
-    mParent->mGBM->unlock(*(jpegBuffer.buffer));
+    getBufferLocks(mJpegHalBuffer.stream)->unlock(*(jpegBuffer.buffer));
 
     mJpegHalBuffer.status = success ?
             CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
@@ -26,6 +26,7 @@
 #include "CameraRotator.h"
 #include "fake-pipeline2/Base.h"
 #include "fake-pipeline2/Sensor.h"
+#include "fake-pipeline2/GrallocLockTracker.h"
 #include "fake-pipeline2/JpegCompressor.h"
 #include <CameraMetadata.h>
 #include <utils/SortedVector.h>
@@ -134,6 +135,8 @@ private:
     static const uint32_t kMaxRawStreamCount = 1;
     static const uint32_t kMaxProcessedStreamCount = 3;
     static const uint32_t kMaxJpegStreamCount = 1;
+    // JPEG input buffers kept in the pool per BLOB stream
+    static const uint32_t kAuxBufferCount = 1;
     static const uint32_t kMaxReprocessStreamCount = 2;
     static const uint32_t kMaxBufferCount = 4;
     // We need a positive stream ID to distinguish external buffers from
@@ -174,8 +177,13 @@ private:
      */
     struct PrivateStreamInfo {
         bool alive;
+        // Locks on the stream's buffers being written
+        sp<GrallocLockTracker> bufferLocks;
     };
 
+    /** Locks on the buffers of a configured stream */
+    static GrallocLockTracker *getBufferLocks(const camera3_stream_t *stream);
+
     // Shortcut to the input stream
     camera3_stream_t*  mInputStream;
 
@@ -192,6 +200,7 @@ private:
     /** Fake hardware interfaces */
     sp<CameraRotator>         mSensor;
     sp<JpegCompressor> mJpegCompressor;
+    sp<AuxBufferPool>  mAuxBufferPool;
     friend class       JpegCompressor;
 
     /** Processing thread for sending out results */
@@ -226,6 +235,10 @@ private:
         static const nsecs_t kWaitPerLoop  = 10000000L; // 10 ms
         static const nsecs_t kMaxWaitLoops = 1000;
         static const size_t  kMaxQueueSize = 4;
+        // The queue and the request being read out can all have frames
+        // waiting in the sensor
+        static_assert(kMaxQueueSize + 1 <= Sensor::kReadoutQueueSize,
+                "Sensor readout queue is shallower than the pipeline");
 
         EmulatedFakeRotatingCamera3 *mParent;
         Mutex mLock;
@@ -19,7 +19,6 @@
  * fake camera device.
  */
 
-#define GL_GLEXT_PROTOTYPES
 #define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCamera_FakeDevice"
 #define FAKE_CAMERA_SENSOR "FakeRotatingCameraSensor"
@@ -28,9 +27,11 @@
 #include "EmulatedFakeRotatingCameraDevice.h"
 #include <qemu_pipe_bp.h>
 
+#include "Alignment.h"
+
 #include <EGL/egl.h>
-#include <GLES/gl.h>
-#include <GLES/glext.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -58,39 +59,6 @@ static void checkEglError(const char* op, EGLBoolean returnVal = EGL_TRUE) {
     }
 }
 
-static signed clamp_rgb(signed value) {
-    if (value > 255) {
-        value = 255;
-    } else if (value < 0) {
-        value = 0;
-    }
-    return value;
-}
-
-static void rgba8888_to_nv21(uint8_t* input, uint8_t* output, int width, int height) {
-    int align = 16;
-    int yStride = (width + (align -1)) & ~(align-1);
-    uint8_t* outputVU = output + height*yStride;
-    for (int j = 0; j < height; ++j) {
-        uint8_t* outputY = output + j*yStride;
-        for (int i = 0; i < width; ++i) {
-            uint8_t R = input[j*width*4 + i*4];
-            uint8_t G = input[j*width*4 + i*4 + 1];
-            uint8_t B = input[j*width*4 + i*4 + 2];
-            uint8_t Y = clamp_rgb((77 * R + 150 * G +  29 * B) >> 8);
-            *outputY++ = Y;
-            bool jeven = (j & 1) == 0;
-            bool ieven = (i & 1) == 0;
-            if (jeven && ieven) {
-                uint8_t V = clamp_rgb((( 128 * R - 107 * G - 21 * B) >> 8) + 128);
-                uint8_t U = clamp_rgb((( -43 * R - 85 * G + 128 * B) >> 8) + 128);
-                *outputVU++ = V;
-                *outputVU++ = U;
-            }
-        }
-    }
-}
-
 static void nv21_to_rgba8888(uint8_t* input, uint32_t * output, int width, int height) {
     int align = 16;
     int yStride = (width + (align -1)) & ~(align-1);
@@ -111,10 +79,29 @@ static void nv21_to_rgba8888(uint8_t* input, uint32_t * output, int width, int h
     }
 }
 
+/* The texture is drawn as is, and transformed with the model, view, and
+ * projection matrix computed by update_scene. */
+static const char kVertexShader[] =
+    "uniform mat4 uMvp;\n"
+    "attribute vec4 aPosition;\n"
+    "attribute vec2 aTexCoord;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    gl_Position = uMvp * aPosition;\n"
+    "    vTexCoord = aTexCoord;\n"
+    "}\n";
+
+static const char kFragmentShader[] =
+    "precision mediump float;\n"
+    "uniform sampler2D uTexture;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(uTexture, vTexCoord);\n"
+    "}\n";
+
 void EmulatedFakeRotatingCameraDevice::render(int width, int height)
 {
     update_scene((float)width, (float)height);
-    create_texture_dotx(1280, 720);
 
     int w= 992/2;
     int h = 1280/2;
@@ -134,14 +121,12 @@ void EmulatedFakeRotatingCameraDevice::render(int width, int height)
 
     const GLushort indices[] = { 0, 1, 2,  0, 2, 3 };
 
-    glVertexPointer(3, GL_FLOAT, 0, verticesfloat);
-    glTexCoordPointer(2, GL_FLOAT, 0, texCoordsfloat);
+    glVertexAttribPointer(mPositionAttrib, 3, GL_FLOAT, GL_FALSE, 0, verticesfloat);
+    glVertexAttribPointer(mTexCoordAttrib, 2, GL_FLOAT, GL_FALSE, 0, texCoordsfloat);
     glClearColor(0.5, 0.5, 0.5, 1.0);
     int nelem = sizeof(indices)/sizeof(indices[0]);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
     glDrawElements(GL_TRIANGLES, nelem, GL_UNSIGNED_SHORT, indices);
-    glFinish();
-    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, mPixelBuf);
 }
 
 static void get_color(uint32_t* img, int i, int j, int w, int h, int dw, uint32_t * color) {
@@ -177,15 +162,43 @@ void EmulatedFakeRotatingCameraDevice::create_texture_dotx(int width, int height
     //glGenerateMipmapOES does not work on mac, dont use it.
     //glGenerateMipmapOES(GL_TEXTURE_2D);
     // need to use linear, otherwise the dots will have sharp edges
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexEnvx(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     delete[] myrgba;
     delete[] myrgba2;
 }
 
 
-static void gluLookAt(float eyeX, float eyeY, float eyeZ,
+/* Multiplies two column-major 4x4 matrices: result = lhs * rhs. */
+static void multiply_matrix(float* result, const float* lhs, const float* rhs)
+{
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                sum += lhs[k * 4 + row] * rhs[col * 4 + k];
+            }
+            result[col * 4 + row] = sum;
+        }
+    }
+}
+
+/* Computes the matrix that glFrustumf would multiply the current one with. */
+static void frustum(float* m, float left, float right, float bottom, float top,
+        float near, float far)
+{
+    memset(m, 0, sizeof(float) * 16);
+    m[0] = 2.0f * near / (right - left);
+    m[5] = 2.0f * near / (top - bottom);
+    m[8] = (right + left) / (right - left);
+    m[9] = (top + bottom) / (top - bottom);
+    m[10] = -(far + near) / (far - near);
+    m[11] = -1.0f;
+    m[14] = -2.0f * far * near / (far - near);
+}
+
+/* Computes the matrix that gluLookAt would multiply the current one with. */
+static void gluLookAt(float* result, float eyeX, float eyeY, float eyeZ,
         float centerX, float centerY, float centerZ, float upX, float upY,
         float upZ)
 {
@@ -240,19 +253,21 @@ static void gluLookAt(float eyeX, float eyeY, float eyeZ,
     m[14] = 0.0f;
     m[15] = 1.0f;
 
-    glMultMatrixf(m);
-    glTranslatef(-eyeX, -eyeY, -eyeZ);
+    float t[16] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        -eyeX, -eyeY, -eyeZ, 1.0f,
+    };
+    multiply_matrix(result, m, t);
 }
 
 void EmulatedFakeRotatingCameraDevice::update_scene(float width, float height)
 {
     float ratio = width / height;
     glViewport(0, 0, width, height);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glFrustumf(-ratio/2.0, ratio/2.0, -1/2.0, 1/2.0, 1, 40000);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    float projection[16];
+    frustum(projection, -ratio/2.0, ratio/2.0, -1/2.0, 1/2.0, 1, 40000);
     float up_x=-1;
     float up_y=0;
     float up_z=0;
@@ -261,10 +276,11 @@ void EmulatedFakeRotatingCameraDevice::update_scene(float width, float height)
     float eye_y=0;
     float eye_z=2000;
     get_eye_x_y_z(&eye_x, &eye_y, &eye_z);
-    gluLookAt( eye_x, eye_y, eye_z, 0, 0, 0, up_x, up_y, up_z);
-    glEnable(GL_TEXTURE_2D);
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    float view[16];
+    gluLookAt(view, eye_x, eye_y, eye_z, 0, 0, 0, up_x, up_y, up_z);
+    float mvp[16];
+    multiply_matrix(mvp, projection, view);
+    glUniformMatrix4fv(mMvpUniform, 1, GL_FALSE, mvp);
 }
 
 void EmulatedFakeRotatingCameraDevice::free_gl_surface(void)
@@ -364,28 +380,55 @@ int EmulatedFakeRotatingCameraDevice::init_gl_surface(int width, int height)
         return 0;
     }
 
-    {
+    /* Prefer an OpenGL ES 3 context, which can read frames back
+     * asynchronously. OpenGL ES 2 renders the same, but reads back
+     * synchronously. */
+    static const struct {
+        EGLint renderableType;
+        EGLint clientVersion;
+    } kContextVersions[] = {
+        { EGL_OPENGL_ES3_BIT_KHR, 3 },
+        { EGL_OPENGL_ES2_BIT, 2 },
+    };
+    mEglContext = EGL_NO_CONTEXT;
+    for (const auto& version : kContextVersions) {
         EGLint s_configAttribs[] = {
-         EGL_SURFACE_TYPE, EGL_PBUFFER_BIT|EGL_WINDOW_BIT,
+         EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+         EGL_RENDERABLE_TYPE, version.renderableType,
          EGL_RED_SIZE,       5,
          EGL_GREEN_SIZE,     6,
          EGL_BLUE_SIZE,      5,
          EGL_NONE
         };
-        eglChooseConfig(mEglDisplay, s_configAttribs, &myConfig, 1, &numConfigs);
-        EGLint attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
-        mEglSurface = eglCreatePbufferSurface(mEglDisplay, myConfig, attribs);
-        if (mEglSurface == EGL_NO_SURFACE) {
-            ALOGE("eglCreatePbufferSurface error %x\n", eglGetError());
+        if (eglChooseConfig(mEglDisplay, s_configAttribs, &myConfig, 1, &numConfigs) != EGL_TRUE ||
+                numConfigs < 1) {
+            continue;
+        }
+        EGLint contextAttribs[] = {
+            EGL_CONTEXT_CLIENT_VERSION, version.clientVersion,
+            EGL_NONE
+        };
+        mEglContext = eglCreateContext(mEglDisplay, myConfig, EGL_NO_CONTEXT,
+                                       contextAttribs);
+        if (mEglContext != EGL_NO_CONTEXT) {
+            mAsyncReadback = version.clientVersion >= 3;
+            break;
         }
     }
-
-    if ( (mEglContext = eglCreateContext(mEglDisplay, myConfig, 0, 0)) == EGL_NO_CONTEXT )
+    if (mEglContext == EGL_NO_CONTEXT)
     {
         ALOGE("eglCreateContext failed\n");
         return 0;
     }
 
+    {
+        EGLint attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        mEglSurface = eglCreatePbufferSurface(mEglDisplay, myConfig, attribs);
+        if (mEglSurface == EGL_NO_SURFACE) {
+            ALOGE("eglCreatePbufferSurface error %x\n", eglGetError());
+        }
+    }
+
     if ( eglMakeCurrent(mEglDisplay, mEglSurface, mEglSurface, mEglContext) != EGL_TRUE )
     {
         ALOGE("eglMakeCurrent failed\n");
@@ -404,9 +447,125 @@ int EmulatedFakeRotatingCameraDevice::init_gl_surface(int width, int height)
     glDisable(GL_DITHER);
     glEnable(GL_CULL_FACE);
 
+    if (!init_gl_program()) {
+        return 0;
+    }
+    create_texture_dotx(1280, 720);
+    if (mAsyncReadback) {
+        init_readback(width, height);
+    } else {
+        mPixelBuf.resize(width * height * kGlBytesPerPixel);
+    }
+    ALOGD("Reading frames back %s", mAsyncReadback ? "asynchronously" : "synchronously");
+
+    return 1;
+}
+
+static GLuint compile_shader(GLenum type, const char* source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        ALOGE("%s: Unable to compile shader: %s", __FUNCTION__, log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+int EmulatedFakeRotatingCameraDevice::init_gl_program()
+{
+    GLuint vertexShader = compile_shader(GL_VERTEX_SHADER, kVertexShader);
+    GLuint fragmentShader = compile_shader(GL_FRAGMENT_SHADER, kFragmentShader);
+    if (vertexShader == 0 || fragmentShader == 0) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return 0;
+    }
+
+    mProgram = glCreateProgram();
+    glAttachShader(mProgram, vertexShader);
+    glAttachShader(mProgram, fragmentShader);
+    glLinkProgram(mProgram);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(mProgram, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        char log[512];
+        glGetProgramInfoLog(mProgram, sizeof(log), NULL, log);
+        ALOGE("%s: Unable to link program: %s", __FUNCTION__, log);
+        return 0;
+    }
+
+    glUseProgram(mProgram);
+    mMvpUniform = glGetUniformLocation(mProgram, "uMvp");
+    mPositionAttrib = glGetAttribLocation(mProgram, "aPosition");
+    mTexCoordAttrib = glGetAttribLocation(mProgram, "aTexCoord");
+    glUniform1i(glGetUniformLocation(mProgram, "uTexture"), 0);
+    glEnableVertexAttribArray(mPositionAttrib);
+    glEnableVertexAttribArray(mTexCoordAttrib);
     return 1;
 }
 
+void EmulatedFakeRotatingCameraDevice::init_readback(int width, int height)
+{
+    glGenBuffers(kReadbackBufferCount, mReadbackBuffers);
+    for (int i = 0; i < kReadbackBufferCount; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, mReadbackBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * kGlBytesPerPixel,
+                     NULL, GL_STREAM_READ);
+        mReadbackFences[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    mReadbackFirst = 0;
+    mReadbackCount = 0;
+}
+
+void EmulatedFakeRotatingCameraDevice::start_readback(int width, int height)
+{
+    const int index = (mReadbackFirst + mReadbackCount) % kReadbackBufferCount;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, mReadbackBuffers[index]);
+    /* With a pack buffer bound, this only queues the copy. */
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    mReadbackFences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    mReadbackCount++;
+}
+
+void EmulatedFakeRotatingCameraDevice::finish_readback(void* buffer, int width,
+                                                       int height)
+{
+    const int index = mReadbackFirst;
+    if (glClientWaitSync(mReadbackFences[index], GL_SYNC_FLUSH_COMMANDS_BIT,
+                         kReadbackTimeoutNs) == GL_WAIT_FAILED) {
+        ALOGE("%s: glClientWaitSync failed: 0x%x", __FUNCTION__, glGetError());
+    }
+    glDeleteSync(mReadbackFences[index]);
+    mReadbackFences[index] = 0;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, mReadbackBuffers[index]);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                          width * height * kGlBytesPerPixel,
+                                          GL_MAP_READ_BIT);
+    if (pixels != NULL) {
+        fillBuffer(buffer, pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        ALOGE("%s: glMapBufferRange failed: 0x%x", __FUNCTION__, glGetError());
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    mReadbackFirst = (mReadbackFirst + 1) % kReadbackBufferCount;
+    mReadbackCount--;
+}
+
 EmulatedFakeRotatingCameraDevice::EmulatedFakeRotatingCameraDevice():
     mObjectLock(),
     mOpenglReady(false),
@@ -502,8 +661,12 @@ status_t EmulatedFakeRotatingCameraDevice::stopDevice()
     mState = ECDS_CONNECTED;
 
     if (mOpenglReady) {
+        /* Destroying the context releases the program, the texture, the
+         * readback buffers and their fences. */
         free_gl_surface();
-        delete mPixelBuf;
+        std::vector<uint8_t>().swap(mPixelBuf);
+        mReadbackFirst = 0;
+        mReadbackCount = 0;
         mOpenglReady=false;
     }
     if (mSensorPipe >= 0) {
@@ -522,16 +685,30 @@ bool EmulatedFakeRotatingCameraDevice::produceFrame(void* buffer,
                                                     int64_t* timestamp)
 {
     if (mOpenglReady == false) {
-        init_gl_surface(mFrameWidth, mFrameHeight);
+        if (!init_gl_surface(mFrameWidth, mFrameHeight)) {
+            free_gl_surface();
+            return false;
+        }
         mOpenglReady = true;
-        int width=mFrameWidth;
-        int height = mFrameHeight;
-        int kGlBytesPerPixel = 4;
-        mPixelBuf = new uint8_t[width * height * kGlBytesPerPixel];
         init_sensor();
     }
-    render(mFrameWidth, mFrameHeight);
-    fillBuffer(buffer);
+
+    if (!mAsyncReadback) {
+        render(mFrameWidth, mFrameHeight);
+        glReadPixels(0, 0, mFrameWidth, mFrameHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                     mPixelBuf.data());
+        fillBuffer(buffer, mPixelBuf.data());
+        return true;
+    }
+
+    /* Render a new frame and queue its readback, then convert the oldest
+     * frame in flight, which the GPU has had a frame's time to complete.
+     * The first call fills the pipeline. */
+    do {
+        render(mFrameWidth, mFrameHeight);
+        start_readback(mFrameWidth, mFrameHeight);
+    } while (mReadbackCount < kReadbackBufferCount);
+    finish_readback(buffer, mFrameWidth, mFrameHeight);
     return true;
 }
 
@@ -539,11 +716,11 @@ bool EmulatedFakeRotatingCameraDevice::produceFrame(void* buffer,
  * Fake camera device private API
  ***************************************************************************/
 
-void EmulatedFakeRotatingCameraDevice::fillBuffer(void* buffer)
+void EmulatedFakeRotatingCameraDevice::fillBuffer(void* buffer,
+                                                  const void* pixels)
 {
-    uint8_t* currentFrame = reinterpret_cast<uint8_t*>(buffer);
-    rgba8888_to_nv21(mPixelBuf, currentFrame, mFrameWidth, mFrameHeight);
-    return;
+    RGBA8888ToNV21(pixels, buffer, mFrameWidth, mFrameHeight,
+                   align(mFrameWidth, 16));
 }
 
 }; /* namespace android */
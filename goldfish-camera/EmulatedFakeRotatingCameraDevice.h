@@ -26,8 +26,9 @@
 #include "EmulatedCameraDevice.h"
 
 #include <EGL/egl.h>
-#include <GLES/gl.h>
-#include <GLES/glext.h>
+#include <GLES3/gl3.h>
+
+#include <vector>
 
 namespace android {
 
@@ -115,9 +116,19 @@ private:
 
 private:
 
-    void fillBuffer(void* buffer);
+    /* Converts the RGBA8888 |pixels| read back from GL into |buffer|. */
+    void fillBuffer(void* buffer, const void* pixels);
     void render(int width, int height);
     int init_gl_surface(int width, int height);
+    int init_gl_program();
+
+    /* Asynchronous readback, with an OpenGL ES 3 context: start_readback
+     * queues a copy of the rendered frame into the next pixel pack buffer,
+     * followed by a fence. finish_readback waits for the oldest frame's
+     * fence, and converts it from its mapped buffer into |buffer|. */
+    void init_readback(int width, int height);
+    void start_readback(int width, int height);
+    void finish_readback(void* buffer, int width, int height);
     void get_eye_x_y_z(float* x, float* y, float*z);
     void get_yawing(float* x, float* y, float*z);
     void read_rotation_vector(double *yaw, double* pitch, double* roll);
@@ -132,7 +143,28 @@ private:
     EGLSurface mEglSurface;
     EGLContext mEglContext;
     GLuint mTexture;
-    uint8_t* mPixelBuf;// = new uint8_t[width * height * kGlBytesPerPixel];;
+    GLuint mProgram = 0;
+    GLint mMvpUniform = -1;
+    GLint mPositionAttrib = -1;
+    GLint mTexCoordAttrib = -1;
+
+    static const int kGlBytesPerPixel = 4;
+
+    /* Synchronous readback target, without an OpenGL ES 3 context. */
+    std::vector<uint8_t> mPixelBuf;
+
+    /* Number of frames in flight between rendering and conversion: frame N
+     * is read back while frame N + 1 renders. */
+    static const int kReadbackBufferCount = 2;
+    /* How long to wait for a frame's readback before converting it anyway. */
+    static const GLuint64 kReadbackTimeoutNs = 100000000ULL;
+
+    bool mAsyncReadback = false;
+    GLuint mReadbackBuffers[kReadbackBufferCount];
+    GLsync mReadbackFences[kReadbackBufferCount];
+    /* Oldest frame in flight, and the number of frames in flight. */
+    int mReadbackFirst = 0;
+    int mReadbackCount = 0;
     int mSensorPipe = -1;
     enum SENSOR_VALUE_TYPE {
         SENSOR_VALUE_ACCEL_X=0,
@@ -36,6 +36,7 @@
 #include "EmulatedCameraFactory.h"
 #include "EmulatedQemuCamera3.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cutils/properties.h>
 #include <inttypes.h>
@@ -228,7 +229,9 @@ status_t EmulatedQemuCamera3::connectCamera(hw_device_t** device) {
     /*
      * Initialize sensor.
      */
-    mSensor = new QemuSensor(mDeviceName, mSensorWidth, mSensorHeight, mGBM);
+    mAuxBufferPool = new AuxBufferPool(mGBM);
+    mSensor = new QemuSensor(mDeviceName, mSensorWidth, mSensorHeight,
+                             mAuxBufferPool);
     mSensor->setQemuSensorListener(this);
     res = mSensor->startUp();
     if (res != NO_ERROR) {
@@ -236,7 +239,7 @@ status_t EmulatedQemuCamera3::connectCamera(hw_device_t** device) {
     }
 
     mReadoutThread = new ReadoutThread(this);
-    mJpegCompressor = new JpegCompressor(mGBM);
+    mJpegCompressor = new JpegCompressor(mAuxBufferPool);
 
     res = mReadoutThread->run("EmuCam3::readoutThread");
     if (res != NO_ERROR) return res;
@@ -287,6 +290,7 @@ status_t EmulatedQemuCamera3::closeCamera() {
         }
         mStreams.clear();
         mReadoutThread.clear();
+        mAuxBufferPool->clear();
     }
 
     return EmulatedCamera3::closeCamera();
@@ -387,6 +391,8 @@ status_t EmulatedQemuCamera3::configureStreams(
             // New stream. Construct info.
             PrivateStreamInfo *privStream = new PrivateStreamInfo();
             privStream->alive = true;
+            privStream->bufferLocks = new GrallocLockTracker(mGBM,
+                    GRALLOC_USAGE_HW_CAMERA_WRITE);
 
             newStream->max_buffers = kMaxBufferCount;
             newStream->priv = privStream;
@@ -442,6 +448,35 @@ status_t EmulatedQemuCamera3::configureStreams(
         }
     }
 
+    /*
+     * Set aside JPEG input buffers for the new stream configuration.
+     */
+    mAuxBufferPool->clear();
+    for (StreamIterator s = mStreams.begin(); s != mStreams.end(); ++s) {
+        if ((*s)->stream_type != CAMERA3_STREAM_INPUT &&
+                (*s)->format == HAL_PIXEL_FORMAT_BLOB &&
+                (*s)->data_space != HAL_DATASPACE_DEPTH) {
+            mAuxBufferPool->reserve((*s)->width, (*s)->height,
+                    HAL_PIXEL_FORMAT_YCbCr_420_888, mSensor->getAuxBufferType(),
+                    kAuxBufferCount);
+        }
+    }
+
+    /*
+     * Start the host camera at the largest output size, other outputs are
+     * cropped to their aspect ratio and scaled from it.
+     */
+    uint32_t maxStreamWidth = 0, maxStreamHeight = 0;
+    for (StreamIterator s = mStreams.begin(); s != mStreams.end(); ++s) {
+        if ((*s)->stream_type != CAMERA3_STREAM_INPUT &&
+                (uint64_t)(*s)->width * (*s)->height >
+                (uint64_t)maxStreamWidth * maxStreamHeight) {
+            maxStreamWidth = (*s)->width;
+            maxStreamHeight = (*s)->height;
+        }
+    }
+    mSensor->setMaxStreamSize(maxStreamWidth, maxStreamHeight);
+
     /*
      * Can't reuse settings across configure call.
      */
@@ -935,35 +970,15 @@ status_t EmulatedQemuCamera3::processCaptureRequest(
         }
         if (res == OK) {
             // Lock buffer for writing.
-            if (srcBuf.stream->format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                if (destBuf.format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                    android_ycbcr ycbcr = {};
-                    res = mGBM->lockYCbCr(
-                            *(destBuf.buffer),
-                            GRALLOC_USAGE_HW_CAMERA_WRITE |
-                            GRALLOC_USAGE_SW_READ_OFTEN |
-                            GRALLOC_USAGE_SW_WRITE_OFTEN,
-                            Rect(0, 0, destBuf.width, destBuf.height),
-                            &ycbcr);
-                    /*
-                     * This is only valid because we know that emulator's
-                     * YCbCr_420_888 is really contiguous NV21 under the hood.
-                     */
-                    destBuf.img = static_cast<uint8_t*>(ycbcr.y);
-                } else {
-                    ALOGE("Unexpected private format for flexible YUV: 0x%x",
-                            destBuf.format);
-                    res = INVALID_OPERATION;
-                }
+            const bool ycbcr =
+                    srcBuf.stream->format == HAL_PIXEL_FORMAT_YCbCr_420_888;
+            if (ycbcr && destBuf.format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+                ALOGE("Unexpected private format for flexible YUV: 0x%x",
+                        destBuf.format);
+                res = INVALID_OPERATION;
             } else {
-                res = mGBM->lock(
-                    *(destBuf.buffer),
-                    GRALLOC_USAGE_HW_CAMERA_WRITE |
-                    GRALLOC_USAGE_SW_READ_OFTEN |
-                    GRALLOC_USAGE_SW_WRITE_OFTEN,
-                    Rect(0, 0, destBuf.width, destBuf.height),
-                    (void**)&(destBuf.img));
-
+                res = getBufferLocks(srcBuf.stream)->lock(*(destBuf.buffer),
+                        ycbcr, destBuf.width, destBuf.height, &destBuf.img);
             }
             if (res != OK) {
                 ALOGE("%s: Request %d: Buffer %zu: Unable to lock buffer",
@@ -977,7 +992,8 @@ status_t EmulatedQemuCamera3::processCaptureRequest(
              * out.
              */
             for (size_t j = 0; j < i; j++) {
-                mGBM->unlock(*(request->output_buffers[i].buffer));
+                const camera3_stream_buffer &b = request->output_buffers[j];
+                getBufferLocks(b.stream)->unlock(*(b.buffer));
             }
             delete sensorBuffers;
             delete buffers;
@@ -1067,10 +1083,29 @@ status_t EmulatedQemuCamera3::flush() {
     return OK;
 }
 
+/*****************************************************************************
+ * Debug Methods
+ ****************************************************************************/
+
+void EmulatedQemuCamera3::dump(int fd) {
+    Mutex::Autolock l(mLock);
+    dprintf(fd, "    Qemu camera %d (%s):\n", mCameraID, mDeviceName);
+    if (mSensor == nullptr) {
+        dprintf(fd, "      Closed\n");
+        return;
+    }
+    mSensor->dump(fd, 6);
+}
+
 /*****************************************************************************
  * Private Methods
  ****************************************************************************/
 
+GrallocLockTracker *EmulatedQemuCamera3::getBufferLocks(
+        const camera3_stream_t *stream) {
+    return static_cast<PrivateStreamInfo*>(stream->priv)->bufferLocks.get();
+}
+
 status_t EmulatedQemuCamera3::getCameraCapabilities() {
     const char *key = mFacingBack ? "qemu.sf.back_camera_caps" :
             "qemu.sf.front_camera_caps";
@@ -2026,7 +2061,7 @@ bool EmulatedQemuCamera3::ReadoutThread::threadLoop() {
                     __FUNCTION__, strerror(-res), res);
             // Fallthrough for cleanup.
         }
-        mParent->mGBM->unlock(*(buf->buffer));
+        getBufferLocks(buf->stream)->unlock(*(buf->buffer));
 
         buf->status = goodBuffer ? CAMERA3_BUFFER_STATUS_OK :
                 CAMERA3_BUFFER_STATUS_ERROR;
@@ -2109,7 +2144,7 @@ void EmulatedQemuCamera3::ReadoutThread::onJpegDone(
         const StreamBuffer &jpegBuffer, bool success) {
     Mutex::Autolock jl(mJpegLock);
 
-    mParent->mGBM->unlock(*(jpegBuffer.buffer));
+    getBufferLocks(mJpegHalBuffer.stream)->unlock(*(jpegBuffer.buffer));
 
     mJpegHalBuffer.status = success ?
             CAMERA3_BUFFER_STATUS_OK : CAMERA3_BUFFER_STATUS_ERROR;
@@ -24,6 +24,7 @@
  */
 
 #include "EmulatedCamera3.h"
+#include "fake-pipeline2/GrallocLockTracker.h"
 #include "fake-pipeline2/JpegCompressor.h"
 #include "qemu-pipeline3/QemuSensor.h"
 
@@ -82,6 +83,11 @@ protected:
     virtual status_t processCaptureRequest(camera3_capture_request *request);
     virtual status_t flush();
 
+    /**************************************************************************
+     * Debug Methods
+     *************************************************************************/
+    virtual void dump(int fd);
+
 private:
     /*
      * Get the requested capability set (from boot properties) for this camera
@@ -130,6 +136,8 @@ private:
     static const uint32_t kMaxRawStreamCount = 0;
     static const uint32_t kMaxProcessedStreamCount = 3;
     static const uint32_t kMaxJpegStreamCount = 1;
+    // JPEG input buffers kept in the pool per BLOB stream.
+    static const uint32_t kAuxBufferCount = 1;
     static const uint32_t kMaxReprocessStreamCount = 0;
     static const uint32_t kMaxBufferCount = 3;
     // We need a positive stream ID to distinguish external buffers from
@@ -167,8 +175,13 @@ private:
     // Private stream information, stored in camera3_stream_t->priv.
     struct PrivateStreamInfo {
         bool alive;
+        // Locks on the stream's buffers being written
+        sp<GrallocLockTracker> bufferLocks;
     };
 
+    // Locks on the buffers of a configured stream.
+    static GrallocLockTracker *getBufferLocks(const camera3_stream_t *stream);
+
     // Shortcut to the input stream.
     camera3_stream_t* mInputStream;
     GraphicBufferMapper* mGBM;
@@ -186,6 +199,7 @@ private:
     // Fake Hardware Interfaces
     sp<QemuSensor> mSensor;
     sp<JpegCompressor> mJpegCompressor;
+    sp<AuxBufferPool> mAuxBufferPool;
     friend class JpegCompressor;
 
     /*
@@ -151,18 +151,6 @@ status_t EmulatedQemuCameraDevice::startDevice(int width,
         return res;
     }
 
-    /* Allocate preview frame buffer. */
-    /* TODO: Watch out for preview format changes! At this point we implement
-     * RGB32 only.*/
-    mPreviewFrames[0].resize(mTotalPixels);
-    mPreviewFrames[1].resize(mTotalPixels);
-
-    mFrameBufferPairs[0].first = mFrameBuffers[0].data();
-    mFrameBufferPairs[0].second = mPreviewFrames[0].data();
-
-    mFrameBufferPairs[1].first = mFrameBuffers[1].data();
-    mFrameBufferPairs[1].second = mPreviewFrames[1].data();
-
     /* Start the actual camera device. */
     res = mQemuClient.queryStart(mPixelFormat, mFrameWidth, mFrameHeight);
     if (res == NO_ERROR) {
@@ -194,12 +182,6 @@ status_t EmulatedQemuCameraDevice::stopDevice()
     /* Stop the actual camera device. */
     status_t res = mQemuClient.queryStop();
     if (res == NO_ERROR) {
-        mPreviewFrames[0].clear();
-        mPreviewFrames[1].clear();
-        // No need to keep all that memory around as capacity, shrink it
-        mPreviewFrames[0].shrink_to_fit();
-        mPreviewFrames[1].shrink_to_fit();
-
         EmulatedCameraDevice::commonStopDevice();
         mState = ECDS_CONNECTED;
         ALOGV("%s: Qemu camera device '%s' is stopped",
@@ -212,91 +194,23 @@ status_t EmulatedQemuCameraDevice::stopDevice()
     return res;
 }
 
-/****************************************************************************
- * EmulatedCameraDevice virtual overrides
- ***************************************************************************/
-
-status_t EmulatedQemuCameraDevice::getCurrentFrame(void* buffer,
-                                                   uint32_t pixelFormat,
-                                                   int64_t* timestamp) {
-    if (!isStarted()) {
-        ALOGE("%s: Device is not started", __FUNCTION__);
-        return EINVAL;
-    }
-    if (buffer == nullptr) {
-        ALOGE("%s: Invalid buffer provided", __FUNCTION__);
-        return EINVAL;
-    }
-
-    FrameLock lock(*this);
-    const void* primary = mCameraThread->getPrimaryBuffer();
-    auto frameBufferPair = reinterpret_cast<const FrameBufferPair*>(primary);
-    uint8_t* frame = frameBufferPair->first;
-
-    if (frame == nullptr) {
-        ALOGE("%s: No frame", __FUNCTION__);
-        return EINVAL;
-    }
-
-    if (timestamp != nullptr) {
-        *timestamp = mCameraThread->getPrimaryTimestamp();
-    }
-
-    return getCurrentFrameImpl(reinterpret_cast<const uint8_t*>(frame),
-                               reinterpret_cast<uint8_t*>(buffer),
-                               pixelFormat);
-}
-
-status_t EmulatedQemuCameraDevice::getCurrentPreviewFrame(void* buffer,
-                                                          int64_t* timestamp) {
-    if (!isStarted()) {
-        ALOGE("%s: Device is not started", __FUNCTION__);
-        return EINVAL;
-    }
-    if (buffer == nullptr) {
-        ALOGE("%s: Invalid buffer provided", __FUNCTION__);
-        return EINVAL;
-    }
-
-    FrameLock lock(*this);
-    const void* primary = mCameraThread->getPrimaryBuffer();
-    auto frameBufferPair = reinterpret_cast<const FrameBufferPair*>(primary);
-    uint32_t* previewFrame = frameBufferPair->second;
-
-    if (previewFrame == nullptr) {
-        ALOGE("%s: No frame", __FUNCTION__);
-        return EINVAL;
-    }
-    if (timestamp != nullptr) {
-      *timestamp = mCameraThread->getPrimaryTimestamp();
-    }
-    memcpy(buffer, previewFrame, mTotalPixels * 4);
-    return NO_ERROR;
-}
-
-const void* EmulatedQemuCameraDevice::getCurrentFrame() {
-    if (mCameraThread.get() == nullptr) {
-        return nullptr;
-    }
-
-    const void* primary = mCameraThread->getPrimaryBuffer();
-    auto frameBufferPair = reinterpret_cast<const FrameBufferPair*>(primary);
-    uint8_t* frame = frameBufferPair->first;
-
-    return frame;
-}
-
 /****************************************************************************
  * Worker thread management overrides.
  ***************************************************************************/
 
-bool EmulatedQemuCameraDevice::produceFrame(void* buffer, int64_t* timestamp)
+bool EmulatedQemuCameraDevice::produceFrame(FrameViews* views,
+                                            int64_t* timestamp)
 {
-    auto frameBufferPair = reinterpret_cast<FrameBufferPair*>(buffer);
-    uint8_t* rawFrame = frameBufferPair->first;
-    uint32_t* previewFrame = frameBufferPair->second;
+    /* Instead of converting the frame to RGB in the guest, have the host
+     * provide it in both formats, but only while the preview window takes
+     * it. */
+    uint32_t* previewFrame = nullptr;
+    if (views->wanted & FRAME_VIEW_PREVIEW) {
+        previewFrame = views->preview.data();
+    }
 
-    status_t query_res = mQemuClient.queryFrame(rawFrame, previewFrame,
+    status_t query_res = mQemuClient.queryFrame(views->frame.data(),
+                                                 previewFrame,
                                                  mFrameBufferSize,
                                                  mTotalPixels * 4,
                                                  mWhiteBalanceScale[0],
@@ -309,14 +223,10 @@ bool EmulatedQemuCameraDevice::produceFrame(void* buffer, int64_t* timestamp)
              __FUNCTION__, strerror(query_res));
         return false;
     }
+    if (previewFrame != nullptr) {
+        views->valid |= FRAME_VIEW_PREVIEW;
+    }
     return true;
 }
 
-void* EmulatedQemuCameraDevice::getPrimaryBuffer() {
-    return &mFrameBufferPairs[0];
-}
-void* EmulatedQemuCameraDevice::getSecondaryBuffer() {
-    return &mFrameBufferPairs[1];
-}
-
 }; /* namespace android */
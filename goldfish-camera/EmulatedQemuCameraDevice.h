@@ -73,26 +73,6 @@ public:
     /* Stops capturing frames from the camera device. */
     status_t stopDevice();
 
-    /***************************************************************************
-     * EmulatedCameraDevice virtual overrides
-     * See declarations of these methods in EmulatedCameraDevice class for
-     * information on each of these methods.
-     **************************************************************************/
-
-public:
-
-    /* Copy the current frame to |buffer| */
-    status_t getCurrentFrame(void* buffer, uint32_t pixelFormat,
-                             int64_t* timestamp) override;
-
-    /* Copy the current preview frame to |buffer| */
-    status_t getCurrentPreviewFrame(void* buffer,
-                                    int64_t* timestamp) override;
-
-    /* Get a pointer to the current frame, lock it first using FrameLock in
-     * EmulatedCameraDevice class */
-    const void* getCurrentFrame() override;
-
     /***************************************************************************
      * Worker thread management overrides.
      * See declarations of these methods in EmulatedCameraDevice class for
@@ -100,11 +80,9 @@ public:
      **************************************************************************/
 
 protected:
-    /* Implementation of the frame production routine. */
-    bool produceFrame(void* buffer, int64_t* timestamp) override;
-
-    void* getPrimaryBuffer() override;
-    void* getSecondaryBuffer() override;
+    /* Implementation of the frame production routine. The host provides the
+     * preview view along with the raw frame. */
+    bool produceFrame(FrameViews* views, int64_t* timestamp) override;
 
     /***************************************************************************
      * Qemu camera device data members
@@ -118,20 +96,6 @@ private:
     /* Name of the camera device connected to the host. */
     String8             mDeviceName;
 
-    /* Current preview framebuffer. */
-    std::vector<uint32_t> mPreviewFrames[2];
-
-    /* Since the Qemu camera needs to keep track of two buffers per frame we
-     * use a pair here. One frame is the camera frame and the other is the
-     * preview frame. These are in different formats and instead of converting
-     * them in the guest it's more efficient to have the host provide the same
-     * frame in two different formats. The first buffer in the pair is the raw
-     * frame and the second buffer is the RGB encoded frame. The downside of
-     * this is that we need to override the getCurrentFrame and
-     * getCurrentPreviewFrame methods to extract the correct buffer from this
-     * pair. */
-    using FrameBufferPair = std::pair<uint8_t*, uint32_t*>;
-    FrameBufferPair     mFrameBufferPairs[2];
     using EmulatedCameraDevice::Initialize;
 };
 
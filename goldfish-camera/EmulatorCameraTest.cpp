@@ -4,6 +4,8 @@
 
 #include "fake-pipeline2/Base.h"
 #include "fake-pipeline2/Scene.h"
+#include "Converters.h"
+#include "FakeQemuCameraHost.h"
 #include "QemuClient.h"
 #include <gralloc_cb_bp.h>
 
@@ -150,11 +152,276 @@ void captureYU12(uint8_t *img, uint32_t gain, uint32_t width, uint32_t height, S
     }
 }
 
+// Self tests, run with "selftest"
+static int sFailures = 0;
+
+#define EXPECT(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: Expected %s\n", __FILE__, __LINE__, #cond); \
+            sFailures++; \
+        } \
+    } while (0)
+
+static bool isHostFrame(const std::vector<uint8_t>& buf, uint32_t frame,
+        bool preview) {
+    for (size_t i = 0; i < buf.size(); i++) {
+        if (buf[i] != FakeQemuCameraHost::frameByte(frame, preview, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t countQueries(const std::vector<std::string>& queries,
+        const char* name) {
+    size_t count = 0;
+    for (const std::string& query : queries) {
+        count += query == name;
+    }
+    return count;
+}
+
+// The client speaks the lower of its own and the host's binary protocol
+// version, and falls back to text queries with hosts that have none.
+static void testQemuClientProtocol() {
+    const uint32_t hostVersions[] = {0, 1, 2, 5};
+    const uint32_t usedVersions[] = {0, 1, 2, 2};
+    for (size_t i = 0; i < sizeof(hostVersions) / sizeof(hostVersions[0]); i++) {
+        FakeQemuCameraHost host(hostVersions[i]);
+        CameraQemuClient client;
+        EXPECT(client.attachClient(host.start()) == NO_ERROR);
+        EXPECT(client.queryConnect() == NO_ERROR);
+        EXPECT(client.isFrameRingSupported() == (usedVersions[i] >= 2));
+        EXPECT((client.setFramePrefetch(true) == NO_ERROR) ==
+                (usedVersions[i] > 0));
+        client.setFramePrefetch(false);
+
+        std::vector<uint8_t> video(1000), preview(333);
+        int64_t frameTime = 0;
+        EXPECT(client.queryFrame(video.data(), preview.data(), video.size(),
+                preview.size(), 1.0f, 1.0f, 1.0f, 1.0f, &frameTime) == NO_ERROR);
+        EXPECT(isHostFrame(video, 0, false));
+        EXPECT(isHostFrame(preview, 0, true));
+        EXPECT(frameTime == FakeQemuCameraHost::frameTime(0));
+
+        const std::vector<std::string> queries = host.getQueries();
+        EXPECT(countQueries(queries, "protocol") == 1);
+        if (usedVersions[i] > 0) {
+            EXPECT(countQueries(queries, "binary-frame") == 1);
+            EXPECT(host.getLastBinaryVersion() == usedVersions[i]);
+        } else {
+            EXPECT(countQueries(queries, "frame") == 1);
+        }
+        client.disconnectClient();
+        host.join();
+    }
+}
+
+// Prefetched frames are used by queries for the same frames, and dropped by
+// any other query.
+static void testQemuClientPrefetch() {
+    FakeQemuCameraHost host(2);
+    CameraQemuClient client;
+    EXPECT(client.attachClient(host.start()) == NO_ERROR);
+    EXPECT(client.queryConnect() == NO_ERROR);
+    EXPECT(client.setFramePrefetch(true) == NO_ERROR);
+
+    std::vector<uint8_t> video(4096);
+    int64_t frameTime = 0;
+    for (uint32_t frame = 0; frame < 3; frame++) {
+        EXPECT(client.queryFrame(video.data(), nullptr, video.size(), 0,
+                1.0f, 1.0f, 1.0f, 1.0f, &frameTime) == NO_ERROR);
+        EXPECT(isHostFrame(video, frame, false));
+        EXPECT(frameTime == FakeQemuCameraHost::frameTime(frame));
+    }
+
+    // Frame 3 was prefetched for the old size, so this gets frame 4.
+    video.resize(1234);
+    EXPECT(client.queryFrame(video.data(), nullptr, video.size(), 0,
+            1.0f, 1.0f, 1.0f, 1.0f, nullptr) == NO_ERROR);
+    EXPECT(isHostFrame(video, 4, false));
+
+    // Frame 5 is prefetched, and the 'stop' query drops it, so the next
+    // query neither takes the reply to 'stop' for a frame nor gets frame 5.
+    EXPECT(client.queryStop() == NO_ERROR);
+    std::vector<std::string> queries = host.getQueries();
+    EXPECT(countQueries(queries, "binary-frame") == 6);
+    EXPECT(!queries.empty() && queries.back() == "stop");
+    EXPECT(client.queryFrame(video.data(), nullptr, video.size(), 0,
+            1.0f, 1.0f, 1.0f, 1.0f, nullptr) == NO_ERROR);
+    EXPECT(isHostFrame(video, 6, false));
+
+    // Disabling prefetch drops frame 7, and no more frames are prefetched.
+    EXPECT(client.setFramePrefetch(false) == NO_ERROR);
+    EXPECT(client.queryFrame(video.data(), nullptr, video.size(), 0,
+            1.0f, 1.0f, 1.0f, 1.0f, nullptr) == NO_ERROR);
+    EXPECT(isHostFrame(video, 8, false));
+    EXPECT(client.queryStop() == NO_ERROR);
+    queries = host.getQueries();
+    EXPECT(countQueries(queries, "binary-frame") == 9);
+
+    client.disconnectClient();
+    host.join();
+}
+
+// Frames of a ring are picked up from the slot the host names, and the ring
+// is gone once the camera is stopped.
+static void testQemuClientFrameRing() {
+    const size_t kSlotCount = 3;
+    const size_t kSlotSize = 37 * 21 * 3 / 2;
+    std::vector<uint8_t> shared(64 + kSlotCount * kSlotSize);
+    uint64_t offsets[kSlotCount];
+    for (size_t i = 0; i < kSlotCount; i++) {
+        offsets[i] = 64 + (kSlotCount - 1 - i) * kSlotSize;
+    }
+
+    FakeQemuCameraHost host(2);
+    host.setSharedMemory(shared.data(), shared.size());
+    CameraQemuClient client;
+    EXPECT(client.attachClient(host.start()) == NO_ERROR);
+    EXPECT(client.queryConnect() == NO_ERROR);
+    EXPECT(client.queryStart(V4L2_PIX_FMT_YUV420, 37, 21) == NO_ERROR);
+    EXPECT(client.queryRingStart(V4L2_PIX_FMT_YUV420, 37, 21, offsets,
+            kSlotCount, kSlotSize) == NO_ERROR);
+
+    uint32_t slot = 0;
+    int64_t frameTime = 0;
+    for (uint32_t frame = 0; frame < 2 * kSlotCount; frame++) {
+        EXPECT(client.queryRingFrame(V4L2_PIX_FMT_YUV420, 1.0f, 1.0f, 1.0f,
+                1.0f, &slot, &frameTime) == NO_ERROR);
+        EXPECT(slot == frame % kSlotCount);
+        EXPECT(frameTime == FakeQemuCameraHost::frameTime(frame));
+        const uint8_t* data = shared.data() + offsets[slot % kSlotCount];
+        EXPECT(isHostFrame(std::vector<uint8_t>(data, data + kSlotSize),
+                frame, false));
+    }
+    // No ring for formats that weren't started.
+    EXPECT(client.queryRingFrame(V4L2_PIX_FMT_RGB32, 1.0f, 1.0f, 1.0f,
+            1.0f, &slot, nullptr) != NO_ERROR);
+
+    EXPECT(client.queryStop() == NO_ERROR);
+    EXPECT(client.queryRingFrame(V4L2_PIX_FMT_YUV420, 1.0f, 1.0f, 1.0f,
+            1.0f, &slot, nullptr) != NO_ERROR);
+    client.disconnectClient();
+    host.join();
+
+    // Hosts before binary protocol version 2 have no frame rings.
+    FakeQemuCameraHost oldHost(1);
+    CameraQemuClient oldClient;
+    EXPECT(oldClient.attachClient(oldHost.start()) == NO_ERROR);
+    EXPECT(oldClient.queryConnect() == NO_ERROR);
+    EXPECT(oldClient.queryRingStart(V4L2_PIX_FMT_YUV420, 37, 21, offsets,
+            kSlotCount, kSlotSize) == INVALID_OPERATION);
+    EXPECT(countQueries(oldHost.getQueries(), "ring-start") == 0);
+    oldClient.disconnectClient();
+    oldHost.join();
+}
+
+typedef void (*YUVToRGBConverter)(const void* yuv, void* rgb, int width,
+        int height);
+
+static void RGBA8888ToNV21Packed(const void* rgba, void* nv21, int width,
+        int height) {
+    RGBA8888ToNV21(rgba, nv21, width, height, width);
+}
+
+// Runs a converter with the plain C and the given instruction set on the same
+// random frame, and compares the whole outputs, padding included.
+static bool convertsAsPlain(ConverterInstructionSet set,
+        YUVToRGBConverter convert, int width, int height,
+        size_t dstPixelSize) {
+    // Room for aligned strides, odd heights, and 32 bit input pixels.
+    const size_t srcSize = (width + 32) * (height + 1) * 4;
+    const size_t dstSize = (width + 1) * height * dstPixelSize + 64;
+    std::vector<uint8_t> src(srcSize);
+    for (uint8_t& b : src) {
+        b = rand();
+    }
+    std::vector<uint8_t> plain(dstSize, 0xa5), vectorized(dstSize, 0xa5);
+    setConverterInstructionSet(CONVERTERS_PLAIN);
+    convert(src.data(), plain.data(), width, height);
+    setConverterInstructionSet(set);
+    convert(src.data(), vectorized.data(), width, height);
+    return plain == vectorized;
+}
+
+// Vectorized converters match the plain C ones bit for bit, including the
+// rows the vector loops leave to the plain ones.
+static void testConverters() {
+    const struct {
+        ConverterInstructionSet set;
+        const char* name;
+    } sets[] = {
+        {CONVERTERS_SSE2, "SSE2"},
+        {CONVERTERS_AVX2, "AVX2"},
+        {CONVERTERS_NEON, "NEON"},
+    };
+    const struct {
+        YUVToRGBConverter convert;
+        const char* name;
+        size_t dstPixelSize;
+    } converters[] = {
+        {YV12ToRGB565, "YV12ToRGB565", 2},
+        {YV12ToRGB32, "YV12ToRGB32", 4},
+        {YU12ToRGB32, "YU12ToRGB32", 4},
+        {NV12ToRGB565, "NV12ToRGB565", 2},
+        {NV12ToRGB32, "NV12ToRGB32", 4},
+        {NV21ToRGB565, "NV21ToRGB565", 2},
+        {NV21ToRGB32, "NV21ToRGB32", 4},
+        {RGBA8888ToNV21Packed, "RGBA8888ToNV21", 2},
+    };
+    // Widths around the 8, 16 and 32 pixel vector steps, odd ones leaving
+    // a tail, and common frame sizes.
+    const int sizes[][2] = {
+        {1, 1}, {2, 2}, {7, 3}, {8, 2}, {15, 5}, {16, 4}, {17, 3},
+        {31, 2}, {33, 7}, {47, 4}, {64, 2}, {65, 3}, {130, 9},
+        {176, 144}, {321, 241}, {640, 480},
+    };
+
+    srand(1);
+    for (const auto& set : sets) {
+        if (!setConverterInstructionSet(set.set)) {
+            printf("Converters: %s not supported here, skipped\n", set.name);
+            continue;
+        }
+        for (const auto& converter : converters) {
+            for (const auto& size : sizes) {
+                if (!convertsAsPlain(set.set, converter.convert, size[0],
+                        size[1], converter.dstPixelSize)) {
+                    printf("%s %s differs from plain C at %dx%d\n",
+                            set.name, converter.name, size[0], size[1]);
+                    sFailures++;
+                }
+            }
+        }
+    }
+    setConverterInstructionSet(CONVERTERS_BEST);
+}
+
+static int runSelfTests() {
+    testQemuClientProtocol();
+    testQemuClientPrefetch();
+    testQemuClientFrameRing();
+    testConverters();
+    if (sFailures > 0) {
+        printf("%d checks failed\n", sFailures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
+
 // Test the capture speed of qemu camera, e.g., webcam and virtual scene
+// or, with "selftest", run the self tests.
 int main(int argc, char* argv[]) {
     using ::android::GraphicBufferAllocator;
     using ::android::GraphicBufferMapper;
 
+    if (argc > 1 && !strcmp(argv[1], "selftest")) {
+        return runSelfTests();
+    }
+
 
     uint32_t pixFmt;
     int uiFmt;
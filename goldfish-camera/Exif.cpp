@@ -22,6 +22,7 @@
 #include <inttypes.h>
 #include <math.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "Exif.h"
 #include <libexif/exif-data.h>
@@ -285,6 +286,32 @@ static bool convertTimestampToTimeAndDate(int64_t timestamp,
     return true;
 }
 
+// Convert a JPEG orientation in degrees to the EXIF orientation tag value
+static uint16_t convertToExifOrientation(int32_t degrees) {
+    enum {
+        EXIF_ROTATE_CAMERA_CW0 = 1,
+        EXIF_ROTATE_CAMERA_CW90 = 6,
+        EXIF_ROTATE_CAMERA_CW180 = 3,
+        EXIF_ROTATE_CAMERA_CW270 = 8,
+    };
+    uint16_t exifOrien = 1;
+    switch (degrees) {
+        case 0:
+            exifOrien = EXIF_ROTATE_CAMERA_CW0;
+            break;
+        case 90:
+            exifOrien = EXIF_ROTATE_CAMERA_CW90;
+            break;
+        case 180:
+            exifOrien = EXIF_ROTATE_CAMERA_CW180;
+            break;
+        case 270:
+            exifOrien = EXIF_ROTATE_CAMERA_CW270;
+            break;
+    }
+    return exifOrien;
+}
+
 // Convert and store key values in CameraMetadata
 static void convertToMetadata(const CameraParameters& src, CameraMetadata& dst) {
     int64_t longValue;
@@ -377,28 +404,8 @@ static ExifData* createExifDataCommon(const CameraMetadata& params, int width, i
     entry = params.find(ANDROID_JPEG_ORIENTATION);
     degrees = (entry.count > 0) ? entry.data.i32[0] : 0;
     ALOGV("degrees %d focalLength %f", degrees, focalLength);
-    enum {
-        EXIF_ROTATE_CAMERA_CW0 = 1,
-        EXIF_ROTATE_CAMERA_CW90 = 6,
-        EXIF_ROTATE_CAMERA_CW180 = 3,
-        EXIF_ROTATE_CAMERA_CW270 = 8,
-    };
-    uint16_t exifOrien = 1;
-    switch (degrees) {
-        case 0:
-            exifOrien = EXIF_ROTATE_CAMERA_CW0;
-            break;
-        case 90:
-            exifOrien = EXIF_ROTATE_CAMERA_CW90;
-            break;
-        case 180:
-            exifOrien = EXIF_ROTATE_CAMERA_CW180;
-            break;
-        case 270:
-            exifOrien = EXIF_ROTATE_CAMERA_CW270;
-            break;
-    }
-    createEntry(exifData, EXIF_IFD_0, EXIF_TAG_ORIENTATION, exifOrien);
+    createEntry(exifData, EXIF_IFD_0, EXIF_TAG_ORIENTATION,
+                convertToExifOrientation(degrees));
 
     // GPS information
     entry = params.find(ANDROID_JPEG_GPS_COORDINATES);
@@ -510,5 +517,390 @@ void freeExifData(ExifData* exifData) {
     exif_data_free(exifData);
 }
 
+// The serialized EXIF data starts with the "Exif\0\0" header, followed by the
+// TIFF header that all offsets in the IFDs are relative to.
+static const size_t kTiffOffset = 6;
+// ExifTemplate builds its blocks with a placeholder thumbnail of this size.
+static const size_t kPlaceholderThumbnailSize = 2;
+
+static uint16_t readShort(const unsigned char* data) {
+    return data[0] | (data[1] << 8);
+}
+
+static uint32_t readLong(const unsigned char* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+           (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static void writeShort(unsigned char* data, uint16_t value) {
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+static void writeLong(unsigned char* data, uint32_t value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = value >> 24;
+}
+
+static uint32_t fieldKey(int ifd, int tag) {
+    return (static_cast<uint32_t>(ifd) << 16) | static_cast<uint16_t>(tag);
+}
+
+bool ExifTemplate::Layout::operator==(const Layout& other) const {
+    return hasDimensions == other.hasDimensions &&
+           hasGpsCoordinates == other.hasGpsCoordinates &&
+           hasGpsTimestamp == other.hasGpsTimestamp &&
+           gpsProcessingMethodLength == other.gpsProcessingMethodLength &&
+           hasThumbnail == other.hasThumbnail;
+}
+
+ExifTemplate::ExifTemplate()
+    : mValid(false),
+      mLayout{false, false, false, -2 /* matches no capture */, false},
+      mThumbnailLengthOffset(0) {
+}
+
+bool ExifTemplate::generate(const CameraMetadata& params,
+                            int width, int height,
+                            const unsigned char* thumbnail,
+                            size_t thumbnailSize,
+                            std::vector<unsigned char>* out) {
+    const Layout layout = getLayout(params, width, height, thumbnailSize);
+    if (!(layout == mLayout)) {
+        build(params, width, height, layout);
+    }
+
+    if (mValid) {
+        out->assign(mBlock.begin(), mBlock.end());
+        if (patch(params, width, height, out)) {
+            if (layout.hasThumbnail) {
+                out->insert(out->end(), thumbnail, thumbnail + thumbnailSize);
+                writeLong(&(*out)[mThumbnailLengthOffset], thumbnailSize);
+            }
+            return true;
+        }
+        ALOGW("%s: EXIF template is missing fields, not using it",
+              __FUNCTION__);
+        mValid = false;
+    }
+
+    // Build the EXIF data from scratch
+    ExifData* exifData = createExifData(params, width, height);
+    if (thumbnailSize > 0) {
+        exifData->data =
+            reinterpret_cast<unsigned char*>(malloc(thumbnailSize));
+        if (exifData->data != nullptr) {
+            memcpy(exifData->data, thumbnail, thumbnailSize);
+            exifData->size = thumbnailSize;
+        }
+    }
+    unsigned char* block = nullptr;
+    unsigned int blockSize = 0;
+    exif_data_save_data(exifData, &block, &blockSize);
+    freeExifData(exifData);
+    if (block == nullptr) {
+        ALOGE("%s: Unable to serialize EXIF data", __FUNCTION__);
+        return false;
+    }
+    out->assign(block, block + blockSize);
+    free(block);
+    return true;
+}
+
+ExifTemplate::Layout ExifTemplate::getLayout(const CameraMetadata& params,
+                                             int width, int height,
+                                             size_t thumbnailSize) {
+    Layout layout;
+    layout.hasDimensions = width > 0 && height > 0;
+    layout.hasGpsCoordinates =
+        params.find(ANDROID_JPEG_GPS_COORDINATES).count > 0;
+
+    camera_metadata_ro_entry_t entry = params.find(ANDROID_JPEG_GPS_TIMESTAMP);
+    float triplet[3];
+    std::string date;
+    layout.hasGpsTimestamp = entry.count > 0 &&
+        convertTimestampToTimeAndDate(entry.data.i64[0], &triplet, &date);
+
+    entry = params.find(ANDROID_JPEG_GPS_PROCESSING_METHOD);
+    layout.gpsProcessingMethodLength = entry.count > 0 ? entry.count : -1;
+    layout.hasThumbnail = thumbnailSize > 0;
+    return layout;
+}
+
+bool ExifTemplate::build(const CameraMetadata& params, int width, int height,
+                         const Layout& layout) {
+    mValid = false;
+    mLayout = layout;
+    mBlock.clear();
+    mFields.clear();
+
+    ExifData* exifData = createExifData(params, width, height);
+    if (layout.hasThumbnail) {
+        exifData->data = reinterpret_cast<unsigned char*>(
+            calloc(1, kPlaceholderThumbnailSize));
+        if (exifData->data != nullptr) {
+            exifData->size = kPlaceholderThumbnailSize;
+        }
+    }
+    unsigned char* block = nullptr;
+    unsigned int blockSize = 0;
+    exif_data_save_data(exifData, &block, &blockSize);
+    freeExifData(exifData);
+    if (block == nullptr) {
+        ALOGE("%s: Unable to serialize EXIF data", __FUNCTION__);
+        return false;
+    }
+    mBlock.assign(block, block + blockSize);
+    free(block);
+
+    // IFD0 is followed by IFD1, which holds the thumbnail, and points to the
+    // EXIF and GPS IFDs. The byte order was set to little endian.
+    if (mBlock.size() < kTiffOffset + 8 ||
+        memcmp(&mBlock[kTiffOffset], "II", 2) != 0) {
+        ALOGW("%s: Unexpected TIFF header", __FUNCTION__);
+        return false;
+    }
+    uint32_t ifd1Offset = 0;
+    uint32_t nextIfdOffset = 0;
+    if (!parseIfd(EXIF_IFD_0, readLong(&mBlock[kTiffOffset + 4]),
+                  &ifd1Offset)) {
+        return false;
+    }
+    const Field* pointer = findField(EXIF_IFD_0, EXIF_TAG_EXIF_IFD_POINTER,
+                                     EXIF_FORMAT_LONG, 4);
+    if (pointer != nullptr &&
+        !parseIfd(EXIF_IFD_EXIF, readLong(&mBlock[pointer->offset]),
+                  &nextIfdOffset)) {
+        return false;
+    }
+    pointer = findField(EXIF_IFD_0, EXIF_TAG_GPS_INFO_IFD_POINTER,
+                        EXIF_FORMAT_LONG, 4);
+    if (pointer != nullptr &&
+        !parseIfd(EXIF_IFD_GPS, readLong(&mBlock[pointer->offset]),
+                  &nextIfdOffset)) {
+        return false;
+    }
+
+    if (layout.hasThumbnail) {
+        // The thumbnail must be the last thing in the block so that it can
+        // be replaced by one of any size
+        if (ifd1Offset == 0 ||
+            !parseIfd(EXIF_IFD_1, ifd1Offset, &nextIfdOffset)) {
+            return false;
+        }
+        const Field* start = findField(EXIF_IFD_1,
+                                       EXIF_TAG_JPEG_INTERCHANGE_FORMAT,
+                                       EXIF_FORMAT_LONG, 4);
+        const Field* length = findField(EXIF_IFD_1,
+                                        EXIF_TAG_JPEG_INTERCHANGE_FORMAT_LENGTH,
+                                        EXIF_FORMAT_LONG, 4);
+        if (start == nullptr || length == nullptr ||
+            readLong(&mBlock[length->offset]) != kPlaceholderThumbnailSize ||
+            kTiffOffset + readLong(&mBlock[start->offset]) +
+                kPlaceholderThumbnailSize != mBlock.size()) {
+            ALOGW("%s: Unexpected thumbnail placement", __FUNCTION__);
+            return false;
+        }
+        mThumbnailLengthOffset = length->offset;
+        mBlock.resize(mBlock.size() - kPlaceholderThumbnailSize);
+    }
+
+    ALOGV("%s: %zu byte template with %zu fields", __FUNCTION__,
+          mBlock.size(), mFields.size());
+    mValid = true;
+    return true;
+}
+
+bool ExifTemplate::parseIfd(int ifd, uint32_t ifdOffset,
+                            uint32_t* nextIfdOffset) {
+    size_t position = kTiffOffset + ifdOffset;
+    if (position + 2 > mBlock.size()) {
+        return false;
+    }
+    const uint16_t count = readShort(&mBlock[position]);
+    position += 2;
+    // Entries of 12 bytes each, then the offset of the next IFD
+    if (position + count * 12 + 4 > mBlock.size()) {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; ++i, position += 12) {
+        Field field;
+        const uint16_t tag = readShort(&mBlock[position]);
+        field.format = readShort(&mBlock[position + 2]);
+        field.components = readLong(&mBlock[position + 4]);
+        const uint64_t size = static_cast<uint64_t>(field.components) *
+            exif_format_get_size(static_cast<ExifFormat>(field.format));
+        // Values of up to four bytes are stored in the entry itself
+        field.offset = size <= 4 ? position + 8
+                                 : kTiffOffset + readLong(&mBlock[position + 8]);
+        if (field.offset + size > mBlock.size()) {
+            return false;
+        }
+        mFields[fieldKey(ifd, tag)] = field;
+    }
+    *nextIfdOffset = readLong(&mBlock[position]);
+    return true;
+}
+
+// Update the fields of a copy of the template for a capture with |params|,
+// using the same values createExifData() would.
+bool ExifTemplate::patch(const CameraMetadata& params, int width, int height,
+                         std::vector<unsigned char>* out) const {
+    bool ok = true;
+    float triplet[3];
+
+    // Date and time, libexif set them to the time the template was built
+    char dateTime[20] = {};
+    time_t now = time(nullptr);
+    struct tm localTime;
+    localtime_r(&now, &localTime);
+    strftime(dateTime, sizeof(dateTime), "%Y:%m:%d %H:%M:%S", &localTime);
+    ok &= setBytes(out, EXIF_IFD_0, EXIF_TAG_DATE_TIME,
+                   dateTime, sizeof(dateTime), EXIF_FORMAT_ASCII);
+    ok &= setBytes(out, EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED,
+                   dateTime, sizeof(dateTime), EXIF_FORMAT_ASCII);
+    if (findField(EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL,
+                  EXIF_FORMAT_ASCII, sizeof(dateTime)) != nullptr) {
+        setBytes(out, EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL,
+                 dateTime, sizeof(dateTime), EXIF_FORMAT_ASCII);
+    }
+
+    if (mLayout.hasDimensions) {
+        ok &= setInteger(out, EXIF_IFD_EXIF, EXIF_TAG_PIXEL_X_DIMENSION, width);
+        ok &= setInteger(out, EXIF_IFD_EXIF, EXIF_TAG_PIXEL_Y_DIMENSION, height);
+    }
+
+    camera_metadata_ro_entry_t entry;
+    entry = params.find(ANDROID_LENS_FOCAL_LENGTH);
+    triplet[0] = (entry.count > 0) ? entry.data.f[0] : 5.0f;
+    ok &= setRationals(out, EXIF_IFD_EXIF, EXIF_TAG_FOCAL_LENGTH,
+                       triplet, 1, 1000.0f);
+    entry = params.find(ANDROID_JPEG_ORIENTATION);
+    ok &= setInteger(out, EXIF_IFD_0, EXIF_TAG_ORIENTATION,
+                     convertToExifOrientation(
+                         (entry.count > 0) ? entry.data.i32[0] : 0));
+
+    if (mLayout.hasGpsCoordinates) {
+        entry = params.find(ANDROID_JPEG_GPS_COORDINATES);
+        convertGpsCoordinate(entry.data.d[0], &triplet);
+        ok &= setRationals(out, EXIF_IFD_GPS, EXIF_TAG_GPS_LATITUDE,
+                           triplet, 3, 1000.0f);
+        ok &= setBytes(out, EXIF_IFD_GPS, EXIF_TAG_GPS_LATITUDE_REF,
+                       entry.data.d[0] < 0.0f ? "S" : "N", 2,
+                       EXIF_FORMAT_ASCII);
+        convertGpsCoordinate(entry.data.d[1], &triplet);
+        ok &= setRationals(out, EXIF_IFD_GPS, EXIF_TAG_GPS_LONGITUDE,
+                           triplet, 3, 1000.0f);
+        ok &= setBytes(out, EXIF_IFD_GPS, EXIF_TAG_GPS_LONGITUDE_REF,
+                       entry.data.d[1] < 0.0f ? "W" : "E", 2,
+                       EXIF_FORMAT_ASCII);
+        triplet[0] = static_cast<float>(fabs(entry.data.d[2]));
+        ok &= setRationals(out, EXIF_IFD_GPS, EXIF_TAG_GPS_ALTITUDE,
+                           triplet, 1, 1000.0f);
+        ok &= setInteger(out, EXIF_IFD_GPS, EXIF_TAG_GPS_ALTITUDE_REF,
+                         entry.data.d[2] < 0.0f ? 1 : 0);
+    }
+
+    if (mLayout.hasGpsTimestamp) {
+        entry = params.find(ANDROID_JPEG_GPS_TIMESTAMP);
+        std::string date;
+        ok &= convertTimestampToTimeAndDate(entry.data.i64[0], &triplet, &date);
+        ok &= setRationals(out, EXIF_IFD_GPS, EXIF_TAG_GPS_TIME_STAMP,
+                           triplet, 3, 1.0f);
+        ok &= setBytes(out, EXIF_IFD_GPS, EXIF_TAG_GPS_DATE_STAMP,
+                       date.c_str(), date.size() + 1, EXIF_FORMAT_ASCII);
+    }
+
+    if (mLayout.gpsProcessingMethodLength >= 0) {
+        entry = params.find(ANDROID_JPEG_GPS_PROCESSING_METHOD);
+        std::vector<unsigned char> data(std::begin(kAsciiPrefix),
+                                        std::end(kAsciiPrefix));
+        data.insert(data.end(), entry.data.u8, entry.data.u8 + entry.count);
+        ok &= setBytes(out, EXIF_IFD_GPS, EXIF_TAG_GPS_PROCESSING_METHOD,
+                       &data[0], data.size(), EXIF_FORMAT_UNDEFINED);
+    }
+
+    entry = params.find(ANDROID_SENSOR_EXPOSURE_TIME);
+    int64_t exposureTimesNs =
+        (entry.count > 0) ? entry.data.i64[0] : Sensor::kExposureTimeRange[0];
+    triplet[0] = exposureTimesNs / 1000000000.0f;
+    ok &= setRationals(out, EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME,
+                       triplet, 1, 1000000000);
+    entry = params.find(ANDROID_LENS_APERTURE);
+    triplet[0] = (entry.count > 0) ? entry.data.f[0] : 2.8;
+    ok &= setRationals(out, EXIF_IFD_EXIF, EXIF_TAG_FNUMBER,
+                       triplet, 1, 1000.0f);
+    entry = params.find(ANDROID_FLASH_MODE);
+    ok &= setInteger(out, EXIF_IFD_EXIF, EXIF_TAG_FLASH,
+                     static_cast<uint16_t>(
+                         (entry.count > 0) ? entry.data.i32[0] : 0));
+    entry = params.find(ANDROID_CONTROL_AWB_MODE);
+    ok &= setInteger(out, EXIF_IFD_EXIF, EXIF_TAG_WHITE_BALANCE,
+                     (entry.count > 0 &&
+                      entry.data.i32[0] == ANDROID_CONTROL_AWB_MODE_AUTO)
+                         ? 0 : 1);
+    entry = params.find(ANDROID_SENSOR_SENSITIVITY);
+    int isoSpeedRating = (entry.count > 0) ?
+        entry.data.i32[0] : Sensor::kSensitivityRange[0];
+    ok &= setInteger(out, EXIF_IFD_EXIF, EXIF_TAG_ISO_SPEED_RATINGS,
+                     static_cast<uint16_t>(isoSpeedRating));
+    return ok;
+}
+
+const ExifTemplate::Field* ExifTemplate::findField(int ifd, int tag,
+                                                   uint16_t format,
+                                                   size_t size) const {
+    auto it = mFields.find(fieldKey(ifd, tag));
+    if (it == mFields.end() || it->second.format != format ||
+        it->second.components *
+            exif_format_get_size(static_cast<ExifFormat>(format)) != size) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+bool ExifTemplate::setInteger(std::vector<unsigned char>* out, int ifd,
+                              int tag, uint32_t value) const {
+    const Field* field = findField(ifd, tag, EXIF_FORMAT_SHORT, 2);
+    if (field != nullptr && value <= 0xFFFF) {
+        writeShort(&(*out)[field->offset], value);
+        return true;
+    }
+    field = findField(ifd, tag, EXIF_FORMAT_LONG, 4);
+    if (field != nullptr) {
+        writeLong(&(*out)[field->offset], value);
+        return true;
+    }
+    return false;
+}
+
+bool ExifTemplate::setRationals(std::vector<unsigned char>* out, int ifd,
+                                int tag, const float* values, size_t count,
+                                float denominator) const {
+    const Field* field = findField(ifd, tag, EXIF_FORMAT_RATIONAL, count * 8);
+    if (field == nullptr) {
+        return false;
+    }
+    unsigned char* data = &(*out)[field->offset];
+    for (size_t i = 0; i < count; ++i) {
+        writeLong(data + i * 8, static_cast<uint32_t>(values[i] * denominator));
+        writeLong(data + i * 8 + 4, static_cast<uint32_t>(denominator));
+    }
+    return true;
+}
+
+bool ExifTemplate::setBytes(std::vector<unsigned char>* out, int ifd, int tag,
+                            const void* data, size_t size,
+                            uint16_t format) const {
+    const Field* field = findField(ifd, tag, format, size);
+    if (field == nullptr) {
+        return false;
+    }
+    memcpy(&(*out)[field->offset], data, size);
+    return true;
+}
+
 }  // namespace android
 
@@ -18,6 +18,11 @@
 #ifndef GOLDFISH_CAMERA_EXIF_H
 #define GOLDFISH_CAMERA_EXIF_H
 
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
 struct _ExifData;
 typedef struct _ExifData ExifData;
 #undef TRUE
@@ -40,6 +45,72 @@ ExifData* createExifData(const CameraMetadata& params, int width, int height);
 /* Free EXIF data created in the createExifData call */
 void freeExifData(ExifData* exifData);
 
+/* A serialized HAL3 EXIF block that is built with libexif once and then
+ * reused. Each capture copies it and patches the fields that change between
+ * captures, such as the time, orientation, exposure and GPS values, in place.
+ * The template is rebuilt when a capture needs a different set of fields, for
+ * example when GPS data is added, and captures fall back to building the EXIF
+ * data from scratch if the serialized layout is not understood.
+ */
+class ExifTemplate {
+public:
+    ExifTemplate();
+
+    /* Write the EXIF block, as stored in the APP1 segment, for a |width| x
+     * |height| image captured with |params| to |out|. A JPEG thumbnail of
+     * |thumbnailSize| bytes is embedded unless |thumbnailSize| is zero.
+     */
+    bool generate(const CameraMetadata& params, int width, int height,
+                  const unsigned char* thumbnail, size_t thumbnailSize,
+                  std::vector<unsigned char>* out);
+
+private:
+    // The optional parts of the EXIF data, captures with the same layout
+    // serialize to blocks of the same size with fields at the same offsets
+    struct Layout {
+        bool hasDimensions;
+        bool hasGpsCoordinates;
+        bool hasGpsTimestamp;
+        int gpsProcessingMethodLength;  // -1 when there is none
+        bool hasThumbnail;
+
+        bool operator==(const Layout& other) const;
+    };
+
+    // Where the value of an entry is stored in mBlock
+    struct Field {
+        size_t offset;
+        uint16_t format;
+        uint32_t components;
+    };
+
+    static Layout getLayout(const CameraMetadata& params, int width,
+                            int height, size_t thumbnailSize);
+    bool build(const CameraMetadata& params, int width, int height,
+               const Layout& layout);
+    bool parseIfd(int ifd, uint32_t ifdOffset, uint32_t* nextIfdOffset);
+    bool patch(const CameraMetadata& params, int width, int height,
+               std::vector<unsigned char>* out) const;
+
+    const Field* findField(int ifd, int tag, uint16_t format,
+                           size_t size) const;
+    bool setInteger(std::vector<unsigned char>* out, int ifd, int tag,
+                    uint32_t value) const;
+    bool setRationals(std::vector<unsigned char>* out, int ifd, int tag,
+                      const float* values, size_t count,
+                      float denominator) const;
+    bool setBytes(std::vector<unsigned char>* out, int ifd, int tag,
+                  const void* data, size_t size, uint16_t format) const;
+
+    bool mValid;
+    Layout mLayout;
+    std::vector<unsigned char> mBlock;
+    // Fields by IFD in the upper and tag in the lower 16 bits
+    std::map<uint32_t, Field> mFields;
+    // Offset of the IFD1 thumbnail length, the thumbnail is appended to mBlock
+    size_t mThumbnailLengthOffset;
+};
+
 }  // namespace android
 
 #endif  // GOLDFISH_CAMERA_EXIF_H
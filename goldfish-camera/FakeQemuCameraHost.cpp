@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of a stand-in for the emulator's 'emulated camera'
+ * service, for testing CameraQemuClient without an emulator.
+ */
+
+#include "FakeQemuCameraHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace android {
+
+/* First four bytes of a binary 'frame' query, "\x7fCFQ". */
+static const uint32_t kBinaryFrameMagic = 0x5146437f;
+/* First four bytes of a binary ring start query, "\x7fCRS". */
+static const uint32_t kBinaryRingStartMagic = 0x5352437f;
+/* First four bytes of a binary ring frame query, "\x7fCRF". */
+static const uint32_t kBinaryRingFrameMagic = 0x4652437f;
+/* Binary 'frame' query flag asking for the frame time. */
+static const uint32_t kBinaryFrameTime = 1;
+/* First binary protocol version with frame rings. */
+static const uint32_t kRingVersion = 2;
+/* Most slots a ring start query has room for. */
+static const size_t kMaxRingSlots = 4;
+
+/* Binary query header, common to all binary queries. */
+struct BinaryHeader {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    size;
+} __attribute__((packed));
+
+/* Binary 'frame' query. */
+struct BinaryFrame {
+    BinaryHeader header;
+    uint32_t    flags;
+    uint32_t    video_size;
+    uint32_t    preview_size;
+    float       white_balance[3];
+    float       exposure_comp;
+} __attribute__((packed));
+
+/* Binary ring start query. */
+struct BinaryRingStart {
+    BinaryHeader header;
+    uint32_t    pixel_format;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    slot_size;
+    uint32_t    slot_count;
+    uint64_t    slot_offsets[kMaxRingSlots];
+} __attribute__((packed));
+
+/* Binary ring frame query. */
+struct BinaryRingFrame {
+    BinaryHeader header;
+    uint32_t    pixel_format;
+    float       white_balance[3];
+    float       exposure_comp;
+} __attribute__((packed));
+
+/* Reply to a binary ring frame query. */
+struct BinaryRingFrameReply {
+    uint32_t    slot;
+    int64_t     frame_time;
+} __attribute__((packed));
+
+static bool isBinaryMagic(uint32_t magic)
+{
+    return magic == kBinaryFrameMagic || magic == kBinaryRingStartMagic ||
+           magic == kBinaryRingFrameMagic;
+}
+
+/* Gets the value of a "<name>=<value>" parameter of a text query. */
+static size_t getTextParam(const std::string& query, const char* name)
+{
+    const std::string key = std::string(" ") + name + "=";
+    const size_t pos = query.find(key);
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    return strtoul(query.c_str() + pos + key.size(), NULL, 10);
+}
+
+FakeQemuCameraHost::FakeQemuCameraHost(uint32_t protocol_version)
+    : mProtocolVersion(protocol_version),
+      mFD(-1),
+      mSharedMemory(NULL),
+      mSharedMemorySize(0),
+      mNextFrame(0),
+      mLastBinaryVersion(0)
+{
+}
+
+FakeQemuCameraHost::~FakeQemuCameraHost()
+{
+    if (mThread.joinable()) {
+        /* Wakes the serving thread up if the client is still attached. */
+        shutdown(mFD, SHUT_RDWR);
+        mThread.join();
+    }
+    if (mFD >= 0) {
+        close(mFD);
+    }
+}
+
+int FakeQemuCameraHost::start()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return -1;
+    }
+    mFD = fds[0];
+    mThread = std::thread(&FakeQemuCameraHost::serve, this);
+    return fds[1];
+}
+
+void FakeQemuCameraHost::join()
+{
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void FakeQemuCameraHost::setSharedMemory(uint8_t* base, size_t size)
+{
+    mSharedMemory = base;
+    mSharedMemorySize = size;
+}
+
+uint8_t FakeQemuCameraHost::frameByte(uint32_t frame, bool preview,
+                                      size_t offset)
+{
+    return static_cast<uint8_t>(frame * 37 + offset + (preview ? 128 : 0));
+}
+
+int64_t FakeQemuCameraHost::frameTime(uint32_t frame)
+{
+    return 1000000000LL + frame * 33333333LL;
+}
+
+std::vector<std::string> FakeQemuCameraHost::getQueries() const
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    return mQueries;
+}
+
+uint32_t FakeQemuCameraHost::getLastBinaryVersion() const
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    return mLastBinaryVersion;
+}
+
+void FakeQemuCameraHost::serve()
+{
+    std::vector<uint8_t> query;
+    while (readQuery(&query)) {
+        handleQuery(query);
+    }
+}
+
+bool FakeQemuCameraHost::readQuery(std::vector<uint8_t>* query)
+{
+    query->resize(sizeof(BinaryHeader));
+    if (read(mFD, query->data(), 1) != 1) {
+        return false;
+    }
+
+    /* Text queries end with a zero-terminator, binary ones carry their size
+     * in the header. */
+    size_t received = 1;
+    while (received < sizeof(uint32_t)) {
+        if (read(mFD, query->data() + received, 1) != 1) {
+            return false;
+        }
+        if ((*query)[received++] == '\0') {
+            query->resize(received);
+            return true;
+        }
+    }
+    uint32_t magic;
+    memcpy(&magic, query->data(), sizeof(magic));
+    if (isBinaryMagic(magic)) {
+        if (read(mFD, query->data() + received,
+                 sizeof(BinaryHeader) - received) !=
+                static_cast<ssize_t>(sizeof(BinaryHeader) - received)) {
+            return false;
+        }
+        BinaryHeader header;
+        memcpy(&header, query->data(), sizeof(header));
+        query->resize(header.size < sizeof(header) ? sizeof(header) :
+                                                     header.size);
+        for (size_t done = sizeof(header); done < query->size(); ) {
+            const ssize_t res = read(mFD, query->data() + done,
+                                     query->size() - done);
+            if (res <= 0) {
+                return false;
+            }
+            done += res;
+        }
+        return true;
+    }
+
+    query->resize(received);
+    for (;;) {
+        uint8_t c;
+        if (read(mFD, &c, 1) != 1) {
+            return false;
+        }
+        query->push_back(c);
+        if (c == '\0') {
+            return true;
+        }
+    }
+}
+
+void FakeQemuCameraHost::handleQuery(const std::vector<uint8_t>& query)
+{
+    uint32_t magic = 0;
+    if (query.size() >= sizeof(magic)) {
+        memcpy(&magic, query.data(), sizeof(magic));
+    }
+    if (magic == kBinaryFrameMagic) {
+        handleBinaryFrame(query);
+        return;
+    }
+    if (magic == kBinaryRingStartMagic) {
+        handleRingStart(query);
+        return;
+    }
+    if (magic == kBinaryRingFrameMagic) {
+        handleRingFrame(query);
+        return;
+    }
+
+    const std::string text(reinterpret_cast<const char*>(query.data()));
+    const std::string name = text.substr(0, text.find(' '));
+    logQuery(name, 0);
+    if (name == "connect" || name == "disconnect" || name == "start") {
+        sendReply("ok", NULL, 0);
+    } else if (name == "stop") {
+        mRings.clear();
+        sendReply("ok", NULL, 0);
+    } else if (name == "protocol" && mProtocolVersion > 0) {
+        char version[16];
+        snprintf(version, sizeof(version), "%u", mProtocolVersion);
+        sendReply("ok", version, strlen(version) + 1);
+    } else if (name == "frame") {
+        handleTextFrame(text);
+    } else {
+        static const char error[] = "Unknown query";
+        sendReply("ko", error, sizeof(error));
+    }
+}
+
+void FakeQemuCameraHost::handleTextFrame(const std::string& query)
+{
+    sendFrames(getTextParam(query, "video"), getTextParam(query, "preview"),
+               getTextParam(query, "time") != 0);
+}
+
+void FakeQemuCameraHost::handleBinaryFrame(const std::vector<uint8_t>& query)
+{
+    BinaryFrame frame;
+    if (query.size() < sizeof(frame)) {
+        logQuery("binary-frame", 0);
+        static const char error[] = "Short query";
+        sendReply("ko", error, sizeof(error));
+        return;
+    }
+    memcpy(&frame, query.data(), sizeof(frame));
+    logQuery("binary-frame", frame.header.version);
+    sendFrames(frame.video_size, frame.preview_size,
+               (frame.flags & kBinaryFrameTime) != 0);
+}
+
+void FakeQemuCameraHost::handleRingStart(const std::vector<uint8_t>& query)
+{
+    BinaryRingStart start;
+    const char* error = NULL;
+    if (query.size() < sizeof(start)) {
+        error = "Short query";
+    } else {
+        memcpy(&start, query.data(), sizeof(start));
+        if (start.header.version < kRingVersion ||
+                mProtocolVersion < kRingVersion) {
+            error = "Frame rings not supported";
+        } else if (start.slot_count == 0 || start.slot_count > kMaxRingSlots) {
+            error = "Invalid slot count";
+        }
+    }
+    logQuery("ring-start", error == NULL ? start.header.version : 0);
+    if (error != NULL) {
+        sendReply("ko", error, strlen(error) + 1);
+        return;
+    }
+
+    Ring ring;
+    ring.slot_size = start.slot_size;
+    ring.next_slot = 0;
+    for (uint32_t i = 0; i < start.slot_count; i++) {
+        const uint64_t offset = start.slot_offsets[i];
+        if (offset > mSharedMemorySize ||
+                mSharedMemorySize - offset < start.slot_size) {
+            static const char range_error[] = "Slot out of shared memory";
+            sendReply("ko", range_error, sizeof(range_error));
+            return;
+        }
+        ring.slot_offsets.push_back(offset);
+    }
+    mRings[start.pixel_format] = ring;
+    sendReply("ok", NULL, 0);
+}
+
+void FakeQemuCameraHost::handleRingFrame(const std::vector<uint8_t>& query)
+{
+    BinaryRingFrame frame;
+    std::map<uint32_t, Ring>::iterator it = mRings.end();
+    if (query.size() >= sizeof(frame)) {
+        memcpy(&frame, query.data(), sizeof(frame));
+        it = mRings.find(frame.pixel_format);
+    }
+    logQuery("ring-frame", it != mRings.end() ? frame.header.version : 0);
+    if (it == mRings.end()) {
+        static const char error[] = "No ring for the format";
+        sendReply("ko", error, sizeof(error));
+        return;
+    }
+
+    /* The slot handed out last time is the guest's until now, so the next
+     * one in turn is always free to fill. */
+    Ring& ring = it->second;
+    BinaryRingFrameReply reply;
+    reply.slot = ring.next_slot;
+    ring.next_slot = (ring.next_slot + 1) % ring.slot_offsets.size();
+    const uint32_t number = mNextFrame++;
+    uint8_t* slot = mSharedMemory + ring.slot_offsets[reply.slot];
+    for (size_t i = 0; i < ring.slot_size; i++) {
+        slot[i] = frameByte(number, false, i);
+    }
+    reply.frame_time = frameTime(number);
+    sendReply("ok", &reply, sizeof(reply));
+}
+
+void FakeQemuCameraHost::sendFrames(size_t video_size, size_t preview_size,
+                                    bool frame_time)
+{
+    const uint32_t frame = mNextFrame++;
+    std::vector<uint8_t> data(video_size + preview_size);
+    for (size_t i = 0; i < video_size; i++) {
+        data[i] = frameByte(frame, false, i);
+    }
+    for (size_t i = 0; i < preview_size; i++) {
+        data[video_size + i] = frameByte(frame, true, i);
+    }
+    if (frame_time) {
+        const int64_t time = frameTime(frame);
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&time);
+        data.insert(data.end(), bytes, bytes + sizeof(time));
+    }
+    sendReply("ok", data.data(), data.size());
+}
+
+bool FakeQemuCameraHost::sendReply(const char* status, const void* data,
+                                   size_t size)
+{
+    /* "ok"/"ko", then ':' and the data, or a zero-terminator if there is no
+     * data. */
+    std::vector<uint8_t> payload(status, status + 2);
+    payload.push_back(size > 0 ? ':' : '\0');
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    payload.insert(payload.end(), bytes, bytes + size);
+
+    char payload_size[9];
+    snprintf(payload_size, sizeof(payload_size), "%08zx", payload.size());
+    payload.insert(payload.begin(), payload_size, payload_size + 8);
+    for (size_t done = 0; done < payload.size(); ) {
+        const ssize_t res = write(mFD, payload.data() + done,
+                                  payload.size() - done);
+        if (res <= 0) {
+            return false;
+        }
+        done += res;
+    }
+    return true;
+}
+
+void FakeQemuCameraHost::logQuery(const std::string& name,
+                                  uint32_t binary_version)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    mQueries.push_back(name);
+    if (binary_version > 0) {
+        mLastBinaryVersion = binary_version;
+    }
+}
+
+}; /* namespace android */
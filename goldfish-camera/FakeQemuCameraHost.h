@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HW_EMULATOR_CAMERA_FAKE_QEMU_CAMERA_HOST_H
+#define HW_EMULATOR_CAMERA_FAKE_QEMU_CAMERA_HOST_H
+
+/*
+ * Contains declaration of a stand-in for the emulator's 'emulated camera'
+ * service, for testing CameraQemuClient without an emulator.
+ */
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+/* Serves the camera queries described in QemuClient.h on one end of a socket
+ * pair, the other end of which is attached to a client with
+ * QemuClient::attachClient(). The wire format of the binary queries is
+ * written out here independently of QemuClient.cpp, so that a change on one
+ * side only shows up as a test failure.
+ *
+ * Frames are filled with frameByte() values, and numbered in the order the
+ * host sends them, starting at 0. Frame rings are served from the memory set
+ * with setSharedMemory(): the emulator fills the slots on its own, while this
+ * host fills the next slot the guest doesn't own when the guest asks for a
+ * frame, which looks the same to the guest.
+ */
+class FakeQemuCameraHost {
+public:
+    /* Constructs a host.
+     * Param:
+     *  protocol_version - Binary protocol version to report in reply to the
+     *      'protocol' query. 0 makes a host that only takes text queries, and
+     *      fails the 'protocol' query as unknown.
+     */
+    explicit FakeQemuCameraHost(uint32_t protocol_version);
+
+    /* Stops serving, and destructs the host. */
+    ~FakeQemuCameraHost();
+
+    /* Starts serving queries.
+     * Return:
+     *  File descriptor to attach the client to, which the caller takes
+     *  ownership of, or -1 on failure.
+     */
+    int start();
+
+    /* Waits until the client end is closed. */
+    void join();
+
+    /* Sets the memory that frame ring slot offsets are relative to. Slots
+     * outside of it are rejected. */
+    void setSharedMemory(uint8_t* base, size_t size);
+
+    /* Byte at offset of the video (or preview) frame with the given number. */
+    static uint8_t frameByte(uint32_t frame, bool preview, size_t offset);
+
+    /* Time the host reports for the frame with the given number. */
+    static int64_t frameTime(uint32_t frame);
+
+    /* Names of the queries served so far, in order: the text query name, or
+     * "binary-frame", "ring-start" or "ring-frame" for binary queries. */
+    std::vector<std::string> getQueries() const;
+
+    /* Binary protocol version of the last binary query. */
+    uint32_t getLastBinaryVersion() const;
+
+private:
+    void serve();
+    bool readQuery(std::vector<uint8_t>* query);
+    void handleQuery(const std::vector<uint8_t>& query);
+    void handleTextFrame(const std::string& query);
+    void handleBinaryFrame(const std::vector<uint8_t>& query);
+    void handleRingStart(const std::vector<uint8_t>& query);
+    void handleRingFrame(const std::vector<uint8_t>& query);
+    void sendFrames(size_t video_size, size_t preview_size, bool frame_time);
+    bool sendReply(const char* status, const void* data, size_t size);
+    void logQuery(const std::string& name, uint32_t binary_version);
+
+    const uint32_t      mProtocolVersion;
+    int                 mFD;
+    std::thread         mThread;
+    uint8_t*            mSharedMemory;
+    size_t              mSharedMemorySize;
+
+    struct Ring {
+        std::vector<uint64_t> slot_offsets;
+        size_t          slot_size;
+        uint32_t        next_slot;
+    };
+
+    /* Only used by the serving thread. */
+    uint32_t            mNextFrame;
+    /* Frame rings by pixel format, dropped by the 'stop' query. */
+    std::map<uint32_t, Ring> mRings;
+
+    mutable std::mutex  mLock;
+    std::vector<std::string> mQueries;
+    uint32_t            mLastBinaryVersion;
+};
+
+}; /* namespace android */
+
+#endif  /* HW_EMULATOR_CAMERA_FAKE_QEMU_CAMERA_HOST_H */
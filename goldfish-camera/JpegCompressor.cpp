@@ -41,6 +41,9 @@ typedef void (*InitFunc)(JpegStub* stub);
 typedef void (*CleanupFunc)(JpegStub* stub);
 typedef int (*CompressFunc)(JpegStub* stub, const void* image,
         int width, int height, int quality, ExifData* exifData);
+typedef int (*CompressToBufferFunc)(JpegStub* stub, const void* image,
+        int width, int height, int quality, ExifData* exifData,
+        void* dest, size_t destSize);
 typedef void (*GetCompressedImageFunc)(JpegStub* stub, void* buff);
 typedef size_t (*GetCompressedSizeFunc)(JpegStub* stub);
 
@@ -80,6 +83,20 @@ status_t NV21JpegCompressor::compressRawImage(const void* image,
     return (status_t)(*f)(&mStub, image, width, height, quality, exifData);
 }
 
+status_t NV21JpegCompressor::compressRawImage(const void* image,
+                                              int width,
+                                              int height,
+                                              int quality,
+                                              ExifData* exifData,
+                                              void* dest,
+                                              size_t destSize)
+{
+    CompressToBufferFunc f = (CompressToBufferFunc)getSymbol(mDl,
+            "JpegStub_compressToBuffer");
+    return (status_t)(*f)(&mStub, image, width, height, quality, exifData,
+                          dest, destSize);
+}
+
 
 size_t NV21JpegCompressor::getCompressedSize()
 {
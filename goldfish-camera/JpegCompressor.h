@@ -61,6 +61,27 @@ public:
                               int quality,
                               ExifData* exifData);
 
+    /* Compresses raw NV21 image into a JPEG, writing it directly into the
+     * given buffer instead of mStream. Use getCompressedSize to obtain the
+     * size of the compressed image.
+     * Param:
+     *  image - Raw NV21 image.
+     *  width, height - Image dimensions.
+     *  quality - JPEG quality.
+     *  exifData - an EXIF data structure to attach to the image, may be null
+     *  dest - Buffer receiving the JPEG.
+     *  destSize - Size of dest. Compression fails if the JPEG is larger.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t compressRawImage(const void* image,
+                              int width,
+                              int height,
+                              int quality,
+                              ExifData* exifData,
+                              void* dest,
+                              size_t destSize);
+
     /* Get size of the compressed JPEG buffer.
      * This method must be called only after a successful completion of
      * compressRawImage call.
@@ -46,36 +46,42 @@ namespace android {
 
 QemuQuery::QemuQuery()
     : mQuery(mQueryPrealloc),
+      mQuerySize(0),
       mQueryDeliveryStatus(NO_ERROR),
       mReplyBuffer(NULL),
       mReplyData(NULL),
       mReplySize(0),
       mReplyDataSize(0),
-      mReplyStatus(0)
+      mReplyStatus(0),
+      mReplyScatteredSize(0)
 {
     *mQuery = '\0';
 }
 
 QemuQuery::QemuQuery(const char* query_string)
     : mQuery(mQueryPrealloc),
+      mQuerySize(0),
       mQueryDeliveryStatus(NO_ERROR),
       mReplyBuffer(NULL),
       mReplyData(NULL),
       mReplySize(0),
       mReplyDataSize(0),
-      mReplyStatus(0)
+      mReplyStatus(0),
+      mReplyScatteredSize(0)
 {
     mQueryDeliveryStatus = QemuQuery::createQuery(query_string, NULL);
 }
 
 QemuQuery::QemuQuery(const char* query_name, const char* query_param)
     : mQuery(mQueryPrealloc),
+      mQuerySize(0),
       mQueryDeliveryStatus(NO_ERROR),
       mReplyBuffer(NULL),
       mReplyData(NULL),
       mReplySize(0),
       mReplyDataSize(0),
-      mReplyStatus(0)
+      mReplyStatus(0),
+      mReplyScatteredSize(0)
 {
     mQueryDeliveryStatus = QemuQuery::createQuery(query_name, query_param);
 }
@@ -119,10 +125,46 @@ status_t QemuQuery::createQuery(const char* name, const char* param)
     } else {
         memcpy(mQuery, name, name_len + 1);
     }
+    mQuerySize = required;
 
     return NO_ERROR;
 }
 
+status_t QemuQuery::createRawQuery(const void* data, size_t size)
+{
+    /* Reset from the previous use. */
+    resetQuery();
+
+    if (data == NULL || size == 0) {
+        ALOGE("%s: No query data", __FUNCTION__);
+        mQueryDeliveryStatus = EINVAL;
+        return EINVAL;
+    }
+
+    if (size > sizeof(mQueryPrealloc)) {
+        mQuery = new char[size];
+    }
+    memcpy(mQuery, data, size);
+    mQuerySize = size;
+
+    return NO_ERROR;
+}
+
+const char* QemuQuery::getLogString() const
+{
+    /* Binary queries aren't zero-terminated. */
+    if (mQuerySize == 0 || mQuery[mQuerySize - 1] != '\0') {
+        return "<binary>";
+    }
+    return mQuery;
+}
+
+bool QemuQuery::isSameQuery(const QemuQuery& other) const
+{
+    return mQuerySize == other.mQuerySize &&
+           !memcmp(mQuery, other.mQuery, mQuerySize);
+}
+
 status_t QemuQuery::completeQuery(status_t status)
 {
     /* Save query completion status. */
@@ -154,7 +196,7 @@ status_t QemuQuery::completeQuery(status_t status)
     }
 
     /* Lets see if there are reply data that follow. */
-    if (mReplySize > 3) {
+    if (mReplySize > 3 || mReplyScatteredSize > 0) {
         /* There are extra data. Make sure they are separated from the status
          * with a ':' */
         if (mReplyBuffer[2] != ':') {
@@ -183,6 +225,7 @@ void QemuQuery::resetQuery()
         delete[] mQuery;
     }
     mQuery = mQueryPrealloc;
+    mQuerySize = 0;
     mQueryDeliveryStatus = NO_ERROR;
     if (mReplyBuffer != NULL) {
         free(mReplyBuffer);
@@ -191,6 +234,7 @@ void QemuQuery::resetQuery()
     mReplyData = NULL;
     mReplySize = mReplyDataSize = 0;
     mReplyStatus = 0;
+    mReplyScatteredSize = 0;
 }
 
 /****************************************************************************
@@ -243,6 +287,20 @@ status_t QemuClient::connectClient(const char* param)
     return NO_ERROR;
 }
 
+status_t QemuClient::attachClient(int fd)
+{
+    ALOGV("%s: %d", __FUNCTION__, fd);
+
+    /* Make sure that client is not connected already. */
+    if (mPipeFD >= 0) {
+        ALOGE("%s: Qemu client is already connected", __FUNCTION__);
+        return EINVAL;
+    }
+
+    mPipeFD = fd;
+    return NO_ERROR;
+}
+
 void QemuClient::disconnectClient()
 {
     ALOGV("%s", __FUNCTION__);
@@ -274,6 +332,33 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size)
     *data = NULL;
     *data_size = 0;
 
+    size_t payload_size;
+    status_t res = receiveMessageSize(&payload_size);
+    if (res != NO_ERROR) {
+        return res;
+    }
+
+    /* Allocate payload data buffer, and read the payload there. */
+    *data = malloc(payload_size);
+    if (*data == NULL) {
+        ALOGE("%s: Unable to allocate %zu bytes payload buffer",
+             __FUNCTION__, payload_size);
+        return ENOMEM;
+    }
+    const struct iovec iov = { *data, payload_size };
+    res = receiveData(&iov, 1);
+    if (res != NO_ERROR) {
+        free(*data);
+        *data = NULL;
+        return res;
+    } else {
+        *data_size = payload_size;
+        return NO_ERROR;
+    }
+}
+
+status_t QemuClient::receiveMessageSize(size_t* data_size)
+{
     if (mPipeFD < 0) {
         ALOGE("%s: Qemu client is not connected", __FUNCTION__);
         return EINVAL;
@@ -283,7 +368,6 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size)
      * then it sends the payload itself. Note that payload size is sent as a
      * string, containing 8 characters representing a hexadecimal payload size
      * value. Note also, that the string doesn't contain zero-terminator. */
-    size_t payload_size;
     char payload_size_str[9];
     if (qemu_pipe_read_fully(mPipeFD, payload_size_str, 8)) {
         ALOGE("%s: Unable to obtain payload size: %s",
@@ -294,32 +378,46 @@ status_t QemuClient::receiveMessage(void** data, size_t* data_size)
     /* Convert payload size. */
     errno = 0;
     payload_size_str[8] = '\0';
-    payload_size = strtol(payload_size_str, NULL, 16);
+    *data_size = strtol(payload_size_str, NULL, 16);
     if (errno) {
         ALOGE("%s: Invalid payload size '%s'", __FUNCTION__, payload_size_str);
         return EIO;
     }
+    return NO_ERROR;
+}
 
-    /* Allocate payload data buffer, and read the payload there. */
-    *data = malloc(payload_size);
-    if (*data == NULL) {
-        ALOGE("%s: Unable to allocate %zu bytes payload buffer",
-             __FUNCTION__, payload_size);
-        return ENOMEM;
-    }
-    if (qemu_pipe_read_fully(mPipeFD, *data, payload_size)) {
-        ALOGE("%s: qemu_pipe_read_fully coud not read %zu bytes: %s",
-             __FUNCTION__, payload_size, strerror(errno));
-        free(*data);
-        *data = NULL;
-        return errno ? errno : EIO;
-    } else {
-        *data_size = payload_size;
-        return NO_ERROR;
+status_t QemuClient::receiveData(const struct iovec* iov, int iovcnt)
+{
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        if (qemu_pipe_read_fully(mPipeFD, iov[i].iov_base, iov[i].iov_len)) {
+            ALOGE("%s: qemu_pipe_read_fully coud not read %zu bytes: %s",
+                 __FUNCTION__, iov[i].iov_len, strerror(errno));
+            return errno ? errno : EIO;
+        }
     }
+    return NO_ERROR;
 }
 
 status_t QemuClient::doQuery(QemuQuery* query)
+{
+    return doQuery(query, NULL, 0);
+}
+
+status_t QemuClient::doQuery(QemuQuery* query,
+                             const struct iovec* iov,
+                             int iovcnt)
+{
+    const status_t res = sendQuery(query);
+    if (res != NO_ERROR) {
+        return res;
+    }
+    return receiveReply(query, iov, iovcnt);
+}
+
+status_t QemuClient::sendQuery(QemuQuery* query)
 {
     /* Make sure that query has been successfuly constructed. */
     if (query->mQueryDeliveryStatus != NO_ERROR) {
@@ -327,31 +425,77 @@ status_t QemuClient::doQuery(QemuQuery* query)
         return query->mQueryDeliveryStatus;
     }
 
-    LOGQ("Send query '%s'", query->mQuery);
+    const char* query_str = query->getLogString();
+    LOGQ("Send query '%s' (%zu bytes)", query_str, query->mQuerySize);
+
+    const status_t res = sendMessage(query->mQuery, query->mQuerySize);
+    if (res != NO_ERROR) {
+        ALOGE("%s: Send query '%s' (%zu bytes) failed: %s",
+             __FUNCTION__, query_str, query->mQuerySize, strerror(res));
+        query->completeQuery(res);
+    }
+    return res;
+}
 
-    /* Send the query. */
-    status_t res = sendMessage(query->mQuery, strlen(query->mQuery) + 1);
+status_t QemuClient::receiveReply(QemuQuery* query,
+                                  const struct iovec* iov,
+                                  int iovcnt)
+{
+    size_t scattered_size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        scattered_size += iov[i].iov_len;
+    }
+
+    /* Read the response size. */
+    size_t payload_size = 0;
+    status_t res = receiveMessageSize(&payload_size);
+
+    /* Only the 'ok:' prefix is staged. If it is there, and the buffers can be
+     * filled, the data goes straight into them. Whatever is left, including
+     * the whole response in any other case, ends up in the reply buffer. */
+    char prefix[3];
+    size_t staged_size = 0;
+    if (res == NO_ERROR && payload_size >= sizeof(prefix) + scattered_size &&
+        scattered_size > 0) {
+        const struct iovec prefix_iov = { prefix, sizeof(prefix) };
+        res = receiveData(&prefix_iov, 1);
+        staged_size = sizeof(prefix);
+        if (res == NO_ERROR && !memcmp(prefix, "ok:", sizeof(prefix))) {
+            res = receiveData(iov, iovcnt);
+            query->mReplyScatteredSize = scattered_size;
+        }
+    }
     if (res == NO_ERROR) {
-        /* Read the response. */
-        res = receiveMessage(reinterpret_cast<void**>(&query->mReplyBuffer),
-                      &query->mReplySize);
-        if (res == NO_ERROR) {
-            LOGQ("Response to query '%s': Status = '%.2s', %d bytes in response",
-                 query->mQuery, query->mReplyBuffer, query->mReplySize);
+        const size_t remaining = payload_size - staged_size -
+                                 query->mReplyScatteredSize;
+        query->mReplyBuffer =
+            reinterpret_cast<char*>(malloc(staged_size + remaining));
+        if (query->mReplyBuffer != NULL) {
+            memcpy(query->mReplyBuffer, prefix, staged_size);
+            const struct iovec rest_iov = {
+                query->mReplyBuffer + staged_size, remaining
+            };
+            res = receiveData(&rest_iov, 1);
+            query->mReplySize = staged_size + remaining;
         } else {
-            ALOGE("%s Response to query '%s' has failed: %s",
-                 __FUNCTION__, query->mQuery, strerror(res));
+            ALOGE("%s: Unable to allocate %zu bytes payload buffer",
+                 __FUNCTION__, staged_size + remaining);
+            res = ENOMEM;
         }
+    }
+    if (res == NO_ERROR) {
+        LOGQ("Response to query '%s': Status = '%.2s', %zu bytes in response",
+             query->getLogString(), query->mReplyBuffer, payload_size);
     } else {
-        ALOGE("%s: Send query '%s' failed: %s",
-             __FUNCTION__, query->mQuery, strerror(res));
+        ALOGE("%s Response to query '%s' has failed: %s",
+             __FUNCTION__, query->getLogString(), strerror(res));
     }
 
     /* Complete the query, and return its completion handling status. */
     const status_t res1 = query->completeQuery(res);
     ALOGE_IF(res1 != NO_ERROR && res1 != res,
             "%s: Error %d in query '%s' completion",
-            __FUNCTION__, res1, query->mQuery);
+            __FUNCTION__, res1, query->getLogString());
     return res1;
 }
 
@@ -423,9 +567,68 @@ const char CameraQemuClient::mQueryStart[]      = "start";
 const char CameraQemuClient::mQueryStop[]       = "stop";
 /* Get next video frame from the camera device. */
 const char CameraQemuClient::mQueryFrame[]      = "frame";
+/* Get the binary protocol version of the host. */
+const char CameraQemuClient::mQueryProtocol[]   = "protocol";
+
+/* Binary protocol version implemented here. Version 2 adds frame rings. */
+static const uint32_t kBinaryProtocolVersion = 2;
+/* First four bytes of a binary query, "\x7fCFQ". */
+static const uint32_t kBinaryQueryMagic = 0x5146437f;
+/* First four bytes of a binary ring start query, "\x7fCRS". */
+static const uint32_t kBinaryRingStartMagic = 0x5352437f;
+/* First four bytes of a binary ring frame query, "\x7fCRF". */
+static const uint32_t kBinaryRingFrameMagic = 0x4652437f;
+/* First binary protocol version with frame rings. */
+static const uint32_t kBinaryRingVersion = 2;
+/* Binary frame query flag asking for the frame time to follow the frames. */
+static const uint32_t kBinaryFrameTime = 1;
+
+/* Binary 'frame' query. Both the guest and the host are little endian. */
+struct BinaryFrameQuery {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    size;
+    uint32_t    flags;
+    uint32_t    video_size;
+    uint32_t    preview_size;
+    float       white_balance[3];
+    float       exposure_comp;
+} __attribute__((packed));
+
+/* Binary ring start query. */
+struct BinaryRingStartQuery {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    size;
+    uint32_t    pixel_format;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    slot_size;
+    uint32_t    slot_count;
+    uint64_t    slot_offsets[CameraQemuClient::kMaxRingSlots];
+} __attribute__((packed));
+
+/* Binary ring frame query. */
+struct BinaryRingFrameQuery {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    size;
+    uint32_t    pixel_format;
+    float       white_balance[3];
+    float       exposure_comp;
+} __attribute__((packed));
+
+/* Reply to a binary ring frame query, following "ok:". */
+struct BinaryRingFrameReply {
+    uint32_t    slot;
+    int64_t     frame_time;
+} __attribute__((packed));
 
 CameraQemuClient::CameraQemuClient()
-    : QemuClient()
+    : QemuClient(),
+      mBinaryProtocolVersion(0),
+      mPrefetchEnabled(false),
+      mPrefetchPending(false)
 {
 }
 
@@ -444,9 +647,111 @@ status_t CameraQemuClient::queryConnect()
     ALOGE_IF(res != NO_ERROR, "%s: Query failed: %s",
             __FUNCTION__, query.mReplyData ? query.mReplyData :
                                              "No error message");
+    if (res == NO_ERROR) {
+        queryProtocol();
+    }
     return res;
 }
 
+status_t CameraQemuClient::queryProtocol()
+{
+    ALOGV("%s", __FUNCTION__);
+
+    mBinaryProtocolVersion = 0;
+    QemuQuery query(mQueryProtocol);
+    doQuery(&query);
+    /* Hosts that only take text queries fail the query as unknown. */
+    if (!query.isQuerySucceeded() || query.mReplyDataSize == 0) {
+        ALOGV("%s: Host only supports text queries", __FUNCTION__);
+        return NO_ERROR;
+    }
+
+    char version[16] = {};
+    memcpy(version, query.mReplyData,
+           query.mReplyDataSize < sizeof(version) - 1 ?
+               query.mReplyDataSize : sizeof(version) - 1);
+    const unsigned long host_version = strtoul(version, NULL, 10);
+    mBinaryProtocolVersion = host_version < kBinaryProtocolVersion ?
+                             host_version : kBinaryProtocolVersion;
+    ALOGV("%s: Host protocol version %lu, using %u", __FUNCTION__,
+          host_version, mBinaryProtocolVersion);
+    return NO_ERROR;
+}
+
+status_t CameraQemuClient::setFramePrefetch(bool enable)
+{
+    ALOGV("%s: %d", __FUNCTION__, enable);
+
+    if (enable && mBinaryProtocolVersion == 0) {
+        return INVALID_OPERATION;
+    }
+    mPrefetchEnabled = enable;
+    if (!enable) {
+        cancelPrefetch();
+    }
+    return NO_ERROR;
+}
+
+void CameraQemuClient::disconnectClient()
+{
+    /* Any pending reply goes away with the connection. */
+    mPrefetchPending = false;
+    mPrefetchEnabled = false;
+    mPrefetchQuery.resetQuery();
+    mBinaryProtocolVersion = 0;
+    QemuClient::disconnectClient();
+}
+
+status_t CameraQemuClient::doQuery(QemuQuery* query,
+                                   const struct iovec* iov,
+                                   int iovcnt)
+{
+    /* Replies come in the order of the queries. */
+    cancelPrefetch();
+    return QemuClient::doQuery(query, iov, iovcnt);
+}
+
+void CameraQemuClient::cancelPrefetch()
+{
+    if (mPrefetchPending) {
+        mPrefetchPending = false;
+        receiveReply(&mPrefetchQuery, NULL, 0);
+        mPrefetchQuery.resetQuery();
+    }
+}
+
+void CameraQemuClient::createFrameQuery(QemuQuery* query,
+                                        size_t video_size,
+                                        size_t preview_size,
+                                        float r_scale,
+                                        float g_scale,
+                                        float b_scale,
+                                        float exposure_comp,
+                                        bool frame_time)
+{
+    if (mBinaryProtocolVersion > 0) {
+        BinaryFrameQuery binary_query;
+        binary_query.magic = kBinaryQueryMagic;
+        binary_query.version = mBinaryProtocolVersion;
+        binary_query.size = sizeof(binary_query);
+        binary_query.flags = frame_time ? kBinaryFrameTime : 0;
+        binary_query.video_size = video_size;
+        binary_query.preview_size = preview_size;
+        binary_query.white_balance[0] = r_scale;
+        binary_query.white_balance[1] = g_scale;
+        binary_query.white_balance[2] = b_scale;
+        binary_query.exposure_comp = exposure_comp;
+        query->createRawQuery(&binary_query, sizeof(binary_query));
+        return;
+    }
+
+    char query_str[256];
+    snprintf(query_str, sizeof(query_str), "%s video=%zu preview=%zu whiteb=%g,%g,%g expcomp=%g time=%d",
+             mQueryFrame, video_size, preview_size, r_scale, g_scale, b_scale,
+             exposure_comp, frame_time ? 1 : 0);
+    query->createQuery(query_str, NULL);
+}
+
 status_t CameraQemuClient::queryDisconnect()
 {
     ALOGV("%s", __FUNCTION__);
@@ -514,13 +819,40 @@ status_t CameraQemuClient::queryFrame(void* vframe,
 {
     ALOGV("%s", __FUNCTION__);
 
-    char query_str[256];
-    snprintf(query_str, sizeof(query_str), "%s video=%zu preview=%zu whiteb=%g,%g,%g expcomp=%g time=%d",
-             mQueryFrame, (vframe && vframe_size) ? vframe_size : 0,
-             (pframe && pframe_size) ? pframe_size : 0, r_scale, g_scale, b_scale,
-             exposure_comp, frame_time != nullptr ? 1 : 0);
-    QemuQuery query(query_str);
-    doQuery(&query);
+    /* Requested frames are received straight into the buffers, video frame
+     * first. */
+    struct iovec iov[2];
+    int iovcnt = 0;
+    size_t frames_size = 0;
+    const size_t video_size = (vframe != NULL) ? vframe_size : 0;
+    const size_t preview_size = (pframe != NULL) ? pframe_size : 0;
+    if (video_size != 0) {
+        iov[iovcnt].iov_base = vframe;
+        iov[iovcnt].iov_len = video_size;
+        iovcnt++;
+        frames_size += video_size;
+    }
+    if (preview_size != 0) {
+        iov[iovcnt].iov_base = pframe;
+        iov[iovcnt].iov_len = preview_size;
+        iovcnt++;
+        frames_size += preview_size;
+    }
+
+    QemuQuery query;
+    createFrameQuery(&query, video_size, preview_size, r_scale, g_scale,
+                     b_scale, exposure_comp, frame_time != nullptr);
+
+    /* A prefetched frame can be used if it was queried the same way. */
+    if (mPrefetchPending && !query.isSameQuery(mPrefetchQuery)) {
+        cancelPrefetch();
+    }
+    if (mPrefetchPending) {
+        mPrefetchPending = false;
+        receiveReply(&query, iov, iovcnt);
+    } else if (sendQuery(&query) == NO_ERROR) {
+        receiveReply(&query, iov, iovcnt);
+    }
     const status_t res = query.getCompletionStatus();
     if( res != NO_ERROR) {
         ALOGE("%s: Query failed: %s",
@@ -529,41 +861,28 @@ status_t CameraQemuClient::queryFrame(void* vframe,
         return res;
     }
 
-    /* Copy requested frames. */
-    size_t cur_offset = 0;
-    const uint8_t* frame = reinterpret_cast<const uint8_t*>(query.mReplyData);
-    /* Video frame is always first. */
-    if (vframe != NULL && vframe_size != 0) {
-        /* Make sure that video frame is in. */
-        if ((query.mReplyDataSize - cur_offset) >= vframe_size) {
-            memcpy(vframe, frame, vframe_size);
-            cur_offset += vframe_size;
-        } else {
-            ALOGE("%s: Reply %zu bytes is to small to contain %zu bytes video frame",
-                 __FUNCTION__, query.mReplyDataSize - cur_offset, vframe_size);
-            return EINVAL;
-        }
-    }
-    if (pframe != NULL && pframe_size != 0) {
-        /* Make sure that preview frame is in. */
-        if ((query.mReplyDataSize - cur_offset) >= pframe_size) {
-            memcpy(pframe, frame + cur_offset, pframe_size);
-            cur_offset += pframe_size;
-        } else {
-            ALOGE("%s: Reply %zu bytes is to small to contain %zu bytes preview frame",
-                 __FUNCTION__, query.mReplyDataSize - cur_offset, pframe_size);
-            return EINVAL;
-        }
+    /* Make sure that the frames are in. */
+    if (query.mReplyScatteredSize != frames_size) {
+        ALOGE("%s: Reply %zu bytes is to small to contain %zu bytes of frames",
+             __FUNCTION__, query.mReplyDataSize, frames_size);
+        return EINVAL;
     }
     if (frame_time != nullptr) {
-        if (query.mReplyDataSize - cur_offset >= 8) {
-            *frame_time = *reinterpret_cast<const int64_t*>(frame + cur_offset);
-            cur_offset += 8;
+        if (query.mReplyDataSize >= 8) {
+            memcpy(frame_time, query.mReplyData, sizeof(*frame_time));
         } else {
             *frame_time = 0L;
         }
     }
 
+    /* Have the host produce and send the next frame while this one is being
+     * processed. */
+    if (mPrefetchEnabled &&
+        mPrefetchQuery.createRawQuery(query.mQuery, query.mQuerySize) == NO_ERROR &&
+        sendQuery(&mPrefetchQuery) == NO_ERROR) {
+        mPrefetchPending = true;
+    }
+
     return NO_ERROR;
 }
 
@@ -607,4 +926,101 @@ status_t CameraQemuClient::queryFrame(int width,
 
     return NO_ERROR;
 }
+
+bool CameraQemuClient::isFrameRingSupported() const
+{
+    return mBinaryProtocolVersion >= kBinaryRingVersion;
+}
+
+status_t CameraQemuClient::queryRingStart(uint32_t pixel_format,
+                                          int width,
+                                          int height,
+                                          const uint64_t* slot_offsets,
+                                          size_t slot_count,
+                                          size_t slot_size)
+{
+    ALOGV("%s: %.4s[%dx%d] %zu slots of %zu bytes", __FUNCTION__,
+          reinterpret_cast<const char*>(&pixel_format), width, height,
+          slot_count, slot_size);
+
+    if (!isFrameRingSupported()) {
+        return INVALID_OPERATION;
+    }
+    if (slot_count == 0 || slot_count > kMaxRingSlots) {
+        ALOGE("%s: Invalid slot count %zu", __FUNCTION__, slot_count);
+        return EINVAL;
+    }
+
+    BinaryRingStartQuery binary_query = {};
+    binary_query.magic = kBinaryRingStartMagic;
+    binary_query.version = mBinaryProtocolVersion;
+    binary_query.size = sizeof(binary_query);
+    binary_query.pixel_format = pixel_format;
+    binary_query.width = width;
+    binary_query.height = height;
+    binary_query.slot_size = slot_size;
+    binary_query.slot_count = slot_count;
+    memcpy(binary_query.slot_offsets, slot_offsets,
+           slot_count * sizeof(*slot_offsets));
+
+    QemuQuery query;
+    query.createRawQuery(&binary_query, sizeof(binary_query));
+    doQuery(&query);
+    const status_t res = query.getCompletionStatus();
+    ALOGE_IF(res != NO_ERROR, "%s: Query failed: %s",
+            __FUNCTION__, query.mReplyData ? query.mReplyData :
+                                             "No error message");
+    return res;
+}
+
+status_t CameraQemuClient::queryRingFrame(uint32_t pixel_format,
+                                          float r_scale,
+                                          float g_scale,
+                                          float b_scale,
+                                          float exposure_comp,
+                                          uint32_t* slot,
+                                          int64_t* frame_time)
+{
+    ALOGV("%s: %.4s", __FUNCTION__,
+          reinterpret_cast<const char*>(&pixel_format));
+
+    if (!isFrameRingSupported()) {
+        return INVALID_OPERATION;
+    }
+
+    BinaryRingFrameQuery binary_query;
+    binary_query.magic = kBinaryRingFrameMagic;
+    binary_query.version = mBinaryProtocolVersion;
+    binary_query.size = sizeof(binary_query);
+    binary_query.pixel_format = pixel_format;
+    binary_query.white_balance[0] = r_scale;
+    binary_query.white_balance[1] = g_scale;
+    binary_query.white_balance[2] = b_scale;
+    binary_query.exposure_comp = exposure_comp;
+
+    QemuQuery query;
+    query.createRawQuery(&binary_query, sizeof(binary_query));
+    doQuery(&query);
+    const status_t res = query.getCompletionStatus();
+    if (res != NO_ERROR) {
+        ALOGE("%s: Query failed: %s",
+             __FUNCTION__, query.mReplyData ? query.mReplyData :
+                                              "No error message");
+        return res;
+    }
+
+    BinaryRingFrameReply reply;
+    if (query.mReplyDataSize < sizeof(reply)) {
+        ALOGE("%s: Reply of %zu bytes is too small", __FUNCTION__,
+              query.mReplyDataSize);
+        return EINVAL;
+    }
+    memcpy(&reply, query.mReplyData, sizeof(reply));
+    *slot = reply.slot;
+    if (frame_time != nullptr) {
+        *frame_time = reply.frame_time;
+    }
+
+    return NO_ERROR;
+}
 }; /* namespace android */
@@ -17,6 +17,8 @@
 #ifndef HW_EMULATOR_CAMERA_QEMU_CLIENT_H
 #define HW_EMULATOR_CAMERA_QEMU_CLIENT_H
 
+#include <sys/uio.h>
+
 /*
  * Contains declaration of classes that encapsulate connection to camera services
  * in the emulator via qemu pipe.
@@ -69,6 +71,12 @@ namespace android {
  * only the result, it always ends with a zero-terminator. So, payload 'ok'/'ko'
  * prefix is always 3 bytes long: it either includes a zero-terminator, if there
  * is no data, or a ':' separator.
+ *
+ * Hosts that report a binary protocol version in reply to the 'protocol' query
+ * also accept a binary form of the 'frame' query. It starts with a magic value
+ * that no query name can start with, and is answered the same way as the text
+ * query. Such hosts also process queries in order as they arrive, so the next
+ * 'frame' query may be sent before the reply to the current one is consumed.
  */
 class QemuQuery {
 public:
@@ -108,6 +116,21 @@ public:
      */
     status_t createQuery(const char* name, const char* param);
 
+    /* Creates new query from raw bytes, such as a binary query.
+     * Param:
+     *  data, size - Query bytes to send.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t createRawQuery(const void* data, size_t size);
+
+    /* Checks if this query sends the same bytes as another one. */
+    bool isSameQuery(const QemuQuery& other) const;
+
+    /* Gets the query string for logging, or "<binary>" for a binary query,
+     * which isn't zero-terminated. */
+    const char* getLogString() const;
+
     /* Completes the query after a reply from the emulator.
      * This method will parse the reply buffer, and calculate the final query
      * status, which depends not only on the transport success / failure, but
@@ -164,6 +187,9 @@ public:
 public:
     /* Query string. */
     char*       mQuery;
+    /* Number of bytes to send for the query, including the zero-terminator of
+     * a query string. */
+    size_t      mQuerySize;
     /* Query delivery status. */
     status_t    mQueryDeliveryStatus;
     /* Reply buffer */
@@ -176,6 +202,10 @@ public:
     size_t      mReplyDataSize;
     /* Reply status: 1 - ok, 0 - ko. */
     int         mReplyStatus;
+    /* Number of reply data bytes that were received directly into the buffers
+     * passed to QemuClient::doQuery(). These bytes precede mReplyData, and are
+     * not in mReplyBuffer. */
+    size_t      mReplyScatteredSize;
 
     /****************************************************************************
      * Private data memebers
@@ -235,6 +265,15 @@ public:
      */
     virtual status_t connectClient(const char* param);
 
+    /* Connects to a stand-in for the camera service instead of the emulator,
+     * for example a test server on the other end of a socket pair.
+     * Param:
+     *  fd - Connected file descriptor, which this client takes ownership of.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    virtual status_t attachClient(int fd);
+
     /* Disconnects from the service. */
     virtual void disconnectClient();
 
@@ -262,6 +301,23 @@ public:
      */
     virtual status_t receiveMessage(void** data, size_t* data_size);
 
+    /* Receives the payload size that precedes every reply from the service.
+     * Param:
+     *  data_size - Upon success contains size of the payload that follows.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t receiveMessageSize(size_t* data_size);
+
+    /* Receives a part of the payload into buffers provided by the caller,
+     * filling them in order.
+     * Param:
+     *  iov, iovcnt - Buffers to receive the data into.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t receiveData(const struct iovec* iov, int iovcnt);
+
     /* Sends a query, and receives a response from the service.
      * Param:
      *  query - Query to send to the service. When this method returns, the query
@@ -277,6 +333,42 @@ public:
      */
     virtual status_t doQuery(QemuQuery* query);
 
+    /* Sends a query, and receives data of a successful response straight into
+     * buffers provided by the caller.
+     * If the response succeeds and carries enough data to fill all the buffers,
+     * the leading data is received into the buffers, and only the data that
+     * follows is placed in the query's reply buffer. Otherwise the response is
+     * received into the reply buffer as with doQuery() above. The query's
+     * mReplyScatteredSize tells which of the two has happened.
+     * Param:
+     *  query - Query to send to the service.
+     *  iov, iovcnt - Buffers to receive the response data into.
+     * Return:
+     *  Same as doQuery() above.
+     */
+    virtual status_t doQuery(QemuQuery* query,
+                             const struct iovec* iov,
+                             int iovcnt);
+
+    /* Sends a query without waiting for the response, which must be received
+     * with receiveReply() before the response to any later query.
+     * Param:
+     *  query - Query to send to the service. On failure the query is completed
+     *      with the error.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t sendQuery(QemuQuery* query);
+
+    /* Receives the response to a query sent with sendQuery(), and completes
+     * the query. Buffers are filled as described for doQuery() above.
+     * Return:
+     *  Same as doQuery() above.
+     */
+    status_t receiveReply(QemuQuery* query,
+                          const struct iovec* iov,
+                          int iovcnt);
+
     /****************************************************************************
      * Data members
      ***************************************************************************/
@@ -363,12 +455,31 @@ public:
      ***************************************************************************/
 
 public:
-    /* Queries camera connection.
+    /* Queries camera connection, and the binary protocol version of the host.
      * Return:
      *  NO_ERROR on success, or an appropriate error status on failure.
      */
     status_t queryConnect();
 
+    /* Enables or disables frame prefetch. With prefetch enabled, a query for
+     * the next video frame is sent as soon as a frame is received, and that
+     * frame is used by the next queryFrame() call made with the same frame
+     * sizes and adjustments. Prefetch is only available with hosts that speak
+     * the binary protocol, and is disabled on disconnection.
+     * Return:
+     *  NO_ERROR on success, or INVALID_OPERATION if the host doesn't support
+     *  prefetch.
+     */
+    status_t setFramePrefetch(bool enable);
+
+    void disconnectClient() override;
+
+    using QemuClient::doQuery;
+    /* Receives a prefetched frame that is still pending before the query. */
+    status_t doQuery(QemuQuery* query,
+                     const struct iovec* iov,
+                     int iovcnt) override;
+
     /* Queries camera disconnection.
      * Return:
      *  NO_ERROR on success, or an appropriate error status on failure.
@@ -394,6 +505,7 @@ public:
     status_t queryStop();
 
     /* Queries camera for the next video frame.
+     * The frames are received from the emulator directly into the buffers.
      * Param:
      *  vframe, vframe_size - Define buffer, allocated to receive a video frame.
      *      Any of these parameters can be 0, indicating that the caller is
@@ -431,7 +543,80 @@ public:
                         float exposure_comp,
                         int64_t* frame_time);
 
+    /* Whether the host supports frame rings. */
+    bool isFrameRingSupported() const;
+
+    /* Maximum number of slots in a frame ring. */
+    static const size_t kMaxRingSlots = 4;
+
+    /* Hands the host a ring of shared memory frame slots to fill with frames
+     * in the given format. Once the camera is started, the host keeps the
+     * latest frames in the slots the guest doesn't own, so that frames are
+     * not sent through the pipe at all. The ring is dropped when the camera
+     * is stopped. Frame rings need binary protocol version 2.
+     * Param:
+     *  pixel_format - Format of the frames in the slots.
+     *  width, height - Frame dimensions.
+     *  slot_offsets, slot_count - Offsets of the slots in the shared memory
+     *      region, as reported by cb_handle_t::getMmapedOffset().
+     *  slot_size - Size of each slot, large enough for a frame.
+     * Return:
+     *  NO_ERROR on success, INVALID_OPERATION if the host doesn't support
+     *  frame rings, or an appropriate error status on failure.
+     */
+    status_t queryRingStart(uint32_t pixel_format,
+                            int width,
+                            int height,
+                            const uint64_t* slot_offsets,
+                            size_t slot_count,
+                            size_t slot_size);
+
+    /* Queries the slot of the ring for pixel_format that holds the latest
+     * frame. The slot is owned by the guest, and left alone by the host,
+     * until the next queryRingFrame() call for the same ring.
+     * Param:
+     *  pixel_format - Format of the ring, as passed to queryRingStart().
+     *  r_scale, g_scale, b_scale - White balance scale.
+     *  exposure_comp - Expsoure compensation.
+     *  slot - Receives the index of the slot holding the frame.
+     *  frame_time - Receives the time at which the frame was produced.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status on failure.
+     */
+    status_t queryRingFrame(uint32_t pixel_format,
+                            float r_scale,
+                            float g_scale,
+                            float b_scale,
+                            float exposure_comp,
+                            uint32_t* slot,
+                            int64_t* frame_time);
+
 private:
+    /* Queries the binary protocol version supported by the host. */
+    status_t queryProtocol();
+
+    /* Creates a 'frame' query for frames of the given sizes, binary if the
+     * host supports it. */
+    void createFrameQuery(QemuQuery* query,
+                          size_t video_size,
+                          size_t preview_size,
+                          float r_scale,
+                          float g_scale,
+                          float b_scale,
+                          float exposure_comp,
+                          bool frame_time);
+
+    /* Receives and drops the reply to a pending prefetch query. */
+    void cancelPrefetch();
+
+    /* Binary protocol version of the host, 0 if it only takes text queries. */
+    uint32_t    mBinaryProtocolVersion;
+    /* Whether to query the next frame as soon as a frame is received. */
+    bool        mPrefetchEnabled;
+    /* Whether mPrefetchQuery was sent, and its reply is yet to be received. */
+    bool        mPrefetchPending;
+    QemuQuery   mPrefetchQuery;
+
     /* Connect to the camera. */
     static const char mQueryConnect[];
     /* Disconnect from the camera. */
@@ -442,6 +627,8 @@ private:
     static const char mQueryStop[];
     /* Query frame(s). */
     static const char mQueryFrame[];
+    /* Query binary protocol version. */
+    static const char mQueryProtocol[];
 };
 
 }; /* namespace android */
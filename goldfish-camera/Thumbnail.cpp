@@ -78,10 +78,10 @@ static bool createRawThumbnail(const unsigned char* sourceImage,
     return true;
 }
 
-bool createThumbnail(const unsigned char* sourceImage,
+bool createThumbnail(NV21JpegCompressor* compressor,
+                     const unsigned char* sourceImage,
                      int sourceWidth, int sourceHeight,
-                     int thumbWidth, int thumbHeight, int quality,
-                     ExifData* exifData) {
+                     int thumbWidth, int thumbHeight, int quality) {
     if (thumbWidth <= 0 || thumbHeight <= 0) {
         ALOGE("%s: Invalid thumbnail width=%d or height=%d, must be > 0",
               __FUNCTION__, thumbWidth, thumbHeight);
@@ -97,14 +97,25 @@ bool createThumbnail(const unsigned char* sourceImage,
     }
 
     // And then compress it into JPEG format without any EXIF data
-    NV21JpegCompressor compressor;
-    status_t result = compressor.compressRawImage(&rawThumbnail[0],
-                                                  thumbWidth, thumbHeight,
-                                                  quality, nullptr /* EXIF */);
+    status_t result = compressor->compressRawImage(&rawThumbnail[0],
+                                                   thumbWidth, thumbHeight,
+                                                   quality, nullptr /* EXIF */);
     if (result != NO_ERROR) {
         ALOGE("%s: Unable to compress thumbnail", __FUNCTION__);
         return false;
     }
+    return true;
+}
+
+bool createThumbnail(const unsigned char* sourceImage,
+                     int sourceWidth, int sourceHeight,
+                     int thumbWidth, int thumbHeight, int quality,
+                     ExifData* exifData) {
+    NV21JpegCompressor compressor;
+    if (!createThumbnail(&compressor, sourceImage, sourceWidth, sourceHeight,
+                         thumbWidth, thumbHeight, quality)) {
+        return false;
+    }
 
     // And finally put it in the EXIF data. This transfers ownership of the
     // malloc'd memory to the EXIF data structure. As long as the EXIF data
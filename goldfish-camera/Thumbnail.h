@@ -22,6 +22,8 @@ typedef struct _ExifData ExifData;
 
 namespace android {
 
+class NV21JpegCompressor;
+
 /* Create a thumbnail from NV21 source data in |sourceImage| with the given
  * dimensions. The resulting thumbnail is JPEG compressed and a pointer and size
  * is placed in |exifData| which takes ownership of the allocated memory.
@@ -31,6 +33,15 @@ bool createThumbnail(const unsigned char* sourceImage,
                      int thumbnailWidth, int thumbnailHeight, int quality,
                      ExifData* exifData);
 
+/* Create a thumbnail like the above, but only compress it with |compressor|,
+ * which holds the JPEG data afterwards. This allows keeping the compressor
+ * across captures.
+ */
+bool createThumbnail(NV21JpegCompressor* compressor,
+                     const unsigned char* sourceImage,
+                     int sourceWidth, int sourceHeight,
+                     int thumbnailWidth, int thumbnailHeight, int quality);
+
 }  // namespace android
 
 #endif  // GOLDFISH_CAMERA_THUMBNAIL_H
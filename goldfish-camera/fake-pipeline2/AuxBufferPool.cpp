@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_AuxBufferPool"
+
+#include <log/log.h>
+#include <ui/Rect.h>
+
+#include "AuxBufferPool.h"
+
+namespace android {
+
+AuxBufferPool::AuxBufferPool(GraphicBufferMapper* gbm):
+        mGBA(&GraphicBufferAllocator::get()),
+        mGBM(gbm) {
+}
+
+AuxBufferPool::~AuxBufferPool() {
+    clear();
+}
+
+status_t AuxBufferPool::reserve(uint32_t width, uint32_t height,
+        uint32_t format, Type type, size_t count) {
+    Mutex::Autolock lock(mMutex);
+    const Key key(width, height, format, type);
+    auto it = mSlots.find(key);
+    if (it == mSlots.end()) {
+        it = mSlots.emplace(key, Slot{std::vector<Entry>(), 0}).first;
+    }
+    Slot &slot = it->second;
+    slot.capacity = count;
+    while (slot.idle.size() < count) {
+        Entry entry;
+        status_t res = allocateBuffer(key, &entry);
+        if (res != OK) return res;
+        slot.idle.push_back(entry);
+    }
+    while (slot.idle.size() > count) {
+        freeBuffer(slot.idle.back());
+        slot.idle.pop_back();
+    }
+    ALOGV("%s: %zu buffers of %dx%d, format %x, type %d", __FUNCTION__,
+            count, width, height, format, type);
+    return OK;
+}
+
+status_t AuxBufferPool::acquire(StreamBuffer *b, Type type) {
+    Mutex::Autolock lock(mMutex);
+    const Key key(b->width, b->height, b->format, type);
+    Entry entry;
+    auto it = mSlots.find(key);
+    if (it != mSlots.end() && !it->second.idle.empty()) {
+        entry = it->second.idle.back();
+        it->second.idle.pop_back();
+    } else {
+        ALOGV("%s: No pooled %dx%d buffer, allocating", __FUNCTION__,
+                b->width, b->height);
+        status_t res = allocateBuffer(key, &entry);
+        if (res != OK) return res;
+    }
+    b->buffer = entry.buffer;
+    b->img = entry.img;
+    return OK;
+}
+
+void AuxBufferPool::release(const StreamBuffer &b) {
+    Mutex::Autolock lock(mMutex);
+    const Key key(b.width, b.height, b.format,
+            b.buffer == nullptr ? HEAP : GRALLOC);
+    const Entry entry = {b.buffer, b.img};
+    auto it = mSlots.find(key);
+    if (it == mSlots.end()) {
+        it = mSlots.emplace(key,
+                Slot{std::vector<Entry>(), kDefaultCapacity}).first;
+    }
+    Slot &slot = it->second;
+    if (slot.idle.size() < slot.capacity) {
+        slot.idle.push_back(entry);
+    } else {
+        freeBuffer(entry);
+    }
+}
+
+void AuxBufferPool::clear() {
+    Mutex::Autolock lock(mMutex);
+    for (auto &it : mSlots) {
+        for (const Entry &entry : it.second.idle) {
+            freeBuffer(entry);
+        }
+    }
+    mSlots.clear();
+}
+
+status_t AuxBufferPool::allocateBuffer(const Key &key, Entry *entry) {
+    const uint32_t width = std::get<0>(key);
+    const uint32_t height = std::get<1>(key);
+    const uint32_t format = std::get<2>(key);
+
+    if (std::get<3>(key) == HEAP) {
+        entry->buffer = nullptr;
+        entry->img = new uint8_t[width * height * 3];
+        return OK;
+    }
+
+    const uint64_t usage =
+        GRALLOC_USAGE_HW_CAMERA_READ |
+        GRALLOC_USAGE_HW_CAMERA_WRITE |
+        GRALLOC_USAGE_HW_TEXTURE;
+    const uint64_t graphicBufferId = 0; // not used
+    const uint32_t layerCount = 1;
+    buffer_handle_t handle;
+    uint32_t stride;
+
+    status_t res = mGBA->allocate(width, height, format, layerCount, usage,
+            &handle, &stride, graphicBufferId, "AuxBufferPool");
+    if (res != OK) {
+        ALOGE("%s: Unable to allocate %dx%d buffer: %d", __FUNCTION__,
+                width, height, res);
+        return res;
+    }
+
+    android_ycbcr ycbcr = {};
+    res = mGBM->lockYCbCr(handle, GRALLOC_USAGE_HW_CAMERA_WRITE,
+            Rect(0, 0, width, height), &ycbcr);
+    if (res != OK) {
+        ALOGE("%s: Unable to lock %dx%d buffer: %d", __FUNCTION__,
+                width, height, res);
+        mGBM->freeBuffer(handle);
+        return res;
+    }
+
+    entry->buffer = new buffer_handle_t;
+    *entry->buffer = handle;
+    entry->img = (uint8_t*)ycbcr.y;
+    return OK;
+}
+
+void AuxBufferPool::freeBuffer(const Entry &entry) {
+    if (entry.buffer == nullptr) {
+        delete[] entry.img;
+        return;
+    }
+    mGBM->unlock(*entry.buffer);
+    mGBM->freeBuffer(*entry.buffer);
+    delete entry.buffer;
+}
+
+} // namespace android
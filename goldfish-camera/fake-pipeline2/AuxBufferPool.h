@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A pool of the auxiliary buffers that sensors capture into before JPEG
+ * compression. Buffers are keyed by size, format and backing (heap memory or
+ * a locked gralloc buffer), handed out by the sensor thread with acquire(),
+ * and returned by the JPEG compressor with release() once it is done with
+ * them, so still captures don't allocate a multi-megabyte buffer per frame.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
+#define HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "utils/Mutex.h"
+#include "utils/RefBase.h"
+
+#include "Base.h"
+#include <ui/GraphicBufferAllocator.h>
+#include <ui/GraphicBufferMapper.h>
+
+namespace android {
+
+class AuxBufferPool: public virtual RefBase {
+  public:
+    enum Type {
+        // Plain memory, buffer is NULL and img points to the pixels.
+        HEAP,
+        // A gralloc buffer kept locked for CPU writes while it is pooled.
+        GRALLOC,
+    };
+
+    // gbm is only needed for GRALLOC buffers and may be NULL otherwise.
+    explicit AuxBufferPool(GraphicBufferMapper* gbm);
+    ~AuxBufferPool();
+
+    // Allocate buffers up front so that at least count buffers of this kind
+    // are available, and keep up to count of them once they are released.
+    status_t reserve(uint32_t width, uint32_t height, uint32_t format,
+            Type type, size_t count);
+
+    // Fill in buffer and img of b for a buffer of b->width x b->height in
+    // b->format, reusing a pooled buffer if one is available.
+    status_t acquire(StreamBuffer *b, Type type);
+
+    // Return a buffer obtained from acquire().
+    void release(const StreamBuffer &b);
+
+    // Free all pooled buffers and forget previous reservations. Buffers that
+    // are acquired at the time are treated as unreserved when released.
+    void clear();
+
+  private:
+    typedef std::tuple<uint32_t, uint32_t, uint32_t, Type> Key;
+
+    struct Entry {
+        buffer_handle_t *buffer;
+        uint8_t *img;
+    };
+
+    // Buffers that are not in use, and how many of them to keep per key.
+    struct Slot {
+        std::vector<Entry> idle;
+        size_t capacity;
+    };
+
+    // Buffers released to a key that was never reserved are still recycled,
+    // keeping this many around.
+    static const size_t kDefaultCapacity = 1;
+
+    status_t allocateBuffer(const Key &key, Entry *entry);
+    void freeBuffer(const Entry &entry);
+
+    Mutex mMutex;
+    GraphicBufferAllocator* mGBA;
+    GraphicBufferMapper* mGBM;
+    std::map<Key, Slot> mSlots;
+};
+
+} // namespace android
+
+#endif // HW_EMULATOR_CAMERA2_AUX_BUFFER_POOL_H
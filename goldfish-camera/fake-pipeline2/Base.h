@@ -43,6 +43,34 @@ struct StreamBuffer {
 };
 typedef Vector<StreamBuffer> Buffers;
 
+/* Part of a frame that a stream is scaled from */
+struct FrameCrop {
+    uint32_t x, y;
+    uint32_t width, height;
+};
+
+/* Largest centered part of a srcWidth x srcHeight frame with the aspect ratio
+ * of a width x height stream. The offsets and sizes are even, so that the crop
+ * also applies to subsampled 4:2:0 chroma planes. */
+inline FrameCrop getCenterCrop(uint32_t srcWidth, uint32_t srcHeight,
+        uint32_t width, uint32_t height) {
+    FrameCrop crop = {0, 0, srcWidth, srcHeight};
+    if (width == 0 || height == 0) {
+        return crop;
+    }
+    // Compare srcWidth / srcHeight with width / height.
+    const uint64_t srcAspect = (uint64_t)srcWidth * height;
+    const uint64_t aspect = (uint64_t)width * srcHeight;
+    if (srcAspect > aspect) {
+        crop.width = (uint32_t)(aspect / height) & ~1u;
+    } else if (srcAspect < aspect) {
+        crop.height = (uint32_t)(srcAspect / width) & ~1u;
+    }
+    crop.x = ((srcWidth - crop.width) / 2) & ~1u;
+    crop.y = ((srcHeight - crop.height) / 2) & ~1u;
+    return crop;
+}
+
 struct Stream {
     const camera2_stream_ops_t *ops;
     uint32_t width, height;
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+//#define LOG_NNDEBUG 0
+#define LOG_TAG "EmulatedCamera2_FramePacer"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+
+#ifdef LOG_NNDEBUG
+#define ALOGVV(...) ALOGV(__VA_ARGS__)
+#else
+#define ALOGVV(...) ((void)0)
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include "FramePacer.h"
+
+namespace android {
+
+// Wakeup latency, up to 50 us is as good as it gets in the emulator
+static const nsecs_t kWakeupLatencyBounds[] = {
+    50000, 100000, 250000, 500000, 1000000, 2000000, 5000000,
+};
+
+static const nsecs_t kOverrunBounds[] = {
+    1000000, 2000000, 5000000, 10000000, 20000000, 50000000, 100000000,
+};
+
+FramePacer::FramePacer():
+        mFrameStart(0),
+        mFrameEnd(0),
+        mFrames(0) {
+    static_assert(sizeof(kWakeupLatencyBounds) == sizeof(Histogram::bounds),
+            "Wakeup latency histogram has the wrong number of buckets");
+    static_assert(sizeof(kOverrunBounds) == sizeof(Histogram::bounds),
+            "Overrun histogram has the wrong number of buckets");
+    for (size_t i = 0; i < kBucketCount - 1; i++) {
+        mWakeupLatency.bounds[i] = kWakeupLatencyBounds[i];
+        mOverrun.bounds[i] = kOverrunBounds[i];
+    }
+    reset();
+}
+
+void FramePacer::reset() {
+    mFrameStart = 0;
+    mFrameEnd = 0;
+
+    Mutex::Autolock lock(mStatsMutex);
+    mFrames = 0;
+    clear(&mWakeupLatency);
+    clear(&mOverrun);
+}
+
+nsecs_t FramePacer::beginFrame(nsecs_t frameDuration) {
+    mFrameStart = (mFrameEnd != 0) ? mFrameEnd : systemTime();
+    mFrameEnd = mFrameStart + frameDuration;
+    return mFrameStart;
+}
+
+void FramePacer::endFrame() {
+    // systemTime() is CLOCK_MONOTONIC, so deadlines are in the same clock
+    nsecs_t now = systemTime();
+    if (now >= mFrameEnd) {
+        const nsecs_t overrun = now - mFrameEnd;
+        ALOGVV("%s: Frame overran by %" PRId64 " us", __FUNCTION__,
+                overrun / 1000);
+        mFrameEnd = now;
+
+        Mutex::Autolock lock(mStatsMutex);
+        mFrames++;
+        mOverrun.add(overrun);
+        return;
+    }
+
+    timespec deadline;
+    deadline.tv_sec = mFrameEnd / 1000000000L;
+    deadline.tv_nsec = mFrameEnd % 1000000000L;
+    int ret;
+    do {
+        ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                nullptr);
+    } while (ret == EINTR);
+    if (ret != 0) {
+        ALOGE("%s: Unable to sleep until the end of the frame: %d",
+                __FUNCTION__, ret);
+    }
+
+    const nsecs_t latency = systemTime() - mFrameEnd;
+    ATRACE_INT("Sensor wakeup latency (us)", latency / 1000);
+
+    Mutex::Autolock lock(mStatsMutex);
+    mFrames++;
+    mWakeupLatency.add(latency);
+}
+
+void FramePacer::dump(int fd, int indent) const {
+    Mutex::Autolock lock(mStatsMutex);
+    uint32_t overruns = 0;
+    for (size_t i = 0; i < kBucketCount; i++) {
+        overruns += mOverrun.counts[i];
+    }
+    dprintf(fd, "%*sFrames: %u, overruns: %u\n", indent, "", mFrames,
+            overruns);
+    mWakeupLatency.dump(fd, indent, "Wakeup latency after the deadline");
+    mOverrun.dump(fd, indent, "Overruns past the deadline");
+}
+
+void FramePacer::clear(Histogram *histogram) {
+    for (size_t i = 0; i < kBucketCount; i++) {
+        histogram->counts[i] = 0;
+    }
+    histogram->max = 0;
+}
+
+void FramePacer::Histogram::add(nsecs_t value) {
+    size_t i = 0;
+    while (i < kBucketCount - 1 && value >= bounds[i]) {
+        i++;
+    }
+    counts[i]++;
+    if (value > max) {
+        max = value;
+    }
+}
+
+void FramePacer::Histogram::dump(int fd, int indent, const char *name) const {
+    dprintf(fd, "%*s%s, max %" PRId64 " us:\n", indent, "", name, max / 1000);
+    for (size_t i = 0; i < kBucketCount; i++) {
+        if (i < kBucketCount - 1) {
+            dprintf(fd, "%*s  < %6" PRId64 " us: %u\n", indent, "",
+                    bounds[i] / 1000, counts[i]);
+        } else {
+            dprintf(fd, "%*s  >= %5" PRId64 " us: %u\n", indent, "",
+                    bounds[i - 1] / 1000, counts[i]);
+        }
+    }
+}
+
+} // namespace android
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Frame timing of an emulated sensor thread. Each frame ends at an absolute
+ * deadline one frame duration after the previous deadline, rather than one
+ * frame duration after the sensor thread woke up, so the time lost waking up
+ * doesn't add up over a recording. Only a frame that is rendered past its
+ * deadline moves the grid, since catching up would make a burst of frames.
+ *
+ * Keeps histograms of how late the sensor thread wakes up after a deadline
+ * and of how far overrunning frames go past theirs, for dump().
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_FRAME_PACER_H
+#define HW_EMULATOR_CAMERA2_FRAME_PACER_H
+
+#include "utils/Mutex.h"
+#include "utils/Timers.h"
+
+namespace android {
+
+class FramePacer {
+  public:
+    FramePacer();
+
+    // Forget the grid; the next frame starts whenever beginFrame() is called.
+    void reset();
+
+    // Start a frame of frameDuration, and return the time it starts at.
+    nsecs_t beginFrame(nsecs_t frameDuration);
+
+    // Sleep until the end of the frame started last.
+    void endFrame();
+
+    // Write the frame timing statistics to fd, indented by indent spaces.
+    void dump(int fd, int indent) const;
+
+  private:
+    static const size_t kBucketCount = 8;
+    struct Histogram {
+        // Upper bounds of all buckets but the last, which has none
+        nsecs_t  bounds[kBucketCount - 1];
+        uint32_t counts[kBucketCount];
+        nsecs_t  max;
+
+        void add(nsecs_t value);
+        void dump(int fd, int indent, const char *name) const;
+    };
+
+    static void clear(Histogram *histogram);
+
+    // Only the sensor thread uses these
+    nsecs_t mFrameStart;
+    nsecs_t mFrameEnd;
+
+    // Lock before accessing the statistics
+    mutable Mutex mStatsMutex;
+    uint32_t  mFrames;
+    Histogram mWakeupLatency;
+    Histogram mOverrun;
+};
+
+} // namespace android
+
+#endif // HW_EMULATOR_CAMERA2_FRAME_PACER_H
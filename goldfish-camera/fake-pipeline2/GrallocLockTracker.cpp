@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_GrallocLockTracker"
+
+#include <log/log.h>
+#include <ui/Rect.h>
+
+#include "GrallocLockTracker.h"
+
+namespace android {
+
+GrallocLockTracker::GrallocLockTracker(GraphicBufferMapper* gbm,
+        uint32_t usage):
+        mGBM(gbm),
+        mUsage(usage) {
+}
+
+GrallocLockTracker::~GrallocLockTracker() {
+    clear();
+}
+
+status_t GrallocLockTracker::lock(buffer_handle_t handle, bool ycbcr,
+        uint32_t width, uint32_t height, uint8_t **img) {
+    Mutex::Autolock lock(mMutex);
+    if (mLocked.find(handle) != mLocked.end()) {
+        ALOGE("%s: Buffer %p is already locked", __FUNCTION__, handle);
+        return INVALID_OPERATION;
+    }
+    if (mLocked.size() >= kMaxLocked) {
+        ALOGE("%s: Too many buffers locked (%zu)", __FUNCTION__,
+                mLocked.size());
+        return NO_MEMORY;
+    }
+
+    const uint32_t usage = mUsage | GRALLOC_USAGE_SW_WRITE_OFTEN;
+    uint8_t *mapping = nullptr;
+    status_t res;
+    if (ycbcr) {
+        android_ycbcr layout = {};
+        res = mGBM->lockYCbCr(handle, usage, Rect(0, 0, width, height),
+                &layout);
+        // This is only valid because we know that emulator's
+        // YCbCr_420_888 is really contiguous NV21 under the hood
+        mapping = static_cast<uint8_t*>(layout.y);
+    } else {
+        res = mGBM->lock(handle, usage, Rect(0, 0, width, height),
+                (void**)&mapping);
+    }
+    if (res != OK) {
+        return res;
+    }
+
+    ALOGV("%s: Locked buffer %p", __FUNCTION__, handle);
+    mLocked.emplace(handle, mapping);
+    *img = mapping;
+    return OK;
+}
+
+void GrallocLockTracker::unlock(buffer_handle_t handle) {
+    Mutex::Autolock lock(mMutex);
+    auto it = mLocked.find(handle);
+    if (it == mLocked.end()) {
+        ALOGE("%s: Buffer %p is not locked", __FUNCTION__, handle);
+        return;
+    }
+    mGBM->unlock(handle);
+    mLocked.erase(it);
+}
+
+void GrallocLockTracker::clear() {
+    Mutex::Autolock lock(mMutex);
+    for (const auto &it : mLocked) {
+        mGBM->unlock(it.first);
+    }
+    mLocked.clear();
+}
+
+} // namespace android
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * The output buffers of one camera3 stream that are locked for writing a
+ * frame. Every buffer is locked for one frame only, and unlocked before it
+ * goes back to the framework. Keeping buffers mapped for the life of the
+ * stream was tried and dropped: the framework may free a buffer as soon as
+ * it has it back, a freed handle can be reused for a new buffer, and gralloc
+ * doesn't allow a buffer to be handed back while locked. Buffers are locked
+ * write-only, so that the stale contents of a buffer backed by a host color
+ * buffer aren't read back first.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_GRALLOC_LOCK_TRACKER_H
+#define HW_EMULATOR_CAMERA2_GRALLOC_LOCK_TRACKER_H
+
+#include <map>
+
+#include "utils/Mutex.h"
+#include "utils/RefBase.h"
+
+#include <ui/GraphicBufferMapper.h>
+
+namespace android {
+
+class GrallocLockTracker: public virtual RefBase {
+  public:
+    // usage is added to the CPU usage buffers are locked with.
+    explicit GrallocLockTracker(GraphicBufferMapper* gbm, uint32_t usage = 0);
+    ~GrallocLockTracker();
+
+    // Get a CPU mapping of a width x height buffer for writing a frame.
+    // Flexible YUV buffers are mapped with lockYCbCr(), and img then points
+    // to the start of their contiguous NV21 planes.
+    status_t lock(buffer_handle_t handle, bool ycbcr, uint32_t width,
+            uint32_t height, uint8_t **img);
+
+    // Done writing a frame to a buffer obtained from lock().
+    void unlock(buffer_handle_t handle);
+
+    // Unlock all buffers still locked, after an aborted frame.
+    void clear();
+
+  private:
+    // More buffers than a stream can have in flight, so that a caller that
+    // doesn't unlock its buffers fails instead of piling up locks.
+    static const size_t kMaxLocked = 32;
+
+    Mutex mMutex;
+    GraphicBufferMapper* mGBM;
+    const uint32_t mUsage;
+    std::map<buffer_handle_t, uint8_t*> mLocked;
+};
+
+} // namespace android
+
+#endif // HW_EMULATOR_CAMERA2_GRALLOC_LOCK_TRACKER_H
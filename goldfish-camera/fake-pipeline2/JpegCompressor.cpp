@@ -23,19 +23,48 @@
 #include "JpegCompressor.h"
 #include "../EmulatedFakeCamera2.h"
 #include "../EmulatedFakeCamera3.h"
-#include "../Exif.h"
 #include "../Thumbnail.h"
 #include "hardware/camera3.h"
 
 namespace android {
 
-JpegCompressor::JpegCompressor(GraphicBufferMapper* gbm):
+// Insert an APP1 segment holding the exifBlockSize byte EXIF block into the
+// size byte JPEG image at jpeg, right after its SOI and JFIF APP0 segments,
+// which is where the encoder writes it when given the EXIF data up front.
+static status_t insertExifData(uint8_t *jpeg, size_t *size, size_t capacity,
+        const unsigned char *exifBlock, size_t exifBlockSize) {
+    // Marker, then a length that counts itself
+    const size_t segmentSize = 4 + exifBlockSize;
+    if (exifBlockSize + 2 > 0xFFFF || *size + segmentSize > capacity) {
+        ALOGE("%s: No room for %zu bytes of EXIF data", __FUNCTION__,
+                exifBlockSize);
+        return NO_MEMORY;
+    }
+
+    size_t offset = 2;
+    if (*size >= 6 && jpeg[2] == 0xFF && jpeg[3] == JPEG_APP0) {
+        offset += 2 + ((jpeg[4] << 8) | jpeg[5]);
+    }
+    memmove(jpeg + offset + segmentSize, jpeg + offset, *size - offset);
+    jpeg[offset] = 0xFF;
+    jpeg[offset + 1] = JPEG_APP0 + 1;
+    jpeg[offset + 2] = (exifBlockSize + 2) >> 8;
+    jpeg[offset + 3] = (exifBlockSize + 2) & 0xFF;
+    memcpy(jpeg + offset + 4, exifBlock, exifBlockSize);
+    *size += segmentSize;
+    return OK;
+}
+
+JpegCompressor::JpegCompressor(const sp<AuxBufferPool> &auxBufferPool):
         Thread(false),
         mIsBusy(false),
         mSynchronous(false),
         mBuffers(NULL),
         mListener(NULL),
-        mGBM(gbm) {
+        mAuxBufferPool(auxBufferPool),
+        mEncodePool(2),
+        mFoundJpeg(false),
+        mFoundAux(false) {
 }
 
 JpegCompressor::~JpegCompressor() {
@@ -52,6 +81,16 @@ status_t JpegCompressor::reserve() {
     return OK;
 }
 
+void JpegCompressor::unreserve() {
+    Mutex::Autolock busyLock(mBusyMutex);
+    if (mBuffers != NULL) {
+        ALOGE("%s: Compression already started!", __FUNCTION__);
+        return;
+    }
+    mIsBusy = false;
+    mDone.signal();
+}
+
 status_t JpegCompressor::start(Buffers *buffers, JpegListener *listener, CameraMetadata* settings) {
     if (listener == NULL) {
         ALOGE("%s: NULL listener not allowed!", __FUNCTION__);
@@ -79,6 +118,7 @@ status_t JpegCompressor::start(Buffers *buffers, JpegListener *listener, CameraM
         ALOGE("%s: Unable to start up compression thread: %s (%d)",
                 __FUNCTION__, strerror(-res), res);
         delete mBuffers;
+        mBuffers = NULL;
     }
     return res;
 }
@@ -132,7 +172,8 @@ bool JpegCompressor::threadLoop() {
 status_t JpegCompressor::compress() {
     // Find source and target buffers. Assumes only one buffer matches
     // each condition!
-    bool mFoundAux = false;
+    mFoundJpeg = false;
+    mFoundAux = false;
     int thumbWidth = 0, thumbHeight = 0;
     unsigned char thumbJpegQuality = 90;
     unsigned char jpegQuality = 90;
@@ -155,8 +196,6 @@ status_t JpegCompressor::compress() {
         return BAD_VALUE;
     }
 
-    // Create EXIF data and compress thumbnail
-    ExifData* exifData = createExifData(mSettings, mAuxBuffer.width, mAuxBuffer.height);
     entry = mSettings.find(ANDROID_JPEG_THUMBNAIL_SIZE);
     if (entry.count > 0) {
         thumbWidth = entry.data.i32[0];
@@ -166,35 +205,65 @@ status_t JpegCompressor::compress() {
     if (entry.count > 0) {
         thumbJpegQuality = entry.data.u8[0];
     }
-    if (thumbWidth > 0 && thumbHeight > 0) {
-        createThumbnail(static_cast<const unsigned char*>(mAuxBuffer.img),
-                        mAuxBuffer.width, mAuxBuffer.height,
-                        thumbWidth, thumbHeight,
-                        thumbJpegQuality, exifData);
-    }
-
-    // Compress the image
     entry = mSettings.find(ANDROID_JPEG_QUALITY);
     if (entry.count > 0) {
         jpegQuality = entry.data.u8[0];
     }
-    NV21JpegCompressor nV21JpegCompressor;
-    nV21JpegCompressor.compressRawImage((void*)mAuxBuffer.img,
-                                         mAuxBuffer.width,
-                                         mAuxBuffer.height,
-                                         jpegQuality, exifData);
-    nV21JpegCompressor.getCompressedImage((void*)mJpegBuffer.img);
+
+    // The encoder writes straight into the BLOB buffer, leaving room for the
+    // transport header at its end. The thumbnail, if any, is downscaled and
+    // encoded alongside the main image, and the APP1 segment carrying the
+    // EXIF data and thumbnail is spliced in once both are done.
+    const cb_handle_t *cb = cb_handle_t::from(*mJpegBuffer.buffer);
+    const size_t jpegBufferSize = cb->width;
+    const size_t jpegCapacity = jpegBufferSize - sizeof(camera3_jpeg_blob_t);
+    status_t res;
+    mThumbnail.clear();
+    std::vector<RenderPool::Job> jobs;
+    jobs.push_back([&]() {
+        res = mJpegEncoder.compressRawImage((void*)mAuxBuffer.img,
+                mAuxBuffer.width, mAuxBuffer.height, jpegQuality,
+                nullptr /* EXIF */, (void*)mJpegBuffer.img, jpegCapacity);
+    });
+    if (thumbWidth > 0 && thumbHeight > 0) {
+        jobs.push_back([&]() {
+            if (createThumbnail(&mThumbnailEncoder,
+                    static_cast<const unsigned char*>(mAuxBuffer.img),
+                    mAuxBuffer.width, mAuxBuffer.height,
+                    thumbWidth, thumbHeight, thumbJpegQuality)) {
+                mThumbnail.resize(mThumbnailEncoder.getCompressedSize());
+                mThumbnailEncoder.getCompressedImage(mThumbnail.data());
+            }
+        });
+    }
+    mEncodePool.run(jobs);
+
+    size_t jpegSize = mJpegEncoder.getCompressedSize();
+    if (res == NO_ERROR) {
+        if (mExifTemplate.generate(mSettings, mAuxBuffer.width,
+                mAuxBuffer.height, mThumbnail.data(), mThumbnail.size(),
+                &mExifBlock)) {
+            res = insertExifData(mJpegBuffer.img, &jpegSize, jpegCapacity,
+                    mExifBlock.data(), mExifBlock.size());
+        } else {
+            res = NO_MEMORY;
+        }
+    }
+    if (res != NO_ERROR) {
+        ALOGE("%s: Unable to compress %dx%d image into %zu bytes",
+                __FUNCTION__, mAuxBuffer.width, mAuxBuffer.height,
+                jpegBufferSize);
+        return res;
+    }
 
     // Refer to /hardware/libhardware/include/hardware/camera3.h
     // Transport header for compressed JPEG buffers in output streams.
     camera3_jpeg_blob_t jpeg_blob;
-    const cb_handle_t *cb = cb_handle_t::from(*mJpegBuffer.buffer);
     jpeg_blob.jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
-    jpeg_blob.jpeg_size = nV21JpegCompressor.getCompressedSize();
-    memcpy(mJpegBuffer.img + cb->width - sizeof(camera3_jpeg_blob_t),
+    jpeg_blob.jpeg_size = jpegSize;
+    memcpy(mJpegBuffer.img + jpegBufferSize - sizeof(camera3_jpeg_blob_t),
            &jpeg_blob, sizeof(camera3_jpeg_blob_t));
 
-    freeExifData(exifData);
     return OK;
 }
 
@@ -228,14 +297,7 @@ void JpegCompressor::cleanUp() {
 
     if (mFoundAux) {
         if (mAuxBuffer.streamId == 0) {
-            if (mAuxBuffer.buffer == nullptr) {
-                delete[] mAuxBuffer.img;
-            } else {
-                buffer_handle_t buffer = *mAuxBuffer.buffer;
-
-                mGBM->unlock(buffer);
-                mGBM->freeBuffer(buffer);
-            }
+            mAuxBufferPool->release(mAuxBuffer);
         } else if (!mSynchronous) {
             mListener->onJpegInputDone(mAuxBuffer);
         }
@@ -245,6 +307,7 @@ void JpegCompressor::cleanUp() {
     }
 
     mBuffers = NULL;
+    mFoundAux = false;
 
     mIsBusy = false;
     mDone.signal();
@@ -28,10 +28,12 @@
 #include "utils/Mutex.h"
 #include "utils/Timers.h"
 
+#include "AuxBufferPool.h"
 #include "Base.h"
+#include "RenderPool.h"
+#include "../Exif.h"
 #include "../JpegCompressor.h"
 #include <CameraMetadata.h>
-#include <ui/GraphicBufferMapper.h>
 
 #include <stdio.h>
 
@@ -46,7 +48,8 @@ namespace android {
 class JpegCompressor: private Thread, public virtual RefBase {
   public:
 
-    JpegCompressor(GraphicBufferMapper* gbm);
+    // Auxiliary input buffers are returned to auxBufferPool once compressed
+    JpegCompressor(const sp<AuxBufferPool> &auxBufferPool);
     ~JpegCompressor();
 
     struct JpegListener {
@@ -77,6 +80,9 @@ class JpegCompressor: private Thread, public virtual RefBase {
     // Reserve the compressor for a later start() call.
     status_t reserve();
 
+    // Give up a reservation that won't be followed by start().
+    void unreserve();
+
     // TODO: Measure this
     static const size_t kMaxJpegSize = 675000;
 
@@ -90,7 +96,16 @@ class JpegCompressor: private Thread, public virtual RefBase {
 
     Buffers *mBuffers;
     JpegListener *mListener;
-    GraphicBufferMapper *mGBM;
+    sp<AuxBufferPool> mAuxBufferPool;
+
+    // Kept across captures so their libjpeg state is set up only once
+    NV21JpegCompressor mJpegEncoder;
+    NV21JpegCompressor mThumbnailEncoder;
+    // Encodes the thumbnail while this thread encodes the main image
+    RenderPool mEncodePool;
+    ExifTemplate mExifTemplate;
+    std::vector<unsigned char> mThumbnail;
+    std::vector<unsigned char> mExifBlock;
 
     StreamBuffer mJpegBuffer, mAuxBuffer;
     bool mFoundJpeg, mFoundAux;
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera2_RenderPool"
+
+#include <log/log.h>
+
+#include "RenderPool.h"
+
+namespace android {
+
+RenderPool::RenderPool(size_t threadCount):
+        mJobs(nullptr),
+        mNextJob(0),
+        mPendingJobs(0),
+        mExiting(false) {
+    for (size_t i = 1; i < threadCount; i++) {
+        sp<Worker> worker = new Worker(this);
+        status_t res = worker->run("EmulatedFakeCamera2::RenderPool",
+                ANDROID_PRIORITY_URGENT_DISPLAY);
+        if (res != OK) {
+            ALOGE("%s: Unable to start render thread %zu: %d", __FUNCTION__,
+                    i, res);
+            break;
+        }
+        mWorkers.push_back(worker);
+    }
+    ALOGV("%s: Render pool with %zu threads", __FUNCTION__,
+            getThreadCount());
+}
+
+RenderPool::~RenderPool() {
+    {
+        Mutex::Autolock lock(mMutex);
+        mExiting = true;
+        mWorkAvailable.broadcast();
+    }
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->requestExitAndWait();
+    }
+}
+
+size_t RenderPool::getThreadCount() const {
+    return mWorkers.size() + 1;
+}
+
+void RenderPool::run(const std::vector<Job> &jobs) {
+    if (mWorkers.empty() || jobs.size() < 2) {
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i]();
+        }
+        return;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    mJobs = &jobs;
+    mNextJob = 0;
+    mPendingJobs = jobs.size();
+    mWorkAvailable.broadcast();
+
+    // The caller works on the batch too, then waits for stragglers
+    runJobsLocked();
+    while (mPendingJobs > 0) {
+        mWorkDone.wait(mMutex);
+    }
+    mJobs = nullptr;
+}
+
+bool RenderPool::workerLoop() {
+    Mutex::Autolock lock(mMutex);
+    while (!mExiting && (mJobs == nullptr || mNextJob >= mJobs->size())) {
+        mWorkAvailable.wait(mMutex);
+    }
+    if (mExiting) return false;
+
+    runJobsLocked();
+    return true;
+}
+
+void RenderPool::runJobsLocked() {
+    while (mJobs != nullptr && mNextJob < mJobs->size()) {
+        const Job &job = (*mJobs)[mNextJob++];
+        mMutex.unlock();
+        job();
+        mMutex.lock();
+        if (--mPendingJobs == 0) {
+            mWorkDone.signal();
+        }
+    }
+}
+
+RenderPool::Worker::Worker(RenderPool *pool):
+        Thread(false),
+        mPool(pool) {
+}
+
+bool RenderPool::Worker::threadLoop() {
+    return mPool->workerLoop();
+}
+
+} // namespace android
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A small fixed-size pool of threads used by the fake sensor to run
+ * independent pieces of a frame (output conversions, image bands) in
+ * parallel. A batch of jobs is handed to run(), which spreads them over the
+ * pool threads and the calling thread, and returns once all of them have
+ * completed.
+ */
+
+#ifndef HW_EMULATOR_CAMERA2_RENDER_POOL_H
+#define HW_EMULATOR_CAMERA2_RENDER_POOL_H
+
+#include <functional>
+#include <vector>
+
+#include "utils/Thread.h"
+#include "utils/Mutex.h"
+#include "utils/Condition.h"
+
+namespace android {
+
+class RenderPool {
+  public:
+    typedef std::function<void()> Job;
+
+    // threadCount: Total number of threads working on a batch, including the
+    // thread calling run(). A count of 1 runs every job on the caller.
+    explicit RenderPool(size_t threadCount);
+    ~RenderPool();
+
+    // Run all jobs and wait for them to complete. Jobs may run in any order
+    // and concurrently, so they must write to disjoint memory. Only one
+    // thread may call run() at a time.
+    void run(const std::vector<Job> &jobs);
+
+    size_t getThreadCount() const;
+
+  private:
+    class Worker: public Thread {
+      public:
+        explicit Worker(RenderPool *pool);
+      private:
+        virtual bool threadLoop();
+        RenderPool *mPool;
+    };
+
+    // Wait for a batch and work on it; returns false once the pool is being
+    // destroyed.
+    bool workerLoop();
+    // Run jobs from the current batch until none are left to start. Must be
+    // called with mMutex held; drops it while a job runs.
+    void runJobsLocked();
+
+    Mutex mMutex;
+    Condition mWorkAvailable;
+    Condition mWorkDone;
+    const std::vector<Job> *mJobs;
+    size_t mNextJob;
+    size_t mPendingJobs;
+    bool mExiting;
+
+    std::vector<sp<Worker> > mWorkers;
+};
+
+} // namespace android
+
+#endif // HW_EMULATOR_CAMERA2_RENDER_POOL_H
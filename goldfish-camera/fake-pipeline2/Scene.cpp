@@ -42,8 +42,8 @@ namespace android {
 
 const int Scene::kSceneWidth = 20;
 const int Scene::kSceneHeight = 20;
-const int Scene::kMaxWidth = 20;
-const int Scene::kMaxHeight = 20;
+const int Scene::kMaxWidth;
+const int Scene::kMaxHeight;
 
 const uint8_t Scene::kScene[Scene::kSceneWidth * Scene::kSceneHeight] = {
     //      5         10        15        20
@@ -89,8 +89,9 @@ Scene::Scene(
         mSensorWidth(sensorWidthPx),
         mSensorHeight(sensorHeightPx),
         mHour(12),
-        mExposureDuration(0.033f)
+        mExposureDuration(0.033f),
         //mSensorSensitivity(sensorSensitivity)
+        mRaster(sensorWidthPx * sensorHeightPx, 0)
 {
     // Map scene to sensor pixels
     if (mSensorWidth > mSensorHeight) {
@@ -337,6 +338,21 @@ void Scene::calculateScene(nsecs_t time) {
               kFreq2Magnitude * std::sin(kVertShakeFreq2 * timeSinceIdx) ) *
             mMapDiv * kShakeFraction;
 
+    // Rasterize the scene map for this frame's handshake offset, clamping at
+    // the scene edges
+    for (int y = 0; y < mSensorHeight; y++) {
+        int sceneY = (y + mOffsetY + mHandshakeY) / mMapDiv;
+        sceneY = sceneY < 0 ? 0 :
+                (sceneY >= kSceneHeight ? kSceneHeight - 1 : sceneY);
+        uint8_t *row = &mRaster[y * mSensorWidth];
+        for (int x = 0; x < mSensorWidth; x++) {
+            int sceneX = (x + mOffsetX + mHandshakeX) / mMapDiv;
+            sceneX = sceneX < 0 ? 0 :
+                    (sceneX >= kSceneWidth ? kSceneWidth - 1 : sceneX);
+            row[x] = kScene[sceneY * kSceneWidth + sceneX];
+        }
+    }
+
     // Set starting pixel
     setReadoutPixel(0,0);
 }
@@ -26,6 +26,8 @@
 #ifndef HW_EMULATOR_CAMERA2_SCENE_H
 #define HW_EMULATOR_CAMERA2_SCENE_H
 
+#include <vector>
+
 #include "utils/Timers.h"
 
 namespace android {
@@ -60,9 +62,19 @@ class Scene {
 
     // Calculate scene information for current hour and the time offset since
     // the hour. Must be called at least once before calling getLuminousExposure.
-    // Resets pixel readout location to 0,0
+    // Resets pixel readout location to 0,0. Also rasterizes the scene for the
+    // current handshake offset, see getRasterElectrons.
     void calculateScene(nsecs_t time);
 
+    // Get sensor response in physical units (electrons) for the sensor pixel
+    // at x,y, from the raster built by the last calculateScene call. Unlike
+    // getPixelElectrons, this has no readout state, so whole spans of output
+    // pixels can be filled from a single lookup. The returned array can be
+    // indexed with ColorChannels.
+    inline const uint32_t* getRasterElectrons(int x, int y) const {
+        return &mCurrentColors[mRaster[y * mSensorWidth + x]];
+    }
+
     // Set sensor pixel readout location.
     inline void setReadoutPixel(int x, int y) {
         mCurrentX = x;
@@ -110,8 +122,8 @@ class Scene {
 
     // Max scene width and height. Calculation for larger scene consumes much
     // CPU resource. So we put a limit here.
-    static const int kMaxWidth;
-    static const int kMaxHeight;
+    static const int kMaxWidth = 20;
+    static const int kMaxHeight = 20;
 
   private:
     // Sensor color filtering coefficients in XYZ
@@ -157,6 +169,10 @@ class Scene {
 
     uint32_t mCurrentColors[NUM_MATERIALS*NUM_CHANNELS];
 
+    // Material of each sensor pixel (as an index into mCurrentColors), with
+    // the handshake offset applied. Rebuilt by calculateScene.
+    std::vector<uint8_t> mRaster;
+
     /**
      * Constants for scene definition. These are various degrees of approximate.
      */
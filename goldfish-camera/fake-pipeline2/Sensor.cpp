@@ -31,8 +31,12 @@
 #include "../EmulatedFakeCamera2.h"
 #include "Sensor.h"
 #include <cmath>
+#include <inttypes.h>
 #include <cstdlib>
+#include <cstring>
 #include <cutils/properties.h>
+#include <libyuv.h>
+#include <unistd.h>
 #include "system/camera_metadata.h"
 
 namespace android {
@@ -82,19 +86,74 @@ const uint32_t Sensor::kDefaultSensitivity = 100;
 
 /** A few utility functions for math, normal distributions */
 
-// Take advantage of IEEE floating-point format to calculate an approximate
-// square root. Accurate to within +-3.6%
-float sqrtf_approx(float r) {
-    // Modifier is based on IEEE floating-point representation; the
-    // manipulations boil down to finding approximate log2, dividing by two, and
-    // then inverting the log2. A bias is added to make the relative error
-    // symmetric about the real answer.
-    const int32_t modifier = 0x1FBB4000;
+// Counter-based random number generator: a 32-bit integer hash of the sample
+// index. Any sample can be drawn without carrying generator state from the
+// previous one, so rows can be generated in any order, on any thread, and in
+// wide vector batches, with the same result.
+static inline uint32_t noiseHash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
 
-    int32_t r_i = *(int32_t*)(&r);
-    r_i = (r_i >> 1) + modifier;
+// Approximately Gaussian sample built from one hash: the sum of its four bytes
+// (Irwin-Hall), centered on 0. Range is +-510, standard deviation
+// kNoiseSampleStddev.
+static inline int32_t noiseSample(uint32_t h) {
+    return (int32_t)((h & 0xFF) + ((h >> 8) & 0xFF) + ((h >> 16) & 0xFF) +
+            (h >> 24)) - 510;
+}
+static const float kNoiseSampleStddev = 147.80f; // sqrt(4 * (256^2 - 1) / 12)
+
+/** Span helpers for the scene rasterizer */
+
+// Fill count pixels of pixelSize bytes at dst with the pixel at pattern. The
+// filled run doubles with each memcpy, so a wide span costs a few large
+// (vectorized) copies instead of one store per pixel.
+static inline void fillSpan(uint8_t *dst, const uint8_t *pattern,
+        size_t pixelSize, size_t count) {
+    if (count == 0) return;
+    if (pixelSize == 1) {
+        memset(dst, *pattern, count);
+        return;
+    }
+    const size_t total = count * pixelSize;
+    memcpy(dst, pattern, pixelSize);
+    size_t filled = pixelSize;
+    while (filled < total) {
+        size_t n = (filled < total - filled) ? filled : total - filled;
+        memcpy(dst + filled, dst, n);
+        filled += n;
+    }
+}
+
+// Map output columns onto scene columns: output pixels
+// [spans[x], spans[x + 1]) all sample scene column x. spans must hold
+// sceneWidth + 1 entries.
+static void getColumnSpans(uint32_t width, unsigned int divW, int sceneWidth,
+        uint32_t *spans) {
+    int x = 0;
+    spans[0] = 0;
+    for (uint32_t outX = 0; outX < width; outX++) {
+        int sceneX = outX * divW >> 10;
+        while (x < sceneX && x < sceneWidth) spans[++x] = outX;
+    }
+    while (x < sceneWidth) spans[++x] = width;
+}
 
-    return *(float*)(&r_i);
+// Sensor response for one scene pixel after gain, in 6-bit fixed point,
+// clipped to the saturation point
+static inline void getSaturatedRGB(const uint32_t *pixel, int scale64x,
+        int saturationPoint, int32_t *rgb) {
+    rgb[0] = pixel[Scene::R]  * scale64x;
+    rgb[0] = rgb[0] < saturationPoint ? rgb[0] : saturationPoint;
+    rgb[1] = pixel[Scene::Gr] * scale64x;
+    rgb[1] = rgb[1] < saturationPoint ? rgb[1] : saturationPoint;
+    rgb[2] = pixel[Scene::B]  * scale64x;
+    rgb[2] = rgb[2] < saturationPoint ? rgb[2] : saturationPoint;
 }
 
 #define GRALLOC_PROP "ro.hardware.gralloc"
@@ -117,7 +176,26 @@ static bool getIsMinigbmFromProperty() {
     return res;
 }
 
-Sensor::Sensor(uint32_t width, uint32_t height):
+#define RENDER_THREADS_PROP "vendor.qemu.sf.fake_camera_render_threads"
+
+// Render threads: taken from RENDER_THREADS_PROP if set, otherwise one per
+// online CPU up to a small cap
+static size_t getRenderThreadCount() {
+    const int32_t kMaxRenderThreads = 16;
+    const long kDefaultMaxRenderThreads = 4;
+    int32_t threads = property_get_int32(RENDER_THREADS_PROP, 0);
+    if (threads > 0) {
+        ALOGV("%s: Using %d render threads from %s", __func__, threads,
+                RENDER_THREADS_PROP);
+        return threads < kMaxRenderThreads ? threads : kMaxRenderThreads;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    return cpus < kDefaultMaxRenderThreads ? cpus : kDefaultMaxRenderThreads;
+}
+
+Sensor::Sensor(uint32_t width, uint32_t height,
+        const sp<AuxBufferPool> &auxBufferPool):
         Thread(false),
         mResolution{width, height},
         mActiveArray{0, 0, width, height},
@@ -128,12 +206,20 @@ Sensor::Sensor(uint32_t width, uint32_t height):
         mGainFactor(kDefaultSensitivity),
         mNextBuffers(nullptr),
         mFrameNumber(0),
-        mCapturedBuffers(nullptr),
+        mReadoutHead(0),
+        mReadoutTail(0),
+        mMaxReadoutQueueDepth(0),
         mListener(nullptr),
+        mAuxBufferPool(auxBufferPool),
         mIsMinigbm(getIsMinigbmFromProperty()),
         mSceneWidth((width < Scene::kMaxWidth) ? width : Scene::kMaxWidth),
         mSceneHeight((height < Scene::kMaxHeight) ? height : Scene::kMaxHeight),
-        mScene(mSceneWidth, mSceneHeight, kElectronsPerLuxSecond)
+        mScene(mSceneWidth, mSceneHeight, kElectronsPerLuxSecond),
+        mRenderPool(new RenderPool(getRenderThreadCount())),
+        mLastRenderTime(0),
+        mRenderOverruns(0),
+        mNoiseTableGain(0),
+        mRawFrameCount(0)
 {
     ALOGV("Sensor created with pixel array %d x %d", width, height);
 }
@@ -146,7 +232,8 @@ status_t Sensor::startUp() {
     ALOGV("%s: E", __FUNCTION__);
 
     int res;
-    mCapturedBuffers = NULL;
+    mReadoutHead = 0;
+    mReadoutTail = 0;
     res = run("EmulatedFakeCamera2::Sensor",
             ANDROID_PRIORITY_URGENT_DISPLAY);
 
@@ -214,24 +301,83 @@ bool Sensor::waitForVSync(nsecs_t reltime) {
 
 bool Sensor::waitForNewFrame(nsecs_t reltime,
         nsecs_t *captureTime) {
-    Mutex::Autolock lock(mReadoutMutex);
-    if (mCapturedBuffers == NULL) {
-        int res;
-        res = mReadoutAvailable.waitRelative(mReadoutMutex, reltime);
-        if (res == TIMED_OUT) {
-            return false;
-        } else if (res != OK || mCapturedBuffers == NULL) {
-            ALOGE("Error waiting for sensor readout signal: %d", res);
-            return false;
+    const uint32_t head = mReadoutHead.load(std::memory_order_relaxed);
+    if (mReadoutTail.load(std::memory_order_acquire) == head) {
+        Mutex::Autolock lock(mReadoutMutex);
+        if (mReadoutTail.load(std::memory_order_acquire) == head) {
+            int res;
+            res = mReadoutAvailable.waitRelative(mReadoutMutex, reltime);
+            if (res == TIMED_OUT) {
+                return false;
+            } else if (res != OK ||
+                    mReadoutTail.load(std::memory_order_acquire) == head) {
+                ALOGE("Error waiting for sensor readout signal: %d", res);
+                return false;
+            }
         }
     }
-    mReadoutComplete.signal();
 
-    *captureTime = mCaptureTime;
-    mCapturedBuffers = NULL;
+    const CapturedFrame &frame = mReadoutQueue[head % kReadoutQueueSize];
+    ALOGVV("%s: Read out buffers %p captured at %" PRId64, __FUNCTION__,
+            frame.buffers, frame.captureTime);
+    *captureTime = frame.captureTime;
+    mReadoutHead.store(head + 1, std::memory_order_release);
+
+    // The sensor only sleeps on a full queue, which now has room
+    Mutex::Autolock lock(mReadoutMutex);
+    mReadoutComplete.signal();
     return true;
 }
 
+void Sensor::dump(int fd, int indent) const {
+    dprintf(fd, "%*sReadout queue: %zu frames, at most %zu\n", indent, "",
+            getReadoutQueueDepth(), getMaxReadoutQueueDepth());
+    mPacer.dump(fd, indent);
+}
+
+size_t Sensor::getReadoutQueueDepth() const {
+    return mReadoutTail.load(std::memory_order_relaxed) -
+            mReadoutHead.load(std::memory_order_relaxed);
+}
+
+size_t Sensor::getMaxReadoutQueueDepth() const {
+    return mMaxReadoutQueueDepth.load(std::memory_order_relaxed);
+}
+
+void Sensor::pushCapturedFrame(Buffers *buffers, nsecs_t captureTime) {
+    const uint32_t tail = mReadoutTail.load(std::memory_order_relaxed);
+    if (tail - mReadoutHead.load(std::memory_order_acquire) ==
+            kReadoutQueueSize) {
+        ALOGV("Waiting for readout thread to catch up!");
+        Mutex::Autolock lock(mReadoutMutex);
+        // The readout thread outlives this one, and waits for this frame
+        // before returning its request, so don't drop it on exit.
+        while (tail - mReadoutHead.load(std::memory_order_acquire) ==
+                kReadoutQueueSize) {
+            int res = mReadoutComplete.waitRelative(mReadoutMutex,
+                    kFrameDurationRange[1]);
+            if (res == TIMED_OUT && exitPending()) {
+                ALOGW("%s: Exiting, still waiting for readout to catch up",
+                        __FUNCTION__);
+            }
+        }
+    }
+
+    CapturedFrame &frame = mReadoutQueue[tail % kReadoutQueueSize];
+    frame.buffers = buffers;
+    frame.captureTime = captureTime;
+    mReadoutTail.store(tail + 1, std::memory_order_release);
+
+    const uint32_t depth = tail + 1 - mReadoutHead.load(std::memory_order_relaxed);
+    ATRACE_INT("Sensor readout queue depth", depth);
+    if (depth > mMaxReadoutQueueDepth.load(std::memory_order_relaxed)) {
+        mMaxReadoutQueueDepth.store(depth, std::memory_order_relaxed);
+    }
+
+    Mutex::Autolock lock(mReadoutMutex);
+    mReadoutAvailable.signal();
+}
+
 Sensor::SensorListener::~SensorListener() {
 }
 
@@ -245,6 +391,7 @@ status_t Sensor::readyToRun() {
     mStartupTime = systemTime();
     mNextCaptureTime = 0;
     mNextCapturedBuffers = NULL;
+    mPacer.reset();
     return OK;
 }
 
@@ -290,11 +437,10 @@ bool Sensor::threadLoop() {
     Buffers *capturedBuffers = NULL;
     nsecs_t captureTime = 0;
 
-    nsecs_t startRealTime  = systemTime();
+    nsecs_t startRealTime  = mPacer.beginFrame(frameDuration);
     // Stagefright cares about system time for timestamps, so base simulated
     // time on that.
     nsecs_t simulatedTime    = startRealTime;
-    nsecs_t frameEndRealTime = startRealTime + frameDuration;
 
     if (mNextCapturedBuffers != NULL) {
         ALOGVV("Sensor starting readout");
@@ -308,15 +454,7 @@ bool Sensor::threadLoop() {
     // time properly
     if (capturedBuffers != NULL) {
         ALOGVV("Sensor readout complete");
-        Mutex::Autolock lock(mReadoutMutex);
-        if (mCapturedBuffers != NULL) {
-            ALOGV("Waiting for readout thread to catch up!");
-            mReadoutComplete.wait(mReadoutMutex);
-        }
-
-        mCapturedBuffers = capturedBuffers;
-        mCaptureTime = captureTime;
-        mReadoutAvailable.signal();
+        pushCapturedFrame(capturedBuffers, captureTime);
         capturedBuffers = NULL;
     }
 
@@ -326,6 +464,7 @@ bool Sensor::threadLoop() {
     mNextCaptureTime = simulatedTime;
     mNextCapturedBuffers = nextBuffers;
 
+    nsecs_t renderStartTime = systemTime();
     if (mNextCapturedBuffers != NULL) {
         if (listener != NULL) {
             listener->onSensorEvent(frameNumber, SensorListener::EXPOSURE_START,
@@ -336,7 +475,35 @@ bool Sensor::threadLoop() {
         mScene.setExposureDuration((float)exposureDuration/1e9);
         mScene.calculateScene(mNextCaptureTime);
 
-        // Might be adding more buffers, so size isn't constant
+        // Add auxillary buffers first, since growing mNextCapturedBuffers
+        // invalidates references into it
+        size_t numBuffers = mNextCapturedBuffers->size();
+        for (size_t i = 0; i < numBuffers; i++) {
+            const StreamBuffer &b = (*mNextCapturedBuffers)[i];
+            if (b.format == HAL_PIXEL_FORMAT_BLOB &&
+                    b.dataSpace != HAL_DATASPACE_DEPTH) {
+                // Add auxillary buffer of the right size
+                // Assumes only one BLOB (JPEG) buffer in
+                // mNextCapturedBuffers
+                StreamBuffer bAux;
+                bAux.streamId = 0;
+                bAux.width = b.width;
+                bAux.height = b.height;
+                bAux.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
+                bAux.stride = b.width;
+                if (mAuxBufferPool->acquire(&bAux,
+                        AuxBufferPool::HEAP) != OK) {
+                    ALOGE("%s: Unable to get JPEG input buffer",
+                            __FUNCTION__);
+                    break;
+                }
+                mNextCapturedBuffers->push_back(bAux);
+                break;
+            }
+        }
+
+        // Colour outputs are rendered together by captureColor
+        Buffers colorBuffers;
         for (size_t i = 0; i < mNextCapturedBuffers->size(); i++) {
             const StreamBuffer &b = (*mNextCapturedBuffers)[i];
             ALOGVV("Sensor capturing buffer %d: stream %d,"
@@ -348,37 +515,15 @@ bool Sensor::threadLoop() {
                     captureRaw(b.img, gain, b.stride);
                     break;
                 case HAL_PIXEL_FORMAT_RGB_888:
-                    captureRGB(b.img, gain, b.width, b.height);
-                    break;
                 case HAL_PIXEL_FORMAT_RGBA_8888:
-                    captureRGBA(b.img, gain, b.width, b.height);
+                case HAL_PIXEL_FORMAT_YCbCr_420_888:
+                    colorBuffers.push_back(b);
                     break;
                 case HAL_PIXEL_FORMAT_BLOB:
-                    if (b.dataSpace != HAL_DATASPACE_DEPTH) {
-                        // Add auxillary buffer of the right size
-                        // Assumes only one BLOB (JPEG) buffer in
-                        // mNextCapturedBuffers
-                        StreamBuffer bAux;
-                        bAux.streamId = 0;
-                        bAux.width = b.width;
-                        bAux.height = b.height;
-                        bAux.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
-                        bAux.stride = b.width;
-                        bAux.buffer = NULL;
-                        // TODO: Reuse these
-                        bAux.img = new uint8_t[b.width * b.height * 3];
-                        mNextCapturedBuffers->push_back(bAux);
-                    } else {
+                    if (b.dataSpace == HAL_DATASPACE_DEPTH) {
                         captureDepthCloud(b.img);
                     }
                     break;
-                case HAL_PIXEL_FORMAT_YCbCr_420_888:
-                    if (mIsMinigbm) {
-                        captureNV12(b.img, gain, b.width, b.height);
-                    } else {
-                        captureYU12(b.img, gain, b.width, b.height);
-                    }
-                   break;
                 case HAL_PIXEL_FORMAT_YV12:
                     // TODO:
                     ALOGE("%s: Format %x is TODO", __FUNCTION__, b.format);
@@ -392,66 +537,247 @@ bool Sensor::threadLoop() {
                     break;
             }
         }
+        captureColor(colorBuffers, gain);
+
+        mLastRenderTime = systemTime() - renderStartTime;
+        ATRACE_INT("Sensor render time (us)", mLastRenderTime / 1000);
+        if (mLastRenderTime > (nsecs_t)frameDuration) {
+            // Only log now and then, an overloaded sensor overruns every frame
+            mRenderOverruns++;
+            ALOGW_IF(mRenderOverruns % 30 == 1,
+                    "%s: Frame %u took %" PRId64 " ms to render, over the %" PRIu64
+                    " ms frame duration (%u overruns)", __FUNCTION__,
+                    frameNumber, mLastRenderTime / 1000000,
+                    frameDuration / 1000000, mRenderOverruns);
+        }
     }
 
     ALOGVV("Sensor vertical blanking interval");
-    nsecs_t workDoneRealTime = systemTime();
-    const nsecs_t timeAccuracy = 2e6; // 2 ms of imprecision is ok
-    if (workDoneRealTime < frameEndRealTime - timeAccuracy) {
-        timespec t;
-        t.tv_sec = (frameEndRealTime - workDoneRealTime)  / 1000000000L;
-        t.tv_nsec = (frameEndRealTime - workDoneRealTime) % 1000000000L;
-
-        int ret;
-        do {
-            ret = nanosleep(&t, &t);
-        } while (ret != 0);
-    }
-    ALOGVV("Frame cycle took %d ms, target %d ms",
+    mPacer.endFrame();
+    ALOGVV("Frame cycle took %d ms (render %d ms), target %d ms",
             (int)((systemTime() - startRealTime)/1000000),
+            (int)(mLastRenderTime / 1000000),
             (int)(frameDuration / 1000000));
     return true;
 };
 
-void Sensor::captureRaw(uint8_t *img, uint32_t gain, uint32_t stride) {
+void Sensor::renderBands(uint32_t height,
+        const std::function<void(uint32_t, uint32_t)> &renderRows) {
+    // Bands smaller than this aren't worth a thread handoff
+    const uint32_t kMinBandHeight = 64;
+    size_t bands = mRenderPool->getThreadCount();
+    if (bands > height / kMinBandHeight) {
+        bands = height / kMinBandHeight;
+    }
+    if (bands <= 1) {
+        renderRows(0, height);
+        return;
+    }
+
+    std::vector<RenderPool::Job> jobs;
+    for (size_t i = 0; i < bands; i++) {
+        uint32_t rowBegin = height * i / bands;
+        uint32_t rowEnd = height * (i + 1) / bands;
+        jobs.push_back([&renderRows, rowBegin, rowEnd]() {
+            renderRows(rowBegin, rowEnd);
+        });
+    }
+    mRenderPool->run(jobs);
+}
+
+static bool isYUV(const StreamBuffer &b) {
+    return b.format == HAL_PIXEL_FORMAT_YCbCr_420_888;
+}
+
+void Sensor::captureColor(const Buffers &buffers, uint32_t gain) {
+    ATRACE_CALL();
+    if (buffers.size() == 1) {
+        // Nothing to share; render straight into the output
+        const StreamBuffer &b = buffers[0];
+        switch (b.format) {
+            case HAL_PIXEL_FORMAT_RGB_888:
+                captureRGB(b.img, gain, b.width, b.height);
+                break;
+            case HAL_PIXEL_FORMAT_RGBA_8888:
+                captureRGBA(b.img, gain, b.width, b.height);
+                break;
+            default:
+                if (mIsMinigbm) {
+                    captureNV12(b.img, gain, b.width, b.height);
+                } else {
+                    captureYU12(b.img, gain, b.width, b.height);
+                }
+                break;
+        }
+        return;
+    }
+    if (buffers.isEmpty()) return;
+
+    // Render the scene once per colour family at the largest requested size,
+    // then scale/convert that frame into every output. YUV outputs get their
+    // own YU12 render so they keep the sensor's exact JFIF conversion.
+    uint32_t rgbWidth = 0, rgbHeight = 0, yuvWidth = 0, yuvHeight = 0;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        const StreamBuffer &b = buffers[i];
+        uint32_t &width = isYUV(b) ? yuvWidth : rgbWidth;
+        uint32_t &height = isYUV(b) ? yuvHeight : rgbHeight;
+        width = b.width > width ? b.width : width;
+        height = b.height > height ? b.height : height;
+    }
+    if (rgbWidth > 0) {
+        mRgbaFrame.resize(rgbWidth * rgbHeight * 4);
+        captureRGBA(mRgbaFrame.data(), gain, rgbWidth, rgbHeight);
+    }
+    if (yuvWidth > 0) {
+        mYuvFrame.resize(yuvWidth * yuvHeight +
+                2 * (yuvWidth / 2) * ((yuvHeight + 1) / 2));
+        captureYU12(mYuvFrame.data(), gain, yuvWidth, yuvHeight);
+    }
+
+    if (mScratch.size() < buffers.size()) {
+        mScratch.resize(buffers.size());
+    }
+    std::vector<RenderPool::Job> jobs;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        const StreamBuffer &b = buffers[i];
+        std::vector<uint8_t> *scratch = &mScratch[i];
+        switch (b.format) {
+            case HAL_PIXEL_FORMAT_RGB_888:
+                jobs.push_back([=]() {
+                    deriveRGB(b, rgbWidth, rgbHeight, scratch);
+                });
+                break;
+            case HAL_PIXEL_FORMAT_RGBA_8888:
+                jobs.push_back([=]() {
+                    deriveRGBA(b, rgbWidth, rgbHeight);
+                });
+                break;
+            default:
+                jobs.push_back([=]() {
+                    deriveYUV(b, yuvWidth, yuvHeight, scratch);
+                });
+                break;
+        }
+    }
+    mRenderPool->run(jobs);
+}
+
+void Sensor::deriveRGBA(const StreamBuffer &b, uint32_t srcWidth,
+        uint32_t srcHeight) {
+    // Channel order doesn't matter to the scaler, so RGBA scales as "ARGB".
+    // Point sampling matches what a direct render of the scene produces.
+    libyuv::ARGBScale(mRgbaFrame.data(), srcWidth * 4, srcWidth, srcHeight,
+            b.img, b.width * 4, b.width, b.height, libyuv::kFilterNone);
+}
+
+void Sensor::deriveRGB(const StreamBuffer &b, uint32_t srcWidth,
+        uint32_t srcHeight, std::vector<uint8_t> *scratch) {
+    const uint8_t *src = mRgbaFrame.data();
+    if (b.width != srcWidth || b.height != srcHeight) {
+        scratch->resize(b.width * b.height * 4);
+        libyuv::ARGBScale(src, srcWidth * 4, srcWidth, srcHeight,
+                scratch->data(), b.width * 4, b.width, b.height,
+                libyuv::kFilterNone);
+        src = scratch->data();
+    }
+    // Dropping the 4th byte of each RGBA pixel leaves RGB in memory order
+    libyuv::ARGBToRGB24(src, b.width * 4, b.img, b.width * 3,
+            b.width, b.height);
+}
+
+void Sensor::deriveYUV(const StreamBuffer &b, uint32_t srcWidth,
+        uint32_t srcHeight, std::vector<uint8_t> *scratch) {
+    const uint8_t *srcY = mYuvFrame.data();
+    const uint8_t *srcU = srcY + srcWidth * srcHeight;
+    const uint8_t *srcV = srcU + (srcWidth / 2) * (srcHeight / 2);
+
+    uint8_t *dstY = b.img;
+    if (mIsMinigbm) {
+        // NV12: scale into planar scratch, then interleave the chroma
+        scratch->resize(b.width * b.height + 2 * (b.width / 2) * (b.height / 2));
+        dstY = scratch->data();
+    }
+    uint8_t *dstU = dstY + b.width * b.height;
+    uint8_t *dstV = dstU + (b.width / 2) * (b.height / 2);
+    libyuv::I420Scale(srcY, srcWidth, srcU, srcWidth / 2, srcV, srcWidth / 2,
+            srcWidth, srcHeight,
+            dstY, b.width, dstU, b.width / 2, dstV, b.width / 2,
+            b.width, b.height, libyuv::kFilterNone);
+    if (mIsMinigbm) {
+        libyuv::I420ToNV12(dstY, b.width, dstU, b.width / 2, dstV, b.width / 2,
+                b.img, b.width, b.img + b.width * b.height, b.width,
+                b.width, b.height);
+    }
+}
+
+void Sensor::updateNoiseTable(uint32_t gain) {
+    if (gain == mNoiseTableGain && !mNoiseScale.empty()) return;
     ATRACE_CALL();
     float totalGain = gain/100.0 * kBaseGainFactor;
     float noiseVarGain =  totalGain * totalGain;
     float readNoiseVar = kReadNoiseVarBeforeGain * noiseVarGain
             + kReadNoiseVarAfterGain;
 
-    int bayerSelect[4] = {Scene::R, Scene::Gr, Scene::Gb, Scene::B}; // RGGB
-    mScene.setReadoutPixel(0,0);
-    for (unsigned int y = 0; y < mResolution[1]; y++ ) {
-        int *bayerRow = bayerSelect + (y & 0x1) * 2;
-        uint16_t *px = (uint16_t*)img + y * stride;
-        for (unsigned int x = 0; x < mResolution[0]; x++) {
-            uint32_t electronCount;
-            electronCount = mScene.getPixelElectrons()[bayerRow[x & 0x1]];
-
-            // TODO: Better pixel saturation curve?
-            electronCount = (electronCount < kSaturationElectrons) ?
-                    electronCount : kSaturationElectrons;
-
-            // TODO: Better A/D saturation curve?
-            uint16_t rawCount = electronCount * totalGain;
-            rawCount = (rawCount < kMaxRawValue) ? rawCount : kMaxRawValue;
-
-            // Calculate noise value
-            // TODO: Use more-correct Gaussian instead of uniform noise
-            float photonNoiseVar = electronCount * noiseVarGain;
-            float noiseStddev = sqrtf_approx(readNoiseVar + photonNoiseVar);
-            // Scaled to roughly match gaussian/uniform noise stddev
-            float noiseSample = std::rand() * (2.5 / (1.0 + RAND_MAX)) - 1.25;
-
-            rawCount += kBlackLevel;
-            rawCount += noiseStddev * noiseSample;
-
-            *px++ = rawCount;
-        }
-        // TODO: Handle this better
-        //simulatedTime += mRowReadoutTime;
+    // Noise standard deviation for each possible (saturated) electron count,
+    // in Q8 units of one noise sample
+    mNoiseScale.resize(kSaturationElectrons + 1);
+    for (uint32_t e = 0; e <= kSaturationElectrons; e++) {
+        float photonNoiseVar = e * noiseVarGain;
+        float noiseStddev = std::sqrt(readNoiseVar + photonNoiseVar);
+        mNoiseScale[e] = noiseStddev / kNoiseSampleStddev * 256 + 0.5f;
     }
+    mNoiseTableGain = gain;
+}
+
+void Sensor::captureRaw(uint8_t *img, uint32_t gain, uint32_t stride) {
+    ATRACE_CALL();
+    float totalGain = gain/100.0 * kBaseGainFactor;
+    updateNoiseTable(gain);
+    // Each frame draws from its own stretch of the noise sequence
+    const uint32_t seed = noiseHash(++mRawFrameCount);
+
+    const uint32_t width = mResolution[0];
+    const uint32_t height = mResolution[1];
+    unsigned int DivH= (float)mSceneHeight/height * (0x1 << 10);
+    unsigned int DivW = (float)mSceneWidth/width * (0x1 << 10);
+    uint32_t spans[Scene::kMaxWidth + 1];
+    getColumnSpans(width, DivW, mSceneWidth, spans);
+
+    const int bayerSelect[4] = {Scene::R, Scene::Gr, Scene::Gb, Scene::B}; // RGGB
+    renderBands(height, [&](uint32_t rowBegin, uint32_t rowEnd) {
+        for (unsigned int outY = rowBegin; outY < rowEnd; outY++) {
+            int y = outY * DivH >> 10;
+            const int *bayerRow = bayerSelect + (outY & 0x1) * 2;
+            uint16_t *px = (uint16_t*)img + outY * stride;
+            const uint32_t rowSeed = seed + outY * width;
+            for (int x = 0; x < mSceneWidth; x++) {
+                // Signal and noise level are constant over a span, apart from
+                // alternating between the two colors of this Bayer row
+                const uint32_t *pixel = mScene.getRasterElectrons(x, y);
+                int32_t base[2], scale[2];
+                for (int c = 0; c < 2; c++) {
+                    uint32_t electronCount = pixel[bayerRow[c]];
+                    // TODO: Better pixel saturation curve?
+                    electronCount = (electronCount < kSaturationElectrons) ?
+                            electronCount : kSaturationElectrons;
+
+                    // TODO: Better A/D saturation curve?
+                    uint32_t rawCount = electronCount * totalGain;
+                    rawCount = (rawCount < kMaxRawValue) ? rawCount : kMaxRawValue;
+
+                    base[c] = rawCount + kBlackLevel;
+                    scale[c] = mNoiseScale[electronCount];
+                }
+                // Branch-free so the compiler can vectorize the whole span
+                for (uint32_t outX = spans[x]; outX < spans[x + 1]; outX++) {
+                    int32_t noise = noiseSample(noiseHash(rowSeed + outX));
+                    int32_t value = base[outX & 0x1] +
+                            ((scale[outX & 0x1] * noise) >> 8);
+                    px[outX] = value > 0 ? value : 0;
+                }
+            }
+        }
+    });
     ALOGVV("Raw sensor image captured");
 }
 
@@ -462,35 +788,37 @@ void Sensor::captureRGBA(uint8_t *img, uint32_t gain, uint32_t width, uint32_t h
     int scale64x = 64 * totalGain * 255 / kMaxRawValue;
     unsigned int DivH= (float)mSceneHeight/height * (0x1 << 10);
     unsigned int DivW = (float)mSceneWidth/width * (0x1 << 10);
-
-    for (unsigned int outY = 0; outY < height; outY++) {
-        unsigned int y = outY * DivH >> 10;
-        uint8_t *px = img + outY * width * 4;
-        mScene.setReadoutPixel(0, y);
-        unsigned int lastX = 0;
-        const uint32_t *pixel = mScene.getPixelElectrons();
-        for (unsigned int outX = 0; outX < width; outX++) {
-            uint32_t rCount, gCount, bCount;
-            unsigned int x = outX * DivW >> 10;
-            if (x - lastX > 0) {
-                for (unsigned int k = 0; k < (x-lastX); k++) {
-                     pixel = mScene.getPixelElectrons();
-                }
+    uint32_t spans[Scene::kMaxWidth + 1];
+    getColumnSpans(width, DivW, mSceneWidth, spans);
+
+    renderBands(height, [&](uint32_t rowBegin, uint32_t rowEnd) {
+        int lastY = -1;
+        for (unsigned int outY = rowBegin; outY < rowEnd; outY++) {
+            int y = outY * DivH >> 10;
+            uint8_t *px = img + outY * width * 4;
+            if (y == lastY) {
+                memcpy(px, px - width * 4, width * 4);
+                continue;
             }
-            lastX = x;
-            // TODO: Perfect demosaicing is a cheat
-            rCount = pixel[Scene::R]  * scale64x;
-            gCount = pixel[Scene::Gr] * scale64x;
-            bCount = pixel[Scene::B]  * scale64x;
-
-            *px++ = rCount < 255*64 ? rCount / 64 : 255;
-            *px++ = gCount < 255*64 ? gCount / 64 : 255;
-            *px++ = bCount < 255*64 ? bCount / 64 : 255;
-            *px++ = 255;
-         }
-        // TODO: Handle this better
-        //simulatedTime += mRowReadoutTime;
-    }
+            lastY = y;
+            for (int x = 0; x < mSceneWidth; x++) {
+                const uint32_t *pixel = mScene.getRasterElectrons(x, y);
+                uint32_t rCount, gCount, bCount;
+                // TODO: Perfect demosaicing is a cheat
+                rCount = pixel[Scene::R]  * scale64x;
+                gCount = pixel[Scene::Gr] * scale64x;
+                bCount = pixel[Scene::B]  * scale64x;
+
+                const uint8_t rgba[4] = {
+                    (uint8_t)(rCount < 255*64 ? rCount / 64 : 255),
+                    (uint8_t)(gCount < 255*64 ? gCount / 64 : 255),
+                    (uint8_t)(bCount < 255*64 ? bCount / 64 : 255),
+                    255
+                };
+                fillSpan(px + spans[x] * 4, rgba, 4, spans[x + 1] - spans[x]);
+            }
+        }
+    });
     ALOGVV("RGBA sensor image captured");
 }
 
@@ -501,32 +829,36 @@ void Sensor::captureRGB(uint8_t *img, uint32_t gain, uint32_t width, uint32_t he
     int scale64x = 64 * totalGain * 255 / kMaxRawValue;
     unsigned int DivH= (float)mSceneHeight/height * (0x1 << 10);
     unsigned int DivW = (float)mSceneWidth/width * (0x1 << 10);
-
-    for (unsigned int outY = 0; outY < height; outY++) {
-        unsigned int y = outY * DivH >> 10;
-        uint8_t *px = img + outY * width * 3;
-        mScene.setReadoutPixel(0, y);
-        unsigned int lastX = 0;
-        const uint32_t *pixel = mScene.getPixelElectrons();
-        for (unsigned int outX = 0; outX < width; outX++) {
-            uint32_t rCount, gCount, bCount;
-            unsigned int x = outX * DivW >> 10;
-            if (x - lastX > 0) {
-                for (unsigned int k = 0; k < (x-lastX); k++) {
-                    pixel = mScene.getPixelElectrons();
-                }
+    uint32_t spans[Scene::kMaxWidth + 1];
+    getColumnSpans(width, DivW, mSceneWidth, spans);
+
+    renderBands(height, [&](uint32_t rowBegin, uint32_t rowEnd) {
+        int lastY = -1;
+        for (unsigned int outY = rowBegin; outY < rowEnd; outY++) {
+            int y = outY * DivH >> 10;
+            uint8_t *px = img + outY * width * 3;
+            if (y == lastY) {
+                memcpy(px, px - width * 3, width * 3);
+                continue;
             }
-            lastX = x;
-           // TODO: Perfect demosaicing is a cheat
-            rCount = pixel[Scene::R]  * scale64x;
-            gCount = pixel[Scene::Gr] * scale64x;
-            bCount = pixel[Scene::B]  * scale64x;
-
-            *px++ = rCount < 255*64 ? rCount / 64 : 255;
-            *px++ = gCount < 255*64 ? gCount / 64 : 255;
-            *px++ = bCount < 255*64 ? bCount / 64 : 255;
-         }
-    }
+            lastY = y;
+            for (int x = 0; x < mSceneWidth; x++) {
+                const uint32_t *pixel = mScene.getRasterElectrons(x, y);
+                uint32_t rCount, gCount, bCount;
+                // TODO: Perfect demosaicing is a cheat
+                rCount = pixel[Scene::R]  * scale64x;
+                gCount = pixel[Scene::Gr] * scale64x;
+                bCount = pixel[Scene::B]  * scale64x;
+
+                const uint8_t rgb[3] = {
+                    (uint8_t)(rCount < 255*64 ? rCount / 64 : 255),
+                    (uint8_t)(gCount < 255*64 ? gCount / 64 : 255),
+                    (uint8_t)(bCount < 255*64 ? bCount / 64 : 255)
+                };
+                fillSpan(px + spans[x] * 3, rgb, 3, spans[x + 1] - spans[x]);
+            }
+        }
+    });
     ALOGVV("RGB sensor image captured");
 }
 
@@ -556,36 +888,57 @@ void Sensor::captureYU12(uint8_t *img, uint32_t gain, uint32_t width, uint32_t h
 
     unsigned int DivH= (float)mSceneHeight/height * (0x1 << 10);
     unsigned int DivW = (float)mSceneWidth/width * (0x1 << 10);
-    for (unsigned int outY = 0; outY < height; outY++) {
-        unsigned int y = outY * DivH >> 10;
-        uint8_t *pxY = img + outY * width;
-        uint8_t *pxU = img + height * width + (outY / 2) * (width / 2);
-        uint8_t *pxV = pxU + (height / 2) * (width / 2);
-        mScene.setReadoutPixel(0, y);
-        unsigned int lastX = 0;
-        const uint32_t *pixel = mScene.getPixelElectrons();
-         for (unsigned int outX = 0; outX < width; outX++) {
-            int32_t rCount, gCount, bCount;
-            unsigned int x = outX * DivW >> 10;
-            if (x - lastX > 0) {
-                for (unsigned int k = 0; k < (x-lastX); k++) {
-                     pixel = mScene.getPixelElectrons();
+    uint32_t spans[Scene::kMaxWidth + 1];
+    getColumnSpans(width, DivW, mSceneWidth, spans);
+
+    const uint32_t chromaWidth = width / 2;
+    uint8_t *planeU = img + height * width;
+    uint8_t *planeV = planeU + (height / 2) * chromaWidth;
+    renderBands(height, [&](uint32_t rowBegin, uint32_t rowEnd) {
+        int lastY = -1;
+        int lastChromaY = -1;
+        for (unsigned int outY = rowBegin; outY < rowEnd; outY++) {
+            int y = outY * DivH >> 10;
+            uint8_t *pxY = img + outY * width;
+            if (y == lastY) {
+                memcpy(pxY, pxY - width, width);
+            } else {
+                for (int x = 0; x < mSceneWidth; x++) {
+                    int32_t rgb[3];
+                    getSaturatedRGB(mScene.getRasterElectrons(x, y), scale64x,
+                            saturationPoint, rgb);
+                    uint8_t valY = (rgbToY[0] * rgb[0] + rgbToY[1] * rgb[1] + rgbToY[2] * rgb[2]);
+                    fillSpan(pxY + spans[x], &valY, 1, spans[x + 1] - spans[x]);
                 }
             }
-            lastX = x;
-            rCount = pixel[Scene::R]  * scale64x;
-            rCount = rCount < saturationPoint ? rCount : saturationPoint;
-            gCount = pixel[Scene::Gr] * scale64x;
-            gCount = gCount < saturationPoint ? gCount : saturationPoint;
-            bCount = pixel[Scene::B]  * scale64x;
-            bCount = bCount < saturationPoint ? bCount : saturationPoint;
-            *pxY++ = (rgbToY[0] * rCount + rgbToY[1] * gCount + rgbToY[2] * bCount);
-            if (outY % 2 == 0 && outX % 2 == 0) {
-                *pxV++ = (rgbToCr[0] * rCount + rgbToCr[1] * gCount + rgbToCr[2] * bCount + rgbToCr[3]);
-                *pxU++ = (rgbToCb[0] * rCount + rgbToCb[1] * gCount + rgbToCb[2] * bCount + rgbToCb[3]);
+            lastY = y;
+            // Chroma is subsampled 2x2; skip the unpaired last row, if any
+            if (outY % 2 != 0 || outY / 2 >= height / 2) continue;
+
+            uint8_t *pxU = planeU + (outY / 2) * chromaWidth;
+            uint8_t *pxV = planeV + (outY / 2) * chromaWidth;
+            if (y == lastChromaY) {
+                memcpy(pxU, pxU - chromaWidth, chromaWidth);
+                memcpy(pxV, pxV - chromaWidth, chromaWidth);
+            } else {
+                for (int x = 0; x < mSceneWidth; x++) {
+                    // Chroma is sampled at even output columns
+                    uint32_t begin = (spans[x] + 1) / 2;
+                    uint32_t end = (spans[x + 1] + 1) / 2;
+                    if (end > chromaWidth) end = chromaWidth;
+                    if (begin >= end) continue;
+                    int32_t rgb[3];
+                    getSaturatedRGB(mScene.getRasterElectrons(x, y), scale64x,
+                            saturationPoint, rgb);
+                    uint8_t valV = (rgbToCr[0] * rgb[0] + rgbToCr[1] * rgb[1] + rgbToCr[2] * rgb[2] + rgbToCr[3]);
+                    uint8_t valU = (rgbToCb[0] * rgb[0] + rgbToCb[1] * rgb[1] + rgbToCb[2] * rgb[2] + rgbToCb[3]);
+                    fillSpan(pxV + begin, &valV, 1, end - begin);
+                    fillSpan(pxU + begin, &valU, 1, end - begin);
+                }
             }
+            lastChromaY = y;
         }
-    }
+    });
     ALOGVV("YU12 sensor image captured");
 }
 
@@ -615,35 +968,54 @@ void Sensor::captureNV12(uint8_t *img, uint32_t gain, uint32_t width, uint32_t h
 
     unsigned int DivH= (float)mSceneHeight/height * (0x1 << 10);
     unsigned int DivW = (float)mSceneWidth/width * (0x1 << 10);
-    for (unsigned int outY = 0; outY < height; outY++) {
-        unsigned int y = outY * DivH >> 10;
-        uint8_t *pxY = img + outY * width;
-        uint8_t *pxVU = img + (height + outY / 2) * width;
-        mScene.setReadoutPixel(0, y);
-        unsigned int lastX = 0;
-        const uint32_t *pixel = mScene.getPixelElectrons();
-         for (unsigned int outX = 0; outX < width; outX++) {
-            int32_t rCount, gCount, bCount;
-            unsigned int x = outX * DivW >> 10;
-            if (x - lastX > 0) {
-                for (unsigned int k = 0; k < (x-lastX); k++) {
-                     pixel = mScene.getPixelElectrons();
+    uint32_t spans[Scene::kMaxWidth + 1];
+    getColumnSpans(width, DivW, mSceneWidth, spans);
+
+    const uint32_t chromaWidth = width / 2;
+    renderBands(height, [&](uint32_t rowBegin, uint32_t rowEnd) {
+        int lastY = -1;
+        int lastChromaY = -1;
+        for (unsigned int outY = rowBegin; outY < rowEnd; outY++) {
+            int y = outY * DivH >> 10;
+            uint8_t *pxY = img + outY * width;
+            if (y == lastY) {
+                memcpy(pxY, pxY - width, width);
+            } else {
+                for (int x = 0; x < mSceneWidth; x++) {
+                    int32_t rgb[3];
+                    getSaturatedRGB(mScene.getRasterElectrons(x, y), scale64x,
+                            saturationPoint, rgb);
+                    uint8_t valY = (rgbToY[0] * rgb[0] + rgbToY[1] * rgb[1] + rgbToY[2] * rgb[2]);
+                    fillSpan(pxY + spans[x], &valY, 1, spans[x + 1] - spans[x]);
                 }
             }
-            lastX = x;
-            rCount = pixel[Scene::R]  * scale64x;
-            rCount = rCount < saturationPoint ? rCount : saturationPoint;
-            gCount = pixel[Scene::Gr] * scale64x;
-            gCount = gCount < saturationPoint ? gCount : saturationPoint;
-            bCount = pixel[Scene::B]  * scale64x;
-            bCount = bCount < saturationPoint ? bCount : saturationPoint;
-            *pxY++ = (rgbToY[0] * rCount + rgbToY[1] * gCount + rgbToY[2] * bCount);
-            if (outY % 2 == 0 && outX % 2 == 0) {
-                *pxVU++ = (rgbToCb[0] * rCount + rgbToCb[1] * gCount + rgbToCb[2] * bCount + rgbToCb[3]);
-                *pxVU++ = (rgbToCr[0] * rCount + rgbToCr[1] * gCount + rgbToCr[2] * bCount + rgbToCr[3]);
+            lastY = y;
+            // Chroma is subsampled 2x2; skip the unpaired last row, if any
+            if (outY % 2 != 0 || outY / 2 >= height / 2) continue;
+
+            uint8_t *pxVU = img + (height + outY / 2) * width;
+            if (y == lastChromaY) {
+                memcpy(pxVU, pxVU - width, chromaWidth * 2);
+            } else {
+                for (int x = 0; x < mSceneWidth; x++) {
+                    // Chroma is sampled at even output columns
+                    uint32_t begin = (spans[x] + 1) / 2;
+                    uint32_t end = (spans[x + 1] + 1) / 2;
+                    if (end > chromaWidth) end = chromaWidth;
+                    if (begin >= end) continue;
+                    int32_t rgb[3];
+                    getSaturatedRGB(mScene.getRasterElectrons(x, y), scale64x,
+                            saturationPoint, rgb);
+                    const uint8_t cbcr[2] = {
+                        (uint8_t)(rgbToCb[0] * rgb[0] + rgbToCb[1] * rgb[1] + rgbToCb[2] * rgb[2] + rgbToCb[3]),
+                        (uint8_t)(rgbToCr[0] * rgb[0] + rgbToCr[1] * rgb[1] + rgbToCr[2] * rgb[2] + rgbToCr[3])
+                    };
+                    fillSpan(pxVU + begin * 2, cbcr, 2, end - begin);
+                }
             }
+            lastChromaY = y;
         }
-    }
+    });
     ALOGVV("NV12 sensor image captured");
 }
 
@@ -654,28 +1026,28 @@ void Sensor::captureDepth(uint8_t *img, uint32_t gain, uint32_t width, uint32_t
     int scale64x = 64 * totalGain * 8191 / kMaxRawValue;
     unsigned int DivH= (float)mSceneHeight/height * (0x1 << 10);
     unsigned int DivW = (float)mSceneWidth/width * (0x1 << 10);
-
-    for (unsigned int outY = 0; outY < height; outY++) {
-        unsigned int y = outY * DivH >> 10;
-        uint16_t *px = ((uint16_t*)img) + outY * width;
-        mScene.setReadoutPixel(0, y);
-        unsigned int lastX = 0;
-        const uint32_t *pixel = mScene.getPixelElectrons();
-        for (unsigned int outX = 0; outX < width; outX++) {
-            uint32_t depthCount;
-            unsigned int x = outX * DivW >> 10;
-            if (x - lastX > 0) {
-                for (unsigned int k = 0; k < (x-lastX); k++) {
-                     pixel = mScene.getPixelElectrons();
-                }
+    uint32_t spans[Scene::kMaxWidth + 1];
+    getColumnSpans(width, DivW, mSceneWidth, spans);
+
+    renderBands(height, [&](uint32_t rowBegin, uint32_t rowEnd) {
+        int lastY = -1;
+        for (unsigned int outY = rowBegin; outY < rowEnd; outY++) {
+            int y = outY * DivH >> 10;
+            uint16_t *px = ((uint16_t*)img) + outY * width;
+            if (y == lastY) {
+                memcpy(px, px - width, width * sizeof(uint16_t));
+                continue;
+            }
+            lastY = y;
+            for (int x = 0; x < mSceneWidth; x++) {
+                uint32_t depthCount;
+                depthCount = mScene.getRasterElectrons(x, y)[Scene::Gr] * scale64x;
+                uint16_t depth = depthCount < 8191*64 ? depthCount / 64 : 0;
+                fillSpan((uint8_t*)(px + spans[x]), (const uint8_t*)&depth,
+                        sizeof(uint16_t), spans[x + 1] - spans[x]);
             }
-            lastX = x;
-            depthCount = pixel[Scene::Gr] * scale64x;
-            *px++ = depthCount < 8191*64 ? depthCount / 64 : 0;
         }
-        // TODO: Handle this better
-        //simulatedTime += mRowReadoutTime;
-    }
+    });
     ALOGVV("Depth sensor image captured");
 }
 
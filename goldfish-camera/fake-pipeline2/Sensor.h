@@ -75,12 +75,19 @@
 #ifndef HW_EMULATOR_CAMERA2_SENSOR_H
 #define HW_EMULATOR_CAMERA2_SENSOR_H
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "utils/Thread.h"
 #include "utils/Mutex.h"
 #include "utils/Timers.h"
 
 #include "Scene.h"
+#include "AuxBufferPool.h"
 #include "Base.h"
+#include "FramePacer.h"
+#include "RenderPool.h"
 namespace android {
 
 class EmulatedFakeCamera2;
@@ -90,7 +97,9 @@ class Sensor: private Thread, public virtual RefBase {
 
     // width: Width of pixel array
     // height: Height of pixel array
-    Sensor(uint32_t width, uint32_t height);
+    // auxBufferPool: Source of the buffers JPEG outputs are rendered into
+    Sensor(uint32_t width, uint32_t height,
+            const sp<AuxBufferPool> &auxBufferPool);
     ~Sensor();
 
     /*
@@ -139,6 +148,15 @@ class Sensor: private Thread, public virtual RefBase {
     bool waitForNewFrame(nsecs_t reltime,
             nsecs_t *captureTime);
 
+    // Number of captured frames waiting for readout, now and at most since
+    // startup. For diagnostics only.
+    size_t getReadoutQueueDepth() const;
+    size_t getMaxReadoutQueueDepth() const;
+
+    // Write the readout queue and frame timing statistics to fd, indented by
+    // indent spaces.
+    void dump(int fd, int indent) const;
+
     /*
      * Interrupt event servicing from the sensor. Only triggers for sensor
      * cycles that have valid buffers to write to.
@@ -193,6 +211,15 @@ class Sensor: private Thread, public virtual RefBase {
     static const int32_t kSensitivityRange[2];
     static const uint32_t kDefaultSensitivity;
 
+    // Captured frames that can wait for readout before the sensor thread
+    // has to. A device must not have more requests read out after the
+    // sensor than this, so that the sensor never misses a frame deadline
+    // waiting for readout. A power of two, so that the free-running queue
+    // counts wrap around onto the same entries.
+    static const size_t kReadoutQueueSize = 16;
+    static_assert((kReadoutQueueSize & (kReadoutQueueSize - 1)) == 0,
+            "kReadoutQueueSize must be a power of two");
+
   private:
     Mutex mControlMutex; // Lock before accessing control parameters
     // Start of control parameters
@@ -206,18 +233,32 @@ class Sensor: private Thread, public virtual RefBase {
 
     // End of control parameters
 
-    Mutex mReadoutMutex; // Lock before accessing readout variables
-    // Start of readout variables
+    // Captured frames waiting for readout, oldest first. The sensor thread
+    // is the only writer and the readout thread the only reader, so the
+    // queue itself is read and written without a lock. mReadoutMutex is
+    // still taken once per frame on each side, to signal the other side,
+    // and for longer when sleeping on an empty or full queue.
+    struct CapturedFrame {
+        Buffers *buffers;
+        nsecs_t  captureTime;
+    };
+    CapturedFrame mReadoutQueue[kReadoutQueueSize];
+    // Free-running counts of frames read and written; the difference is the
+    // queue occupancy
+    std::atomic<uint32_t> mReadoutHead;
+    std::atomic<uint32_t> mReadoutTail;
+    std::atomic<uint32_t> mMaxReadoutQueueDepth;
+
+    Mutex mReadoutMutex;
     Condition mReadoutAvailable;
     Condition mReadoutComplete;
-    Buffers  *mCapturedBuffers;
-    nsecs_t   mCaptureTime;
+
     SensorListener *mListener;
-    // End of readout variables
 
     // Time of sensor startup, used for simulation zero-time point
     nsecs_t mStartupTime;
 
+    sp<AuxBufferPool> mAuxBufferPool;
     bool mIsMinigbm;
 
     /**
@@ -231,11 +272,50 @@ class Sensor: private Thread, public virtual RefBase {
 
     nsecs_t mNextCaptureTime;
     Buffers *mNextCapturedBuffers;
+    FramePacer mPacer;
 
     int mSceneWidth;
     int mSceneHeight;
     Scene mScene;
 
+    // Runs image bands and per-output conversions of a frame in parallel
+    std::unique_ptr<RenderPool> mRenderPool;
+    // Frame render time against the frame duration budget
+    nsecs_t  mLastRenderTime;
+    uint32_t mRenderOverruns;
+    // Frames rendered once per capture and scaled/converted into each
+    // requested output, see captureColor
+    std::vector<uint8_t> mRgbaFrame;
+    std::vector<uint8_t> mYuvFrame;
+    // Per-output scratch space for conversions that need a scaled copy first
+    std::vector<std::vector<uint8_t> > mScratch;
+
+    // Split rows [0, height) into horizontal bands and render them on the
+    // render pool. Each row must depend only on its own index, so the output
+    // doesn't depend on how many threads there are. Not reentrant from a
+    // render pool job.
+    void renderBands(uint32_t height,
+            const std::function<void(uint32_t, uint32_t)> &renderRows);
+
+    void captureColor(const Buffers &buffers, uint32_t gain);
+    void deriveRGBA(const StreamBuffer &b, uint32_t srcWidth, uint32_t srcHeight);
+    void deriveRGB(const StreamBuffer &b, uint32_t srcWidth, uint32_t srcHeight,
+            std::vector<uint8_t> *scratch);
+    void deriveYUV(const StreamBuffer &b, uint32_t srcWidth, uint32_t srcHeight,
+            std::vector<uint8_t> *scratch);
+    // RAW noise engine: noise standard deviation per electron count for
+    // mNoiseTableGain, and a frame counter seeding the noise sequence
+    uint32_t mNoiseTableGain;
+    std::vector<int32_t> mNoiseScale;
+    uint32_t mRawFrameCount;
+    void updateNoiseTable(uint32_t gain);
+
+    // Hand a captured frame over to the readout thread. Only waits if the
+    // readout thread is a whole queue behind, and then waits for room even
+    // if the thread is exiting, since the frame's request can't complete
+    // without it.
+    void pushCapturedFrame(Buffers *buffers, nsecs_t captureTime);
+
     void captureRaw(uint8_t *img, uint32_t gain, uint32_t stride);
     void captureRGBA(uint8_t *img, uint32_t gain, uint32_t width, uint32_t height);
     void captureRGB(uint8_t *img, uint32_t gain, uint32_t width, uint32_t height);
@@ -21,27 +21,62 @@
 #include <log/log.h>
 #include <libexif/exif-data.h>
 
-Compressor::Compressor() {
+Compressor::Compressor()
+    : mCreated(false), mWidth(0), mHeight(0), mQuality(0) {
+    mCompressInfo.err = jpeg_std_error(&mErrorManager);
+    // jpeg_std_error resets the handlers, restore ours
+    mErrorManager.error_exit = &ErrorManager::onJpegError;
+}
 
+Compressor::~Compressor() {
+    if (mCreated) {
+        jpeg_destroy_compress(&mCompressInfo);
+    }
 }
 
 bool Compressor::compress(const unsigned char* data,
                           int width, int height, int quality,
                           ExifData* exifData) {
-    if (!configureCompressor(width, height, quality)) {
-        // The method will have logged a more detailed error message than we can
-        // provide here so just return.
+    return compress(data, width, height, quality, exifData, nullptr, 0);
+}
+
+bool Compressor::compress(const unsigned char* data,
+                          int width, int height, int quality,
+                          ExifData* exifData,
+                          unsigned char* dest, size_t destSize) {
+    mDestManager.mDest = dest;
+    mDestManager.mDestSize = destSize;
+    mDestManager.mSize = 0;
+    if (dest != nullptr) {
+        mDestManager.mBuffer.clear();
+    }
+    if (!configureCompressor(width, height, quality) ||
+        !compressData(data, exifData)) {
+        // The methods will have logged a more detailed error message than we
+        // can provide here. The context was aborted, so set it up from scratch
+        // next time.
+        mWidth = mHeight = mQuality = 0;
+        mDestManager.mSize = 0;
         return false;
     }
-    return compressData(data, exifData);
+    return true;
 }
 
 const std::vector<uint8_t>& Compressor::getCompressedData() const {
     return mDestManager.mBuffer;
 }
 
+size_t Compressor::getCompressedSize() const {
+    return mDestManager.mSize;
+}
+
 bool Compressor::configureCompressor(int width, int height, int quality) {
-    mCompressInfo.err = jpeg_std_error(&mErrorManager);
+    if (mCreated && width == mWidth && height == mHeight &&
+        quality == mQuality) {
+        // Quantization and Huffman tables from the previous image still apply
+        return true;
+    }
+
     // NOTE! DANGER! Do not construct any non-trivial objects below setjmp!
     // The compiler will not generate code to destroy them during the return
     // below so they will leak. Additionally, do not place any calls to libjpeg
@@ -52,7 +87,10 @@ bool Compressor::configureCompressor(int width, int height, int quality) {
         return false;
     }
 
-    jpeg_create_compress(&mCompressInfo);
+    if (!mCreated) {
+        jpeg_create_compress(&mCompressInfo);
+        mCreated = true;
+    }
 
     mCompressInfo.image_width = width;
     mCompressInfo.image_height = height;
@@ -76,6 +114,9 @@ bool Compressor::configureCompressor(int width, int height, int quality) {
 
     mCompressInfo.dest = &mDestManager;
 
+    mWidth = width;
+    mHeight = height;
+    mQuality = quality;
     return true;
 }
 
@@ -123,8 +164,8 @@ bool Compressor::compressData(const unsigned char* data, ExifData* exifData) {
         jpeg_write_raw_data(&mCompressInfo, const_cast<JSAMPIMAGE>(planes), 16);
     }
 
+    // Leaves the context set up for the next image
     jpeg_finish_compress(&mCompressInfo);
-    jpeg_destroy_compress(&mCompressInfo);
 
     return true;
 }
@@ -165,13 +206,15 @@ void Compressor::ErrorManager::onJpegError(j_common_ptr cinfo) {
     (*errorManager->format_message)(cinfo, errorMessage);
     errorMessage[sizeof(errorMessage) - 1] = '\0';
     ALOGE("JPEG compression error: %s", errorMessage);
-    jpeg_destroy(cinfo);
+    // Keep the context around for reuse, only drop the failed image
+    jpeg_abort(cinfo);
 
     // And through the looking glass we go
     longjmp(errorManager->mJumpBuffer, 1);
 }
 
-Compressor::DestinationManager::DestinationManager() {
+Compressor::DestinationManager::DestinationManager()
+    : mDest(nullptr), mDestSize(0), mSize(0) {
     init_destination = &initDestination;
     empty_output_buffer = &emptyOutputBuffer;
     term_destination = &termDestination;
@@ -180,8 +223,16 @@ Compressor::DestinationManager::DestinationManager() {
 void Compressor::DestinationManager::initDestination(j_compress_ptr cinfo) {
     auto manager = reinterpret_cast<DestinationManager*>(cinfo->dest);
 
-    // Start out with some arbitrary but not too large buffer size
-    manager->mBuffer.resize(16 * 1024);
+    if (manager->mDest != nullptr) {
+        manager->next_output_byte = manager->mDest;
+        manager->free_in_buffer = manager->mDestSize;
+        return;
+    }
+
+    // Start out with some arbitrary but not too large buffer size, or with
+    // whatever earlier images grew the buffer to
+    size_t size = manager->mBuffer.capacity();
+    manager->mBuffer.resize(size > 16 * 1024 ? size : 16 * 1024);
     manager->next_output_byte = &manager->mBuffer[0];
     manager->free_in_buffer = manager->mBuffer.size();
 }
@@ -190,6 +241,12 @@ boolean Compressor::DestinationManager::emptyOutputBuffer(
         j_compress_ptr cinfo) {
     auto manager = reinterpret_cast<DestinationManager*>(cinfo->dest);
 
+    if (manager->mDest != nullptr) {
+        // The caller's buffer can't grow, fail the compression
+        ERREXIT(cinfo, JERR_BUFFER_SIZE);
+        return FALSE;
+    }
+
     // Keep doubling the size of the buffer for a very low, amortized
     // performance cost of the allocations
     size_t oldSize = manager->mBuffer.size();
@@ -202,8 +259,13 @@ boolean Compressor::DestinationManager::emptyOutputBuffer(
 void Compressor::DestinationManager::termDestination(j_compress_ptr cinfo) {
     auto manager = reinterpret_cast<DestinationManager*>(cinfo->dest);
 
+    if (manager->mDest != nullptr) {
+        manager->mSize = manager->mDestSize - manager->free_in_buffer;
+        return;
+    }
+
     // Resize down to the exact size of the output, that is remove as many
     // bytes as there are left in the buffer
     manager->mBuffer.resize(manager->mBuffer.size() - manager->free_in_buffer);
+    manager->mSize = manager->mBuffer.size();
 }
-
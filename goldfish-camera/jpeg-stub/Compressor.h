@@ -32,20 +32,36 @@ typedef _ExifData ExifData;
 class Compressor {
 public:
     Compressor();
+    ~Compressor();
 
     /* Compress |data| which represents raw NV21 encoded data of dimensions
      * |width| * |height|. |exifData| is optional EXIF data that will be
      * attached to the compressed data if present, set to null if not needed.
+     * The libjpeg context and its tables are kept between calls and only
+     * rebuilt when the dimensions or quality change.
      */
     bool compress(const unsigned char* data,
                   int width, int height, int quality,
                   ExifData* exifData);
 
+    /* Same as above but writes the compressed data straight into |dest|,
+     * which can hold |destSize| bytes. Fails if the image does not fit.
+     */
+    bool compress(const unsigned char* data,
+                  int width, int height, int quality,
+                  ExifData* exifData,
+                  unsigned char* dest, size_t destSize);
+
     /* Get a reference to the compressed data, this will return an empty vector
-     * if compress has not been called yet
+     * if compress has not been called yet or the last call compressed into a
+     * caller provided buffer
      */
     const std::vector<unsigned char>& getCompressedData() const;
 
+    /* Get the size of the last compressed image, wherever it was written to
+     */
+    size_t getCompressedSize() const;
+
 private:
     struct DestinationManager : jpeg_destination_mgr {
         DestinationManager();
@@ -55,6 +71,10 @@ private:
         static void termDestination(j_compress_ptr cinfo);
 
         std::vector<unsigned char> mBuffer;
+        // Caller provided output, used instead of mBuffer when set
+        unsigned char* mDest;
+        size_t mDestSize;
+        size_t mSize;
     };
     struct ErrorManager : jpeg_error_mgr {
         ErrorManager();
@@ -67,6 +87,11 @@ private:
     jpeg_compress_struct mCompressInfo;
     DestinationManager mDestManager;
     ErrorManager mErrorManager;
+    bool mCreated;
+    // Parameters mCompressInfo is currently set up for
+    int mWidth;
+    int mHeight;
+    int mQuality;
 
     bool configureCompressor(int width, int height, int quality);
     bool compressData(const unsigned char* data, ExifData* exifData);
@@ -39,14 +39,29 @@ extern "C" int JpegStub_compress(JpegStub* stub,
                                  int height,
                                  int quality,
                                  ExifData* exifData)
+{
+    return JpegStub_compressToBuffer(stub, buffer, width, height, quality,
+                                     exifData, nullptr, 0);
+}
+
+extern "C" int JpegStub_compressToBuffer(JpegStub* stub,
+                                         const void* buffer,
+                                         int width,
+                                         int height,
+                                         int quality,
+                                         ExifData* exifData,
+                                         void* dest,
+                                         size_t destSize)
 {
     Compressor* compressor = reinterpret_cast<Compressor*>(stub->mCompressor);
 
     if (compressor->compress(reinterpret_cast<const unsigned char*>(buffer),
-                              width, height, quality, exifData)) {
+                              width, height, quality, exifData,
+                              reinterpret_cast<unsigned char*>(dest),
+                              destSize)) {
         ALOGV("%s: Compressed JPEG: %d[%dx%d] -> %zu bytes",
               __FUNCTION__, (width * height * 12) / 8,
-              width, height, compressor->getCompressedData().size());
+              width, height, compressor->getCompressedSize());
         return 0;
     }
     ALOGE("%s: JPEG compression failed", __FUNCTION__);
@@ -57,11 +72,11 @@ extern "C" void JpegStub_getCompressedImage(JpegStub* stub, void* buff) {
     Compressor* compressor = reinterpret_cast<Compressor*>(stub->mCompressor);
 
     const std::vector<unsigned char>& data = compressor->getCompressedData();
-    memcpy(buff, &data[0], data.size());
+    memcpy(buff, data.data(), data.size());
 }
 
 extern "C" size_t JpegStub_getCompressedSize(JpegStub* stub) {
     Compressor* compressor = reinterpret_cast<Compressor*>(stub->mCompressor);
 
-    return compressor->getCompressedData().size();
+    return compressor->getCompressedSize();
 }
@@ -36,6 +36,16 @@ int JpegStub_compress(JpegStub* stub,
                       int height,
                       int quality,
                       ExifData* exifData);
+// Like JpegStub_compress, but writes the image to |dest| rather than to the
+// stub's own buffer. Fails if it takes more than |destSize| bytes.
+int JpegStub_compressToBuffer(JpegStub* stub,
+                              const void* image,
+                              int width,
+                              int height,
+                              int quality,
+                              ExifData* exifData,
+                              void* dest,
+                              size_t destSize);
 void JpegStub_getCompressedImage(JpegStub* stub, void* buff);
 size_t JpegStub_getCompressedSize(JpegStub* stub);
 
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedCamera3_QemuFrameRing"
+
+#include "qemu-pipeline3/QemuFrameRing.h"
+
+#include <gralloc_cb_bp.h>
+#include <log/log.h>
+#include <ui/Rect.h>
+
+namespace android {
+
+QemuFrameRing::QemuFrameRing():
+        mGBA(&GraphicBufferAllocator::get()),
+        mGBM(&GraphicBufferMapper::get()),
+        mSlotSize(0) {
+}
+
+QemuFrameRing::~QemuFrameRing() {
+    clear();
+}
+
+status_t QemuFrameRing::allocate(size_t slotCount, size_t slotSize) {
+    clear();
+
+    // Slots are plain byte buffers, one row of slotSize bytes.
+    const uint64_t usage =
+        GRALLOC_USAGE_HW_CAMERA_WRITE |
+        GRALLOC_USAGE_SW_READ_OFTEN;
+    const uint64_t graphicBufferId = 0; // not used
+    const uint32_t layerCount = 1;
+
+    for (size_t i = 0; i < slotCount; ++i) {
+        Slot slot;
+        uint32_t stride;
+        status_t res = mGBA->allocate(slotSize, 1, HAL_PIXEL_FORMAT_BLOB,
+                layerCount, usage, &slot.handle, &stride, graphicBufferId,
+                "QemuFrameRing");
+        if (res != OK) {
+            ALOGE("%s: Unable to allocate %zu byte slot: %d", __FUNCTION__,
+                    slotSize, res);
+            clear();
+            return res;
+        }
+
+        const cb_handle_t* cb = cb_handle_t::from(slot.handle);
+        if (cb == nullptr) {
+            ALOGV("%s: Slots can't be shared with the host", __FUNCTION__);
+            mGBA->free(slot.handle);
+            clear();
+            return INVALID_OPERATION;
+        }
+        slot.offset = cb->getMmapedOffset();
+
+        res = mGBM->lock(slot.handle, GRALLOC_USAGE_SW_READ_OFTEN,
+                Rect(0, 0, slotSize, 1), (void**)&slot.data);
+        if (res != OK) {
+            ALOGE("%s: Unable to lock slot: %d", __FUNCTION__, res);
+            mGBA->free(slot.handle);
+            clear();
+            return res;
+        }
+        mSlots.push_back(slot);
+    }
+    mSlotSize = slotSize;
+
+    ALOGV("%s: %zu slots of %zu bytes", __FUNCTION__, slotCount, slotSize);
+    return OK;
+}
+
+void QemuFrameRing::clear() {
+    for (const Slot &slot : mSlots) {
+        mGBM->unlock(slot.handle);
+        mGBA->free(slot.handle);
+    }
+    mSlots.clear();
+    mSlotSize = 0;
+}
+
+}; // end of namespace android
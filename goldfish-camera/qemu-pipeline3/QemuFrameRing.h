@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A ring of frame slots in memory shared with the host camera service. The
+ * slots are gralloc buffers kept locked for CPU reads; their offsets in the
+ * shared region are handed to the host with
+ * CameraQemuClient::queryRingStart(), after which the host fills them with
+ * frames on its own and the sensor only asks for the index of the slot
+ * holding the latest frame.
+ */
+
+#ifndef HW_EMULATOR_CAMERA3_QEMU_FRAME_RING_H
+#define HW_EMULATOR_CAMERA3_QEMU_FRAME_RING_H
+
+#include <vector>
+
+#include <ui/GraphicBufferAllocator.h>
+#include <ui/GraphicBufferMapper.h>
+
+namespace android {
+
+class QemuFrameRing {
+  public:
+    QemuFrameRing();
+    ~QemuFrameRing();
+
+    /*
+     * Allocate slotCount slots of slotSize bytes each. Fails if the slots
+     * can't be shared with the host, e.g. with minigbm.
+     */
+    status_t allocate(size_t slotCount, size_t slotSize);
+
+    size_t getSlotCount() const { return mSlots.size(); }
+    size_t getSlotSize() const { return mSlotSize; }
+
+    /* Offset of a slot in the memory region shared with the host. */
+    uint64_t getSlotOffset(size_t slot) const { return mSlots[slot].offset; }
+
+    /* CPU mapping of a slot. */
+    const uint8_t *getSlotData(size_t slot) const { return mSlots[slot].data; }
+
+  private:
+    struct Slot {
+        buffer_handle_t handle;
+        uint64_t offset;
+        uint8_t *data;
+    };
+
+    void clear();
+
+    GraphicBufferAllocator *mGBA;
+    GraphicBufferMapper *mGBM;
+    std::vector<Slot> mSlots;
+    size_t mSlotSize;
+};
+
+}; // end of namespace android
+
+#endif // HW_EMULATOR_CAMERA3_QEMU_FRAME_RING_H
@@ -33,12 +33,13 @@
 #include "system/camera_metadata.h"
 #include <gralloc_cb_bp.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <libyuv.h>
 #include <linux/videodev2.h>
 #include <log/log.h>
 #include <cutils/properties.h>
-#include <ui/Rect.h>
 #include <utils/Trace.h>
 
 namespace android {
@@ -75,21 +76,23 @@ static bool getIsMinigbmFromProperty() {
 }
 
 QemuSensor::QemuSensor(const char *deviceName, uint32_t width, uint32_t height,
-                       GraphicBufferMapper* gbm):
+                       const sp<AuxBufferPool>& auxBufferPool):
         Thread(false),
         mWidth(width),
         mHeight(height),
         mActiveArray{0, 0, width, height},
-        mLastRequestWidth(-1),
-        mLastRequestHeight(-1),
+        mStreamWidth(-1),
+        mStreamHeight(-1),
+        mStreamPixFmt(0),
         mCameraQemuClient(),
         mDeviceName(deviceName),
-        mGBA(&GraphicBufferAllocator::get()),
-        mGBM(gbm),
+        mAuxBufferPool(auxBufferPool),
         mGotVSync(false),
         mFrameDuration(kFrameDurationRange[0]),
         mNextBuffers(nullptr),
         mFrameNumber(0),
+        mMaxStreamWidth(0),
+        mMaxStreamHeight(0),
         mCapturedBuffers(nullptr),
         mListener(nullptr),
         mIsMinigbm(getIsMinigbmFromProperty()) {
@@ -124,6 +127,11 @@ status_t QemuSensor::startUp() {
         ALOGV("%s: Connected to device '%s'",
                 __FUNCTION__, (const char*) mDeviceName);
         mState = ECDS_CONNECTED;
+        // Hosts that support it send the next frame while this one is
+        // being processed.
+        if (mCameraQemuClient.setFramePrefetch(true) == NO_ERROR) {
+            ALOGV("%s: Frame prefetch enabled", __FUNCTION__);
+        }
     } else {
         ALOGE("%s: Connection to device '%s' failed",
                 __FUNCTION__, (const char*) mDeviceName);
@@ -142,6 +150,9 @@ status_t QemuSensor::shutDown() {
 
     /* Stop the actual camera device. */
     res = mCameraQemuClient.queryStop();
+    releaseFrameRings();
+    mStreamWidth = -1;
+    mStreamHeight = -1;
     if (res == NO_ERROR) {
         mState = ECDS_CONNECTED;
         ALOGV("%s: Qemu camera device '%s' is stopped",
@@ -170,6 +181,12 @@ void QemuSensor::setFrameNumber(uint32_t frameNumber) {
     mFrameNumber = frameNumber;
 }
 
+void QemuSensor::setMaxStreamSize(uint32_t width, uint32_t height) {
+    Mutex::Autolock lock(mControlMutex);
+    mMaxStreamWidth = width;
+    mMaxStreamHeight = height;
+}
+
 bool QemuSensor::waitForVSync(nsecs_t reltime) {
     int res;
     Mutex::Autolock lock(mControlMutex);
@@ -183,6 +200,10 @@ bool QemuSensor::waitForVSync(nsecs_t reltime) {
     return mGotVSync;
 }
 
+void QemuSensor::dump(int fd, int indent) const {
+    mPacer.dump(fd, indent);
+}
+
 bool QemuSensor::waitForNewFrame(nsecs_t reltime, nsecs_t *captureTime) {
     Mutex::Autolock lock(mReadoutMutex);
     if (mCapturedBuffers == nullptr) {
@@ -205,6 +226,12 @@ bool QemuSensor::waitForNewFrame(nsecs_t reltime, nsecs_t *captureTime) {
 QemuSensor::QemuSensorListener::~QemuSensorListener() {
 }
 
+AuxBufferPool::Type QemuSensor::getAuxBufferType() const {
+    // Host camera v1 writes frames straight into gralloc buffers.
+    return (mHostCameraVer == 1 && !mIsMinigbm) ?
+            AuxBufferPool::GRALLOC : AuxBufferPool::HEAP;
+}
+
 void QemuSensor::setQemuSensorListener(QemuSensorListener *listener) {
     Mutex::Autolock lock(mControlMutex);
     mListener = listener;
@@ -215,6 +242,7 @@ status_t QemuSensor::readyToRun() {
     mStartupTime = systemTime();
     mNextCaptureTime = 0;
     mNextCapturedBuffers = nullptr;
+    mPacer.reset();
     return OK;
 }
 
@@ -255,13 +283,12 @@ bool QemuSensor::threadLoop() {
     Buffers *capturedBuffers = nullptr;
     nsecs_t captureTime = 0;
 
-    nsecs_t startRealTime = systemTime();
+    nsecs_t startRealTime = mPacer.beginFrame(frameDuration);
     /*
      * Stagefright cares about system time for timestamps, so base simulated
      * time on that.
      */
     nsecs_t simulatedTime = startRealTime;
-    nsecs_t frameEndRealTime = startRealTime + frameDuration;
 
     if (mNextCapturedBuffers != nullptr) {
         ALOGVV("QemuSensor starting readout");
@@ -333,38 +360,11 @@ bool QemuSensor::threadLoop() {
                         bAux.height = b.height;
                         bAux.format = HAL_PIXEL_FORMAT_YCbCr_420_888;
                         bAux.stride = b.width;
-                        if (mHostCameraVer == 1 && !mIsMinigbm) {
-                            const uint64_t usage =
-                                GRALLOC_USAGE_HW_CAMERA_READ |
-                                GRALLOC_USAGE_HW_CAMERA_WRITE |
-                                GRALLOC_USAGE_HW_TEXTURE;
-                            const uint64_t graphicBufferId = 0; // not used
-                            const uint32_t layerCount = 1;
-                            buffer_handle_t handle;
-                            uint32_t stride;
-
-                            status_t status = mGBA->allocate(
-                                bAux.width, bAux.height, bAux.format,
-                                layerCount, usage,
-                                &handle, &stride,
-                                graphicBufferId, "QemuSensor");
-                            if (status != OK) {
-                                LOG_ALWAYS_FATAL("allocate failed");
-                            }
-
-                            android_ycbcr ycbcr = {};
-                            mGBM->lockYCbCr(handle,
-                                            GRALLOC_USAGE_HW_CAMERA_WRITE,
-                                            Rect(0, 0, bAux.width, bAux.height),
-                                            &ycbcr);
-
-                            bAux.buffer = new buffer_handle_t;
-                            *bAux.buffer = handle;
-                            bAux.img = (uint8_t*)ycbcr.y;
-                        } else {
-                            bAux.buffer = nullptr;
-                            // TODO: Reuse these.
-                            bAux.img = new uint8_t[b.width * b.height * 3];
+                        if (mAuxBufferPool->acquire(&bAux,
+                                getAuxBufferType()) != OK) {
+                            ALOGE("%s: Unable to get JPEG input buffer",
+                                    __FUNCTION__);
+                            break;
                         }
                         mNextCapturedBuffers->push_back(bAux);
                     }
@@ -394,18 +394,7 @@ bool QemuSensor::threadLoop() {
     }
 
     ALOGVV("QemuSensor vertical blanking interval");
-    nsecs_t workDoneRealTime = systemTime();
-    const nsecs_t timeAccuracy = 2e6;  // 2 ms of imprecision is ok.
-    if (workDoneRealTime < frameEndRealTime - timeAccuracy) {
-        timespec t;
-        t.tv_sec = (frameEndRealTime - workDoneRealTime) / 1000000000L;
-        t.tv_nsec = (frameEndRealTime - workDoneRealTime) % 1000000000L;
-
-        int ret;
-        do {
-            ret = nanosleep(&t, &t);
-        } while (ret != 0);
-    }
+    mPacer.endFrame();
     ALOGVV("Frame cycle took %d ms, target %d ms",
             (int) ((systemTime() - startRealTime) / 1000000),
             (int) (frameDuration / 1000000));
@@ -415,66 +404,47 @@ bool QemuSensor::threadLoop() {
 void QemuSensor::captureRGBA(uint8_t *img, uint32_t width, uint32_t height,
         uint32_t stride, int64_t *timestamp) {
     ATRACE_CALL();
-    status_t res;
-    if (width != (uint32_t)mLastRequestWidth ||
-        height != (uint32_t)mLastRequestHeight) {
-        ALOGI("%s: Dimensions for the current request (%dx%d) differ "
-              "from the previous request (%dx%d). Restarting camera",
-                __FUNCTION__, width, height, mLastRequestWidth,
-                mLastRequestHeight);
-
-        if (mLastRequestWidth != -1 || mLastRequestHeight != -1) {
-            // We only need to stop the camera if this isn't the first request.
-
-            // Stop the camera device.
-            res = mCameraQemuClient.queryStop();
-            if (res == NO_ERROR) {
-                mState = ECDS_CONNECTED;
-                ALOGV("%s: Qemu camera device '%s' is stopped",
-                        __FUNCTION__, (const char*) mDeviceName);
-            } else {
-                ALOGE("%s: Unable to stop device '%s'",
-                        __FUNCTION__, (const char*) mDeviceName);
-            }
-        }
-
-        /*
-         * Host Camera always assumes V4L2_PIX_FMT_RGB32 as the preview format,
-         * and asks for the video format from the pixFmt parameter, which is
-         * V4L2_PIX_FMT_YUV420 in our implementation.
-         */
-        uint32_t pixFmt = V4L2_PIX_FMT_YUV420;
-        res = mCameraQemuClient.queryStart(pixFmt, width, height);
-        if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
-            ALOGV("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            mState = ECDS_STARTED;
-        } else {
-            ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            return;
-        }
+    // Preview frames are RGB32 whatever the video format is.
+    if (!startStream(0, width, height)) {
+        return;
     }
     if (width != stride) {
         ALOGW("%s: expect stride (%d), actual stride (%d)", __FUNCTION__,
               width, stride);
     }
 
+    // Smaller frames are scaled down from a frame of the stream size.
+    const uint32_t streamWidth = mStreamWidth;
+    const uint32_t streamHeight = mStreamHeight;
+    const bool scale = width != streamWidth || height != streamHeight;
+
     // Since the format is V4L2_PIX_FMT_RGB32, we need 4 bytes per pixel.
-      size_t bufferSize = width * height * 4;
-      // Apply no white balance or exposure compensation.
-      float whiteBalance[] = {1.0f, 1.0f, 1.0f};
-      float exposureCompensation = 1.0f;
-      // Read from webcam.
-      mCameraQemuClient.queryFrame(nullptr, img, 0, bufferSize, whiteBalance[0],
-              whiteBalance[1], whiteBalance[2],
-              exposureCompensation, timestamp);
+    size_t bufferSize = streamWidth * streamHeight * 4;
+    const uint8_t *frame = captureFromRing(V4L2_PIX_FMT_RGB32, timestamp);
+    if (frame == nullptr) {
+        uint8_t *dst = img;
+        if (scale) {
+            mStreamFrame.resize(bufferSize);
+            dst = mStreamFrame.data();
+        }
+        // Apply no white balance or exposure compensation.
+        float whiteBalance[] = {1.0f, 1.0f, 1.0f};
+        float exposureCompensation = 1.0f;
+        // Read from webcam.
+        mCameraQemuClient.queryFrame(nullptr, dst, 0, bufferSize,
+                whiteBalance[0], whiteBalance[1], whiteBalance[2],
+                exposureCompensation, timestamp);
+        frame = dst;
+    } else if (!scale) {
+        copyRingFrame(img, frame, bufferSize);
+    }
+    if (scale) {
+        const FrameCrop crop = getCenterCrop(streamWidth, streamHeight,
+                width, height);
+        libyuv::ARGBScale(frame + crop.y * streamWidth * 4 + crop.x * 4,
+                streamWidth * 4, crop.width, crop.height,
+                img, width * 4, width, height, libyuv::kFilterBilinear);
+    }
 
     ALOGVV("RGBA sensor image captured");
 }
@@ -483,12 +453,13 @@ void QemuSensor::captureRGBA(uint32_t width, uint32_t height,
         uint32_t stride, int64_t *timestamp, buffer_handle_t* handle) {
     ATRACE_CALL();
     status_t res;
-    if (mLastRequestWidth == -1 || mLastRequestHeight == -1) {
+    if (mStreamWidth == -1 || mStreamHeight == -1) {
         uint32_t pixFmt = V4L2_PIX_FMT_YUV420;
         res = mCameraQemuClient.queryStart();
         if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
+            mStreamWidth = width;
+            mStreamHeight = height;
+            mStreamPixFmt = pixFmt;
             ALOGV("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
                     __FUNCTION__, (const char*) mDeviceName,
                     reinterpret_cast<const char*>(&pixFmt),
@@ -526,65 +497,66 @@ void QemuSensor::captureRGB(uint8_t *img, uint32_t width, uint32_t height, uint3
 void QemuSensor::captureYU12(uint8_t *img, uint32_t width, uint32_t height, uint32_t stride,
                              int64_t *timestamp) {
     ATRACE_CALL();
-    status_t res;
-    if (width != (uint32_t)mLastRequestWidth ||
-        height != (uint32_t)mLastRequestHeight) {
-        ALOGI("%s: Dimensions for the current request (%dx%d) differ "
-              "from the previous request (%dx%d). Restarting camera",
-                __FUNCTION__, width, height, mLastRequestWidth,
-                mLastRequestHeight);
-
-        if (mLastRequestWidth != -1 || mLastRequestHeight != -1) {
-            // We only need to stop the camera if this isn't the first request.
-            // Stop the camera device.
-            res = mCameraQemuClient.queryStop();
-            if (res == NO_ERROR) {
-                mState = ECDS_CONNECTED;
-                ALOGV("%s: Qemu camera device '%s' is stopped",
-                        __FUNCTION__, (const char*) mDeviceName);
-            } else {
-                ALOGE("%s: Unable to stop device '%s'",
-                        __FUNCTION__, (const char*) mDeviceName);
-            }
-        }
-
-        /*
-         * Host Camera always assumes V4L2_PIX_FMT_RGB32 as the preview format,
-         * and asks for the video format from the pixFmt parameter, which is
-         * V4L2_PIX_FMT_YUV420 in our implementation.
-         */
-        uint32_t pixFmt = mIsMinigbm ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_YUV420;
-        res = mCameraQemuClient.queryStart(pixFmt, width, height);
-        if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
-            ALOGV("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            mState = ECDS_STARTED;
-        } else {
-            ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
-                    __FUNCTION__, (const char*) mDeviceName,
-                    reinterpret_cast<const char*>(&pixFmt),
-                    mWidth, mHeight);
-            return;
-        }
+    uint32_t pixFmt = mIsMinigbm ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_YUV420;
+    if (!startStream(pixFmt, width, height)) {
+        return;
     }
     if (width != stride) {
         ALOGW("%s: expect stride (%d), actual stride (%d)", __FUNCTION__,
               width, stride);
     }
 
+    // Smaller frames are scaled down from a frame of the stream size.
+    const uint32_t streamWidth = mStreamWidth;
+    const uint32_t streamHeight = mStreamHeight;
+    const bool scale = width != streamWidth || height != streamHeight;
+
     // Calculate the buffer size for YUV420.
-    size_t bufferSize = (width * height * 12) / 8;
-    // Apply no white balance or exposure compensation.
-    float whiteBalance[] = {1.0f, 1.0f, 1.0f};
-    float exposureCompensation = 1.0f;
-    // Read video frame from webcam.
-    mCameraQemuClient.queryFrame(img, nullptr, bufferSize, 0, whiteBalance[0],
-            whiteBalance[1], whiteBalance[2],
-            exposureCompensation, timestamp);
+    size_t bufferSize = (streamWidth * streamHeight * 12) / 8;
+    const uint8_t *frame = captureFromRing(pixFmt, timestamp);
+    if (frame == nullptr) {
+        uint8_t *dst = img;
+        if (scale) {
+            mStreamFrame.resize(bufferSize);
+            dst = mStreamFrame.data();
+        }
+        // Apply no white balance or exposure compensation.
+        float whiteBalance[] = {1.0f, 1.0f, 1.0f};
+        float exposureCompensation = 1.0f;
+        // Read video frame from webcam.
+        mCameraQemuClient.queryFrame(dst, nullptr, bufferSize, 0,
+                whiteBalance[0], whiteBalance[1], whiteBalance[2],
+                exposureCompensation, timestamp);
+        frame = dst;
+    } else if (!scale) {
+        copyRingFrame(img, frame, bufferSize);
+    }
+    if (scale) {
+        const FrameCrop crop = getCenterCrop(streamWidth, streamHeight,
+                width, height);
+        const uint8_t *srcY = frame + crop.y * streamWidth + crop.x;
+        const uint8_t *srcU = frame + streamWidth * streamHeight;
+        uint8_t *dstY = img;
+        uint8_t *dstU = dstY + width * height;
+        if (pixFmt == V4L2_PIX_FMT_NV12) {
+            libyuv::NV12Scale(srcY, streamWidth,
+                    srcU + (crop.y / 2) * streamWidth + crop.x, streamWidth,
+                    crop.width, crop.height,
+                    dstY, width, dstU, width,
+                    width, height, libyuv::kFilterBilinear);
+        } else {
+            const uint8_t *srcV = srcU + (streamWidth / 2) * (streamHeight / 2);
+            const size_t cropOffset =
+                    (crop.y / 2) * (streamWidth / 2) + crop.x / 2;
+            uint8_t *dstV = dstU + (width / 2) * (height / 2);
+            libyuv::I420Scale(srcY, streamWidth,
+                    srcU + cropOffset, streamWidth / 2,
+                    srcV + cropOffset, streamWidth / 2,
+                    crop.width, crop.height,
+                    dstY, width, dstU, width / 2, dstV, width / 2,
+                    width, height, libyuv::kFilterBilinear);
+        }
+    }
 
     ALOGVV("YUV420 sensor image captured");
 }
@@ -593,12 +565,13 @@ void QemuSensor::captureYU12(uint32_t width, uint32_t height, uint32_t stride,
                              int64_t *timestamp, buffer_handle_t* handle) {
     ATRACE_CALL();
     status_t res;
-    if (mLastRequestWidth == -1 || mLastRequestHeight == -1) {
+    if (mStreamWidth == -1 || mStreamHeight == -1) {
         uint32_t pixFmt = V4L2_PIX_FMT_YUV420;
         res = mCameraQemuClient.queryStart();
         if (res == NO_ERROR) {
-            mLastRequestWidth = width;
-            mLastRequestHeight = height;
+            mStreamWidth = width;
+            mStreamHeight = height;
+            mStreamPixFmt = pixFmt;
             ALOGV("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
                     __FUNCTION__, (const char*) mDeviceName,
                     reinterpret_cast<const char*>(&pixFmt),
@@ -628,4 +601,150 @@ void QemuSensor::captureYU12(uint32_t width, uint32_t height, uint32_t stride,
     ALOGVV("YUV420 sensor image captured");
 }
 
+bool QemuSensor::startStream(uint32_t pixFmt, uint32_t width,
+        uint32_t height) {
+    const bool started = mStreamWidth != -1 && mStreamHeight != -1;
+    // Frames are only ever scaled down, so the stream has to be at least as
+    // wide and as tall as the request.
+    if (started && (pixFmt == 0 || pixFmt == mStreamPixFmt) &&
+            width <= (uint32_t)mStreamWidth &&
+            height <= (uint32_t)mStreamHeight) {
+        return true;
+    }
+
+    // Start at the largest configured stream size if it covers the request,
+    // so that other streams don't restart the camera. They are cropped to
+    // their aspect ratio and scaled from it.
+    uint32_t streamWidth = width, streamHeight = height;
+    {
+        Mutex::Autolock lock(mControlMutex);
+        if (mMaxStreamWidth >= width && mMaxStreamHeight >= height) {
+            streamWidth = mMaxStreamWidth;
+            streamHeight = mMaxStreamHeight;
+        }
+    }
+    if (pixFmt == 0) {
+        pixFmt = started ? mStreamPixFmt : V4L2_PIX_FMT_YUV420;
+    }
+
+    status_t res;
+    if (started) {
+        ALOGI("%s: Request for %.4s[%dx%d] frames doesn't fit the stream "
+              "(%.4s[%dx%d]). Restarting camera",
+                __FUNCTION__, reinterpret_cast<const char*>(&pixFmt),
+                width, height, reinterpret_cast<const char*>(&mStreamPixFmt),
+                mStreamWidth, mStreamHeight);
+
+        // Stop the camera device.
+        res = mCameraQemuClient.queryStop();
+        releaseFrameRings();
+        if (res == NO_ERROR) {
+            mState = ECDS_CONNECTED;
+            ALOGV("%s: Qemu camera device '%s' is stopped",
+                    __FUNCTION__, (const char*) mDeviceName);
+        } else {
+            ALOGE("%s: Unable to stop device '%s'",
+                    __FUNCTION__, (const char*) mDeviceName);
+        }
+        mStreamWidth = -1;
+        mStreamHeight = -1;
+    }
+
+    /*
+     * Host Camera always assumes V4L2_PIX_FMT_RGB32 as the preview format,
+     * and asks for the video format from the pixFmt parameter.
+     */
+    res = mCameraQemuClient.queryStart(pixFmt, streamWidth, streamHeight);
+    if (res != NO_ERROR) {
+        ALOGE("%s: Unable to start device '%s' for %.4s[%dx%d] frames",
+                __FUNCTION__, (const char*) mDeviceName,
+                reinterpret_cast<const char*>(&pixFmt),
+                streamWidth, streamHeight);
+        return false;
+    }
+    mStreamWidth = streamWidth;
+    mStreamHeight = streamHeight;
+    mStreamPixFmt = pixFmt;
+    ALOGV("%s: Qemu camera device '%s' is started for %.4s[%dx%d] frames",
+            __FUNCTION__, (const char*) mDeviceName,
+            reinterpret_cast<const char*>(&pixFmt),
+            streamWidth, streamHeight);
+    mState = ECDS_STARTED;
+
+    // The preview frames are always RGB32. Video frames in other formats
+    // than YUV420 are only sent with minigbm, which has no rings anyway.
+    startFrameRing(V4L2_PIX_FMT_RGB32, streamWidth, streamHeight,
+            streamWidth * streamHeight * 4);
+    if (pixFmt == V4L2_PIX_FMT_YUV420) {
+        startFrameRing(pixFmt, streamWidth, streamHeight,
+                (streamWidth * streamHeight * 12) / 8);
+    }
+    return true;
+}
+
+void QemuSensor::startFrameRing(uint32_t pixFmt, uint32_t width,
+        uint32_t height, size_t size) {
+    // Slots can only be shared with the host through goldfish gralloc.
+    if (mIsMinigbm || !mCameraQemuClient.isFrameRingSupported()) {
+        return;
+    }
+
+    std::unique_ptr<QemuFrameRing> ring(new QemuFrameRing());
+    status_t res = ring->allocate(kFrameRingSlots, size);
+    if (res == OK) {
+        uint64_t offsets[kFrameRingSlots];
+        for (size_t i = 0; i < kFrameRingSlots; ++i) {
+            offsets[i] = ring->getSlotOffset(i);
+        }
+        res = mCameraQemuClient.queryRingStart(pixFmt, width, height,
+                offsets, kFrameRingSlots, size);
+    }
+    if (res != OK) {
+        ALOGW("%s: No frame ring for %.4s[%dx%d] frames: %d",
+                __FUNCTION__, reinterpret_cast<const char*>(&pixFmt),
+                width, height, res);
+        return;
+    }
+    mFrameRings[pixFmt] = std::move(ring);
+}
+
+const uint8_t *QemuSensor::captureFromRing(uint32_t pixFmt,
+        int64_t *timestamp) {
+    ATRACE_CALL();
+    auto it = mFrameRings.find(pixFmt);
+    if (it == mFrameRings.end()) {
+        return nullptr;
+    }
+    const QemuFrameRing *ring = it->second.get();
+
+    // Apply no white balance or exposure compensation.
+    float whiteBalance[] = {1.0f, 1.0f, 1.0f};
+    float exposureCompensation = 1.0f;
+    uint32_t slot = 0;
+    status_t res = mCameraQemuClient.queryRingFrame(pixFmt, whiteBalance[0],
+            whiteBalance[1], whiteBalance[2], exposureCompensation, &slot,
+            timestamp);
+    if (res != NO_ERROR || slot >= ring->getSlotCount()) {
+        ALOGE("%s: Unable to get a frame from the %.4s ring: %d, slot %u",
+                __FUNCTION__, reinterpret_cast<const char*>(&pixFmt), res,
+                slot);
+        return nullptr;
+    }
+    return ring->getSlotData(slot);
+}
+
+void QemuSensor::copyRingFrame(uint8_t *img, const uint8_t *frame,
+        size_t size) {
+    ATRACE_CALL();
+    // The host fills the slots ahead of the requests, before the buffers the
+    // frames go to are known, so a frame of the stream size is copied out.
+    // Smaller frames are scaled straight from the slot instead.
+    memcpy(img, frame, size);
+}
+
+void QemuSensor::releaseFrameRings() {
+    // The host drops its end of the rings when the camera is stopped.
+    mFrameRings.clear();
+}
+
 }; // end of namespace android
@@ -26,11 +26,16 @@
 #ifndef HW_EMULATOR_CAMERA2_QEMU_SENSOR_H
 #define HW_EMULATOR_CAMERA2_QEMU_SENSOR_H
 
+#include "fake-pipeline2/AuxBufferPool.h"
 #include "fake-pipeline2/Base.h"
+#include "fake-pipeline2/FramePacer.h"
+#include "qemu-pipeline3/QemuFrameRing.h"
 #include "QemuClient.h"
 
-#include <ui/GraphicBufferAllocator.h>
-#include <ui/GraphicBufferMapper.h>
+#include <map>
+#include <memory>
+#include <vector>
+
 #include <utils/Mutex.h>
 #include <utils/Thread.h>
 #include <utils/Timers.h>
@@ -47,9 +52,10 @@ class QemuSensor: private Thread, public virtual RefBase {
     *                 "/dev/video0").
     *     width: Width of pixel array.
     *     height: Height of pixel array.
+    *     auxBufferPool: Source of the buffers JPEG outputs are captured into.
     */
     QemuSensor(const char *deviceName, uint32_t width, uint32_t height,
-               GraphicBufferMapper* gbm);
+               const sp<AuxBufferPool>& auxBufferPool);
     ~QemuSensor();
 
     /*
@@ -73,6 +79,14 @@ class QemuSensor: private Thread, public virtual RefBase {
      * To simplify tracking the sensor's current frame.
      */
     void setFrameNumber(uint32_t frameNumber);
+    /*
+     * Size of the largest configured output stream, by area. The host camera
+     * is started at this size and other outputs are cropped to their aspect
+     * ratio and scaled on the guest, so switching between streams doesn't
+     * restart it. An output this size doesn't cover in both width and
+     * height restarts the camera at the output's own size.
+     */
+    void setMaxStreamSize(uint32_t width, uint32_t height);
 
     /*
      * Synchronizing with sensor operation (vertical sync).
@@ -97,6 +111,11 @@ class QemuSensor: private Thread, public virtual RefBase {
      */
     bool waitForNewFrame(nsecs_t reltime, nsecs_t *captureTime);
 
+    /*
+     * Write the frame timing statistics to fd, indented by indent spaces.
+     */
+    void dump(int fd, int indent) const;
+
     /*
      * Interrupt event servicing from the sensor. Only triggers for sensor
      * cycles that have valid buffers to write to.
@@ -113,6 +132,12 @@ class QemuSensor: private Thread, public virtual RefBase {
 
     void setQemuSensorListener(QemuSensorListener *listener);
 
+    /*
+     * Kind of auxiliary buffer JPEG outputs are captured into, for
+     * reserving them ahead of time.
+     */
+    AuxBufferPool::Type getAuxBufferType() const;
+
     /*
      * Static Sensor Characteristics
      */
@@ -129,7 +154,12 @@ class QemuSensor: private Thread, public virtual RefBase {
     static const char kHostCameraVerString[];
 
   private:
-    int32_t mLastRequestWidth, mLastRequestHeight;
+    /*
+     * Size and video format the host camera is started with, -1 if it is
+     * stopped.
+     */
+    int32_t mStreamWidth, mStreamHeight;
+    uint32_t mStreamPixFmt;
 
     /*
      * Defines possible states of the emulated camera device object.
@@ -149,8 +179,7 @@ class QemuSensor: private Thread, public virtual RefBase {
 
     CameraQemuClient mCameraQemuClient;
     const char *mDeviceName;
-    GraphicBufferAllocator* mGBA;
-    GraphicBufferMapper*    mGBM;
+    sp<AuxBufferPool> mAuxBufferPool;
 
     // Always lock before accessing control parameters.
     Mutex mControlMutex;
@@ -162,6 +191,7 @@ class QemuSensor: private Thread, public virtual RefBase {
     uint64_t mFrameDuration;
     Buffers *mNextBuffers;
     uint32_t mFrameNumber;
+    uint32_t mMaxStreamWidth, mMaxStreamHeight;
 
     // Always lock before accessing readout variables.
     Mutex mReadoutMutex;
@@ -194,6 +224,16 @@ class QemuSensor: private Thread, public virtual RefBase {
      */
     nsecs_t mNextCaptureTime;
     Buffers *mNextCapturedBuffers;
+    FramePacer mPacer;
+    // Full stream frame that smaller frames are scaled down from.
+    std::vector<uint8_t> mStreamFrame;
+
+    /*
+     * Make sure the host camera is started for frames of at least width x
+     * height, in the pixFmt video format unless pixFmt is 0. Returns false if
+     * the camera couldn't be started.
+     */
+    bool startStream(uint32_t pixFmt, uint32_t width, uint32_t height);
 
     void captureRGBA(uint32_t width, uint32_t height, uint32_t stride,
                      int64_t *timestamp, buffer_handle_t* handle);
@@ -205,6 +245,35 @@ class QemuSensor: private Thread, public virtual RefBase {
                      uint32_t stride, int64_t *timestamp);
     void captureRGB(uint8_t *img, uint32_t width, uint32_t height,
                     uint32_t stride, int64_t *timestamp);
+
+    /*
+     * Frame rings shared with the host, by pixel format, set up when the
+     * camera is started and dropped when it is stopped. Formats without a
+     * ring are captured through the pipe. Rings cover all the frames
+     * captured into CPU buffers: the RGB32 preview frames for RGBA streams,
+     * and the YUV420 video frames for YCbCr and, through an auxiliary YUV
+     * buffer, BLOB streams. The NV12 video frames of minigbm have no ring,
+     * as only goldfish gralloc buffers can be shared with the host, and
+     * RGB888 streams aren't supported. Frames captured into gralloc buffers
+     * with host camera protocol version 1 are written in place by the host.
+     */
+    static const size_t kFrameRingSlots = 3;
+    std::map<uint32_t, std::unique_ptr<QemuFrameRing>> mFrameRings;
+
+    /*
+     * Hand the host a ring for pixFmt frames of size bytes. On failure, the
+     * format is captured through the pipe.
+     */
+    void startFrameRing(uint32_t pixFmt, uint32_t width, uint32_t height,
+                        size_t size);
+    /*
+     * Latest frame in pixFmt from its frame ring, valid until the next call
+     * for the same format, or nullptr if the frame has to be queried through
+     * the pipe instead.
+     */
+    const uint8_t *captureFromRing(uint32_t pixFmt, int64_t *timestamp);
+    void copyRingFrame(uint8_t *img, const uint8_t *frame, size_t size);
+    void releaseFrameRings();
 };
 
 }; // end of namespace android